@@ -0,0 +1,718 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeaders.h"
+#include "BinaryJson.h"
+
+#include "OrthancException.h"
+
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include <cassert>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * Layout of the encoded documents:
+   *
+   * - The magic header "\0OBJ", followed by the version of the format.
+   * - The table of the interned strings: count, followed by the
+   *   strings (length + characters).
+   * - The root value.
+   *
+   * The counts, lengths and sizes are stored as LEB128 variable-length
+   * integers. Each value starts with a byte encoding its type (cf.
+   * "ValueType" below). Arrays and objects are prefixed by the size of
+   * their body, which allows to skip them. The body of an object
+   * contains its number of members, the width (1, 2 or 4 bytes) of the
+   * entries of its table of members, then this table that contains
+   * the (index of the interned key, offset of the value) pairs sorted
+   * by key, then the values themselves. The fixed-width entries allow
+   * a binary search in the table. The numbers are stored in
+   * little-endian.
+   **/
+
+  static const char MAGIC[4] = { '\0', 'O', 'B', 'J' };
+  static const uint8_t VERSION = 1;
+  static const size_t HEADER_SIZE = sizeof(MAGIC) + 1;
+
+  // Only the short strings that appear several times are interned
+  static const size_t MAX_INTERNED_LENGTH = 64;
+
+  // Protection against the stack overflows on corrupted documents
+  static const unsigned int MAX_DEPTH = 256;
+
+  enum ValueType
+  {
+    ValueType_Null = 0,
+    ValueType_False = 1,
+    ValueType_True = 2,
+    ValueType_Int = 3,
+    ValueType_UInt = 4,
+    ValueType_Real = 5,
+    ValueType_String = 6,
+    ValueType_InternedString = 7,
+    ValueType_Array = 8,
+    ValueType_Object = 9
+  };
+
+
+  namespace
+  {
+    class Encoder : public boost::noncopyable
+    {
+    private:
+      typedef std::map<std::string, uint32_t>  Strings;
+
+      Strings  strings_;
+
+      static void CountStrings(std::map<std::string, unsigned int>& values,
+                               std::set<std::string>& keys,
+                               const Json::Value& source)
+      {
+        switch (source.type())
+        {
+          case Json::stringValue:
+          {
+            std::string s = source.asString();
+            if (s.size() <= MAX_INTERNED_LENGTH)
+            {
+              values[s] ++;
+            }
+            break;
+          }
+
+          case Json::arrayValue:
+            for (Json::Value::ArrayIndex i = 0; i < source.size(); i++)
+            {
+              CountStrings(values, keys, source[i]);
+            }
+            break;
+
+          case Json::objectValue:
+          {
+            Json::Value::Members members = source.getMemberNames();
+            for (size_t i = 0; i < members.size(); i++)
+            {
+              keys.insert(members[i]);
+              CountStrings(values, keys, source[members[i]]);
+            }
+            break;
+          }
+
+          default:
+            break;
+        }
+      }
+
+      static void WriteByte(std::string& target,
+                            uint8_t value)
+      {
+        target.push_back(static_cast<char>(value));
+      }
+
+      static void WriteVarInt(std::string& target,
+                              uint64_t value)
+      {
+        while (value >= 0x80)
+        {
+          target.push_back(static_cast<char>((value & 0x7f) | 0x80));
+          value >>= 7;
+        }
+
+        target.push_back(static_cast<char>(value));
+      }
+
+      static void WriteFixed(std::string& target,
+                             uint64_t value,
+                             unsigned int width)
+      {
+        for (unsigned int i = 0; i < width; i++)
+        {
+          target.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+      }
+
+      static void WriteString(std::string& target,
+                              const std::string& s)
+      {
+        WriteVarInt(target, s.size());
+        target.append(s);
+      }
+
+      static uint64_t CheckSize(size_t size)
+      {
+        if (static_cast<size_t>(static_cast<uint32_t>(size)) != size)
+        {
+          throw OrthancException(ErrorCode_NotEnoughMemory);
+        }
+
+        return size;
+      }
+
+      void WriteValue(std::string& target,
+                      const Json::Value& source) const
+      {
+        switch (source.type())
+        {
+          case Json::nullValue:
+            WriteByte(target, ValueType_Null);
+            break;
+
+          case Json::booleanValue:
+            WriteByte(target, source.asBool() ? ValueType_True : ValueType_False);
+            break;
+
+          case Json::intValue:
+            WriteByte(target, ValueType_Int);
+            WriteFixed(target, static_cast<uint64_t>(static_cast<int64_t>(source.asInt64())), 8);
+            break;
+
+          case Json::uintValue:
+            WriteByte(target, ValueType_UInt);
+            WriteFixed(target, static_cast<uint64_t>(source.asUInt64()), 8);
+            break;
+
+          case Json::realValue:
+          {
+            double d = source.asDouble();
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            WriteByte(target, ValueType_Real);
+            WriteFixed(target, bits, 8);
+            break;
+          }
+
+          case Json::stringValue:
+          {
+            std::string s = source.asString();
+            Strings::const_iterator found = strings_.find(s);
+            if (found == strings_.end())
+            {
+              WriteByte(target, ValueType_String);
+              WriteString(target, s);
+            }
+            else
+            {
+              WriteByte(target, ValueType_InternedString);
+              WriteVarInt(target, found->second);
+            }
+            break;
+          }
+
+          case Json::arrayValue:
+          {
+            std::string body;
+            WriteVarInt(body, source.size());
+
+            for (Json::Value::ArrayIndex i = 0; i < source.size(); i++)
+            {
+              WriteValue(body, source[i]);
+            }
+
+            WriteByte(target, ValueType_Array);
+            WriteVarInt(target, CheckSize(body.size()));
+            target.append(body);
+            break;
+          }
+
+          case Json::objectValue:
+          {
+            Json::Value::Members members = source.getMemberNames();
+            std::sort(members.begin(), members.end());
+
+            std::vector<uint32_t> keys(members.size());
+            std::vector<uint32_t> offsets(members.size());
+            uint64_t maxEntry = 0;
+
+            std::string values;
+            for (size_t i = 0; i < members.size(); i++)
+            {
+              Strings::const_iterator key = strings_.find(members[i]);
+              assert(key != strings_.end());
+
+              keys[i] = key->second;
+              offsets[i] = static_cast<uint32_t>(CheckSize(values.size()));
+              maxEntry = std::max(maxEntry, static_cast<uint64_t>(std::max(keys[i], offsets[i])));
+
+              WriteValue(values, source[members[i]]);
+            }
+
+            uint8_t width;
+            if (maxEntry <= 0xffu)
+            {
+              width = 1;
+            }
+            else if (maxEntry <= 0xffffu)
+            {
+              width = 2;
+            }
+            else
+            {
+              width = 4;
+            }
+
+            std::string body;
+            WriteVarInt(body, members.size());
+            WriteByte(body, width);
+
+            for (size_t i = 0; i < members.size(); i++)
+            {
+              WriteFixed(body, keys[i], width);
+              WriteFixed(body, offsets[i], width);
+            }
+
+            body.append(values);
+
+            WriteByte(target, ValueType_Object);
+            WriteVarInt(target, CheckSize(body.size()));
+            target.append(body);
+            break;
+          }
+
+          default:
+            throw OrthancException(ErrorCode_NotImplemented);
+        }
+      }
+
+    public:
+      void Encode(std::string& target,
+                  const Json::Value& source)
+      {
+        std::map<std::string, unsigned int> values;
+        std::set<std::string> keys;
+        CountStrings(values, keys, source);
+
+        std::vector<std::string> table(keys.begin(), keys.end());
+        for (std::map<std::string, unsigned int>::const_iterator
+               it = values.begin(); it != values.end(); ++it)
+        {
+          if (it->second >= 2 &&
+              keys.find(it->first) == keys.end())
+          {
+            table.push_back(it->first);
+          }
+        }
+
+        target.clear();
+        target.append(MAGIC, sizeof(MAGIC));
+        WriteByte(target, VERSION);
+
+        strings_.clear();
+        WriteVarInt(target, table.size());
+        for (size_t i = 0; i < table.size(); i++)
+        {
+          strings_[table[i]] = static_cast<uint32_t>(i);
+          WriteString(target, table[i]);
+        }
+
+        WriteValue(target, source);
+      }
+    };
+
+
+    class Decoder : public boost::noncopyable
+    {
+    private:
+      struct StringInfo
+      {
+        const char*  data_;
+        size_t       size_;
+      };
+
+      struct ObjectInfo
+      {
+        size_t        count_;
+        unsigned int  width_;
+        size_t        table_;
+        size_t        values_;
+        size_t        end_;
+      };
+
+      const uint8_t*           data_;
+      size_t                   size_;
+      std::vector<StringInfo>  strings_;
+      size_t                   root_;
+
+      static void Corrupted()
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      void Check(size_t position,
+                 size_t length) const
+      {
+        if (position > size_ ||
+            length > size_ - position)
+        {
+          Corrupted();
+        }
+      }
+
+      uint64_t ReadVarInt(size_t& position) const
+      {
+        uint64_t value = 0;
+
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+          Check(position, 1);
+          uint8_t b = data_[position];
+          position++;
+
+          value |= static_cast<uint64_t>(b & 0x7f) << shift;
+          if ((b & 0x80) == 0)
+          {
+            return value;
+          }
+        }
+
+        Corrupted();
+        return 0;  // Dummy
+      }
+
+      size_t ReadSize(size_t& position) const
+      {
+        uint64_t value = ReadVarInt(position);
+        if (value > static_cast<uint64_t>(size_))
+        {
+          Corrupted();
+        }
+
+        return static_cast<size_t>(value);
+      }
+
+      uint64_t ReadFixed(size_t position,
+                         unsigned int width) const
+      {
+        Check(position, width);
+
+        uint64_t value = 0;
+        for (unsigned int i = 0; i < width; i++)
+        {
+          value |= static_cast<uint64_t>(data_[position + i]) << (8 * i);
+        }
+
+        return value;
+      }
+
+      const StringInfo& GetString(uint64_t index) const
+      {
+        if (index >= strings_.size())
+        {
+          Corrupted();
+        }
+
+        return strings_[static_cast<size_t>(index)];
+      }
+
+      // "position" must point after the type byte of the object
+      void ReadObjectInfo(ObjectInfo& info,
+                          size_t position) const
+      {
+        size_t bodySize = ReadSize(position);
+        Check(position, bodySize);
+        info.end_ = position + bodySize;
+
+        info.count_ = ReadSize(position);
+        Check(position, 1);
+        info.width_ = data_[position];
+        position++;
+
+        if (info.width_ != 1 &&
+            info.width_ != 2 &&
+            info.width_ != 4)
+        {
+          Corrupted();
+        }
+
+        if (info.count_ > bodySize / (2 * info.width_))
+        {
+          Corrupted();
+        }
+
+        info.table_ = position;
+        info.values_ = position + 2 * info.width_ * info.count_;
+
+        if (info.values_ > info.end_)
+        {
+          Corrupted();
+        }
+      }
+
+      size_t GetMemberValue(const ObjectInfo& info,
+                            size_t index) const
+      {
+        size_t offset = static_cast<size_t>(ReadFixed(info.table_ + (2 * index + 1) * info.width_, info.width_));
+        if (offset >= info.end_ - info.values_)
+        {
+          Corrupted();
+        }
+
+        return info.values_ + offset;
+      }
+
+      // Returns the position that follows the value
+      size_t ReadValue(Json::Value& target,
+                       size_t position,
+                       unsigned int depth) const
+      {
+        if (depth > MAX_DEPTH)
+        {
+          Corrupted();
+        }
+
+        Check(position, 1);
+        uint8_t type = data_[position];
+        position++;
+
+        switch (type)
+        {
+          case ValueType_Null:
+            target = Json::nullValue;
+            return position;
+
+          case ValueType_False:
+            target = false;
+            return position;
+
+          case ValueType_True:
+            target = true;
+            return position;
+
+          case ValueType_Int:
+            target = static_cast<Json::Int64>(static_cast<int64_t>(ReadFixed(position, 8)));
+            return position + 8;
+
+          case ValueType_UInt:
+            target = static_cast<Json::UInt64>(ReadFixed(position, 8));
+            return position + 8;
+
+          case ValueType_Real:
+          {
+            uint64_t bits = ReadFixed(position, 8);
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            target = d;
+            return position + 8;
+          }
+
+          case ValueType_String:
+          {
+            size_t length = ReadSize(position);
+            Check(position, length);
+            target = std::string(reinterpret_cast<const char*>(data_) + position, length);
+            return position + length;
+          }
+
+          case ValueType_InternedString:
+          {
+            const StringInfo& s = GetString(ReadVarInt(position));
+            target = std::string(s.data_, s.size_);
+            return position;
+          }
+
+          case ValueType_Array:
+          {
+            size_t bodySize = ReadSize(position);
+            Check(position, bodySize);
+            size_t end = position + bodySize;
+
+            size_t count = ReadSize(position);
+            if (count > bodySize)   // Each value takes at least one byte
+            {
+              Corrupted();
+            }
+
+            target = Json::arrayValue;
+            target.resize(static_cast<Json::Value::ArrayIndex>(count));
+
+            for (size_t i = 0; i < count; i++)
+            {
+              position = ReadValue(target[static_cast<Json::Value::ArrayIndex>(i)], position, depth + 1);
+            }
+
+            if (position != end)
+            {
+              Corrupted();
+            }
+
+            return end;
+          }
+
+          case ValueType_Object:
+          {
+            ObjectInfo info;
+            ReadObjectInfo(info, position);
+
+            target = Json::objectValue;
+
+            for (size_t i = 0; i < info.count_; i++)
+            {
+              const StringInfo& key = GetString(ReadFixed(info.table_ + 2 * i * info.width_, info.width_));
+              ReadValue(target[std::string(key.data_, key.size_)], GetMemberValue(info, i), depth + 1);
+            }
+
+            return info.end_;
+          }
+
+          default:
+            Corrupted();
+            return 0;  // Dummy
+        }
+      }
+
+    public:
+      Decoder(const void* data,
+              size_t size) :
+        data_(reinterpret_cast<const uint8_t*>(data)),
+        size_(size)
+      {
+        if (!BinaryJson::IsBinaryJson(data, size))
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        if (data_[sizeof(MAGIC)] != VERSION)
+        {
+          throw OrthancException(ErrorCode_NotImplemented);
+        }
+
+        size_t position = HEADER_SIZE;
+        size_t count = ReadSize(position);
+
+        strings_.resize(count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+          size_t length = ReadSize(position);
+          Check(position, length);
+          strings_[i].data_ = reinterpret_cast<const char*>(data_) + position;
+          strings_[i].size_ = length;
+          position += length;
+        }
+
+        root_ = position;
+      }
+
+      void Decode(Json::Value& target) const
+      {
+        if (ReadValue(target, root_, 0) != size_)
+        {
+          Corrupted();
+        }
+      }
+
+      bool LookupMember(Json::Value& target,
+                        const std::string& key) const
+      {
+        Check(root_, 1);
+        if (data_[root_] != ValueType_Object)
+        {
+          return false;
+        }
+
+        ObjectInfo info;
+        ReadObjectInfo(info, root_ + 1);
+
+        // Binary search in the sorted table of the members
+        size_t low = 0;
+        size_t high = info.count_;
+
+        while (low < high)
+        {
+          size_t middle = low + (high - low) / 2;
+
+          const StringInfo& s = GetString(ReadFixed(info.table_ + 2 * middle * info.width_, info.width_));
+          int cmp = key.compare(0, std::string::npos, s.data_, s.size_);
+
+          if (cmp == 0)
+          {
+            ReadValue(target, GetMemberValue(info, middle), 1);
+            return true;
+          }
+          else if (cmp < 0)
+          {
+            high = middle;
+          }
+          else
+          {
+            low = middle + 1;
+          }
+        }
+
+        return false;
+      }
+    };
+  }
+
+
+  bool BinaryJson::IsBinaryJson(const void* data,
+                                size_t size)
+  {
+    return (data != NULL &&
+            size >= HEADER_SIZE &&
+            memcmp(data, MAGIC, sizeof(MAGIC)) == 0);
+  }
+
+
+  void BinaryJson::Encode(std::string& target,
+                          const Json::Value& source)
+  {
+    Encoder encoder;
+    encoder.Encode(target, source);
+  }
+
+
+  void BinaryJson::Decode(Json::Value& target,
+                          const void* data,
+                          size_t size)
+  {
+    Decoder decoder(data, size);
+    decoder.Decode(target);
+  }
+
+
+  bool BinaryJson::LookupMember(Json::Value& target,
+                                const void* data,
+                                size_t size,
+                                const std::string& key)
+  {
+    Decoder decoder(data, size);
+    return decoder.LookupMember(target, key);
+  }
+}
@@ -0,0 +1,93 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+#include <string>
+
+namespace Orthanc
+{
+  /**
+   * Compact binary encoding of JSON documents, that is notably used
+   * to store the "DICOM-as-JSON" summaries of the instances. The
+   * strings that are repeated in the document (such as the names of
+   * the members of the objects) are only stored once. The members of
+   * each object are sorted and indexed by a table of offsets, which
+   * makes it possible to extract one member of the top-level object
+   * (e.g. one DICOM tag) without decoding the full document.
+   *
+   * The encoded documents start with a magic header that cannot
+   * appear at the beginning of a textual JSON document, which allows
+   * to store both formats side by side.
+   **/
+  class BinaryJson
+  {
+  public:
+    static bool IsBinaryJson(const void* data,
+                             size_t size);
+
+    static bool IsBinaryJson(const std::string& data)
+    {
+      return IsBinaryJson(data.empty() ? NULL : data.c_str(), data.size());
+    }
+
+    static void Encode(std::string& target,
+                       const Json::Value& source);
+
+    static void Decode(Json::Value& target,
+                       const void* data,
+                       size_t size);
+
+    static void Decode(Json::Value& target,
+                       const std::string& source)
+    {
+      Decode(target, source.empty() ? NULL : source.c_str(), source.size());
+    }
+
+    // Decodes the member "key" of the top-level object. Returns
+    // "false" if the top-level value is not an object, or if it has
+    // no such member.
+    static bool LookupMember(Json::Value& target,
+                             const void* data,
+                             size_t size,
+                             const std::string& key);
+
+    static bool LookupMember(Json::Value& target,
+                             const std::string& source,
+                             const std::string& key)
+    {
+      return LookupMember(target, source.empty() ? NULL : source.c_str(), source.size(), key);
+    }
+  };
+}
@@ -0,0 +1,204 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "MemoryStringCache.h"
+
+namespace Orthanc
+{
+  void MemoryStringCache::RemoveOldest()
+  {
+    Value value;
+    index_.RemoveOldest(value);
+
+    assert(value.get() != NULL &&
+           currentSize_ >= value->size());
+    currentSize_ -= value->size();
+  }
+
+
+  void MemoryStringCache::InvalidateInternal(const std::string& key)
+  {
+    Value value;
+    if (index_.Contains(key, value))
+    {
+      assert(value.get() != NULL &&
+             currentSize_ >= value->size());
+      currentSize_ -= value->size();
+      index_.Invalidate(key);
+    }
+  }
+
+
+  MemoryStringCache::MemoryStringCache(size_t maxSize) :
+    maxSize_(maxSize),
+    currentSize_(0),
+    hits_(0),
+    misses_(0)
+  {
+  }
+
+
+  MemoryStringCache::~MemoryStringCache()
+  {
+    Clear();
+  }
+
+
+  void MemoryStringCache::SetMaximumSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    maxSize_ = size;
+
+    while (currentSize_ > maxSize_)
+    {
+      RemoveOldest();
+    }
+  }
+
+
+  size_t MemoryStringCache::GetMaximumSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_;
+  }
+
+
+  size_t MemoryStringCache::GetCurrentSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  size_t MemoryStringCache::GetCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return index_.GetSize();
+  }
+
+
+  uint64_t MemoryStringCache::GetHits()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return hits_;
+  }
+
+
+  uint64_t MemoryStringCache::GetMisses()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return misses_;
+  }
+
+
+  void MemoryStringCache::Add(const std::string& key,
+                              const std::string& value)
+  {
+    // The value is copied before locking the cache
+    Value item(new std::string(value));
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    InvalidateInternal(key);
+
+    if (value.size() > maxSize_)
+    {
+      return;
+    }
+
+    while (currentSize_ + value.size() > maxSize_)
+    {
+      RemoveOldest();
+    }
+
+    index_.Add(key, item);
+    currentSize_ += value.size();
+  }
+
+
+  bool MemoryStringCache::Fetch(std::string& value,
+                                const std::string& key)
+  {
+    Value item;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (index_.Contains(key, item))
+      {
+        assert(item.get() != NULL);
+        index_.MakeMostRecent(key);
+        hits_++;
+      }
+      else
+      {
+        misses_++;
+        return false;
+      }
+    }
+
+    // The value is copied after releasing the mutex. It cannot be
+    // freed meanwhile, as "item" shares its ownership.
+    value = *item;
+    return true;
+  }
+
+
+  bool MemoryStringCache::IsCached(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return index_.Contains(key);
+  }
+
+
+  void MemoryStringCache::Invalidate(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    InvalidateInternal(key);
+  }
+
+
+  void MemoryStringCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (!index_.IsEmpty())
+    {
+      RemoveOldest();
+    }
+
+    assert(currentSize_ == 0);
+  }
+}
@@ -0,0 +1,109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class MemoryStringCache cannot be used in sandboxed environments
+#endif
+
+#include "LeastRecentlyUsedIndex.h"
+
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Thread-safe cache of strings (e.g. the content of attachments),
+   * whose capacity is a number of bytes, and not a number of
+   * items. The least recently used strings are recycled first.
+   **/
+  class MemoryStringCache : public boost::noncopyable
+  {
+  private:
+    // The values are shared with the callers of "Fetch()", so that
+    // they can be copied without holding the mutex
+    typedef boost::shared_ptr<const std::string>         Value;
+    typedef LeastRecentlyUsedIndex<std::string, Value>   Index;
+
+    boost::mutex  mutex_;
+    size_t        maxSize_;
+    size_t        currentSize_;
+    Index         index_;
+    uint64_t      hits_;
+    uint64_t      misses_;
+
+    void RemoveOldest();
+
+    void InvalidateInternal(const std::string& key);
+
+  public:
+    explicit MemoryStringCache(size_t maxSize);
+
+    ~MemoryStringCache();
+
+    // "0" disables the cache
+    void SetMaximumSize(size_t size);
+
+    size_t GetMaximumSize();
+
+    size_t GetCurrentSize();
+
+    size_t GetCount();
+
+    uint64_t GetHits();
+
+    uint64_t GetMisses();
+
+    // The value is not cached if it is larger than the capacity
+    void Add(const std::string& key,
+             const std::string& value);
+
+    bool Fetch(std::string& value,
+               const std::string& key);
+
+    // Contrarily to "Fetch()", this method neither updates the
+    // statistics, nor the order of recycling
+    bool IsCached(const std::string& key);
+
+    void Invalidate(const std::string& key);
+
+    void Clear();
+  };
+}
@@ -0,0 +1,306 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "SharedObjectCache.h"
+
+#include "../OrthancException.h"
+
+#include <boost/functional/hash.hpp>
+#include <memory>  // For std::auto_ptr
+
+namespace Orthanc
+{
+  SharedObjectCache::Shard& SharedObjectCache::GetShard(const std::string& key)
+  {
+    boost::hash<std::string> hasher;
+    return *shards_[hasher(key) % shards_.size()];
+  }
+
+
+  void SharedObjectCache::UpdateSize(size_t added,
+                                     size_t removed)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(currentSize_ + added >= removed);
+    currentSize_ = currentSize_ + added - removed;
+  }
+
+
+  void SharedObjectCache::Recycle()
+  {
+    // Remove the oldest object of each shard in turn, until the
+    // cache fits its capacity. This approximates a global LRU policy
+    // without ever locking two shards at once.
+    size_t emptyShards = 0;
+
+    while (emptyShards < shards_.size())
+    {
+      size_t victim;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (currentSize_ <= maxSize_)
+        {
+          return;
+        }
+
+        victim = nextVictim_;
+        nextVictim_ = (nextVictim_ + 1) % shards_.size();
+      }
+
+      Shard& shard = *shards_[victim];
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      if (shard.index_.IsEmpty())
+      {
+        emptyShards++;
+      }
+      else
+      {
+        Entry* entry = NULL;
+        shard.index_.RemoveOldest(entry);
+
+        assert(entry != NULL &&
+               shard.size_ >= entry->size_);
+        shard.size_ -= entry->size_;
+        UpdateSize(0, entry->size_);
+        delete entry;
+
+        emptyShards = 0;
+      }
+    }
+  }
+
+
+  SharedObjectCache::SharedObjectCache(size_t maxSize,
+                                       unsigned int shardsCount) :
+    maxSize_(maxSize),
+    currentSize_(0),
+    nextVictim_(0),
+    hits_(0),
+    misses_(0)
+  {
+    if (shardsCount == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    shards_.resize(shardsCount);
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i] = new Shard;
+      shards_[i]->size_ = 0;
+    }
+  }
+
+
+  SharedObjectCache::~SharedObjectCache()
+  {
+    Clear();
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      delete shards_[i];
+    }
+  }
+
+
+  void SharedObjectCache::SetMaximumSize(size_t size)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      maxSize_ = size;
+    }
+
+    Recycle();
+  }
+
+
+  size_t SharedObjectCache::GetMaximumSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_;
+  }
+
+
+  size_t SharedObjectCache::GetCurrentSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  size_t SharedObjectCache::GetCount()
+  {
+    size_t count = 0;
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      boost::mutex::scoped_lock lock(shards_[i]->mutex_);
+      count += shards_[i]->index_.GetSize();
+    }
+
+    return count;
+  }
+
+
+  uint64_t SharedObjectCache::GetHits()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return hits_;
+  }
+
+
+  uint64_t SharedObjectCache::GetMisses()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return misses_;
+  }
+
+
+  bool SharedObjectCache::Fetch(Item& target,
+                                const std::string& key)
+  {
+    bool found;
+
+    {
+      Shard& shard = GetShard(key);
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      Entry* entry = NULL;
+      found = shard.index_.Contains(key, entry);
+
+      if (found)
+      {
+        assert(entry != NULL);
+        shard.index_.MakeMostRecent(key);
+        target = entry->object_;
+      }
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (found)
+    {
+      hits_++;
+    }
+    else
+    {
+      misses_++;
+    }
+
+    return found;
+  }
+
+
+  SharedObjectCache::Item SharedObjectCache::Add(const std::string& key,
+                                                 const Item& object,
+                                                 size_t size)
+  {
+    if (object.get() == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    if (size > GetMaximumSize())
+    {
+      return object;
+    }
+
+    {
+      Shard& shard = GetShard(key);
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      Entry* entry = NULL;
+      if (shard.index_.Contains(key, entry))
+      {
+        assert(entry != NULL);
+        shard.index_.MakeMostRecent(key);
+        return entry->object_;
+      }
+
+      std::auto_ptr<Entry> item(new Entry);
+      item->object_ = object;
+      item->size_ = size;
+      shard.index_.Add(key, item.get());
+      item.release();
+
+      shard.size_ += size;
+      UpdateSize(size, 0);
+    }
+
+    Recycle();
+
+    return object;
+  }
+
+
+  void SharedObjectCache::Invalidate(const std::string& key)
+  {
+    Shard& shard = GetShard(key);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    Entry* entry = NULL;
+    if (shard.index_.Contains(key, entry))
+    {
+      assert(entry != NULL &&
+             shard.size_ >= entry->size_);
+      shard.index_.Invalidate(key);
+      shard.size_ -= entry->size_;
+      UpdateSize(0, entry->size_);
+      delete entry;
+    }
+  }
+
+
+  void SharedObjectCache::Clear()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      Shard& shard = *shards_[i];
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      while (!shard.index_.IsEmpty())
+      {
+        Entry* entry = NULL;
+        shard.index_.RemoveOldest(entry);
+        assert(entry != NULL);
+        UpdateSize(0, entry->size_);
+        delete entry;
+      }
+
+      shard.size_ = 0;
+    }
+  }
+}
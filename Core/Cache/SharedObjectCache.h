@@ -0,0 +1,136 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class SharedObjectCache cannot be used in sandboxed environments
+#endif
+
+#include "LeastRecentlyUsedIndex.h"
+#include "../IDynamicObject.h"
+
+#include <stdint.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Thread-safe cache of dynamic objects (e.g. parsed DICOM files),
+   * whose capacity is a number of bytes that is estimated by the
+   * caller for each object. The cache is split into shards, each
+   * protected by its own mutex, so that concurrent accesses to
+   * different keys rarely contend. The objects are handed out with
+   * shared ownership: An object that is recycled or invalidated
+   * remains valid as long as some caller holds a reference to it.
+   **/
+  class SharedObjectCache : public boost::noncopyable
+  {
+  public:
+    typedef boost::shared_ptr<IDynamicObject>  Item;
+
+  private:
+    struct Entry
+    {
+      Item    object_;
+      size_t  size_;
+    };
+
+    typedef LeastRecentlyUsedIndex<std::string, Entry*>  Index;
+
+    struct Shard
+    {
+      boost::mutex  mutex_;
+      Index         index_;
+      size_t        size_;
+    };
+
+    std::vector<Shard*>  shards_;
+
+    // Protects the members below. It can be locked while holding the
+    // mutex of a shard, but never the other way around.
+    boost::mutex  mutex_;
+    size_t        maxSize_;
+    size_t        currentSize_;
+    size_t        nextVictim_;
+    uint64_t      hits_;
+    uint64_t      misses_;
+
+    Shard& GetShard(const std::string& key);
+
+    void UpdateSize(size_t added,
+                    size_t removed);
+
+    void Recycle();
+
+  public:
+    SharedObjectCache(size_t maxSize,
+                      unsigned int shardsCount);
+
+    ~SharedObjectCache();
+
+    // "0" disables the cache
+    void SetMaximumSize(size_t size);
+
+    size_t GetMaximumSize();
+
+    size_t GetCurrentSize();
+
+    size_t GetCount();
+
+    uint64_t GetHits();
+
+    uint64_t GetMisses();
+
+    bool Fetch(Item& target,
+               const std::string& key);
+
+    // The object is not cached if it is larger than the capacity. If
+    // another thread has cached the same key in the meantime, the
+    // cached object is kept and returned instead of "object", so
+    // that all the callers share the same instance.
+    Item Add(const std::string& key,
+             const Item& object,
+             size_t size);
+
+    void Invalidate(const std::string& key);
+
+    void Clear();
+  };
+}
@@ -0,0 +1,135 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "BufferCompressorFactory.h"
+
+#include "ZlibCompressor.h"
+#include "../Logging.h"
+#include "../OrthancException.h"
+
+#if !defined(ORTHANC_ENABLE_LZ4)
+#  error The macro ORTHANC_ENABLE_LZ4 must be defined
+#endif
+
+#if !defined(ORTHANC_ENABLE_ZSTD)
+#  error The macro ORTHANC_ENABLE_ZSTD must be defined
+#endif
+
+#if ORTHANC_ENABLE_LZ4 == 1
+#  include "Lz4Compressor.h"
+#endif
+
+#if ORTHANC_ENABLE_ZSTD == 1
+#  include "ZstdCompressor.h"
+#endif
+
+#include <memory>
+
+namespace Orthanc
+{
+  bool BufferCompressorFactory::IsSupported(CompressionType compression)
+  {
+    switch (compression)
+    {
+      case CompressionType_None:
+      case CompressionType_ZlibWithSize:
+        return true;
+
+      case CompressionType_Lz4WithSize:
+        return (ORTHANC_ENABLE_LZ4 == 1);
+
+      case CompressionType_ZstdWithSize:
+        return (ORTHANC_ENABLE_ZSTD == 1);
+
+      default:
+        return false;
+    }
+  }
+
+
+  IBufferCompressor* BufferCompressorFactory::Create(CompressionType compression,
+                                                     int level)
+  {
+    if (level < 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    switch (compression)
+    {
+      case CompressionType_ZlibWithSize:
+      {
+        std::auto_ptr<ZlibCompressor> compressor(new ZlibCompressor);
+        if (level != 0)
+        {
+          if (level > 9)
+          {
+            throw OrthancException(ErrorCode_ParameterOutOfRange);
+          }
+
+          compressor->SetCompressionLevel(static_cast<uint8_t>(level));
+        }
+
+        return compressor.release();
+      }
+
+      case CompressionType_Lz4WithSize:
+      {
+#if ORTHANC_ENABLE_LZ4 == 1
+        std::auto_ptr<Lz4Compressor> compressor(new Lz4Compressor);
+        compressor->SetCompressionLevel(level);
+        return compressor.release();
+#else
+        LOG(ERROR) << "This version of Orthanc was built without support for LZ4 compression";
+        throw OrthancException(ErrorCode_NotImplemented);
+#endif
+      }
+
+      case CompressionType_ZstdWithSize:
+      {
+#if ORTHANC_ENABLE_ZSTD == 1
+        std::auto_ptr<ZstdCompressor> compressor(new ZstdCompressor);
+        compressor->SetCompressionLevel(level);
+        return compressor.release();
+#else
+        LOG(ERROR) << "This version of Orthanc was built without support for Zstandard compression";
+        throw OrthancException(ErrorCode_NotImplemented);
+#endif
+      }
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+}
@@ -0,0 +1,156 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "Lz4Compressor.h"
+
+#include "../OrthancException.h"
+#include "../Logging.h"
+
+#include <string.h>
+#include <lz4.h>
+#include <lz4hc.h>
+
+namespace Orthanc
+{
+  void Lz4Compressor::SetCompressionLevel(int level)
+  {
+    if (level < 0 ||
+        level > LZ4HC_CLEVEL_MAX)
+    {
+      LOG(ERROR) << "LZ4 compression level must be between 0 (fast mode) and "
+                 << LZ4HC_CLEVEL_MAX << " (highest compression)";
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    compressionLevel_ = level;
+  }
+
+
+  void Lz4Compressor::Compress(std::string& compressed,
+                               const void* uncompressed,
+                               size_t uncompressedSize)
+  {
+    if (uncompressedSize == 0)
+    {
+      compressed.clear();
+      return;
+    }
+
+    if (uncompressedSize > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+    {
+      LOG(ERROR) << "The buffer is too large to be compressed with LZ4";
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    int bound = LZ4_compressBound(static_cast<int>(uncompressedSize));
+    compressed.resize(sizeof(uint64_t) + static_cast<size_t>(bound));
+
+    const char* source = reinterpret_cast<const char*>(uncompressed);
+    char* target = &compressed[0] + sizeof(uint64_t);
+
+    int size;
+    if (compressionLevel_ == 0)
+    {
+      size = LZ4_compress_default(source, target, static_cast<int>(uncompressedSize), bound);
+    }
+    else
+    {
+      size = LZ4_compress_HC(source, target, static_cast<int>(uncompressedSize), bound, compressionLevel_);
+    }
+
+    if (size <= 0)
+    {
+      compressed.clear();
+      throw OrthancException(ErrorCode_InternalError);
+    }
+
+    uint64_t s = static_cast<uint64_t>(uncompressedSize);
+    memcpy(&compressed[0], &s, sizeof(uint64_t));
+    compressed.resize(sizeof(uint64_t) + static_cast<size_t>(size));
+  }
+
+
+  void Lz4Compressor::Uncompress(std::string& uncompressed,
+                                 const void* compressed,
+                                 size_t compressedSize)
+  {
+    if (compressedSize == 0)
+    {
+      uncompressed.clear();
+      return;
+    }
+
+    if (compressedSize < sizeof(uint64_t))
+    {
+      LOG(ERROR) << "The compressed buffer is ill-formed";
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    uint64_t uncompressedSize;
+    memcpy(&uncompressedSize, compressed, sizeof(uint64_t));
+
+    if (uncompressedSize > static_cast<uint64_t>(LZ4_MAX_INPUT_SIZE) ||
+        compressedSize - sizeof(uint64_t) > static_cast<size_t>(LZ4_compressBound(LZ4_MAX_INPUT_SIZE)))
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    try
+    {
+      uncompressed.resize(static_cast<size_t>(uncompressedSize));
+    }
+    catch (...)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    if (uncompressedSize == 0)
+    {
+      return;
+    }
+
+    int size = LZ4_decompress_safe(reinterpret_cast<const char*>(compressed) + sizeof(uint64_t),
+                                   &uncompressed[0],
+                                   static_cast<int>(compressedSize - sizeof(uint64_t)),
+                                   static_cast<int>(uncompressedSize));
+
+    if (size < 0 ||
+        static_cast<uint64_t>(size) != uncompressedSize)
+    {
+      uncompressed.clear();
+      LOG(ERROR) << "Error while uncompressing a LZ4 buffer";
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+  }
+}
@@ -0,0 +1,821 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../PrecompiledHeaders.h"
+#include "DicomFrameOffsetTable.h"
+
+#include "DicomImageInformation.h"
+#include "../OrthancException.h"
+#include "../Toolbox.h"
+
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+#include <string.h>
+
+namespace Orthanc
+{
+  static const uint32_t UNDEFINED_LENGTH = 0xffffffffu;
+
+  // Bound on the nesting of the sequences, against malformed files
+  static const unsigned int MAX_DEPTH = 64;
+
+  namespace
+  {
+    struct ElementHeader
+    {
+      uint16_t  group_;
+      uint16_t  element_;
+      uint32_t  length_;
+      size_t    size_;      // Size of the header itself
+      bool      unknown_;   // Whether the VR is "UN"
+    };
+  }
+
+
+  static uint16_t ReadUInt16(const uint8_t* p)
+  {
+    // The supported transfer syntaxes are all little endian
+    return static_cast<uint16_t>(p[0]) | (static_cast<uint16_t>(p[1]) << 8);
+  }
+
+
+  static uint32_t ReadUInt32(const uint8_t* p)
+  {
+    return (static_cast<uint32_t>(p[0]) |
+            (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16) |
+            (static_cast<uint32_t>(p[3]) << 24));
+  }
+
+
+  static bool ReadElementHeader(ElementHeader& header,
+                                const uint8_t* dicom,
+                                size_t size,
+                                size_t pos,
+                                bool explicitVR)
+  {
+    if (pos > size ||
+        size - pos < 8)
+    {
+      return false;
+    }
+
+    header.group_ = ReadUInt16(dicom + pos);
+    header.element_ = ReadUInt16(dicom + pos + 2);
+    header.unknown_ = false;
+
+    if (header.group_ == 0xfffe ||  // The items and the delimiters have no VR
+        !explicitVR)
+    {
+      header.length_ = ReadUInt32(dicom + pos + 4);
+      header.size_ = 8;
+      return true;
+    }
+
+    const char vr[2] = { static_cast<char>(dicom[pos + 4]),
+                         static_cast<char>(dicom[pos + 5]) };
+
+    // PS3.5 Section 7.1.2: VRs with a 32-bit length field
+    if ((vr[0] == 'O' && (vr[1] == 'B' || vr[1] == 'D' || vr[1] == 'F' ||
+                          vr[1] == 'L' || vr[1] == 'V' || vr[1] == 'W')) ||
+        (vr[0] == 'S' && (vr[1] == 'Q' || vr[1] == 'V')) ||
+        (vr[0] == 'U' && (vr[1] == 'C' || vr[1] == 'N' || vr[1] == 'R' ||
+                          vr[1] == 'T' || vr[1] == 'V')))
+    {
+      if (size - pos < 12)
+      {
+        return false;
+      }
+
+      header.length_ = ReadUInt32(dicom + pos + 8);
+      header.size_ = 12;
+      header.unknown_ = (vr[0] == 'U' && vr[1] == 'N');
+    }
+    else
+    {
+      header.length_ = ReadUInt16(dicom + pos + 6);
+      header.size_ = 8;
+    }
+
+    return true;
+  }
+
+
+  static bool SkipItems(size_t& pos,
+                        const uint8_t* dicom,
+                        size_t size,
+                        bool explicitVR,
+                        unsigned int depth);
+
+
+  // Skips the elements of an item with undefined length, up to its
+  // item delimitation
+  static bool SkipItemContent(size_t& pos,
+                              const uint8_t* dicom,
+                              size_t size,
+                              bool explicitVR,
+                              unsigned int depth)
+  {
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, dicom, size, pos, explicitVR))
+      {
+        return false;
+      }
+
+      pos += header.size_;
+
+      if (header.group_ == 0xfffe &&
+          header.element_ == 0xe00d)
+      {
+        return true;
+      }
+
+      if (header.length_ == UNDEFINED_LENGTH)
+      {
+        // The content of the "UN" elements with undefined length is
+        // encoded with implicit VR (PS3.5 Section 6.2.2)
+        if (!SkipItems(pos, dicom, size, explicitVR && !header.unknown_, depth + 1))
+        {
+          return false;
+        }
+      }
+      else if (header.length_ > size - pos)
+      {
+        return false;
+      }
+      else
+      {
+        pos += header.length_;
+      }
+    }
+  }
+
+
+  // Skips the items of an element with undefined length (a sequence,
+  // or encapsulated pixel data), up to the sequence delimitation
+  static bool SkipItems(size_t& pos,
+                        const uint8_t* dicom,
+                        size_t size,
+                        bool explicitVR,
+                        unsigned int depth)
+  {
+    if (depth > MAX_DEPTH)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, dicom, size, pos, explicitVR) ||
+          header.group_ != 0xfffe)
+      {
+        return false;
+      }
+
+      pos += header.size_;
+
+      if (header.element_ == 0xe0dd)
+      {
+        return true;
+      }
+      else if (header.element_ != 0xe000)
+      {
+        return false;
+      }
+      else if (header.length_ == UNDEFINED_LENGTH)
+      {
+        if (!SkipItemContent(pos, dicom, size, explicitVR, depth))
+        {
+          return false;
+        }
+      }
+      else if (header.length_ > size - pos)
+      {
+        return false;
+      }
+      else
+      {
+        pos += header.length_;
+      }
+    }
+  }
+
+
+  static bool IsVideo(const std::string& transferSyntax)
+  {
+    // Same list as in "DicomFrameIndex::IsVideo()", for which a
+    // single frame is assumed
+    return (transferSyntax == "1.2.840.10008.1.2.4.100" ||
+            transferSyntax == "1.2.840.10008.1.2.4.101" ||
+            transferSyntax == "1.2.840.10008.1.2.4.102" ||
+            transferSyntax == "1.2.840.10008.1.2.4.103" ||
+            transferSyntax == "1.2.840.10008.1.2.4.104" ||
+            transferSyntax == "1.2.840.10008.1.2.4.105" ||
+            transferSyntax == "1.2.840.10008.1.2.4.106");
+  }
+
+
+  bool DicomFrameOffsetTable::MapFragments(const std::vector<Fragment>& fragments,
+                                           const std::vector<uint32_t>& offsetTable,
+                                           unsigned int framesCount)
+  {
+    // Same rules as in "DicomFrameIndex::FragmentIndex"
+    if (fragments.size() < framesCount)
+    {
+      return false;
+    }
+
+    frames_.resize(framesCount);
+
+    if (fragments.size() == framesCount)
+    {
+      // Simple case: There is one fragment per frame
+      for (unsigned int i = 0; i < framesCount; i++)
+      {
+        frames_[i].push_back(fragments[i]);
+      }
+
+      return true;
+    }
+
+    if (framesCount == 1)
+    {
+      frames_[0] = fragments;
+      return true;
+    }
+
+    // Use the basic offset table
+    if (offsetTable.size() != framesCount ||
+        offsetTable[0] != 0)
+    {
+      return false;
+    }
+
+    uint64_t offset = 0;
+    unsigned int currentFrame = 0;
+
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+      if (currentFrame + 1 < framesCount &&
+          offset == offsetTable[currentFrame + 1])
+      {
+        currentFrame += 1;
+      }
+
+      frames_[currentFrame].push_back(fragments[i]);
+
+      // 8 bytes = overhead for the item tag and length field
+      offset += fragments[i].size_ + 8;
+    }
+
+    return (currentFrame + 1 == framesCount);
+  }
+
+
+  bool DicomFrameOffsetTable::ScanPixelData(const uint8_t* dicom,
+                                            size_t size,
+                                            size_t pos,
+                                            uint32_t length,
+                                            unsigned int framesCount,
+                                            size_t frameSize)
+  {
+    if (length != UNDEFINED_LENGTH)
+    {
+      // Native pixel data: The frames are stored one after the other
+      if (frameSize == 0 ||
+          length > size - pos ||
+          static_cast<uint64_t>(frameSize) * static_cast<uint64_t>(framesCount) > length)
+      {
+        return false;
+      }
+
+      frames_.resize(framesCount);
+
+      for (unsigned int i = 0; i < framesCount; i++)
+      {
+        Fragment fragment;
+        fragment.offset_ = pos + static_cast<uint64_t>(i) * frameSize;
+        fragment.size_ = frameSize;
+        frames_[i].push_back(fragment);
+      }
+
+      return true;
+    }
+
+    // Encapsulated pixel data: The first item is the basic offset
+    // table, followed by the fragments
+    std::vector<uint32_t> offsetTable;
+    std::vector<Fragment> fragments;
+    bool first = true;
+
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, dicom, size, pos, true) ||
+          header.group_ != 0xfffe)
+      {
+        return false;
+      }
+
+      pos += header.size_;
+
+      if (header.element_ == 0xe0dd)
+      {
+        break;
+      }
+
+      if (header.element_ != 0xe000 ||
+          header.length_ == UNDEFINED_LENGTH ||
+          header.length_ > size - pos)
+      {
+        return false;
+      }
+
+      if (first)
+      {
+        if (header.length_ % 4 != 0)
+        {
+          return false;
+        }
+
+        offsetTable.resize(header.length_ / 4);
+        for (size_t i = 0; i < offsetTable.size(); i++)
+        {
+          offsetTable[i] = ReadUInt32(dicom + pos + 4 * i);
+        }
+
+        first = false;
+      }
+      else
+      {
+        Fragment fragment;
+        fragment.offset_ = pos;
+        fragment.size_ = header.length_;
+        fragments.push_back(fragment);
+      }
+
+      pos += header.length_;
+    }
+
+    return (!first &&
+            MapFragments(fragments, offsetTable, framesCount));
+  }
+
+
+  // Parses the preamble and the meta header of a DICOM file (PS3.10
+  // Section 7.1), then moves "pos" to the first element of the dataset
+  static DicomFrameOffsetTable::PixelDataLookup ParseMetaHeader(size_t& pos,
+                                                                bool& explicitVR,
+                                                                std::string& transferSyntax,
+                                                                const uint8_t* dicom,
+                                                                size_t size)
+  {
+    if (size < 132)
+    {
+      return DicomFrameOffsetTable::PixelDataLookup_Incomplete;
+    }
+
+    if (memcmp(dicom + 128, "DICM", 4) != 0)
+    {
+      return DicomFrameOffsetTable::PixelDataLookup_NotFound;
+    }
+
+    // The meta header is always encoded as explicit VR little endian
+    pos = 132;
+    transferSyntax.clear();
+
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, dicom, size, pos, true))
+      {
+        return DicomFrameOffsetTable::PixelDataLookup_Incomplete;
+      }
+
+      if (header.group_ != 0x0002)
+      {
+        break;
+      }
+
+      pos += header.size_;
+
+      if (header.length_ == UNDEFINED_LENGTH ||
+          header.length_ > size - pos)
+      {
+        return DicomFrameOffsetTable::PixelDataLookup_Incomplete;
+      }
+
+      if (header.element_ == 0x0010)
+      {
+        // The UIDs are padded with a null character
+        transferSyntax.assign(reinterpret_cast<const char*>(dicom + pos), header.length_);
+        transferSyntax = Toolbox::StripSpaces(transferSyntax.c_str());
+      }
+
+      pos += header.length_;
+    }
+
+    if (transferSyntax == "1.2.840.10008.1.2")
+    {
+      explicitVR = false;
+    }
+    else if (transferSyntax.empty() ||
+             transferSyntax == "1.2.840.10008.1.2.1.99" ||  // Deflated explicit VR little endian
+             transferSyntax == "1.2.840.10008.1.2.2")       // Explicit VR big endian
+    {
+      return DicomFrameOffsetTable::PixelDataLookup_NotFound;
+    }
+    else
+    {
+      explicitVR = true;
+    }
+
+    return DicomFrameOffsetTable::PixelDataLookup_Found;
+  }
+
+
+  // Walks the top-level elements of the dataset, up to the header of
+  // the pixel data, after which "pos" is left
+  static DicomFrameOffsetTable::PixelDataLookup SkipToPixelData(size_t& pos,
+                                                                ElementHeader& header,
+                                                                bool& privateCompression,
+                                                                const uint8_t* dicom,
+                                                                size_t size,
+                                                                bool explicitVR)
+  {
+    privateCompression = false;
+
+    for (;;)
+    {
+      if (!ReadElementHeader(header, dicom, size, pos, explicitVR))
+      {
+        return DicomFrameOffsetTable::PixelDataLookup_Incomplete;
+      }
+
+      if (header.group_ > 0x7fe0 ||
+          (header.group_ == 0x7fe0 &&
+           header.element_ > 0x0010))
+      {
+        return DicomFrameOffsetTable::PixelDataLookup_NotFound;
+      }
+
+      pos += header.size_;
+
+      if (header.group_ == 0x7fe0 &&
+          header.element_ == 0x0010)
+      {
+        return DicomFrameOffsetTable::PixelDataLookup_Found;
+      }
+
+      if (header.length_ == UNDEFINED_LENGTH)
+      {
+        if (!SkipItems(pos, dicom, size, explicitVR && !header.unknown_, 0))
+        {
+          return DicomFrameOffsetTable::PixelDataLookup_Incomplete;
+        }
+      }
+      else if (header.length_ > size - pos)
+      {
+        return DicomFrameOffsetTable::PixelDataLookup_Incomplete;
+      }
+      else
+      {
+        // The private Philips compression "PMSCT_RLE1" (cf. the class
+        // "DicomImageDecoder") is only handled by DCMTK
+        if (header.group_ == 0x07a1 &&
+            header.element_ == 0x1011 &&
+            header.length_ >= 10 &&
+            memcmp(dicom + pos, "PMSCT_RLE1", 10) == 0)
+        {
+          privateCompression = true;
+        }
+
+        pos += header.length_;
+      }
+    }
+  }
+
+
+  bool DicomFrameOffsetTable::Compute(const void* dicom,
+                                      size_t size,
+                                      const DicomMap& summary)
+  {
+    Clear();
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(dicom);
+
+    size_t pos;
+    bool explicitVR;
+    std::string transferSyntax;
+    if (ParseMetaHeader(pos, explicitVR, transferSyntax, p, size) != PixelDataLookup_Found)
+    {
+      return false;
+    }
+
+    if (transferSyntax == "1.2.840.10008.1.2.4.50")
+    {
+      mime_ = MimeType_Jpeg;
+    }
+    else if (transferSyntax == "1.2.840.10008.1.2.4.90" ||
+             transferSyntax == "1.2.840.10008.1.2.4.91")
+    {
+      mime_ = MimeType_Jpeg2000;
+    }
+    else
+    {
+      mime_ = MimeType_Binary;
+    }
+
+    unsigned int framesCount;
+    size_t frameSize;
+
+    try
+    {
+      DicomImageInformation information(summary);
+      framesCount = information.GetNumberOfFrames();
+      frameSize = information.GetFrameSize();
+    }
+    catch (OrthancException&)
+    {
+      // Not an image, or an image that is not supported by Orthanc
+      return false;
+    }
+
+    if (IsVideo(transferSyntax))
+    {
+      framesCount = 1;
+    }
+
+    ElementHeader header;
+    bool privateCompression;
+    if (SkipToPixelData(pos, header, privateCompression, p, size, explicitVR) != PixelDataLookup_Found ||
+        privateCompression ||
+        !ScanPixelData(p, size, pos, header.length_, framesCount, frameSize))
+    {
+      Clear();
+      return false;
+    }
+
+    return true;
+  }
+
+
+  DicomFrameOffsetTable::PixelDataLookup
+  DicomFrameOffsetTable::LookupPixelData(uint64_t& headerStart,
+                                         uint64_t& valueStart,
+                                         const void* dicom,
+                                         size_t size)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(dicom);
+
+    size_t pos;
+    bool explicitVR;
+    std::string transferSyntax;
+
+    PixelDataLookup result = ParseMetaHeader(pos, explicitVR, transferSyntax, p, size);
+    if (result != PixelDataLookup_Found)
+    {
+      return result;
+    }
+
+    ElementHeader header;
+    bool privateCompression;
+
+    result = SkipToPixelData(pos, header, privateCompression, p, size, explicitVR);
+    if (result == PixelDataLookup_Found)
+    {
+      headerStart = pos - header.size_;
+      valueStart = pos;
+    }
+
+    return result;
+  }
+
+
+  void DicomFrameOffsetTable::Clear()
+  {
+    mime_ = MimeType_Binary;
+    frames_.clear();
+  }
+
+
+  void DicomFrameOffsetTable::GetFrameRange(uint64_t& start,
+                                            uint64_t& end,
+                                            unsigned int frame) const
+  {
+    if (frame >= frames_.size())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    const Fragments& fragments = frames_[frame];
+    assert(!fragments.empty());
+
+    start = fragments.front().offset_;
+    end = fragments.back().offset_ + fragments.back().size_;
+  }
+
+
+  void DicomFrameOffsetTable::ExtractFrame(std::string& target,
+                                           const std::string& range,
+                                           unsigned int frame) const
+  {
+    uint64_t start, end;
+    GetFrameRange(start, end, frame);
+
+    if (range.size() != end - start)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    const Fragments& fragments = frames_[frame];
+
+    if (fragments.size() == 1)
+    {
+      target = range;
+      return;
+    }
+
+    uint64_t size = 0;
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+      size += fragments[i].size_;
+    }
+
+    target.resize(static_cast<size_t>(size));
+
+    size_t pos = 0;
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+      if (fragments[i].size_ > 0)
+      {
+        memcpy(&target[pos], range.c_str() + (fragments[i].offset_ - start), 
+               static_cast<size_t>(fragments[i].size_));
+        pos += static_cast<size_t>(fragments[i].size_);
+      }
+    }
+  }
+
+
+  bool DicomFrameOffsetTable::IsNative() const
+  {
+    bool native = !frames_.empty();
+
+    for (size_t i = 0; i < frames_.size() && native; i++)
+    {
+      native = (frames_[i].size() == 1 &&
+                frames_[i][0].size_ == frames_[0][0].size_ &&
+                frames_[i][0].offset_ == frames_[0][0].offset_ + i * frames_[0][0].size_);
+    }
+
+    return native;
+  }
+
+
+  void DicomFrameOffsetTable::Serialize(std::string& target) const
+  {
+    target = std::string(EnumerationToString(mime_));
+
+    // Compact form for the native pixel data
+    if (IsNative())
+    {
+      target += (";native;" + 
+                 boost::lexical_cast<std::string>(frames_[0][0].offset_) + ";" +
+                 boost::lexical_cast<std::string>(frames_[0][0].size_) + ";" +
+                 boost::lexical_cast<std::string>(frames_.size()));
+    }
+    else
+    {
+      target += ";fragments";
+
+      for (size_t i = 0; i < frames_.size(); i++)
+      {
+        target += ";";
+
+        for (size_t j = 0; j < frames_[i].size(); j++)
+        {
+          if (j > 0)
+          {
+            target += ",";
+          }
+
+          target += (boost::lexical_cast<std::string>(frames_[i][j].offset_) + "+" +
+                     boost::lexical_cast<std::string>(frames_[i][j].size_));
+        }
+      }
+    }
+  }
+
+
+  bool DicomFrameOffsetTable::Unserialize(const std::string& source)
+  {
+    Clear();
+
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, source, ';');
+
+    if (tokens.size() < 2)
+    {
+      return false;
+    }
+
+    try
+    {
+      mime_ = StringToMimeType(tokens[0]);
+
+      if (tokens[1] == "native" &&
+          tokens.size() == 5)
+      {
+        Fragment fragment;
+        fragment.offset_ = boost::lexical_cast<uint64_t>(tokens[2]);
+        fragment.size_ = boost::lexical_cast<uint64_t>(tokens[3]);
+
+        frames_.resize(boost::lexical_cast<unsigned int>(tokens[4]));
+
+        for (size_t i = 0; i < frames_.size(); i++)
+        {
+          frames_[i].push_back(fragment);
+          fragment.offset_ += fragment.size_;
+        }
+
+        return true;
+      }
+      else if (tokens[1] == "fragments")
+      {
+        frames_.resize(tokens.size() - 2);
+
+        for (size_t i = 0; i < frames_.size(); i++)
+        {
+          std::vector<std::string> items;
+          Toolbox::TokenizeString(items, tokens[i + 2], ',');
+
+          for (size_t j = 0; j < items.size(); j++)
+          {
+            size_t separator = items[j].find('+');
+            if (separator == std::string::npos)
+            {
+              Clear();
+              return false;
+            }
+
+            Fragment fragment;
+            fragment.offset_ = boost::lexical_cast<uint64_t>(items[j].substr(0, separator));
+            fragment.size_ = boost::lexical_cast<uint64_t>(items[j].substr(separator + 1));
+            frames_[i].push_back(fragment);
+          }
+
+          if (frames_[i].empty())
+          {
+            Clear();
+            return false;
+          }
+        }
+
+        return true;
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+    catch (OrthancException&)
+    {
+    }
+
+    Clear();
+    return false;
+  }
+}
@@ -0,0 +1,147 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "DicomMap.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * Byte ranges of the frames inside a serialized DICOM file. The
+   * table is computed once by scanning the file (without DCMTK), then
+   * serialized as a metadata of the instance, so that a raw frame can
+   * later be read from the storage area without parsing the file.
+   **/
+  class DicomFrameOffsetTable
+  {
+  public:
+    // Contiguous bytes of a frame, inside the DICOM file
+    struct Fragment
+    {
+      uint64_t  offset_;
+      uint64_t  size_;
+    };
+
+    enum PixelDataLookup
+    {
+      PixelDataLookup_Found,
+      PixelDataLookup_NotFound,    // No pixel data, or unsupported transfer syntax
+      PixelDataLookup_Incomplete   // More bytes of the file are needed
+    };
+
+  private:
+    typedef std::vector<Fragment>  Fragments;
+
+    MimeType                mime_;
+    std::vector<Fragments>  frames_;
+
+    bool ScanPixelData(const uint8_t* dicom,
+                       size_t size,
+                       size_t pos,
+                       uint32_t length,
+                       unsigned int framesCount,
+                       size_t frameSize);
+
+    bool MapFragments(const std::vector<Fragment>& fragments,
+                      const std::vector<uint32_t>& offsetTable,
+                      unsigned int framesCount);
+
+  public:
+    DicomFrameOffsetTable() :
+      mime_(MimeType_Binary)
+    {
+    }
+
+    /**
+     * Returns "false" if the frames cannot be located without DCMTK,
+     * in which case the table is left empty. This happens for the
+     * instances without pixel data, for the big endian and deflated
+     * transfer syntaxes, and for the pixel data whose fragments do
+     * not match the frames.
+     **/
+    bool Compute(const void* dicom,
+                 size_t size,
+                 const DicomMap& summary);
+
+    void Clear();
+
+    unsigned int GetFramesCount() const
+    {
+      return static_cast<unsigned int>(frames_.size());
+    }
+
+    // MIME type of the raw frames, as in "ParsedDicomFile::GetRawFrame()"
+    MimeType GetMimeType() const
+    {
+      return mime_;
+    }
+
+    // Tells whether the frames are made of a single fragment of
+    // constant size, stored one after the other (native pixel data)
+    bool IsNative() const;
+
+    // Smallest range [start, end) of the DICOM file that contains
+    // all the fragments of the frame
+    void GetFrameRange(uint64_t& start,
+                       uint64_t& end,
+                       unsigned int frame) const;
+
+    // Concatenates the fragments of the frame, given the content of
+    // the range that is returned by "GetFrameRange()"
+    void ExtractFrame(std::string& target,
+                      const std::string& range,
+                      unsigned int frame) const;
+
+    void Serialize(std::string& target) const;
+
+    bool Unserialize(const std::string& source);
+
+    /**
+     * Locates the top-level pixel data element (7FE0,0010) in the
+     * first "size" bytes of a DICOM file. On success, the header of
+     * the element lies in the range [headerStart, valueStart) of the
+     * file. This allows to parse the DICOM tags of a large image
+     * without reading its pixel data.
+     **/
+    static PixelDataLookup LookupPixelData(uint64_t& headerStart,
+                                           uint64_t& valueStart,
+                                           const void* dicom,
+                                           size_t size);
+  };
+}
@@ -96,6 +96,7 @@ namespace Orthanc
     worklistRequestHandlerFactory_ = NULL;
     applicationEntityFilter_ = NULL;
     checkCalledAet_ = true;
+    bitPreservingStore_ = false;
     associationTimeout_ = 30;
     continue_ = false;
   }
@@ -146,6 +147,28 @@ namespace Orthanc
     return checkCalledAet_;
   }
 
+  void DicomServer::SetBitPreservingStore(bool bitPreserving)
+  {
+    Stop();
+    bitPreservingStore_ = bitPreserving;
+  }
+
+  bool DicomServer::HasBitPreservingStore() const
+  {
+    return bitPreservingStore_;
+  }
+
+  void DicomServer::SetBitPreservingDirectory(const std::string& directory)
+  {
+    Stop();
+    bitPreservingDirectory_ = directory;
+  }
+
+  const std::string& DicomServer::GetBitPreservingDirectory() const
+  {
+    return bitPreservingDirectory_;
+  }
+
   void DicomServer::SetApplicationEntityTitle(const std::string& aet)
   {
     if (aet.size() == 0)
@@ -73,6 +73,8 @@ namespace Orthanc
     boost::shared_ptr<PImpl> pimpl_;
 
     bool checkCalledAet_;
+    bool bitPreservingStore_;
+    std::string bitPreservingDirectory_;
     std::string aet_;
     uint16_t port_;
     bool continue_;
@@ -100,6 +102,16 @@ namespace Orthanc
     void SetCalledApplicationEntityTitleCheck(bool check);
     bool HasCalledApplicationEntityTitleCheck() const;
 
+    // In the bit-preserving mode, the received instances are written
+    // as such to a temporary file, and only their tags are parsed
+    void SetBitPreservingStore(bool bitPreserving);
+    bool HasBitPreservingStore() const;
+
+    // Directory of the temporary files of the bit-preserving mode. If
+    // empty, the temporary directory of the system is used.
+    void SetBitPreservingDirectory(const std::string& directory);
+    const std::string& GetBitPreservingDirectory() const;
+
     void SetApplicationEntityTitle(const std::string& aet);
     const std::string& GetApplicationEntityTitle() const;
 
@@ -837,7 +837,9 @@ namespace Orthanc
 
                 if (handler.get() != NULL)
                 {
-                  cond = Internals::storeScp(assoc_, &msg, presID, *handler, remoteIp_);
+                  cond = Internals::storeScp(assoc_, &msg, presID, *handler, remoteIp_,
+                                             server_.HasBitPreservingStore(),
+                                             server_.GetBitPreservingDirectory());
                 }
               }
               break;
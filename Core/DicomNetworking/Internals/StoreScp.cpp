@@ -84,9 +84,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "StoreScp.h"
 
 #include "../../DicomParsing/FromDcmtkBridge.h"
+#include "../../DicomParsing/ParsedDicomFile.h"
 #include "../../DicomParsing/ToDcmtkBridge.h"
 #include "../../OrthancException.h"
 #include "../../Logging.h"
+#include "../../SystemToolbox.h"
+#include "../../TemporaryFile.h"
 
 #include <dcmtk/dcmdata/dcfilefo.h>
 #include <dcmtk/dcmdata/dcmetinf.h>
@@ -116,7 +119,7 @@ namespace Orthanc
       void *callbackData,
       T_DIMSE_StoreProgress *progress,
       T_DIMSE_C_StoreRQ *req,
-      char * /*imageFileName*/, DcmDataset **imageDataSet,
+      char *imageFileName, DcmDataset **imageDataSet,
       T_DIMSE_C_StoreRSP *rsp,
       DcmDataset **statusDetail)
     /*
@@ -157,22 +160,50 @@ namespace Orthanc
         // then the status will reflect this.  The callback function is still called to allow cleanup.
         //rsp->DimseStatus = STATUS_Success;
 
-        // we want to write the received information to a file only if this information
-        // is present and the options opt_bitPreserving and opt_ignore are not set.
+        // The received information is either a data set that was
+        // parsed by DCMTK, or (if opt_bitPreserving is set) a file
+        // that contains the data as it was received from the network
+        std::string buffer;
+        std::auto_ptr<ParsedDicomFile> header;
+        DcmDataset* dataset = NULL;
+
         if ((imageDataSet != NULL) && (*imageDataSet != NULL))
+        {
+          dataset = *imageDataSet;
+        }
+        else if (imageFileName != NULL &&
+                 rsp->DimseStatus == STATUS_Success)
+        {
+          try
+          {
+            // Only the DICOM tags are parsed, the pixel data is kept
+            // untouched in the buffer
+            SystemToolbox::ReadFile(buffer, imageFileName);
+            header.reset(ParsedDicomFile::CreateUntilPixelData
+                         (buffer.empty() ? NULL : buffer.c_str(), buffer.size()));
+            dataset = header->GetDcmtkObject().getDataset();
+          }
+          catch (...)
+          {
+            LOG(ERROR) << "cannot read the received DICOM file: " << imageFileName;
+            rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
+          }
+        }
+
+        if (dataset != NULL)
         {
           DicomMap summary;
           Json::Value dicomJson;
-          std::string buffer;
 
           try
           {
             std::set<DicomTag> ignoreTagLength;
             
-            FromDcmtkBridge::ExtractDicomSummary(summary, **imageDataSet);
-            FromDcmtkBridge::ExtractDicomAsJson(dicomJson, **imageDataSet, ignoreTagLength);
+            FromDcmtkBridge::ExtractDicomSummary(summary, *dataset);
+            FromDcmtkBridge::ExtractDicomAsJson(dicomJson, *dataset, ignoreTagLength);
 
-            if (!FromDcmtkBridge::SaveToMemoryBuffer(buffer, **imageDataSet))
+            if (header.get() == NULL &&
+                !FromDcmtkBridge::SaveToMemoryBuffer(buffer, *dataset))
             {
               LOG(ERROR) << "cannot write DICOM file to memory";
               rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
@@ -188,7 +219,7 @@ namespace Orthanc
           if (rsp->DimseStatus == STATUS_Success)
           {
             // which SOP class and SOP instance ?
-            if (!DU_findSOPClassAndInstanceInDataSet(*imageDataSet, sopClass, sopInstance, /*opt_correctUIDPadding*/ OFFalse))
+            if (!DU_findSOPClassAndInstanceInDataSet(dataset, sopClass, sopInstance, /*opt_correctUIDPadding*/ OFFalse))
             {
               //LOG4CPP_ERROR(Internals::GetLogger(), "bad DICOM file: " << fileName);
               rsp->DimseStatus = STATUS_STORE_Error_CannotUnderstand;
@@ -241,7 +272,9 @@ namespace Orthanc
                                   T_DIMSE_Message * msg, 
                                   T_ASC_PresentationContextID presID,
                                   IStoreRequestHandler& handler,
-                                  const std::string& remoteIp)
+                                  const std::string& remoteIp,
+                                  bool bitPreserving,
+                                  const std::string& bitPreservingDirectory)
   {
     OFCondition cond = EC_Normal;
     T_DIMSE_C_StoreRQ *req;
@@ -270,22 +303,40 @@ namespace Orthanc
       data.calledAET = "";
     }
 
-    DcmFileFormat dcmff;
-
-    // store SourceApplicationEntityTitle in metaheader
-    if (assoc && assoc->params)
+    if (bitPreserving)
     {
-      const char *aet = assoc->params->DULparams.callingAPTitle;
-      if (aet) dcmff.getMetaInfo()->putAndInsertString(DCM_SourceApplicationEntityTitle, aet);
+      // write the information which will be received over the network
+      // as such to a temporary file, that is removed once the
+      // callback has handled it. The callback reads this file once,
+      // as the store handler expects the instance in memory: The file
+      // should thus not be in a memory-backed filesystem (such as
+      // tmpfs), which would double the memory usage.
+      TemporaryFile tmp(bitPreservingDirectory, ".dcm");
+
+      cond = DIMSE_storeProvider(assoc, presID, req, tmp.GetPath().c_str(), /*opt_useMetaheader*/OFTrue, NULL,
+                                 storeScpCallback, &data, 
+                                 /*opt_blockMode*/ DIMSE_BLOCKING, 
+                                 /*opt_dimse_timeout*/ 0);
     }
+    else
+    {
+      DcmFileFormat dcmff;
 
-    // define an address where the information which will be received over the network will be stored
-    DcmDataset *dset = dcmff.getDataset();
+      // store SourceApplicationEntityTitle in metaheader
+      if (assoc && assoc->params)
+      {
+        const char *aet = assoc->params->DULparams.callingAPTitle;
+        if (aet) dcmff.getMetaInfo()->putAndInsertString(DCM_SourceApplicationEntityTitle, aet);
+      }
 
-    cond = DIMSE_storeProvider(assoc, presID, req, NULL, /*opt_useMetaheader*/OFFalse, &dset,
-                               storeScpCallback, &data, 
-                               /*opt_blockMode*/ DIMSE_BLOCKING, 
-                               /*opt_dimse_timeout*/ 0);
+      // define an address where the information which will be received over the network will be stored
+      DcmDataset *dset = dcmff.getDataset();
+
+      cond = DIMSE_storeProvider(assoc, presID, req, NULL, /*opt_useMetaheader*/OFFalse, &dset,
+                                 storeScpCallback, &data, 
+                                 /*opt_blockMode*/ DIMSE_BLOCKING, 
+                                 /*opt_dimse_timeout*/ 0);
+    }
 
     // if some error occured, dump corresponding information and remove the outfile if necessary
     if (cond.bad())
@@ -85,6 +85,7 @@
 #include "Internals/DicomFrameIndex.h"
 #include "ToDcmtkBridge.h"
 
+#include "../DicomFormat/DicomFrameOffsetTable.h"
 #include "../Images/PamReader.h"
 #include "../Logging.h"
 #include "../OrthancException.h"
@@ -92,6 +93,7 @@
 
 #if ORTHANC_SANDBOXED == 0
 #  include "../SystemToolbox.h"
+#  include <boost/thread/mutex.hpp>
 #endif
 
 #if ORTHANC_ENABLE_JPEG == 1
@@ -158,6 +160,13 @@ namespace Orthanc
   {
     std::auto_ptr<DcmFileFormat> file_;
     std::auto_ptr<DicomFrameIndex>  frameIndex_;
+
+#if ORTHANC_SANDBOXED == 0
+    // The same parsed file can be read by several threads through
+    // the DICOM cache of Orthanc server: Protects the lazy creation
+    // of the frame index
+    boost::mutex  frameIndexMutex_;
+#endif
   };
 
 
@@ -1025,6 +1034,120 @@ namespace Orthanc
   }
 
 
+  ParsedDicomFile* ParsedDicomFile::CreateUntilPixelData(const void* content,
+                                                         size_t size)
+  {
+    uint64_t headerStart, valueStart;
+    if (size > 0 &&
+        DicomFrameOffsetTable::LookupPixelData(headerStart, valueStart, content, size) ==
+        DicomFrameOffsetTable::PixelDataLookup_Found)
+    {
+      // Keep the header of the pixel data element, but set its length
+      // to zero, so that DCMTK still reports an (empty) pixel data
+      std::string header(reinterpret_cast<const char*>(content), static_cast<size_t>(valueStart));
+      assert(valueStart - headerStart >= 8);
+
+      for (size_t i = static_cast<size_t>(valueStart) - 4; i < header.size(); i++)
+      {
+        header[i] = 0;
+      }
+
+      return new ParsedDicomFile(header);
+    }
+    else
+    {
+      // No pixel data, or a transfer syntax that cannot be scanned
+      // without DCMTK: Parse the whole file
+      return new ParsedDicomFile(content, size);
+    }
+  }
+
+
+  static void AppendLittleEndianUInt32(std::string& target,
+                                      uint32_t value)
+  {
+    for (unsigned int i = 0; i < 4; i++)
+    {
+      target.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+  }
+
+
+  static void AppendItemHeader(std::string& target,
+                               uint16_t element,
+                               uint32_t length)
+  {
+    // Tag (FFFE,element) of an item, followed by its length
+    target.push_back(static_cast<char>(0xfe));
+    target.push_back(static_cast<char>(0xff));
+    target.push_back(static_cast<char>(element & 0xff));
+    target.push_back(static_cast<char>(element >> 8));
+    AppendLittleEndianUInt32(target, length);
+  }
+
+
+  ParsedDicomFile* ParsedDicomFile::CreateSingleFrame(const void* header,
+                                                      size_t headerSize,
+                                                      const std::string& frame)
+  {
+    uint64_t headerStart, valueStart;
+    if (headerSize == 0 ||
+        DicomFrameOffsetTable::LookupPixelData(headerStart, valueStart, header, headerSize) !=
+        DicomFrameOffsetTable::PixelDataLookup_Found)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    // Both with explicit and implicit VR, the length of the pixel
+    // data element is the last field of its header
+    assert(valueStart - headerStart >= 8);
+    const size_t lengthStart = static_cast<size_t>(valueStart) - 4;
+    const uint8_t* length = reinterpret_cast<const uint8_t*>(header) + lengthStart;
+
+    const bool encapsulated = (length[0] == 0xff && length[1] == 0xff &&
+                               length[2] == 0xff && length[3] == 0xff);
+
+    // The values and the items must have an even length
+    std::string value = frame;
+    if (value.size() % 2 == 1)
+    {
+      value.push_back('\0');
+    }
+
+    if (value.size() >= 0xfffffffeu)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    std::string dicom(reinterpret_cast<const char*>(header), lengthStart);
+
+    if (encapsulated)
+    {
+      // Empty basic offset table, followed by one fragment
+      AppendLittleEndianUInt32(dicom, 0xffffffffu);
+      AppendItemHeader(dicom, 0xe000, 0);
+      AppendItemHeader(dicom, 0xe000, static_cast<uint32_t>(value.size()));
+      dicom.append(value);
+      AppendItemHeader(dicom, 0xe0dd, 0);
+    }
+    else
+    {
+      AppendLittleEndianUInt32(dicom, static_cast<uint32_t>(value.size()));
+      dicom.append(value);
+    }
+
+    std::auto_ptr<ParsedDicomFile> result(new ParsedDicomFile(dicom));
+
+    if (result->HasTag(DICOM_TAG_NUMBER_OF_FRAMES))
+    {
+      result->Replace(DICOM_TAG_NUMBER_OF_FRAMES, std::string("1"),
+                      false, DicomReplaceMode_ThrowIfAbsent);
+    }
+
+    return result.release();
+  }
+
+
   ParsedDicomFile::ParsedDicomFile(ParsedDicomFile& other,
                                    bool keepSopInstanceUid) : 
     pimpl_(new PImpl)
@@ -1491,9 +1614,15 @@ namespace Orthanc
                                     MimeType& mime,
                                     unsigned int frameId)
   {
-    if (pimpl_->frameIndex_.get() == NULL)
     {
-      pimpl_->frameIndex_.reset(new DicomFrameIndex(*pimpl_->file_));
+#if ORTHANC_SANDBOXED == 0
+      boost::mutex::scoped_lock lock(pimpl_->frameIndexMutex_);
+#endif
+
+      if (pimpl_->frameIndex_.get() == NULL)
+      {
+        pimpl_->frameIndex_.reset(new DicomFrameIndex(*pimpl_->file_));
+      }
     }
 
     pimpl_->frameIndex_->GetRawFrame(target, frameId);
@@ -106,6 +106,21 @@ namespace Orthanc
 
     ParsedDicomFile(const std::string& content);
 
+    // Parses the DICOM file up to its pixel data (7FE0,0010), that is
+    // replaced by an empty value. The content can stop right after
+    // the header of the pixel data element, which allows to read the
+    // tags of a large image without reading its pixel data.
+    static ParsedDicomFile* CreateUntilPixelData(const void* content,
+                                                 size_t size);
+
+    // Creates a single-frame DICOM file from the beginning of a DICOM
+    // file, up to the header of its pixel data element, and from one
+    // of its raw frames (as returned by "GetRawFrame()"). This allows
+    // to decode one frame without parsing the other ones.
+    static ParsedDicomFile* CreateSingleFrame(const void* header,
+                                              size_t headerSize,
+                                              const std::string& frame);
+
     ParsedDicomFile(DcmDataset& dicom);
 
     ParsedDicomFile(DcmFileFormat& dicom);
@@ -178,6 +178,9 @@ namespace Orthanc
       case ErrorCode_CanceledJob:
         return "This job was canceled";
 
+      case ErrorCode_DuplicateResource:
+        return "Duplicated resource";
+
       case ErrorCode_SQLiteNotOpened:
         return "SQLite: The database is not opened";
 
@@ -1032,6 +1035,28 @@ namespace Orthanc
   }
 
 
+  const char* EnumerationToString(CompressionType compression)
+  {
+    switch (compression)
+    {
+      case CompressionType_None:
+        return "None";
+
+      case CompressionType_ZlibWithSize:
+        return "Zlib";
+
+      case CompressionType_Lz4WithSize:
+        return "Lz4";
+
+      case CompressionType_ZstdWithSize:
+        return "Zstd";
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
   const char* EnumerationToString(MimeType mime)
   {
     switch (mime)
@@ -1577,6 +1602,31 @@ namespace Orthanc
   }
 
 
+  CompressionType StringToCompressionType(const std::string& compression)
+  {
+    if (compression == "None")
+    {
+      return CompressionType_None;
+    }
+    else if (compression == "Zlib")
+    {
+      return CompressionType_ZlibWithSize;
+    }
+    else if (compression == "Lz4")
+    {
+      return CompressionType_Lz4WithSize;
+    }
+    else if (compression == "Zstd")
+    {
+      return CompressionType_ZstdWithSize;
+    }
+    else
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
   RequestOrigin StringToRequestOrigin(const std::string& origin)
   {
     if (origin == "Unknown")
@@ -154,6 +154,7 @@ namespace Orthanc
     ErrorCode_NullPointer = 35    /*!< Cannot handle a NULL pointer */,
     ErrorCode_DatabaseUnavailable = 36    /*!< The database is currently not available (probably a transient situation) */,
     ErrorCode_CanceledJob = 37    /*!< This job was canceled */,
+    ErrorCode_DuplicateResource = 38    /*!< Duplicated resource */,
     ErrorCode_SQLiteNotOpened = 1000    /*!< SQLite: The database is not opened */,
     ErrorCode_SQLiteAlreadyOpened = 1001    /*!< SQLite: Connection is already open */,
     ErrorCode_SQLiteCannotOpen = 1002    /*!< SQLite: Unable to open the database */,
@@ -320,6 +321,20 @@ namespace Orthanc
   };
 
 
+  /**
+   * Interpolation of the pixels while resizing an image.
+   **/
+  enum ImageInterpolation
+  {
+    // Average of the source pixels that are covered by each target
+    // pixel (best suited to downscaling, e.g. for thumbnails)
+    ImageInterpolation_Box,
+
+    // Weighted average of the 4 nearest source pixels
+    ImageInterpolation_Bilinear
+  };
+
+
   /**
    * Most common, non-joke and non-experimental HTTP status codes
    * http://en.wikipedia.org/wiki/List_of_HTTP_status_codes
@@ -662,7 +677,25 @@ namespace Orthanc
      * buffer is non-empty, the buffer is compatible with the
      * "deflate" HTTP compression.
      **/
-    CompressionType_ZlibWithSize = 2
+    CompressionType_ZlibWithSize = 2,
+
+    /**
+     * Buffer that is compressed using the LZ4 block format, prefixed
+     * with a "uint64_t" (8 bytes) that encodes the size of the
+     * uncompressed buffer. If the compressed buffer is empty, its
+     * represents an empty uncompressed buffer. This format is
+     * internal to Orthanc.
+     **/
+    CompressionType_Lz4WithSize = 3,
+
+    /**
+     * Buffer that is compressed using Zstandard (RFC 8478), prefixed
+     * with a "uint64_t" (8 bytes) that encodes the size of the
+     * uncompressed buffer. If the compressed buffer is empty, its
+     * represents an empty uncompressed buffer. This format is
+     * internal to Orthanc.
+     **/
+    CompressionType_ZstdWithSize = 4
   };
 
   enum FileContentType
@@ -721,6 +754,8 @@ namespace Orthanc
 
   const char* EnumerationToString(MimeType mime);
 
+  const char* EnumerationToString(CompressionType compression);
+
   Encoding StringToEncoding(const char* encoding);
 
   ResourceType StringToResourceType(const char* type);
@@ -743,6 +778,8 @@ namespace Orthanc
   RequestOrigin StringToRequestOrigin(const std::string& origin);
 
   MimeType StringToMimeType(const std::string& mime);
+
+  CompressionType StringToCompressionType(const std::string& compression);
   
   unsigned int GetBytesPerPixel(PixelFormat format);
 
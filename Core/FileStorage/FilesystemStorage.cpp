@@ -42,7 +42,11 @@
 #include "../Toolbox.h"
 #include "../SystemToolbox.h"
 
+#include <algorithm>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <ctype.h>
 
 
 static std::string ToString(const boost::filesystem::path& p)
@@ -57,6 +61,170 @@ static std::string ToString(const boost::filesystem::path& p)
 
 namespace Orthanc
 {
+  // Number of I/O operations over which the latencies are computed
+  static const size_t LATENCY_WINDOW = 1024;
+
+
+  FilesystemStorage::LatencyWindow::LatencyWindow() :
+    next_(0),
+    count_(0)
+  {
+    durations_.reserve(LATENCY_WINDOW);
+  }
+
+
+  void FilesystemStorage::LatencyWindow::Add(uint32_t duration)
+  {
+    if (durations_.size() < LATENCY_WINDOW)
+    {
+      durations_.push_back(duration);
+    }
+    else
+    {
+      durations_[next_] = duration;
+    }
+
+    next_ = (next_ + 1) % LATENCY_WINDOW;
+    count_++;
+  }
+
+
+  void FilesystemStorage::LatencyWindow::Format(Json::Value& target,
+                                                const std::string& prefix) const
+  {
+    target[prefix + "Count"] = boost::lexical_cast<std::string>(count_);
+
+    static const unsigned int PERCENTILES[] = { 50, 90, 99 };
+
+    std::vector<uint32_t> sorted(durations_);
+
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(unsigned int); i++)
+    {
+      const std::string key = prefix + "LatencyP" + boost::lexical_cast<std::string>(PERCENTILES[i]);
+
+      if (sorted.empty())
+      {
+        target[key] = 0;
+      }
+      else
+      {
+        std::vector<uint32_t>::iterator nth = sorted.begin() + (sorted.size() - 1) * PERCENTILES[i] / 100;
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        target[key] = *nth;
+      }
+    }
+  }
+
+
+  // Keeps track of the I/O operation that is running, and of its
+  // duration
+  class FilesystemStorage::IoOperation : public boost::noncopyable
+  {
+  private:
+    FilesystemStorage&        that_;
+    LatencyWindow&            latencies_;
+    boost::posix_time::ptime  start_;
+
+  public:
+    IoOperation(FilesystemStorage& that,
+                LatencyWindow& latencies) :
+      that_(that),
+      latencies_(latencies),
+      start_(boost::posix_time::microsec_clock::universal_time())
+    {
+      boost::mutex::scoped_lock lock(that_.ioMutex_);
+      that_.ioRunning_++;
+    }
+
+    ~IoOperation()
+    {
+      boost::posix_time::time_duration duration =
+        boost::posix_time::microsec_clock::universal_time() - start_;
+
+      boost::mutex::scoped_lock lock(that_.ioMutex_);
+      assert(that_.ioRunning_ > 0);
+      that_.ioRunning_--;
+      latencies_.Add(static_cast<uint32_t>(duration.total_microseconds()));
+    }
+  };
+
+
+  // Task of a batch, that is counted as queued until it is started
+  // by the pool of threads
+  class FilesystemStorage::QueuedTask : public TaskPool::ITask
+  {
+  private:
+    FilesystemStorage&  that_;
+    bool                started_;
+
+    void Dequeue()
+    {
+      boost::mutex::scoped_lock lock(that_.ioMutex_);
+      assert(that_.ioQueued_ > 0);
+      that_.ioQueued_--;
+    }
+
+  protected:
+    FilesystemStorage& GetStorage()
+    {
+      return that_;
+    }
+
+    virtual void ExecuteIo() = 0;
+
+  public:
+    explicit QueuedTask(FilesystemStorage& that) :
+      that_(that),
+      started_(false)
+    {
+      boost::mutex::scoped_lock lock(that_.ioMutex_);
+      that_.ioQueued_++;
+    }
+
+    virtual ~QueuedTask()
+    {
+      if (!started_)
+      {
+        Dequeue();
+      }
+    }
+
+    virtual void Execute()
+    {
+      started_ = true;
+      Dequeue();
+      ExecuteIo();
+    }
+  };
+
+
+  class FilesystemStorage::ReadTask : public QueuedTask
+  {
+  private:
+    std::string&        content_;
+    std::string         uuid_;
+    FileContentType     type_;
+
+  protected:
+    virtual void ExecuteIo()
+    {
+      GetStorage().Read(content_, uuid_, type_);
+    }
+
+  public:
+    ReadTask(FilesystemStorage& that,
+             std::string& content,
+             const std::string& uuid,
+             FileContentType type) :
+      QueuedTask(that),
+      content_(content),
+      uuid_(uuid),
+      type_(type)
+    {
+    }
+  };
+
+
   boost::filesystem::path FilesystemStorage::GetPath(const std::string& uuid) const
   {
     namespace fs = boost::filesystem;
@@ -79,7 +247,14 @@ namespace Orthanc
     return path;
   }
 
-  FilesystemStorage::FilesystemStorage(std::string root)
+  FilesystemStorage::FilesystemStorage(std::string root) :
+    ioQueued_(0),
+    ioRunning_(0),
+    durableWrites_(false),
+    syncRunning_(false),
+    syncWrites_(0),
+    syncCompleted_(0),
+    syncCount_(0)
   {
     //root_ = boost::filesystem::absolute(root).string();
     root_ = root;
@@ -110,14 +285,8 @@ namespace Orthanc
   }
 
 
-  void FilesystemStorage::Create(const std::string& uuid,
-                                 const void* content, 
-                                 size_t size,
-                                 FileContentType type)
+  boost::filesystem::path FilesystemStorage::PrepareCreate(const std::string& uuid) const
   {
-    LOG(INFO) << "Creating attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
-              << "\" type (size: " << (size / (1024 * 1024) + 1) << "MB)";
-
     boost::filesystem::path path;
     
     path = GetPath(uuid);
@@ -126,9 +295,18 @@ namespace Orthanc
     {
       // Extremely unlikely case: This Uuid has already been created
       // in the past.
-      throw OrthancException(ErrorCode_InternalError);
+      throw OrthancException(ErrorCode_DuplicateResource);
     }
 
+    // The parent directories are only created if the file cannot be
+    // opened, which saves system calls in the common case where they
+    // already exist
+    return path;
+  }
+
+
+  void FilesystemStorage::CreateParentDirectories(const boost::filesystem::path& path)
+  {
     if (boost::filesystem::exists(path.parent_path()))
     {
       if (!boost::filesystem::is_directory(path.parent_path()))
@@ -143,8 +321,313 @@ namespace Orthanc
         throw OrthancException(ErrorCode_FileStorageCannotWrite);
       }
     }
+  }
+
+
+  void FilesystemStorage::WriteFileCreatingDirectories(const void* content,
+                                                       size_t size,
+                                                       const boost::filesystem::path& path)
+  {
+    try
+    {
+      SystemToolbox::WriteFile(content, size, path.string());
+    }
+    catch (OrthancException& e)
+    {
+      if (e.GetErrorCode() != ErrorCode_CannotWriteFile)
+      {
+        throw;
+      }
+
+      // The file cannot be opened: The parent directories are
+      // probably missing
+      CreateParentDirectories(path);
+      SystemToolbox::WriteFile(content, size, path.string());
+    }
+  }
+
 
-    SystemToolbox::WriteFile(content, size, path.string());
+  static boost::filesystem::path GetTemporaryPath(const boost::filesystem::path& path)
+  {
+    // The temporary file is in the same directory as the attachment,
+    // which makes the renaming atomic. Its name is not an UUID, so it
+    // is ignored by "ListAllFiles()".
+    return boost::filesystem::path(path.string() + ".tmp");
+  }
+
+
+  void FilesystemStorage::RenameTemporaryFile(const boost::filesystem::path& temporary,
+                                              const boost::filesystem::path& path)
+  {
+    try
+    {
+      boost::filesystem::rename(temporary, path);
+    }
+    catch (boost::filesystem::filesystem_error&)
+    {
+      boost::system::error_code err;
+      boost::filesystem::remove(temporary, err);
+      throw OrthancException(ErrorCode_FileStorageCannotWrite);
+    }
+  }
+
+
+  void FilesystemStorage::CommitDurableWrite(const boost::filesystem::path& temporary,
+                                             const boost::filesystem::path& path)
+  {
+    RenameTemporaryFile(temporary, path);
+    FlushWrites(1);
+  }
+
+
+  void FilesystemStorage::FlushWrites(uint64_t count)
+  {
+    // Group commit: One flush of the filesystem is shared by all the
+    // writers whose files were renamed before the flush has started
+    boost::mutex::scoped_lock lock(syncMutex_);
+
+    syncWrites_ += count;
+    const uint64_t ticket = syncWrites_;
+
+    while (syncCompleted_ < ticket)
+    {
+      if (syncRunning_)
+      {
+        syncDone_.wait(lock);
+      }
+      else
+      {
+        syncRunning_ = true;
+        const uint64_t covered = syncWrites_;
+
+        lock.unlock();
+
+        bool success = true;
+        try
+        {
+          SystemToolbox::SyncFilesystem(root_.string());
+        }
+        catch (OrthancException&)
+        {
+          success = false;
+        }
+
+        lock.lock();
+        syncRunning_ = false;
+        syncDone_.notify_all();
+
+        if (!success)
+        {
+          LOG(ERROR) << "Cannot flush the storage directory to the disk: " << root_;
+          throw OrthancException(ErrorCode_FileStorageCannotWrite);
+        }
+
+        syncCount_++;
+        if (covered > syncCompleted_)
+        {
+          syncCompleted_ = covered;
+        }
+      }
+    }
+  }
+
+
+  void FilesystemStorage::Flush(const std::string& uuid)
+  {
+    if (durableWrites_)
+    {
+      // "Create()" has already flushed the attachment
+      return;
+    }
+
+    boost::filesystem::path path = GetPath(uuid);
+
+    try
+    {
+      // The two levels of parent directories were possibly created
+      // together with the file, so their entries are flushed as well
+      SystemToolbox::SyncFile(path.string());
+      SystemToolbox::SyncFile(path.parent_path().string());
+      SystemToolbox::SyncFile(path.parent_path().parent_path().string());
+      SystemToolbox::SyncFile(root_.string());
+    }
+    catch (OrthancException&)
+    {
+      LOG(ERROR) << "Cannot flush an attachment to the disk: " << path;
+      throw OrthancException(ErrorCode_FileStorageCannotWrite);
+    }
+  }
+
+
+  void FilesystemStorage::Create(const std::string& uuid,
+                                 const void* content, 
+                                 size_t size,
+                                 FileContentType type)
+  {
+    LOG(INFO) << "Creating attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
+              << "\" type (size: " << (size / (1024 * 1024) + 1) << "MB)";
+
+    IoOperation operation(*this, writeLatencies_);
+
+    boost::filesystem::path path = PrepareCreate(uuid);
+
+    if (durableWrites_)
+    {
+      boost::filesystem::path temporary = GetTemporaryPath(path);
+      WriteFileCreatingDirectories(content, size, temporary);
+      CommitDurableWrite(temporary, path);
+    }
+    else
+    {
+      WriteFileCreatingDirectories(content, size, path);
+    }
+  }
+
+
+  class FilesystemStorage::Writer : public IStorageArea::IWriter
+  {
+  private:
+    FilesystemStorage&               that_;
+    std::string                      uuid_;
+    boost::filesystem::path          path_;
+    boost::filesystem::path          temporary_;
+    bool                             durable_;
+    boost::filesystem::ofstream      file_;
+    bool                             committed_;
+
+  public:
+    Writer(FilesystemStorage& that,
+           const std::string& uuid) :
+      that_(that),
+      uuid_(uuid),
+      path_(that.PrepareCreate(uuid)),
+      durable_(that.durableWrites_),
+      committed_(false)
+    {
+      temporary_ = (durable_ ? GetTemporaryPath(path_) : path_);
+
+      file_.open(temporary_, std::ofstream::out | std::ofstream::binary);
+      if (!file_.good())
+      {
+        // The parent directories are probably missing
+        CreateParentDirectories(temporary_);
+        file_.clear();
+        file_.open(temporary_, std::ofstream::out | std::ofstream::binary);
+      }
+
+      if (!file_.good())
+      {
+        throw OrthancException(ErrorCode_CannotWriteFile);
+      }
+    }
+
+    virtual ~Writer()
+    {
+      if (!committed_)
+      {
+        file_.close();
+
+        if (durable_)
+        {
+          boost::system::error_code err;
+          boost::filesystem::remove(temporary_, err);
+        }
+        else
+        {
+          that_.Remove(uuid_, FileContentType_Unknown /* ignored in this class */);
+        }
+      }
+    }
+
+    virtual void Write(const void* data,
+                       size_t size)
+    {
+      if (size > 0)
+      {
+        file_.write(reinterpret_cast<const char*>(data), size);
+        if (!file_.good())
+        {
+          throw OrthancException(ErrorCode_FileStorageCannotWrite);
+        }
+      }
+    }
+
+    virtual void Commit()
+    {
+      file_.close();
+      if (file_.fail())
+      {
+        throw OrthancException(ErrorCode_FileStorageCannotWrite);
+      }
+
+      if (durable_)
+      {
+        that_.CommitDurableWrite(temporary_, path_);
+      }
+
+      committed_ = true;
+    }
+  };
+
+
+  class FilesystemStorage::Reader : public IStorageArea::IReader
+  {
+  private:
+    boost::filesystem::ifstream  file_;
+
+  public:
+    Reader(const boost::filesystem::path& path)
+    {
+      if (!SystemToolbox::IsRegularFile(path.string()))
+      {
+        LOG(ERROR) << "The path does not point to a regular file: " << path.string();
+        throw OrthancException(ErrorCode_RegularFileExpected);
+      }
+
+      file_.open(path, std::ifstream::in | std::ifstream::binary);
+      if (!file_.good())
+      {
+        throw OrthancException(ErrorCode_InexistentFile);
+      }
+    }
+
+    virtual size_t Read(void* buffer,
+                        size_t size)
+    {
+      if (size == 0 ||
+          file_.eof())
+      {
+        return 0;
+      }
+
+      file_.read(reinterpret_cast<char*>(buffer), size);
+      if (file_.bad())
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      return static_cast<size_t>(file_.gcount());
+    }
+  };
+
+
+  IStorageArea::IWriter* FilesystemStorage::OpenWriter(const std::string& uuid,
+                                                       FileContentType type)
+  {
+    LOG(INFO) << "Creating attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
+              << "\" type (streaming)";
+
+    return new Writer(*this, uuid);
+  }
+
+
+  IStorageArea::IReader* FilesystemStorage::OpenReader(const std::string& uuid,
+                                                       FileContentType type)
+  {
+    LOG(INFO) << "Reading attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
+              << "\" content type (streaming)";
+
+    return new Reader(GetPath(uuid));
   }
 
 
@@ -155,11 +638,86 @@ namespace Orthanc
     LOG(INFO) << "Reading attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
               << "\" content type";
 
+    IoOperation operation(*this, readLatencies_);
+
     content.clear();
     SystemToolbox::ReadFile(content, GetPath(uuid).string());
   }
 
 
+  void FilesystemStorage::ReadRange(std::string& content,
+                                    const std::string& uuid,
+                                    FileContentType type,
+                                    uint64_t start,
+                                    uint64_t end)
+  {
+    LOG(INFO) << "Reading bytes " << start << "-" << end << " of attachment \"" << uuid 
+              << "\" of \"" << GetDescriptionInternal(type) << "\" content type";
+
+    IoOperation operation(*this, readLatencies_);
+
+    SystemToolbox::ReadFileRange(content, GetPath(uuid).string(), start, end);
+  }
+
+
+  void FilesystemStorage::SetIoThreadsCount(size_t count)
+  {
+    if (count == 0)
+    {
+      ioPool_.reset(NULL);
+    }
+    else
+    {
+      ioPool_.reset(new TaskPool(count));
+    }
+  }
+
+
+  void FilesystemStorage::ReadBatch(std::vector<std::string>& contents,
+                                    const std::vector<std::string>& uuids,
+                                    FileContentType type)
+  {
+    if (ioPool_.get() == NULL ||
+        uuids.size() < 2)
+    {
+      IStorageArea::ReadBatch(contents, uuids, type);
+      return;
+    }
+
+    contents.clear();
+    contents.resize(uuids.size());
+
+    TaskPool::Batch batch(*ioPool_);
+
+    for (size_t i = 0; i < uuids.size(); i++)
+    {
+      batch.Submit(new ReadTask(*this, contents[i], uuids[i], type));
+    }
+
+    batch.Join();
+  }
+
+
+  void FilesystemStorage::ComputeStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(ioMutex_);
+
+    target["StorageIoQueued"] = ioQueued_;
+    target["StorageIoRunning"] = ioRunning_;
+    readLatencies_.Format(target, "StorageRead");
+    writeLatencies_.Format(target, "StorageWrite");
+
+    lock.unlock();
+
+    if (durableWrites_)
+    {
+      boost::mutex::scoped_lock syncLock(syncMutex_);
+      target["StorageDurableWrites"] = boost::lexical_cast<std::string>(syncWrites_);
+      target["StorageSyncCount"] = boost::lexical_cast<std::string>(syncCount_);
+    }
+  }
+
+
   uintmax_t FilesystemStorage::GetSize(const std::string& uuid) const
   {
     boost::filesystem::path path = GetPath(uuid);
@@ -168,15 +726,35 @@ namespace Orthanc
 
 
 
-  void FilesystemStorage::ListAllFiles(std::set<std::string>& result) const
+  bool FilesystemStorage::Exists(const std::string& uuid) const
+  {
+    return boost::filesystem::exists(GetPath(uuid));
+  }
+
+
+  std::time_t FilesystemStorage::GetLastWriteTime(const std::string& uuid) const
+  {
+    return boost::filesystem::last_write_time(GetPath(uuid));
+  }
+
+
+  void FilesystemStorage::SetLastWriteTime(const std::string& uuid,
+                                           std::time_t time)
+  {
+    boost::filesystem::last_write_time(GetPath(uuid), time);
+  }
+
+
+  void FilesystemStorage::ListFilesInternal(std::set<std::string>& result,
+                                            const boost::filesystem::path& directory) const
   {
     namespace fs = boost::filesystem;
 
     result.clear();
 
-    if (fs::exists(root_) && fs::is_directory(root_))
+    if (fs::exists(directory) && fs::is_directory(directory))
     {
-      for (fs::recursive_directory_iterator current(root_), end; current != end ; ++current)
+      for (fs::recursive_directory_iterator current(directory), end; current != end ; ++current)
       {
         if (SystemToolbox::IsRegularFile(current->path().string()))
         {
@@ -208,6 +786,43 @@ namespace Orthanc
   }
 
 
+  void FilesystemStorage::ListAllFiles(std::set<std::string>& result) const
+  {
+    ListFilesInternal(result, root_);
+  }
+
+
+  void FilesystemStorage::ListAttachments(std::set<std::string>& target,
+                                          const std::string& prefix)
+  {
+    if (prefix.size() != 2 ||
+        !isxdigit(prefix[0]) ||
+        !isxdigit(prefix[1]))
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    ListFilesInternal(target, root_ / prefix);
+  }
+
+
+  bool FilesystemStorage::LookupModificationTime(time_t& target,
+                                                 const std::string& uuid,
+                                                 FileContentType type)
+  {
+    try
+    {
+      target = GetLastWriteTime(uuid);
+      return true;
+    }
+    catch (boost::filesystem::filesystem_error&)
+    {
+      // The file does not exist (anymore)
+      return false;
+    }
+  }
+
+
   void FilesystemStorage::Clear()
   {
     namespace fs = boost::filesystem;
@@ -42,9 +42,14 @@
 #endif
 
 #include "IStorageArea.h"
+#include "../MultiThreading/TaskPool.h"
 
 #include <stdint.h>
 #include <boost/filesystem.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <ctime>
+#include <memory>  // For std::auto_ptr
 #include <set>
 
 namespace Orthanc
@@ -56,13 +61,105 @@ namespace Orthanc
     friend class FileStorageAccessor;
 
   private:
+    class Writer;
+    class Reader;
+    class QueuedTask;
+    class ReadTask;
+    class IoOperation;
+
+    // Sliding window over the durations of the last I/O operations,
+    // from which the latency percentiles are computed
+    class LatencyWindow
+    {
+    private:
+      std::vector<uint32_t>  durations_;  // In microseconds
+      size_t                 next_;
+      uint64_t               count_;
+
+    public:
+      LatencyWindow();
+
+      void Add(uint32_t duration);
+
+      void Format(Json::Value& target,
+                  const std::string& prefix) const;
+    };
+
     boost::filesystem::path root_;
 
+    // Pool of threads that executes the batches of reads.
+    // If NULL, the batches are handled sequentially.
+    std::auto_ptr<TaskPool> ioPool_;
+
+    boost::mutex   ioMutex_;
+    unsigned int   ioQueued_;
+    unsigned int   ioRunning_;
+    LatencyWindow  readLatencies_;
+    LatencyWindow  writeLatencies_;
+
+    // Group commit of the durable writes: "syncWrites_" counts the
+    // renamed files, and "syncCompleted_" the ones that are known to
+    // be flushed to the disk
+    bool                       durableWrites_;
+    boost::mutex               syncMutex_;
+    boost::condition_variable  syncDone_;
+    bool                       syncRunning_;
+    uint64_t                   syncWrites_;
+    uint64_t                   syncCompleted_;
+    uint64_t                   syncCount_;
+
     boost::filesystem::path GetPath(const std::string& uuid) const;
 
+    boost::filesystem::path PrepareCreate(const std::string& uuid) const;
+
+    static void CreateParentDirectories(const boost::filesystem::path& path);
+
+    static void WriteFileCreatingDirectories(const void* content,
+                                             size_t size,
+                                             const boost::filesystem::path& path);
+
+    static void RenameTemporaryFile(const boost::filesystem::path& temporary,
+                                    const boost::filesystem::path& path);
+
+    void FlushWrites(uint64_t count);
+
+    void CommitDurableWrite(const boost::filesystem::path& temporary,
+                            const boost::filesystem::path& path);
+
+    void ListFilesInternal(std::set<std::string>& result,
+                           const boost::filesystem::path& directory) const;
+
   public:
     explicit FilesystemStorage(std::string root);
 
+    // Number of threads that execute the batches of reads
+    // concurrently. "0" means that the batches are handled
+    // sequentially.
+    void SetIoThreadsCount(size_t count);
+
+    size_t GetIoThreadsCount() const
+    {
+      return (ioPool_.get() == NULL ? 0 : ioPool_->GetThreadsCount());
+    }
+
+    // If enabled, the attachments are written to a temporary file
+    // that is renamed once complete, and "Create()" only returns once
+    // the attachment is flushed to the disk. The flushes of the
+    // concurrent writers are coalesced.
+    void SetDurableWrites(bool durable)
+    {
+      durableWrites_ = durable;
+    }
+
+    bool IsDurableWrites() const
+    {
+      return durableWrites_;
+    }
+
+    // Flushes to the disk an attachment that was written without
+    // durable writes, together with its parent directories
+    void Flush(const std::string& uuid);
+
     virtual void Create(const std::string& uuid,
                         const void* content, 
                         size_t size,
@@ -72,13 +169,61 @@ namespace Orthanc
                       const std::string& uuid,
                       FileContentType type);
 
+    virtual void ReadBatch(std::vector<std::string>& contents,
+                           const std::vector<std::string>& uuids,
+                           FileContentType type);
+
+    virtual bool HasReadRange() const
+    {
+      return true;
+    }
+
+    virtual void ReadRange(std::string& content,
+                           const std::string& uuid,
+                           FileContentType type,
+                           uint64_t start,
+                           uint64_t end);
+
+    virtual void ComputeStatistics(Json::Value& target);
+
     virtual void Remove(const std::string& uuid,
                         FileContentType type);
 
+    virtual bool HasListAttachments() const
+    {
+      return true;
+    }
+
+    virtual void ListAttachments(std::set<std::string>& target,
+                                 const std::string& prefix);
+
+    virtual bool LookupModificationTime(time_t& target,
+                                        const std::string& uuid,
+                                        FileContentType type);
+
+    virtual bool HasStreaming() const
+    {
+      return true;
+    }
+
+    virtual IWriter* OpenWriter(const std::string& uuid,
+                                FileContentType type);
+
+    virtual IReader* OpenReader(const std::string& uuid,
+                                FileContentType type);
+
     void ListAllFiles(std::set<std::string>& result) const;
 
     uintmax_t GetSize(const std::string& uuid) const;
 
+    bool Exists(const std::string& uuid) const;
+
+    // Time of the last modification of the file, as a UNIX timestamp
+    std::time_t GetLastWriteTime(const std::string& uuid) const;
+
+    void SetLastWriteTime(const std::string& uuid,
+                          std::time_t time);
+
     void Clear();
 
     uintmax_t GetCapacity() const;
@@ -34,15 +34,51 @@
 #pragma once
 
 #include "../Enumerations.h"
+#include "../OrthancException.h"
 
+#include <set>
+#include <stdint.h>
 #include <string>
+#include <time.h>
+#include <vector>
 #include <boost/noncopyable.hpp>
+#include <json/value.h>
 
 namespace Orthanc
 {
   class IStorageArea : public boost::noncopyable
   {
   public:
+    // Incremental writing of one attachment
+    class IWriter : public boost::noncopyable
+    {
+    public:
+      virtual ~IWriter()
+      {
+      }
+
+      virtual void Write(const void* data,
+                         size_t size) = 0;
+
+      // Must be invoked once all the data has been written. If the
+      // writer is destroyed before, the partial attachment is removed.
+      virtual void Commit() = 0;
+    };
+
+    // Incremental reading of one attachment
+    class IReader : public boost::noncopyable
+    {
+    public:
+      virtual ~IReader()
+      {
+      }
+
+      // Returns the number of bytes that were read, which is only
+      // smaller than "size" at the end of the attachment
+      virtual size_t Read(void* buffer,
+                          size_t size) = 0;
+    };
+
     virtual ~IStorageArea()
     {
     }
@@ -58,5 +94,100 @@ namespace Orthanc
 
     virtual void Remove(const std::string& uuid,
                         FileContentType type) = 0;
+
+    // Whether "ReadRange()" reads only the requested bytes from the
+    // storage area, instead of the whole attachment
+    virtual bool HasReadRange() const
+    {
+      return false;
+    }
+
+    // Reads the bytes in the range [start, end) of an attachment, as
+    // stored in the storage area. The default implementation reads
+    // the whole attachment, storage areas that are able to seek
+    // override this method.
+    virtual void ReadRange(std::string& content,
+                           const std::string& uuid,
+                           FileContentType type,
+                           uint64_t start,
+                           uint64_t end)
+    {
+      std::string full;
+      Read(full, uuid, type);
+
+      if (start > end ||
+          end > full.size())
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      content.assign(full, static_cast<size_t>(start), static_cast<size_t>(end - start));
+    }
+
+    // Reads several attachments of the same content type at once. The
+    // default implementation reads them one after the other, storage
+    // areas that are able to overlap their I/O override this method.
+    virtual void ReadBatch(std::vector<std::string>& contents,
+                           const std::vector<std::string>& uuids,
+                           FileContentType type)
+    {
+      contents.resize(uuids.size());
+
+      for (size_t i = 0; i < uuids.size(); i++)
+      {
+        Read(contents[i], uuids[i], type);
+      }
+    }
+
+    // Adds the statistics about the I/O of the storage area (if any)
+    // to the statistics of the server
+    virtual void ComputeStatistics(Json::Value& target)
+    {
+    }
+
+    // Whether "ListAttachments()" is available for this storage area
+    virtual bool HasListAttachments() const
+    {
+      return false;
+    }
+
+    // Lists the attachments whose uuid starts with "prefix", a string
+    // of 2 hexadecimal digits. This corresponds to one top-level
+    // directory of the filesystem storage.
+    virtual void ListAttachments(std::set<std::string>& target,
+                                 const std::string& prefix)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    // Retrieves the time of the last modification of an attachment,
+    // as a number of seconds since the epoch. Returns "false" if
+    // this information is not available for this storage area.
+    virtual bool LookupModificationTime(time_t& target,
+                                        const std::string& uuid,
+                                        FileContentType type)
+    {
+      return false;
+    }
+
+    // Whether "OpenWriter()" and "OpenReader()" are available for
+    // this storage area. If not, the attachments are only accessed
+    // as a whole through "Create()" and "Read()".
+    virtual bool HasStreaming() const
+    {
+      return false;
+    }
+
+    virtual IWriter* OpenWriter(const std::string& uuid,
+                                FileContentType type)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    virtual IReader* OpenReader(const std::string& uuid,
+                                FileContentType type)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
   };
 }
@@ -67,7 +67,7 @@ namespace Orthanc
     }
     else if (content_.find(uuid) != content_.end())
     {
-      throw OrthancException(ErrorCode_InternalError);
+      throw OrthancException(ErrorCode_DuplicateResource);
     }
     else
     {
@@ -0,0 +1,646 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "PackedStorageArea.h"
+
+#include "../Logging.h"
+#include "../OrthancException.h"
+#include "../SystemToolbox.h"
+#include "../SQLite/Transaction.h"
+
+#include <stdio.h>
+
+
+namespace Orthanc
+{
+  // Number of attachments that are moved at once during the
+  // compaction of a segment
+  static const unsigned int COMPACTION_BATCH_SIZE = 64;
+
+  // Delay between two lookups for segments to be compacted (in seconds)
+  static const unsigned int COMPACTION_THREAD_SLEEP = 10;
+
+
+  void PackedStorageArea::CompactionThread(PackedStorageArea* that)
+  {
+    while (!that->done_)
+    {
+      bool compacted = false;
+
+      try
+      {
+        compacted = that->CompactNext();
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Error while compacting the packed storage area: " << e.What();
+      }
+
+      if (!compacted)
+      {
+        for (unsigned int i = 0; i < 10 * COMPACTION_THREAD_SLEEP && !that->done_; i++)
+        {
+          boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        }
+      }
+    }
+  }
+
+
+  std::string PackedStorageArea::GetSegmentPath(int64_t segment) const
+  {
+    char buf[64];
+    sprintf(buf, "segment-%08d.pack", static_cast<int>(segment));
+    return (segmentsRoot_ / buf).string();
+  }
+
+
+  void PackedStorageArea::OpenActiveSegment(int64_t segment)
+  {
+    std::string path = GetSegmentPath(segment);
+    const bool isNew = !SystemToolbox::IsRegularFile(path);
+
+    writer_.reset(NULL);
+    writer_.reset(new boost::filesystem::ofstream);
+    writer_->open(path, std::ofstream::out | std::ofstream::binary | std::ofstream::app);
+    if (!writer_->good())
+    {
+      writer_.reset(NULL);
+      throw OrthancException(ErrorCode_CannotWriteFile);
+    }
+
+    if (isNew &&
+        durableWrites_)
+    {
+      // Make the entry of the new segment in its directory durable
+      SystemToolbox::SyncFile(segmentsRoot_.string());
+    }
+
+    // The segment might end with data that was written before a
+    // crash, but that was never registered in the index
+    activeSegment_ = segment;
+    activeSize_ = SystemToolbox::GetFileSize(path);
+
+    SQLite::Statement s(index_, SQLITE_FROM_HERE, "INSERT OR IGNORE INTO Segments VALUES(?, 0, ?)");
+    s.BindInt64(0, segment);
+    s.BindInt64(1, static_cast<int64_t>(activeSize_));
+    s.Run();
+
+    VLOG(1) << "Active segment of the packed storage area: " << path;
+  }
+
+
+  void PackedStorageArea::PrepareAppend(size_t size)
+  {
+    if (activeSize_ != 0 &&
+        activeSize_ + size > segmentSize_)
+    {
+      // The active segment is full, seal it
+      OpenActiveSegment(activeSegment_ + 1);
+    }
+  }
+
+
+  uint64_t PackedStorageArea::Append(const void* content,
+                                     size_t size)
+  {
+    uint64_t offset = activeSize_;
+
+    if (size != 0)
+    {
+      writer_->write(reinterpret_cast<const char*>(content), size);
+      writer_->flush();
+
+      if (!writer_->good())
+      {
+        // Reopen the segment to recover from the error
+        OpenActiveSegment(activeSegment_);
+        throw OrthancException(ErrorCode_FileStorageCannotWrite);
+      }
+
+      if (durableWrites_)
+      {
+        // The content must reach the disk before it is indexed
+        SystemToolbox::SyncFile(GetSegmentPath(activeSegment_));
+      }
+    }
+
+    activeSize_ += size;
+
+    SQLite::Statement s(index_, SQLITE_FROM_HERE, "UPDATE Segments SET liveSize=liveSize+?, totalSize=? WHERE id=?");
+    s.BindInt64(0, static_cast<int64_t>(size));
+    s.BindInt64(1, static_cast<int64_t>(activeSize_));
+    s.BindInt64(2, activeSegment_);
+    s.Run();
+
+    return offset;
+  }
+
+
+  bool PackedStorageArea::LookupEntry(int64_t& segment,
+                                      uint64_t& offset,
+                                      uint64_t& size,
+                                      const std::string& uuid)
+  {
+    SQLite::Statement s(index_, SQLITE_FROM_HERE, "SELECT segment, offset, size FROM Entries WHERE uuid=?");
+    s.BindString(0, uuid);
+
+    if (s.Step())
+    {
+      segment = s.ColumnInt64(0);
+      offset = static_cast<uint64_t>(s.ColumnInt64(1));
+      size = static_cast<uint64_t>(s.ColumnInt64(2));
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void PackedStorageArea::ReadSegment(std::string& content,
+                                      int64_t segment,
+                                      uint64_t offset,
+                                      uint64_t size) const
+  {
+    content.resize(static_cast<size_t>(size));
+
+    if (size == 0)
+    {
+      return;
+    }
+
+    boost::filesystem::ifstream f;
+    f.open(GetSegmentPath(segment), std::ifstream::in | std::ifstream::binary);
+    if (!f.good())
+    {
+      throw OrthancException(ErrorCode_InexistentFile);
+    }
+
+    f.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    f.read(&content[0], static_cast<std::streamsize>(size));
+
+    if (!f.good() ||
+        f.gcount() != static_cast<std::streamsize>(size))
+    {
+      LOG(ERROR) << "Truncated segment in the packed storage area: " << GetSegmentPath(segment);
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+  }
+
+
+  PackedStorageArea::PackedStorageArea(const std::string& root,
+                                       size_t threshold,
+                                       uint64_t segmentSize) :
+    large_(root),
+    segmentsRoot_(boost::filesystem::path(root) / "packs"),
+    threshold_(threshold),
+    segmentSize_(segmentSize),
+    compactionRatio_(0.5f),
+    durableWrites_(false),
+    done_(false)
+  {
+    if (segmentSize_ == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    SystemToolbox::MakeDirectory(segmentsRoot_.string());
+
+    index_.Open((segmentsRoot_ / "index.db").string());
+    index_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+    index_.Execute("PRAGMA JOURNAL_MODE=WAL;");
+
+    if (!index_.DoesTableExist("Segments"))
+    {
+      SQLite::Transaction t(index_);
+      t.Begin();
+      index_.Execute("CREATE TABLE Segments(id INTEGER PRIMARY KEY, liveSize INTEGER, totalSize INTEGER);");
+      index_.Execute("CREATE TABLE Entries(uuid TEXT PRIMARY KEY, segment INTEGER, offset INTEGER, size INTEGER);");
+      index_.Execute("CREATE INDEX EntriesSegmentIndex ON Entries(segment);");
+      t.Commit();
+    }
+
+    int64_t active = 1;
+
+    {
+      SQLite::Statement s(index_, SQLITE_FROM_HERE, "SELECT MAX(id) FROM Segments");
+      if (s.Step() &&
+          !s.ColumnIsNull(0))
+      {
+        active = s.ColumnInt64(0);
+      }
+    }
+
+    OpenActiveSegment(active);
+  }
+
+
+  PackedStorageArea::~PackedStorageArea()
+  {
+    Stop();
+  }
+
+
+  void PackedStorageArea::SetCompactionRatio(float ratio)
+  {
+    if (ratio <= 0.0f ||
+        ratio > 1.0f)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    compactionRatio_ = ratio;
+  }
+
+
+  void PackedStorageArea::SetDurableWrites(bool durable)
+  {
+    large_.SetDurableWrites(durable);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (durable &&
+        !durableWrites_)
+    {
+      // The active segment was possibly created before this call
+      SystemToolbox::SyncFile(GetSegmentPath(activeSegment_));
+      SystemToolbox::SyncFile(segmentsRoot_.string());
+    }
+
+    durableWrites_ = durable;
+
+    // A committed entry of the index must also survive a power loss
+    index_.Execute(durable ? "PRAGMA SYNCHRONOUS=FULL;" : "PRAGMA SYNCHRONOUS=NORMAL;");
+  }
+
+
+  void PackedStorageArea::Start()
+  {
+    if (compactionThread_.joinable() ||
+        done_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    compactionThread_ = boost::thread(CompactionThread, this);
+  }
+
+
+  void PackedStorageArea::Stop()
+  {
+    done_ = true;
+
+    if (compactionThread_.joinable())
+    {
+      compactionThread_.join();
+    }
+  }
+
+
+  void PackedStorageArea::Create(const std::string& uuid,
+                                 const void* content, 
+                                 size_t size,
+                                 FileContentType type)
+  {
+    if (size > threshold_)
+    {
+      large_.Create(uuid, content, size, type);
+      return;
+    }
+
+    LOG(INFO) << "Packing attachment \"" << uuid << "\" of type " << static_cast<int>(type)
+              << " (size: " << size << " bytes)";
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    int64_t segment;
+    uint64_t offset, s;
+    if (LookupEntry(segment, offset, s, uuid))
+    {
+      // Extremely unlikely case: This Uuid has already been created
+      // in the past.
+      throw OrthancException(ErrorCode_DuplicateResource);
+    }
+
+    PrepareAppend(size);
+
+    SQLite::Transaction t(index_);
+    t.Begin();
+
+    offset = Append(content, size);
+
+    SQLite::Statement s2(index_, SQLITE_FROM_HERE, "INSERT INTO Entries VALUES(?, ?, ?, ?)");
+    s2.BindString(0, uuid);
+    s2.BindInt64(1, activeSegment_);
+    s2.BindInt64(2, static_cast<int64_t>(offset));
+    s2.BindInt64(3, static_cast<int64_t>(size));
+    s2.Run();
+
+    t.Commit();
+  }
+
+
+  void PackedStorageArea::Read(std::string& content,
+                               const std::string& uuid,
+                               FileContentType type)
+  {
+    {
+      boost::shared_lock<boost::shared_mutex> segmentsLock(segmentsMutex_);
+
+      int64_t segment;
+      uint64_t offset, size;
+      bool found;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        found = LookupEntry(segment, offset, size, uuid);
+      }
+
+      if (found)
+      {
+        LOG(INFO) << "Reading packed attachment \"" << uuid << "\" of type " << static_cast<int>(type);
+        ReadSegment(content, segment, offset, size);
+        return;
+      }
+    }
+
+    large_.Read(content, uuid, type);
+  }
+
+
+  void PackedStorageArea::ReadRange(std::string& content,
+                                    const std::string& uuid,
+                                    FileContentType type,
+                                    uint64_t start,
+                                    uint64_t end)
+  {
+    if (start > end)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    {
+      boost::shared_lock<boost::shared_mutex> segmentsLock(segmentsMutex_);
+
+      int64_t segment;
+      uint64_t offset, size;
+      bool found;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        found = LookupEntry(segment, offset, size, uuid);
+      }
+
+      if (found)
+      {
+        if (end > size)
+        {
+          throw OrthancException(ErrorCode_ParameterOutOfRange);
+        }
+
+        ReadSegment(content, segment, offset + start, end - start);
+        return;
+      }
+    }
+
+    large_.ReadRange(content, uuid, type, start, end);
+  }
+
+
+  void PackedStorageArea::Remove(const std::string& uuid,
+                                 FileContentType type)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      int64_t segment;
+      uint64_t offset, size;
+      if (LookupEntry(segment, offset, size, uuid))
+      {
+        LOG(INFO) << "Deleting packed attachment \"" << uuid << "\" of type " << static_cast<int>(type);
+
+        SQLite::Transaction t(index_);
+        t.Begin();
+
+        {
+          SQLite::Statement s(index_, SQLITE_FROM_HERE, "DELETE FROM Entries WHERE uuid=?");
+          s.BindString(0, uuid);
+          s.Run();
+        }
+
+        {
+          SQLite::Statement s(index_, SQLITE_FROM_HERE, "UPDATE Segments SET liveSize=liveSize-? WHERE id=?");
+          s.BindInt64(0, static_cast<int64_t>(size));
+          s.BindInt64(1, segment);
+          s.Run();
+        }
+
+        t.Commit();
+        return;
+      }
+    }
+
+    large_.Remove(uuid, type);
+  }
+
+
+  void PackedStorageArea::ListAllFiles(std::set<std::string>& result)
+  {
+    large_.ListAllFiles(result);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    SQLite::Statement s(index_, SQLITE_FROM_HERE, "SELECT uuid FROM Entries");
+    while (s.Step())
+    {
+      result.insert(s.ColumnString(0));
+    }
+  }
+
+
+  void PackedStorageArea::ListAttachments(std::set<std::string>& target,
+                                          const std::string& prefix)
+  {
+    large_.ListAttachments(target, prefix);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // "~" is sorted after all the characters of a uuid
+    SQLite::Statement s(index_, SQLITE_FROM_HERE, "SELECT uuid FROM Entries WHERE uuid>? AND uuid<?");
+    s.BindString(0, prefix);
+    s.BindString(1, prefix + "~");
+
+    while (s.Step())
+    {
+      target.insert(s.ColumnString(0));
+    }
+  }
+
+
+  bool PackedStorageArea::LookupModificationTime(time_t& target,
+                                                 const std::string& uuid,
+                                                 FileContentType type)
+  {
+    // Only the large attachments, that are stored as separate files,
+    // have a modification time
+    return large_.LookupModificationTime(target, uuid, type);
+  }
+
+
+  uint64_t PackedStorageArea::GetSegmentsCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    SQLite::Statement s(index_, SQLITE_FROM_HERE, "SELECT COUNT(*) FROM Segments");
+    s.Step();
+    return static_cast<uint64_t>(s.ColumnInt64(0));
+  }
+
+
+  bool PackedStorageArea::CompactNext()
+  {
+    int64_t segment;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      SQLite::Statement s(index_, SQLITE_FROM_HERE, 
+                          "SELECT id FROM Segments WHERE id<>? AND totalSize>0 AND "
+                          "totalSize-liveSize >= ? * totalSize "
+                          "ORDER BY (totalSize-liveSize) * 1.0 / totalSize DESC LIMIT 1");
+      s.BindInt64(0, activeSegment_);
+      s.BindDouble(1, compactionRatio_);
+
+      if (!s.Step())
+      {
+        return false;
+      }
+
+      segment = s.ColumnInt64(0);
+    }
+
+    LOG(INFO) << "Compacting segment " << GetSegmentPath(segment) << " of the packed storage area";
+
+    uint64_t moved = 0;
+
+    for (;;)
+    {
+      std::vector<std::string> uuids;
+      std::vector<uint64_t> offsets, sizes;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        SQLite::Statement s(index_, SQLITE_FROM_HERE, "SELECT uuid, offset, size FROM Entries WHERE segment=? LIMIT ?");
+        s.BindInt64(0, segment);
+        s.BindInt(1, COMPACTION_BATCH_SIZE);
+
+        while (s.Step())
+        {
+          uuids.push_back(s.ColumnString(0));
+          offsets.push_back(static_cast<uint64_t>(s.ColumnInt64(1)));
+          sizes.push_back(static_cast<uint64_t>(s.ColumnInt64(2)));
+        }
+      }
+
+      if (uuids.empty())
+      {
+        break;
+      }
+
+      for (size_t i = 0; i < uuids.size(); i++)
+      {
+        // The content is read without holding the mutex, as the
+        // segment cannot be deleted by another thread
+        std::string content;
+        ReadSegment(content, segment, offsets[i], sizes[i]);
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        int64_t currentSegment;
+        uint64_t currentOffset, currentSize;
+        if (!LookupEntry(currentSegment, currentOffset, currentSize, uuids[i]) ||
+            currentSegment != segment)
+        {
+          continue;  // The attachment was removed in the meantime
+        }
+
+        PrepareAppend(content.size());
+
+        SQLite::Transaction t(index_);
+        t.Begin();
+
+        uint64_t offset = Append(content.empty() ? NULL : content.c_str(), content.size());
+
+        {
+          SQLite::Statement s(index_, SQLITE_FROM_HERE, "UPDATE Entries SET segment=?, offset=? WHERE uuid=?");
+          s.BindInt64(0, activeSegment_);
+          s.BindInt64(1, static_cast<int64_t>(offset));
+          s.BindString(2, uuids[i]);
+          s.Run();
+        }
+
+        {
+          SQLite::Statement s(index_, SQLITE_FROM_HERE, "UPDATE Segments SET liveSize=liveSize-? WHERE id=?");
+          s.BindInt64(0, static_cast<int64_t>(content.size()));
+          s.BindInt64(1, segment);
+          s.Run();
+        }
+
+        t.Commit();
+        moved += content.size();
+      }
+    }
+
+    {
+      // Wait for the pending reads before deleting the segment
+      boost::unique_lock<boost::shared_mutex> segmentsLock(segmentsMutex_);
+      boost::mutex::scoped_lock lock(mutex_);
+
+      SQLite::Statement s(index_, SQLITE_FROM_HERE, "DELETE FROM Segments WHERE id=?");
+      s.BindInt64(0, segment);
+      s.Run();
+
+      SystemToolbox::RemoveFile(GetSegmentPath(segment));
+    }
+
+    LOG(INFO) << "Segment " << GetSegmentPath(segment) << " of the packed storage area is compacted ("
+              << moved << " bytes were moved)";
+
+    return true;
+  }
+}
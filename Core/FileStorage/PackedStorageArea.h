@@ -0,0 +1,193 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class PackedStorageArea cannot be used in sandboxed environments
+#endif
+
+#if !defined(ORTHANC_ENABLE_SQLITE)
+#  error The macro ORTHANC_ENABLE_SQLITE must be defined
+#endif
+
+#if ORTHANC_ENABLE_SQLITE != 1
+#  error SQLite must be enabled to use the class PackedStorageArea
+#endif
+
+#include "FilesystemStorage.h"
+#include "../SQLite/Connection.h"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <memory>
+
+namespace Orthanc
+{
+  /**
+   * Storage area that appends the small attachments to large
+   * "segment" files, instead of creating one file per attachment,
+   * in order to save inodes and to speed up backups. The location of
+   * each packed attachment (segment, offset, size) is stored in a
+   * SQLite index next to the segments. The attachments above the
+   * size threshold are stored as individual files, with the same
+   * layout as FilesystemStorage.
+   *
+   * The segments are append-only: Removing an attachment only
+   * updates the index. A background thread compacts the segments
+   * whose ratio of deleted space is too high, by moving their
+   * remaining attachments to the active segment.
+   *
+   * By default, the packed attachments are only flushed to the
+   * operating system: After a power loss, the index might refer to
+   * the last bytes of a segment that never reached the disk. With
+   * durable writes, the segment (and its directory, if the segment
+   * is new) is flushed to the disk before the attachment is indexed,
+   * which serializes the writers on the flushes.
+   **/
+  class PackedStorageArea : public IStorageArea
+  {
+  private:
+    FilesystemStorage        large_;
+    boost::filesystem::path  segmentsRoot_;
+    size_t                   threshold_;
+    uint64_t                 segmentSize_;
+    float                    compactionRatio_;
+    bool                     durableWrites_;
+
+    boost::mutex             mutex_;   // Protects the index and the active segment
+    SQLite::Connection       index_;
+    int64_t                  activeSegment_;
+    uint64_t                 activeSize_;
+    std::auto_ptr<boost::filesystem::ofstream>  writer_;
+
+    // Taken exclusively while a segment file is being deleted
+    boost::shared_mutex      segmentsMutex_;
+
+    bool                     done_;
+    boost::thread            compactionThread_;
+
+    static void CompactionThread(PackedStorageArea* that);
+
+    std::string GetSegmentPath(int64_t segment) const;
+
+    void OpenActiveSegment(int64_t segment);
+
+    void PrepareAppend(size_t size);
+
+    uint64_t Append(const void* content,
+                    size_t size);
+
+    bool LookupEntry(int64_t& segment,
+                     uint64_t& offset,
+                     uint64_t& size,
+                     const std::string& uuid);
+
+    void ReadSegment(std::string& content,
+                     int64_t segment,
+                     uint64_t offset,
+                     uint64_t size) const;
+
+  public:
+    // Attachments whose size is below "threshold" bytes are packed
+    PackedStorageArea(const std::string& root,
+                      size_t threshold,
+                      uint64_t segmentSize);
+
+    virtual ~PackedStorageArea();
+
+    // Minimum ratio of deleted space before a segment gets compacted
+    void SetCompactionRatio(float ratio);
+
+    // Flush the attachments to the disk before returning from
+    // "Create()", including the large attachments
+    void SetDurableWrites(bool durable);
+
+    void Start();
+
+    void Stop();
+
+    virtual void Create(const std::string& uuid,
+                        const void* content, 
+                        size_t size,
+                        FileContentType type);
+
+    virtual void Read(std::string& content,
+                      const std::string& uuid,
+                      FileContentType type);
+
+    virtual bool HasReadRange() const
+    {
+      return true;
+    }
+
+    virtual void ReadRange(std::string& content,
+                           const std::string& uuid,
+                           FileContentType type,
+                           uint64_t start,
+                           uint64_t end);
+
+    virtual void Remove(const std::string& uuid,
+                        FileContentType type);
+
+    virtual bool HasListAttachments() const
+    {
+      return true;
+    }
+
+    virtual void ListAttachments(std::set<std::string>& target,
+                                 const std::string& prefix);
+
+    virtual bool LookupModificationTime(time_t& target,
+                                        const std::string& uuid,
+                                        FileContentType type);
+
+    void ListAllFiles(std::set<std::string>& result);
+
+    uint64_t GetSegmentsCount();
+
+    /**
+     * Compacts the sealed segment with the highest ratio of deleted
+     * space, if this ratio is above the compaction ratio. Returns
+     * "false" if no segment needs compaction. This method is invoked
+     * by the background thread, but it can also be called directly
+     * if the thread is not started.
+     **/
+    bool CompactNext();
+  };
+}
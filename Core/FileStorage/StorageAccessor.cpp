@@ -34,10 +34,16 @@
 #include "../PrecompiledHeaders.h"
 #include "StorageAccessor.h"
 
-#include "../Compression/ZlibCompressor.h"
+#include "../Compression/BufferCompressorFactory.h"
+#include "../Compression/DeflateBaseCompressor.h"
+#include "../Logging.h"
 #include "../OrthancException.h"
 #include "../Toolbox.h"
-#include "../Toolbox.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <zlib.h>
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
 #  include "../HttpServer/HttpStreamTranscoder.h"
@@ -45,35 +51,443 @@
 
 namespace Orthanc
 {
-  FileInfo StorageAccessor::Write(const void* data,
-                                  size_t size,
-                                  FileContentType type,
-                                  CompressionType compression,
-                                  bool storeMd5)
+  namespace
+  {
+    // Anonymous namespace to avoid clashes between compilation modules
+
+    // Size of the chunks of uncompressed data that are fed to zlib
+    static const size_t STREAMING_INPUT_CHUNK = 1024 * 1024;
+
+    // Size of the chunks of compressed data that are written to, or
+    // read from, the storage area
+    static const size_t STREAMING_OUTPUT_CHUNK = 64 * 1024;
+
+
+    // Fallback for the storage areas that can only create an
+    // attachment from a single buffer
+    class BufferedWriter : public IStorageArea::IWriter
+    {
+    private:
+      IStorageArea&    area_;
+      std::string      uuid_;
+      FileContentType  type_;
+      std::string      buffer_;
+
+    public:
+      BufferedWriter(IStorageArea& area,
+                     const std::string& uuid,
+                     FileContentType type) :
+        area_(area),
+        uuid_(uuid),
+        type_(type)
+      {
+      }
+
+      virtual void Write(const void* data,
+                         size_t size)
+      {
+        buffer_.append(reinterpret_cast<const char*>(data), size);
+      }
+
+      virtual void Commit()
+      {
+        area_.Create(uuid_, buffer_.empty() ? NULL : buffer_.c_str(), buffer_.size(), type_);
+      }
+    };
+
+
+    // Fallback for the storage areas that can only read an
+    // attachment as a single buffer
+    class BufferedReader : public IStorageArea::IReader
+    {
+    private:
+      std::string  buffer_;
+      size_t       position_;
+
+    public:
+      BufferedReader(IStorageArea& area,
+                     const std::string& uuid,
+                     FileContentType type) :
+        position_(0)
+      {
+        area.Read(buffer_, uuid, type);
+      }
+
+      virtual size_t Read(void* buffer,
+                          size_t size)
+      {
+        size_t count = std::min(size, buffer_.size() - position_);
+        if (count > 0)
+        {
+          memcpy(buffer, buffer_.c_str() + position_, count);
+          position_ += count;
+        }
+
+        return count;
+      }
+    };
+
+
+    // Forwards the compressed data to the storage area, while
+    // computing its size and its MD5 hash
+    class CompressedOutput : public boost::noncopyable
+    {
+    private:
+      IStorageArea::IWriter&  writer_;
+      bool                    storeMd5_;
+      Toolbox::MD5Context     md5_;
+      uint64_t                size_;
+
+    public:
+      CompressedOutput(IStorageArea::IWriter& writer,
+                       bool storeMd5) :
+        writer_(writer),
+        storeMd5_(storeMd5),
+        size_(0)
+      {
+      }
+
+      void Write(const void* data,
+                 size_t size)
+      {
+        if (size > 0)
+        {
+          if (storeMd5_)
+          {
+            md5_.Append(data, size);
+          }
+
+          writer_.Write(data, size);
+          size_ += size;
+        }
+      }
+
+      uint64_t GetSize() const
+      {
+        return size_;
+      }
+
+      void GetMD5(std::string& target)
+      {
+        if (storeMd5_)
+        {
+          md5_.Finish(target);
+        }
+        else
+        {
+          target.clear();
+        }
+      }
+    };
+
+
+    class ZlibDeflateStream : public boost::noncopyable
+    {
+    private:
+      z_stream  stream_;
+
+    public:
+      explicit ZlibDeflateStream(int level)
+      {
+        memset(&stream_, 0, sizeof(stream_));
+        if (deflateInit(&stream_, level) != Z_OK)
+        {
+          throw OrthancException(ErrorCode_InternalError);
+        }
+      }
+
+      ~ZlibDeflateStream()
+      {
+        deflateEnd(&stream_);
+      }
+
+      void Process(CompressedOutput& output,
+                   const void* data,
+                   size_t size,
+                   bool isLast)
+      {
+        uint8_t buffer[STREAMING_OUTPUT_CHUNK];
+
+        stream_.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+        stream_.avail_in = static_cast<uInt>(size);
+
+        do
+        {
+          stream_.next_out = buffer;
+          stream_.avail_out = sizeof(buffer);
+
+          int error = deflate(&stream_, isLast ? Z_FINISH : Z_NO_FLUSH);
+          if (error == Z_STREAM_ERROR)
+          {
+            throw OrthancException(ErrorCode_InternalError);
+          }
+
+          output.Write(buffer, sizeof(buffer) - stream_.avail_out);
+        }
+        while (stream_.avail_out == 0);
+
+        assert(stream_.avail_in == 0);
+      }
+    };
+
+
+    class ZlibInflateStream : public boost::noncopyable
+    {
+    private:
+      z_stream  stream_;
+
+    public:
+      ZlibInflateStream()
+      {
+        memset(&stream_, 0, sizeof(stream_));
+        if (inflateInit(&stream_) != Z_OK)
+        {
+          throw OrthancException(ErrorCode_InternalError);
+        }
+      }
+
+      ~ZlibInflateStream()
+      {
+        inflateEnd(&stream_);
+      }
+
+      // Returns "true" iff the end of the compressed stream is reached
+      bool Process(uint8_t*& target,
+                   size_t& targetSize,
+                   const void* data,
+                   size_t size)
+      {
+        stream_.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+        stream_.avail_in = static_cast<uInt>(size);
+        stream_.next_out = target;
+        stream_.avail_out = static_cast<uInt>(targetSize);
+
+        int error = inflate(&stream_, Z_NO_FLUSH);
+
+        target = stream_.next_out;
+        targetSize = stream_.avail_out;
+
+        switch (error)
+        {
+          case Z_STREAM_END:
+            return true;
+
+          case Z_OK:
+            if (stream_.avail_in != 0)
+            {
+              // The uncompressed data is larger than announced by the prefix
+              throw OrthancException(ErrorCode_CorruptedFile);
+            }
+
+            return false;
+
+          case Z_BUF_ERROR:
+            // No progress was possible, which is an error as soon as
+            // new input was provided or the output is full
+            if (size != 0 || targetSize == 0)
+            {
+              throw OrthancException(ErrorCode_CorruptedFile);
+            }
+
+            return false;
+
+          case Z_MEM_ERROR:
+            throw OrthancException(ErrorCode_NotEnoughMemory);
+
+          default:
+            throw OrthancException(ErrorCode_CorruptedFile);
+        }
+      }
+    };
+  }
+
+
+  IStorageArea::IWriter* StorageAccessor::OpenWriter(const std::string& uuid,
+                                                     FileContentType type)
   {
-    std::string uuid = Toolbox::GenerateUuid();
+    if (area_.HasStreaming())
+    {
+      return area_.OpenWriter(uuid, type);
+    }
+    else
+    {
+      return new BufferedWriter(area_, uuid, type);
+    }
+  }
+
+
+  IStorageArea::IReader* StorageAccessor::OpenReader(const FileInfo& info)
+  {
+    if (area_.HasStreaming())
+    {
+      return area_.OpenReader(info.GetUuid(), info.GetContentType());
+    }
+    else
+    {
+      return new BufferedReader(area_, info.GetUuid(), info.GetContentType());
+    }
+  }
+
+
+  FileInfo StorageAccessor::WriteZlib(const std::string& uuid,
+                                      const void* data,
+                                      size_t size,
+                                      FileContentType type,
+                                      bool storeMd5)
+  {
+    // Validate the compression level, and apply the default level of
+    // "ZlibCompressor" if none is provided
+    std::auto_ptr<IBufferCompressor> compressor
+      (BufferCompressorFactory::Create(CompressionType_ZlibWithSize, compressionLevel_));
+    const int level = dynamic_cast<DeflateBaseCompressor&>(*compressor).GetCompressionLevel();
+
+    // The uncompressed data is hashed and deflated in a single pass,
+    // and the compressed chunks are sent to the storage area as soon
+    // as they are available. The layout of the attachment is the
+    // same as with "ZlibCompressor::Compress()".
+    std::auto_ptr<IStorageArea::IWriter> writer(OpenWriter(uuid, type));
+    CompressedOutput output(*writer, storeMd5);
+    Toolbox::MD5Context md5;
+
+    if (size > 0)
+    {
+      uint64_t prefix = static_cast<uint64_t>(size);
+      output.Write(&prefix, sizeof(uint64_t));
+
+      ZlibDeflateStream deflate(level);
+
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+      size_t remaining = size;
 
-    std::string md5;
+      while (remaining > 0)
+      {
+        size_t chunk = std::min(remaining, STREAMING_INPUT_CHUNK);
+
+        if (storeMd5)
+        {
+          md5.Append(p, chunk);
+        }
+
+        deflate.Process(output, p, chunk, chunk == remaining);
+        p += chunk;
+        remaining -= chunk;
+      }
+    }
+
+    writer->Commit();
 
+    std::string uncompressedMD5, compressedMD5;
     if (storeMd5)
     {
-      Toolbox::ComputeMD5(md5, data, size);
+      md5.Finish(uncompressedMD5);
+    }
+
+    output.GetMD5(compressedMD5);
+
+    return FileInfo(uuid, type, size, uncompressedMD5, CompressionType_ZlibWithSize,
+                    static_cast<size_t>(output.GetSize()), compressedMD5);
+  }
+
+
+  void StorageAccessor::ReadZlib(std::string& content,
+                                 const FileInfo& info)
+  {
+    std::auto_ptr<IStorageArea::IReader> reader(OpenReader(info));
+
+    uint64_t prefix;
+    size_t count = reader->Read(&prefix, sizeof(uint64_t));
+
+    if (count == 0)
+    {
+      // Empty attachment
+      content.clear();
+      return;
+    }
+    else if (count != sizeof(uint64_t) ||
+             static_cast<uint64_t>(static_cast<size_t>(prefix)) != prefix)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    try
+    {
+      content.resize(static_cast<size_t>(prefix));
+    }
+    catch (...)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
     }
 
+    uint8_t* target = (content.empty() ? NULL : reinterpret_cast<uint8_t*>(&content[0]));
+    size_t targetSize = content.size();
+
+    ZlibInflateStream inflate;
+    uint8_t buffer[STREAMING_OUTPUT_CHUNK];
+
+    for (;;)
+    {
+      count = reader->Read(buffer, sizeof(buffer));
+      if (count == 0)
+      {
+        // Truncated attachment
+        content.clear();
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      if (inflate.Process(target, targetSize, buffer, count))
+      {
+        break;
+      }
+    }
+
+    if (targetSize != 0)
+    {
+      // The uncompressed data is smaller than announced by the prefix
+      content.clear();
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+  }
+
+
+  FileInfo StorageAccessor::Write(const std::string& uuid,
+                                  const void* data,
+                                  size_t size,
+                                  FileContentType type,
+                                  CompressionType compression,
+                                  bool storeMd5)
+  {
     switch (compression)
     {
       case CompressionType_None:
       {
+        std::string md5;
+
+        if (storeMd5)
+        {
+          Toolbox::ComputeMD5(md5, data, size);
+        }
+
         area_.Create(uuid, data, size, type);
         return FileInfo(uuid, type, size, md5);
       }
 
       case CompressionType_ZlibWithSize:
+        return WriteZlib(uuid, data, size, type, storeMd5);
+
+      default:
       {
-        ZlibCompressor zlib;
+        std::string md5;
+
+        if (storeMd5)
+        {
+          Toolbox::ComputeMD5(md5, data, size);
+        }
+
+        std::auto_ptr<IBufferCompressor> compressor
+          (BufferCompressorFactory::Create(compression, compressionLevel_));
 
         std::string compressed;
-        zlib.Compress(compressed, data, size);
+        compressor->Compress(compressed, data, size);
 
         std::string compressedMD5;
       
@@ -92,11 +506,8 @@ namespace Orthanc
         }
 
         return FileInfo(uuid, type, size, md5,
-                        CompressionType_ZlibWithSize, compressed.size(), compressedMD5);
+                        compression, compressed.size(), compressedMD5);
       }
-
-      default:
-        throw OrthancException(ErrorCode_NotImplemented);
     }
   }
 
@@ -114,17 +525,20 @@ namespace Orthanc
 
       case CompressionType_ZlibWithSize:
       {
-        ZlibCompressor zlib;
-
-        std::string compressed;
-        area_.Read(compressed, info.GetUuid(), info.GetContentType());
-        IBufferCompressor::Uncompress(content, zlib, compressed);
+        ReadZlib(content, info);
         break;
       }
 
       default:
       {
-        throw OrthancException(ErrorCode_NotImplemented);
+        // The compression level is irrelevant for decompression
+        std::auto_ptr<IBufferCompressor> compressor
+          (BufferCompressorFactory::Create(info.GetCompressionType(), 0));
+
+        std::string compressed;
+        area_.Read(compressed, info.GetUuid(), info.GetContentType());
+        IBufferCompressor::Uncompress(content, *compressor, compressed);
+        break;
       }
     }
 
@@ -132,6 +546,36 @@ namespace Orthanc
   }
 
 
+  void StorageAccessor::ReadRange(std::string& content,
+                                  const FileInfo& info,
+                                  uint64_t start,
+                                  uint64_t end)
+  {
+    if (start > end ||
+        end > info.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (info.GetCompressionType() == CompressionType_None)
+    {
+      area_.ReadRange(content, info.GetUuid(), info.GetContentType(), start, end);
+    }
+    else
+    {
+      std::string full;
+      Read(full, info);
+
+      if (end > full.size())
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      content.assign(full, static_cast<size_t>(start), static_cast<size_t>(end - start));
+    }
+  }
+
+
   void StorageAccessor::Read(Json::Value& content,
                              const FileInfo& info)
   {
@@ -146,12 +590,137 @@ namespace Orthanc
   }
 
 
+  StorageAccessor::MD5Verifier::MD5Verifier(StorageAccessor& accessor,
+                                            const FileInfo& info) :
+    reader_(accessor.OpenReader(info)),
+    info_(info),
+    size_(0),
+    done_(false),
+    valid_(false)
+  {
+  }
+
+
+  size_t StorageAccessor::MD5Verifier::Read(size_t maxSize)
+  {
+    if (done_)
+    {
+      return 0;
+    }
+
+    if (buffer_.empty())
+    {
+      buffer_.resize(STREAMING_INPUT_CHUNK);
+    }
+
+    size_t total = 0;
+
+    while (total < std::max(maxSize, static_cast<size_t>(1)))
+    {
+      size_t chunk = std::min(buffer_.size(), std::max(maxSize - total, static_cast<size_t>(1)));
+
+      size_t count = reader_->Read(&buffer_[0], chunk);
+      if (count == 0)
+      {
+        std::string actual;
+        md5_.Finish(actual);
+
+        done_ = true;
+        valid_ = (size_ == info_.GetCompressedSize() &&
+                  actual == info_.GetCompressedMD5());
+        reader_.reset(NULL);
+        buffer_.clear();
+        break;
+      }
+
+      md5_.Append(buffer_.c_str(), count);
+      size_ += count;
+      total += count;
+    }
+
+    return total;
+  }
+
+
+  bool StorageAccessor::VerifyMD5(const FileInfo& info)
+  {
+    MD5Verifier verifier(*this, info);
+
+    while (!verifier.IsDone())
+    {
+      verifier.Read(STREAMING_INPUT_CHUNK);
+    }
+
+    return verifier.IsValid();
+  }
+
+
+  void StorageAccessor::ReadBatch(std::vector<std::string>& contents,
+                                  const std::vector<FileInfo>& infos)
+  {
+    if (infos.empty())
+    {
+      contents.clear();
+      return;
+    }
+
+    const FileContentType type = infos[0].GetContentType();
+
+    std::vector<std::string> uuids(infos.size());
+    for (size_t i = 0; i < infos.size(); i++)
+    {
+      if (infos[i].GetContentType() != type)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      uuids[i] = infos[i].GetUuid();
+    }
+
+    area_.ReadBatch(contents, uuids, type);
+
+    if (contents.size() != infos.size())
+    {
+      throw OrthancException(ErrorCode_InternalError);
+    }
+
+    for (size_t i = 0; i < infos.size(); i++)
+    {
+      if (!infos[i].GetCompressedMD5().empty())
+      {
+        // The whole attachment is in memory: Check its integrity
+        // before it is uncompressed, and possibly cached by the caller
+        std::string md5;
+        Toolbox::ComputeMD5(md5, contents[i]);
+
+        if (contents[i].size() != infos[i].GetCompressedSize() ||
+            md5 != infos[i].GetCompressedMD5())
+        {
+          LOG(ERROR) << "Bad MD5 for attachment " << infos[i].GetUuid();
+          contents.clear();
+          throw OrthancException(ErrorCode_CorruptedFile);
+        }
+      }
+
+      if (infos[i].GetCompressionType() != CompressionType_None)
+      {
+        // The compression level is irrelevant for decompression
+        std::auto_ptr<IBufferCompressor> compressor
+          (BufferCompressorFactory::Create(infos[i].GetCompressionType(), 0));
+
+        std::string compressed;
+        compressed.swap(contents[i]);
+        IBufferCompressor::Uncompress(contents[i], *compressor, compressed);
+      }
+    }
+  }
+
+
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
   void StorageAccessor::SetupSender(BufferHttpSender& sender,
                                     const FileInfo& info,
                                     const std::string& mime)
   {
-    area_.Read(sender.GetBuffer(), info.GetUuid(), info.GetContentType());
     sender.SetContentType(mime);
 
     const char* extension;
@@ -181,6 +750,7 @@ namespace Orthanc
                                    const std::string& mime)
   {
     BufferHttpSender sender;
+    area_.Read(sender.GetBuffer(), info.GetUuid(), info.GetContentType());
     SetupSender(sender, info, mime);
   
     HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
@@ -195,10 +765,25 @@ namespace Orthanc
                                    const std::string& mime)
   {
     BufferHttpSender sender;
+    area_.Read(sender.GetBuffer(), info.GetUuid(), info.GetContentType());
     SetupSender(sender, info, mime);
   
     HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
     output.AnswerStream(transcoder);
   }
 #endif
+
+
+#if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
+  void StorageAccessor::AnswerUncompressedFile(RestApiOutput& output,
+                                               const FileInfo& info,
+                                               std::string& content,
+                                               const std::string& mime)
+  {
+    BufferHttpSender sender;
+    sender.GetBuffer().swap(content);
+    SetupSender(sender, info, mime);
+    output.AnswerStream(sender);
+  }
+#endif
 }
@@ -51,12 +51,14 @@
 
 #include "IStorageArea.h"
 #include "FileInfo.h"
+#include "../Toolbox.h"
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
 #  include "../HttpServer/BufferHttpSender.h"
 #  include "../RestApi/RestApiOutput.h"
 #endif
 
+#include <memory>  // For std::auto_ptr
 #include <vector>
 #include <string>
 #include <boost/noncopyable.hpp>
@@ -67,8 +69,63 @@ namespace Orthanc
 {
   class StorageAccessor : boost::noncopyable
   {
+  public:
+    // Incremental verification of the size and of the MD5 hash of one
+    // attachment, as stored in the storage area. The attachment is
+    // read by pieces, which allows the caller to throttle the reads.
+    class MD5Verifier : public boost::noncopyable
+    {
+    private:
+      std::auto_ptr<IStorageArea::IReader>  reader_;
+      FileInfo                              info_;
+      Toolbox::MD5Context                   md5_;
+      uint64_t                              size_;
+      bool                                  done_;
+      bool                                  valid_;
+      std::string                           buffer_;
+
+    public:
+      MD5Verifier(StorageAccessor& accessor,
+                  const FileInfo& info);
+
+      // Reads at most "maxSize" bytes of the attachment (at least one
+      // byte), and returns the number of bytes that were read
+      size_t Read(size_t maxSize);
+
+      bool IsDone() const
+      {
+        return done_;
+      }
+
+      // Only meaningful once "IsDone()" returns "true"
+      bool IsValid() const
+      {
+        return valid_;
+      }
+
+      const FileInfo& GetInfo() const
+      {
+        return info_;
+      }
+    };
+
   private:
     IStorageArea&  area_;
+    int            compressionLevel_;
+
+    IStorageArea::IWriter* OpenWriter(const std::string& uuid,
+                                      FileContentType type);
+
+    IStorageArea::IReader* OpenReader(const FileInfo& info);
+
+    FileInfo WriteZlib(const std::string& uuid,
+                       const void* data,
+                       size_t size,
+                       FileContentType type,
+                       bool storeMd5);
+
+    void ReadZlib(std::string& content,
+                  const FileInfo& info);
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
     void SetupSender(BufferHttpSender& sender,
@@ -77,11 +134,37 @@ namespace Orthanc
 #endif
 
   public:
-    StorageAccessor(IStorageArea& area) : area_(area)
+    StorageAccessor(IStorageArea& area) :
+      area_(area),
+      compressionLevel_(0)
+    {
+    }
+
+    // Level that is used by the codec when writing compressed
+    // attachments, "0" corresponding to the default of the codec
+    void SetCompressionLevel(int level)
+    {
+      compressionLevel_ = level;
+    }
+
+    int GetCompressionLevel() const
     {
+      return compressionLevel_;
     }
 
     FileInfo Write(const void* data,
+                   size_t size,
+                   FileContentType type,
+                   CompressionType compression,
+                   bool storeMd5)
+    {
+      return Write(Toolbox::GenerateUuid(), data, size, type, compression, storeMd5);
+    }
+
+    // Write the attachment using an UUID that is provided by the
+    // caller (e.g. in the case of content-addressed storage)
+    FileInfo Write(const std::string& uuid,
+                   const void* data,
                    size_t size,
                    FileContentType type,
                    CompressionType compression,
@@ -102,6 +185,25 @@ namespace Orthanc
     void Read(Json::Value& content,
               const FileInfo& info);
 
+    // Reads the bytes in the range [start, end) of the uncompressed
+    // attachment. Only the uncompressed attachments are partially
+    // read from the storage area.
+    void ReadRange(std::string& content,
+                   const FileInfo& info,
+                   uint64_t start,
+                   uint64_t end);
+
+    // Streams the attachment, as stored in the storage area, and
+    // checks its size and its MD5 hash against "info". The hash is
+    // computed over the compressed data.
+    bool VerifyMD5(const FileInfo& info);
+
+    // Reads and uncompresses several attachments of the same content
+    // type, whose reads are submitted as one batch to the storage area.
+    // The MD5 hashes are checked, if they are stored in "infos".
+    void ReadBatch(std::vector<std::string>& contents,
+                   const std::vector<FileInfo>& infos);
+
     void Remove(const FileInfo& info)
     {
       area_.Remove(info.GetUuid(), info.GetContentType());
@@ -129,6 +231,14 @@ namespace Orthanc
     void AnswerFile(RestApiOutput& output,
                     const FileInfo& info,
                     const std::string& mime);
+
+    // Answers the content of the attachment, that was previously read
+    // and uncompressed (e.g. by a cache). The "content" string is
+    // consumed by this method.
+    void AnswerUncompressedFile(RestApiOutput& output,
+                                const FileInfo& info,
+                                std::string& content,
+                                const std::string& mime);
 #endif
   };
 }
@@ -0,0 +1,232 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "StorageScanner.h"
+
+#include "../Logging.h"
+
+#include <memory>
+#include <stdio.h>
+
+
+namespace Orthanc
+{
+  void StorageScanner::Worker(StorageScanner* that)
+  {
+    for (;;)
+    {
+      unsigned int task;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->stopped_ &&
+               that->nextTask_ < PREFIXES_COUNT &&
+               that->nextTask_ >= that->nextResult_ + that->maxPending_)
+        {
+          that->roomAvailable_.wait(lock);
+        }
+
+        if (that->stopped_ ||
+            that->nextTask_ >= PREFIXES_COUNT)
+        {
+          return;
+        }
+
+        task = that->nextTask_++;
+      }
+
+      std::auto_ptr< std::set<std::string> > result(new std::set<std::string>);
+      ErrorCode error = ErrorCode_Success;
+
+      try
+      {
+        that->area_.ListAttachments(*result, FormatPrefix(task));
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Error while scanning the storage area: " << e.What();
+        error = e.GetErrorCode();
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Native exception while scanning the storage area";
+        error = ErrorCode_InternalError;
+      }
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        if (error != ErrorCode_Success)
+        {
+          that->error_ = error;
+          that->stopped_ = true;
+          that->roomAvailable_.notify_all();
+        }
+        else
+        {
+          that->results_[task] = result.release();
+        }
+
+        that->resultAvailable_.notify_all();
+      }
+    }
+  }
+
+
+  void StorageScanner::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopped_ = true;
+      roomAvailable_.notify_all();
+    }
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i] != NULL)
+      {
+        if (workers_[i]->joinable())
+        {
+          workers_[i]->join();
+        }
+
+        delete workers_[i];
+        workers_[i] = NULL;
+      }
+    }
+
+    for (Results::iterator it = results_.begin(); it != results_.end(); ++it)
+    {
+      delete it->second;
+    }
+
+    results_.clear();
+  }
+
+
+  StorageScanner::StorageScanner(IStorageArea& area,
+                                 unsigned int threadsCount,
+                                 unsigned int maxPending,
+                                 unsigned int first) :
+    area_(area),
+    nextTask_(first),
+    nextResult_(first),
+    maxPending_(maxPending),
+    stopped_(false),
+    error_(ErrorCode_Success)
+  {
+    if (threadsCount == 0 ||
+        maxPending == 0 ||
+        first > PREFIXES_COUNT)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (!area.HasListAttachments())
+    {
+      LOG(ERROR) << "This storage area cannot list its attachments";
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    workers_.resize(threadsCount);
+
+    for (unsigned int i = 0; i < threadsCount; i++)
+    {
+      workers_[i] = new boost::thread(Worker, this);
+    }
+  }
+
+
+  StorageScanner::~StorageScanner()
+  {
+    Stop();
+  }
+
+
+  std::string StorageScanner::FormatPrefix(unsigned int index)
+  {
+    if (index >= PREFIXES_COUNT)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    char buf[8];
+    sprintf(buf, "%02x", index);
+    return buf;
+  }
+
+
+  bool StorageScanner::GetNext(std::string& prefix,
+                               std::set<std::string>& uuids)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (nextResult_ >= PREFIXES_COUNT)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      if (error_ != ErrorCode_Success)
+      {
+        throw OrthancException(error_);
+      }
+
+      Results::iterator found = results_.find(nextResult_);
+      if (found != results_.end())
+      {
+        prefix = FormatPrefix(nextResult_);
+        uuids.swap(*found->second);
+
+        delete found->second;
+        results_.erase(found);
+
+        nextResult_++;
+        roomAvailable_.notify_all();
+        return true;
+      }
+
+      resultAvailable_.wait(lock);
+    }
+  }
+
+
+  unsigned int StorageScanner::GetScannedCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return nextResult_;
+  }
+}
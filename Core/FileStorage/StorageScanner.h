@@ -0,0 +1,102 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class StorageScanner cannot be used in sandboxed environments
+#endif
+
+#include "IStorageArea.h"
+
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Lists the attachments of a storage area using a pool of threads,
+   * with one task per top-level directory (i.e. per 2-digits prefix
+   * of the uuids). The results are streamed prefix by prefix, in
+   * increasing order, so that the full list of attachments never
+   * has to fit in memory.
+   **/
+  class StorageScanner : public boost::noncopyable
+  {
+  private:
+    typedef std::map<unsigned int, std::set<std::string>*>  Results;
+
+    IStorageArea&               area_;
+    std::vector<boost::thread*> workers_;
+
+    boost::mutex                mutex_;
+    boost::condition_variable   resultAvailable_;
+    boost::condition_variable   roomAvailable_;
+    unsigned int                nextTask_;      // Next prefix to be scanned
+    unsigned int                nextResult_;    // Next prefix to be returned
+    unsigned int                maxPending_;
+    Results                     results_;
+    bool                        stopped_;
+    ErrorCode                   error_;
+
+    static void Worker(StorageScanner* that);
+
+    void Stop();
+
+  public:
+    static const unsigned int PREFIXES_COUNT = 256;
+
+    // "maxPending" is the maximum number of scanned top-level
+    // directories whose results are waiting to be consumed. The scan
+    // starts at the prefix whose index is "first" (between 0 and 255).
+    StorageScanner(IStorageArea& area,
+                   unsigned int threadsCount,
+                   unsigned int maxPending,
+                   unsigned int first);
+
+    ~StorageScanner();
+
+    static std::string FormatPrefix(unsigned int index);
+
+    // Returns "false" once all the prefixes have been returned
+    bool GetNext(std::string& prefix,
+                 std::set<std::string>& uuids);
+
+    unsigned int GetScannedCount();
+  };
+}
@@ -0,0 +1,695 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "TieredStorageArea.h"
+
+#include "../Logging.h"
+#include "../OrthancException.h"
+
+#include <algorithm>
+
+
+namespace Orthanc
+{
+  // The access time of the hot attachments is only persisted on the
+  // filesystem if it has changed by more than one hour, in order to
+  // avoid a metadata write on each read
+  static const std::time_t ACCESS_TIME_RESOLUTION = 3600;
+
+  // Granularity of the sleeps of the migration thread (in milliseconds)
+  static const unsigned int MIGRATION_THREAD_SLEEP = 100;
+
+
+  static void SleepMigrationThread(const bool& done,
+                                   uint64_t milliseconds)
+  {
+    while (!done && milliseconds > 0)
+    {
+      uint64_t s = std::min(milliseconds, static_cast<uint64_t>(MIGRATION_THREAD_SLEEP));
+      boost::this_thread::sleep(boost::posix_time::milliseconds(s));
+      milliseconds -= s;
+    }
+  }
+
+
+  void TieredStorageArea::MigrationThread(TieredStorageArea* that)
+  {
+    that->ScanHotTier();
+
+    while (!that->done_)
+    {
+      uint64_t size = 0;
+      if (!that->MigrateNext(size))
+      {
+        // Nothing to migrate for the time being
+        SleepMigrationThread(that->done_, 1000);
+      }
+      else if (that->bandwidth_ != 0 &&
+               size != 0)
+      {
+        SleepMigrationThread(that->done_, size * 1000 / that->bandwidth_);
+      }
+    }
+  }
+
+
+  void TieredStorageArea::ScanHotTier()
+  {
+    LOG(WARNING) << "Scanning the hot tier of the storage area to get the access times";
+
+    std::set<std::string> files;
+    hot_.ListAllFiles(files);
+
+    std::vector< std::pair<std::time_t, std::string> > scanned;
+    scanned.reserve(files.size());
+
+    for (std::set<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+    {
+      if (done_)
+      {
+        return;
+      }
+
+      try
+      {
+        scanned.push_back(std::make_pair(hot_.GetLastWriteTime(*it), *it));
+      }
+      catch (boost::filesystem::filesystem_error&)
+      {
+        // The file was removed in the meantime
+      }
+    }
+
+    std::sort(scanned.begin(), scanned.end());
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // The attachments that were created or read during the scan
+      // are more recent than the scanned ones: Re-insert them after
+      // the latter, in the same order
+      std::vector< std::pair<std::string, std::time_t> > accessed;
+      accessed.reserve(hotAttachments_.GetSize());
+
+      while (!hotAttachments_.IsEmpty())
+      {
+        std::time_t time;
+        std::string uuid = hotAttachments_.RemoveOldest(time);
+        accessed.push_back(std::make_pair(uuid, time));
+      }
+
+      for (size_t i = 0; i < scanned.size(); i++)
+      {
+        hotAttachments_.Add(scanned[i].second, scanned[i].first);
+      }
+
+      for (size_t i = 0; i < accessed.size(); i++)
+      {
+        hotAttachments_.AddOrMakeMostRecent(accessed[i].first, accessed[i].second);
+      }
+    }
+
+    LOG(WARNING) << "The hot tier of the storage area contains " << scanned.size() << " attachments";
+  }
+
+
+  bool TieredStorageArea::IsHot(const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return hotAttachments_.Contains(uuid);
+  }
+
+
+  void TieredStorageArea::RegisterAccess(const std::string& uuid)
+  {
+    std::time_t now = std::time(NULL);
+    bool persist;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      std::time_t last;
+      if (!hotAttachments_.Contains(uuid, last))
+      {
+        hotAttachments_.Add(uuid, now);
+        persist = true;
+      }
+      else if (now < last ||
+               now - last >= ACCESS_TIME_RESOLUTION)
+      {
+        hotAttachments_.MakeMostRecent(uuid, now);
+        persist = true;
+      }
+      else
+      {
+        hotAttachments_.MakeMostRecent(uuid);
+        persist = false;
+      }
+    }
+
+    if (persist)
+    {
+      try
+      {
+        hot_.SetLastWriteTime(uuid, now);
+      }
+      catch (boost::filesystem::filesystem_error&)
+      {
+        // The attachment was removed or demoted in the meantime
+      }
+    }
+  }
+
+
+  void TieredStorageArea::SchedulePromotion(const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    promotions_.insert(uuid);
+  }
+
+
+  uint64_t TieredStorageArea::Promote(const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    if (!cold_.Exists(uuid))
+    {
+      // The attachment was removed in the meantime
+      return 0;
+    }
+
+    std::string content;
+    cold_.Read(content, uuid, FileContentType_Unknown);
+
+    if (hot_.Exists(uuid))
+    {
+      // Leftover of an interrupted migration
+      hot_.Remove(uuid, FileContentType_Unknown);
+    }
+
+    hot_.Create(uuid, content.empty() ? NULL : content.c_str(),
+                content.size(), FileContentType_Unknown);
+
+    // The copy must be on the disk before the original is removed
+    hot_.Flush(uuid);
+
+    {
+      boost::mutex::scoped_lock lock2(mutex_);
+      hotAttachments_.AddOrMakeMostRecent(uuid, std::time(NULL));
+    }
+
+    cold_.Remove(uuid, FileContentType_Unknown);
+
+    VLOG(1) << "Attachment " << uuid << " moved to the hot tier of the storage area";
+    return content.size();
+  }
+
+
+  uint64_t TieredStorageArea::Demote(const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    std::string content;
+    hot_.Read(content, uuid, FileContentType_Unknown);
+
+    if (cold_.Exists(uuid))
+    {
+      // Leftover of an interrupted migration
+      cold_.Remove(uuid, FileContentType_Unknown);
+    }
+
+    cold_.Create(uuid, content.empty() ? NULL : content.c_str(),
+                 content.size(), FileContentType_Unknown);
+    cold_.Flush(uuid);
+
+    {
+      boost::mutex::scoped_lock lock2(mutex_);
+
+      std::time_t last;
+      if (!hotAttachments_.Contains(uuid, last) ||
+          hotAttachments_.GetOldest() != uuid ||
+          std::time(NULL) - last < static_cast<std::time_t>(delay_))
+      {
+        // The attachment was accessed while it was being copied
+        cold_.Remove(uuid, FileContentType_Unknown);
+        return 0;
+      }
+
+      hotAttachments_.Invalidate(uuid);
+    }
+
+    hot_.Remove(uuid, FileContentType_Unknown);
+
+    VLOG(1) << "Attachment " << uuid << " moved to the cold tier of the storage area";
+    return content.size();
+  }
+
+
+  TieredStorageArea::TieredStorageArea(const std::string& hotRoot,
+                                       const std::string& coldRoot) :
+    hot_(hotRoot),
+    cold_(coldRoot),
+    delay_(30 * 24 * 3600),
+    bandwidth_(0),
+    done_(false)
+  {
+  }
+
+
+  TieredStorageArea::~TieredStorageArea()
+  {
+    Stop();
+  }
+
+
+  void TieredStorageArea::SetMigrationDelay(unsigned int seconds)
+  {
+    if (migrationThread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    delay_ = seconds;
+  }
+
+
+  void TieredStorageArea::SetMigrationBandwidth(uint64_t bytesPerSecond)
+  {
+    if (migrationThread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    bandwidth_ = bytesPerSecond;
+  }
+
+
+  void TieredStorageArea::SetDurableWrites(bool durable)
+  {
+    if (migrationThread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    hot_.SetDurableWrites(durable);
+    cold_.SetDurableWrites(durable);
+  }
+
+
+  void TieredStorageArea::SetIoThreadsCount(size_t count)
+  {
+    if (migrationThread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    hot_.SetIoThreadsCount(count);
+  }
+
+
+  void TieredStorageArea::Start()
+  {
+    if (migrationThread_.joinable() ||
+        done_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    migrationThread_ = boost::thread(MigrationThread, this);
+  }
+
+
+  void TieredStorageArea::Stop()
+  {
+    done_ = true;
+
+    if (migrationThread_.joinable())
+    {
+      migrationThread_.join();
+    }
+  }
+
+
+  bool TieredStorageArea::MigrateNext(uint64_t& size)
+  {
+    std::string uuid;
+    bool promote;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      std::time_t now = std::time(NULL);
+
+      if (!promotions_.empty())
+      {
+        uuid = *promotions_.begin();
+        promotions_.erase(promotions_.begin());
+        promote = true;
+      }
+      else if (!hotAttachments_.IsEmpty() &&
+               now >= hotAttachments_.GetOldestPayload() &&
+               now - hotAttachments_.GetOldestPayload() >= static_cast<std::time_t>(delay_))
+      {
+        uuid = hotAttachments_.GetOldest();
+        promote = false;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    try
+    {
+      size = (promote ? Promote(uuid) : Demote(uuid));
+    }
+    catch (OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot move attachment " << uuid << " to the " 
+                 << (promote ? "hot" : "cold") << " tier of the storage area: " << e.What();
+      size = 0;
+
+      if (!promote)
+      {
+        // Retry the demotion later on, or forget about the
+        // attachment if it has disappeared from the hot tier
+        boost::mutex::scoped_lock lock(mutex_);
+        if (hotAttachments_.Contains(uuid))
+        {
+          if (hot_.Exists(uuid))
+          {
+            hotAttachments_.MakeMostRecent(uuid, std::time(NULL));
+          }
+          else
+          {
+            hotAttachments_.Invalidate(uuid);
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  void TieredStorageArea::Create(const std::string& uuid,
+                                 const void* content, 
+                                 size_t size,
+                                 FileContentType type)
+  {
+    if (cold_.Exists(uuid))
+    {
+      throw OrthancException(ErrorCode_DuplicateResource);
+    }
+
+    hot_.Create(uuid, content, size, type);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    hotAttachments_.AddOrMakeMostRecent(uuid, std::time(NULL));
+  }
+
+
+  void TieredStorageArea::Read(std::string& content,
+                               const std::string& uuid,
+                               FileContentType type)
+  {
+    if (IsHot(uuid) &&
+        hot_.Exists(uuid))
+    {
+      try
+      {
+        hot_.Read(content, uuid, type);
+        RegisterAccess(uuid);
+        return;
+      }
+      catch (OrthancException&)
+      {
+        // The attachment was moved to the cold tier in the meantime
+      }
+    }
+
+    if (cold_.Exists(uuid))
+    {
+      try
+      {
+        cold_.Read(content, uuid, type);
+        SchedulePromotion(uuid);
+        return;
+      }
+      catch (OrthancException&)
+      {
+        // The attachment was promoted to the hot tier in the meantime
+      }
+    }
+    else
+    {
+      try
+      {
+        // Hot attachment that is not registered yet (the hot tier is
+        // possibly still being scanned)
+        hot_.Read(content, uuid, type);
+        RegisterAccess(uuid);
+        return;
+      }
+      catch (OrthancException&)
+      {
+        // The attachment was demoted to the cold tier in the meantime
+      }
+    }
+
+    // The attachment was moved between the tiers while it was being
+    // read: Retry with the migrations locked out
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    if (hot_.Exists(uuid))
+    {
+      hot_.Read(content, uuid, type);
+      RegisterAccess(uuid);
+    }
+    else
+    {
+      cold_.Read(content, uuid, type);
+      SchedulePromotion(uuid);
+    }
+  }
+
+
+  void TieredStorageArea::ReadBatch(std::vector<std::string>& contents,
+                                    const std::vector<std::string>& uuids,
+                                    FileContentType type)
+  {
+    // The hot attachments are read at once, the other ones one by one
+    contents.clear();
+    contents.resize(uuids.size());
+
+    std::vector<std::string> hotUuids;
+    std::vector<size_t> hotIndexes;
+
+    for (size_t i = 0; i < uuids.size(); i++)
+    {
+      if (IsHot(uuids[i]))
+      {
+        hotUuids.push_back(uuids[i]);
+        hotIndexes.push_back(i);
+      }
+      else
+      {
+        Read(contents[i], uuids[i], type);
+      }
+    }
+
+    if (hotUuids.empty())
+    {
+      return;
+    }
+
+    std::vector<std::string> hotContents;
+
+    try
+    {
+      hot_.ReadBatch(hotContents, hotUuids, type);
+    }
+    catch (OrthancException&)
+    {
+      // Some attachment was demoted in the meantime: Fallback to the
+      // individual reads
+      for (size_t i = 0; i < hotUuids.size(); i++)
+      {
+        Read(contents[hotIndexes[i]], hotUuids[i], type);
+      }
+
+      return;
+    }
+
+    for (size_t i = 0; i < hotUuids.size(); i++)
+    {
+      contents[hotIndexes[i]].swap(hotContents[i]);
+      RegisterAccess(hotUuids[i]);
+    }
+  }
+
+
+  void TieredStorageArea::ReadRange(std::string& content,
+                                    const std::string& uuid,
+                                    FileContentType type,
+                                    uint64_t start,
+                                    uint64_t end)
+  {
+    // Same as "Read()", for a range of the attachment
+    if (IsHot(uuid) &&
+        hot_.Exists(uuid))
+    {
+      try
+      {
+        hot_.ReadRange(content, uuid, type, start, end);
+        RegisterAccess(uuid);
+        return;
+      }
+      catch (OrthancException& e)
+      {
+        if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
+        {
+          throw;
+        }
+      }
+    }
+
+    if (cold_.Exists(uuid))
+    {
+      try
+      {
+        cold_.ReadRange(content, uuid, type, start, end);
+        SchedulePromotion(uuid);
+        return;
+      }
+      catch (OrthancException& e)
+      {
+        if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
+        {
+          throw;
+        }
+      }
+    }
+    else
+    {
+      try
+      {
+        hot_.ReadRange(content, uuid, type, start, end);
+        RegisterAccess(uuid);
+        return;
+      }
+      catch (OrthancException& e)
+      {
+        if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
+        {
+          throw;
+        }
+      }
+    }
+
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    if (hot_.Exists(uuid))
+    {
+      hot_.ReadRange(content, uuid, type, start, end);
+      RegisterAccess(uuid);
+    }
+    else
+    {
+      cold_.ReadRange(content, uuid, type, start, end);
+      SchedulePromotion(uuid);
+    }
+  }
+
+
+  void TieredStorageArea::Remove(const std::string& uuid,
+                                 FileContentType type)
+  {
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    {
+      boost::mutex::scoped_lock lock2(mutex_);
+
+      if (hotAttachments_.Contains(uuid))
+      {
+        hotAttachments_.Invalidate(uuid);
+      }
+
+      promotions_.erase(uuid);
+    }
+
+    hot_.Remove(uuid, type);
+    cold_.Remove(uuid, type);
+  }
+
+
+  void TieredStorageArea::ListAttachments(std::set<std::string>& target,
+                                          const std::string& prefix)
+  {
+    // Take the migration mutex so that no attachment is missed while
+    // it is moved from one tier to the other
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    hot_.ListAttachments(target, prefix);
+
+    std::set<std::string> cold;
+    cold_.ListAttachments(cold, prefix);
+    target.insert(cold.begin(), cold.end());
+  }
+
+
+  bool TieredStorageArea::LookupModificationTime(time_t& target,
+                                                 const std::string& uuid,
+                                                 FileContentType type)
+  {
+    boost::mutex::scoped_lock lock(migrationMutex_);
+
+    return (hot_.LookupModificationTime(target, uuid, type) ||
+            cold_.LookupModificationTime(target, uuid, type));
+  }
+
+
+  size_t TieredStorageArea::GetHotCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return hotAttachments_.GetSize();
+  }
+
+
+  size_t TieredStorageArea::GetPendingPromotionsCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return promotions_.size();
+  }
+}
@@ -0,0 +1,176 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class TieredStorageArea cannot be used in sandboxed environments
+#endif
+
+#include "FilesystemStorage.h"
+#include "../Cache/LeastRecentlyUsedIndex.h"
+
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Storage area made of two filesystem tiers. The attachments are
+   * always written to the "hot" tier (typically a SSD). A background
+   * thread moves the attachments that have not been accessed for a
+   * given delay to the "cold" tier (typically bulk disks), at a
+   * limited bandwidth so as not to compete with the regular
+   * traffic. Reading an attachment from the cold tier schedules its
+   * promotion back to the hot tier.
+   *
+   * The time of the last access to a hot attachment is kept in
+   * memory, and is persisted (with a coarse resolution) as the
+   * modification time of the file, so that it survives restarts.
+   **/
+  class TieredStorageArea : public IStorageArea
+  {
+  private:
+    // Maps the hot attachments to the time of their last access
+    typedef LeastRecentlyUsedIndex<std::string, std::time_t>  HotAttachments;
+
+    FilesystemStorage      hot_;
+    FilesystemStorage      cold_;
+
+    boost::mutex           mutex_;   // Protects "hotAttachments_" and "promotions_"
+    HotAttachments         hotAttachments_;
+    std::set<std::string>  promotions_;
+
+    // Serializes the migrations with respect to the removals
+    boost::mutex           migrationMutex_;
+
+    unsigned int           delay_;       // In seconds
+    uint64_t               bandwidth_;   // In bytes per second (0 means unlimited)
+
+    bool                   done_;
+    boost::thread          migrationThread_;
+
+    static void MigrationThread(TieredStorageArea* that);
+
+    void ScanHotTier();
+
+    bool IsHot(const std::string& uuid);
+
+    void RegisterAccess(const std::string& uuid);
+
+    void SchedulePromotion(const std::string& uuid);
+
+    uint64_t Promote(const std::string& uuid);
+
+    uint64_t Demote(const std::string& uuid);
+
+  public:
+    TieredStorageArea(const std::string& hotRoot,
+                      const std::string& coldRoot);
+
+    virtual ~TieredStorageArea();
+
+    // Minimum time without access before an attachment gets moved
+    // to the cold tier
+    void SetMigrationDelay(unsigned int seconds);
+
+    void SetMigrationBandwidth(uint64_t bytesPerSecond);
+
+    // Enables the durable writes on both tiers. The migrations always
+    // flush the moved attachment before removing it from its source
+    // tier, independently of this option.
+    void SetDurableWrites(bool durable);
+
+    // Number of threads that read the batches of hot attachments
+    // concurrently
+    void SetIoThreadsCount(size_t count);
+
+    void Start();
+
+    void Stop();
+
+    /**
+     * Moves one attachment between the tiers (pending promotions
+     * first). Returns "false" if there is nothing to migrate. This
+     * method is invoked by the background thread, but it can also be
+     * called directly if the thread is not started.
+     **/
+    bool MigrateNext(uint64_t& size);
+
+    virtual void Create(const std::string& uuid,
+                        const void* content, 
+                        size_t size,
+                        FileContentType type);
+
+    virtual void Read(std::string& content,
+                      const std::string& uuid,
+                      FileContentType type);
+
+    virtual void ReadBatch(std::vector<std::string>& contents,
+                           const std::vector<std::string>& uuids,
+                           FileContentType type);
+
+    virtual bool HasReadRange() const
+    {
+      return true;
+    }
+
+    virtual void ReadRange(std::string& content,
+                           const std::string& uuid,
+                           FileContentType type,
+                           uint64_t start,
+                           uint64_t end);
+
+    virtual void Remove(const std::string& uuid,
+                        FileContentType type);
+
+    virtual bool HasListAttachments() const
+    {
+      return true;
+    }
+
+    virtual void ListAttachments(std::set<std::string>& target,
+                                 const std::string& prefix);
+
+    virtual bool LookupModificationTime(time_t& target,
+                                        const std::string& uuid,
+                                        FileContentType type);
+
+    size_t GetHotCount();
+
+    size_t GetPendingPromotionsCount();
+  };
+}
@@ -35,7 +35,7 @@
 #include "HttpStreamTranscoder.h"
 
 #include "../OrthancException.h"
-#include "../Compression/ZlibCompressor.h"
+#include "../Compression/BufferCompressorFactory.h"
 
 #include <string.h>   // For memcpy()
 #include <cassert>
@@ -97,16 +97,23 @@ namespace Orthanc
     else
     {
       // TODO Use stream-based zlib decoding to reduce memory usage
-      std::string compressed;
-      ReadSource(compressed);
+      return SetupInMemoryUncompression();
+    }
+  }
 
-      uncompressed_.reset(new BufferHttpSender);
 
-      ZlibCompressor compressor;
-      IBufferCompressor::Uncompress(uncompressed_->GetBuffer(), compressor, compressed);
+  HttpCompression HttpStreamTranscoder::SetupInMemoryUncompression()
+  {
+    std::auto_ptr<IBufferCompressor> compressor
+      (BufferCompressorFactory::Create(sourceCompression_, 0));
 
-      return HttpCompression_None;
-    }
+    std::string compressed;
+    ReadSource(compressed);
+
+    uncompressed_.reset(new BufferHttpSender);
+    IBufferCompressor::Uncompress(uncompressed_->GetBuffer(), *compressor, compressed);
+
+    return HttpCompression_None;
   }
 
 
@@ -128,6 +135,12 @@ namespace Orthanc
       case CompressionType_ZlibWithSize:
         return SetupZlibCompression(deflateAllowed);
 
+      case CompressionType_Lz4WithSize:
+      case CompressionType_ZstdWithSize:
+        // No HTTP content-coding corresponds to these formats (notably
+        // because of the size prefix), so uncompress them in memory
+        return SetupInMemoryUncompression();
+
       default:
         throw OrthancException(ErrorCode_NotImplemented);
     }
@@ -55,6 +55,8 @@ namespace Orthanc
 
     HttpCompression SetupZlibCompression(bool deflateAllowed);
 
+    HttpCompression SetupInMemoryUncompression();
+
   public:
     HttpStreamTranscoder(IHttpStreamAnswer& source,
                          CompressionType compression) : 
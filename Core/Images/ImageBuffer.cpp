@@ -36,6 +36,14 @@
 
 #include "../OrthancException.h"
 
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 0
+#  include "ImageBufferPool.h"
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -50,7 +58,8 @@ namespace Orthanc
       /*
         if (forceMinimalPitch_)
         {
-        TODO: Align pitch and memory buffer to optimal size for SIMD.
+        TODO: Align pitch to optimal size for SIMD (the buffers of
+        ImageBufferPool are already aligned).
         }
       */
 
@@ -63,11 +72,15 @@ namespace Orthanc
       }
       else
       {
+#if ORTHANC_SANDBOXED == 0
+        buffer_ = ImageBufferPool::GetGlobalInstance().Allocate(size);
+#else
         buffer_ = malloc(size);
         if (buffer_ == NULL)
         {
           throw OrthancException(ErrorCode_NotEnoughMemory);
         }
+#endif
       }
 
       changed_ = false;
@@ -79,7 +92,11 @@ namespace Orthanc
   {
     if (buffer_ != NULL)
     {
+#if ORTHANC_SANDBOXED == 0
+      ImageBufferPool::GetGlobalInstance().Release(buffer_);
+#else
       free(buffer_);
+#endif
       buffer_ = NULL;
       changed_ = true;
     }
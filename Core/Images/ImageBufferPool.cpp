@@ -0,0 +1,262 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../PrecompiledHeaders.h"
+#include "ImageBufferPool.h"
+
+#include "../OrthancException.h"
+
+#include <cassert>
+#include <stdlib.h>
+
+namespace Orthanc
+{
+  namespace
+  {
+    // Stored just before each aligned buffer
+    struct BlockHeader
+    {
+      void*   raw_;
+      size_t  capacity_;
+    };
+  }
+
+
+  static void* AllocateBlock(size_t capacity)
+  {
+    void* raw = malloc(capacity + ImageBufferPool::ALIGNMENT + sizeof(BlockHeader));
+    if (raw == NULL)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    uintptr_t p = reinterpret_cast<uintptr_t>(raw) + sizeof(BlockHeader);
+    p = (p + ImageBufferPool::ALIGNMENT - 1) & ~static_cast<uintptr_t>(ImageBufferPool::ALIGNMENT - 1);
+
+    BlockHeader* header = reinterpret_cast<BlockHeader*>(p) - 1;
+    header->raw_ = raw;
+    header->capacity_ = capacity;
+
+    return reinterpret_cast<void*>(p);
+  }
+
+
+  static const BlockHeader& GetBlockHeader(void* block)
+  {
+    return *(reinterpret_cast<const BlockHeader*>(block) - 1);
+  }
+
+
+  static void FreeBlock(void* block)
+  {
+    free(GetBlockHeader(block).raw_);
+  }
+
+
+  void ImageBufferPool::Trim()
+  {
+    // Drop the largest buffers first
+    while (retainedSize_ > maximumRetainedSize_)
+    {
+      assert(!freeLists_.empty());
+
+      FreeLists::iterator last = freeLists_.end();
+      --last;
+
+      assert(!last->second.empty());
+      FreeBlock(last->second.back());
+      last->second.pop_back();
+
+      retainedSize_ -= last->first;
+      retainedCount_ --;
+
+      if (last->second.empty())
+      {
+        freeLists_.erase(last);
+      }
+    }
+  }
+
+
+  ImageBufferPool::ImageBufferPool(size_t maximumRetainedSize) :
+    maximumRetainedSize_(maximumRetainedSize),
+    retainedSize_(0),
+    retainedCount_(0),
+    hits_(0),
+    misses_(0)
+  {
+  }
+
+
+  ImageBufferPool::~ImageBufferPool()
+  {
+    maximumRetainedSize_ = 0;
+    Trim();
+  }
+
+
+  size_t ImageBufferPool::GetCapacity(size_t size)
+  {
+    if (size < MINIMUM_POOLED_SIZE)
+    {
+      return size;
+    }
+
+    // Round up to the next multiple of a quarter of the highest
+    // power of two below "size"
+    size_t base = MINIMUM_POOLED_SIZE;
+    while (base <= size / 2)
+    {
+      base *= 2;
+    }
+
+    const size_t step = base / 4;
+    return ((size + step - 1) / step) * step;
+  }
+
+
+  void* ImageBufferPool::Allocate(size_t size)
+  {
+    const size_t capacity = GetCapacity(size);
+
+    if (capacity >= MINIMUM_POOLED_SIZE)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      FreeLists::iterator found = freeLists_.find(capacity);
+      if (found == freeLists_.end())
+      {
+        misses_++;
+      }
+      else
+      {
+        assert(!found->second.empty());
+        void* block = found->second.back();
+        found->second.pop_back();
+
+        if (found->second.empty())
+        {
+          freeLists_.erase(found);
+        }
+
+        retainedSize_ -= capacity;
+        retainedCount_ --;
+        hits_++;
+
+        return block;
+      }
+    }
+
+    // The allocation itself is done outside of the mutex
+    return AllocateBlock(capacity);
+  }
+
+
+  void ImageBufferPool::Release(void* buffer)
+  {
+    if (buffer == NULL)
+    {
+      return;
+    }
+
+    const size_t capacity = GetBlockHeader(buffer).capacity_;
+
+    if (capacity >= MINIMUM_POOLED_SIZE)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (retainedSize_ + capacity <= maximumRetainedSize_)
+      {
+        freeLists_[capacity].push_back(buffer);
+        retainedSize_ += capacity;
+        retainedCount_ ++;
+        return;
+      }
+    }
+
+    FreeBlock(buffer);
+  }
+
+
+  void ImageBufferPool::SetMaximumRetainedSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maximumRetainedSize_ = size;
+    Trim();
+  }
+
+
+  size_t ImageBufferPool::GetMaximumRetainedSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maximumRetainedSize_;
+  }
+
+
+  size_t ImageBufferPool::GetRetainedSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return retainedSize_;
+  }
+
+
+  size_t ImageBufferPool::GetRetainedCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return retainedCount_;
+  }
+
+
+  uint64_t ImageBufferPool::GetHits()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return hits_;
+  }
+
+
+  uint64_t ImageBufferPool::GetMisses()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return misses_;
+  }
+
+
+  ImageBufferPool& ImageBufferPool::GetGlobalInstance()
+  {
+    // Constructed on first use, which avoids the static
+    // initialization order fiasco with the global ImageBuffer objects
+    static ImageBufferPool globalPool(0);
+    return globalPool;
+  }
+}
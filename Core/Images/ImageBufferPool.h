@@ -0,0 +1,112 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class ImageBufferPool cannot be used in sandboxed environments
+#endif
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Thread-safe pool of the pixel buffers of ImageBuffer. All the
+   * buffers are aligned on ALIGNMENT bytes (for the SIMD kernels).
+   * The large buffers are rounded up to size classes (4 classes per
+   * power of two, hence at most 25% of overhead), and the released
+   * buffers are kept for reuse by the next allocations of the same
+   * class, as long as the total retained size stays below a
+   * maximum. This avoids the churn of the allocator (and the
+   * fragmentation of the memory) during bursts of previews.
+   **/
+  class ImageBufferPool : public boost::noncopyable
+  {
+  private:
+    typedef std::map<size_t, std::vector<void*> >  FreeLists;
+
+    boost::mutex  mutex_;
+    FreeLists     freeLists_;
+    size_t        maximumRetainedSize_;
+    size_t        retainedSize_;
+    size_t        retainedCount_;
+    uint64_t      hits_;
+    uint64_t      misses_;
+
+    void Trim();
+
+  public:
+    static const size_t ALIGNMENT = 64;
+
+    // The smaller buffers are directly handled by the allocator
+    static const size_t MINIMUM_POOLED_SIZE = 64 * 1024;
+
+    explicit ImageBufferPool(size_t maximumRetainedSize);
+
+    ~ImageBufferPool();
+
+    // Size class of a buffer
+    static size_t GetCapacity(size_t size);
+
+    void* Allocate(size_t size);
+
+    // The buffer must have been created by some ImageBufferPool
+    void Release(void* buffer);
+
+    void SetMaximumRetainedSize(size_t size);
+
+    size_t GetMaximumRetainedSize();
+
+    size_t GetRetainedSize();
+
+    size_t GetRetainedCount();
+
+    uint64_t GetHits();
+
+    uint64_t GetMisses();
+
+    // Pool used by all the instances of ImageBuffer (that retains
+    // nothing, until configured otherwise)
+    static ImageBufferPool& GetGlobalInstance();
+  };
+}
@@ -34,15 +34,26 @@
 #include "../PrecompiledHeaders.h"
 #include "ImageProcessing.h"
 
+#include "ImageProcessingSimd.h"
 #include "PixelTraits.h"
 #include "../OrthancException.h"
 
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 0
+#  include "../MultiThreading/TaskPool.h"
+#endif
+
 #include <boost/math/special_functions/round.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <string.h>
 #include <limits>
 #include <stdint.h>
+#include <vector>
 
 namespace Orthanc
 {
@@ -61,6 +72,11 @@ namespace Orthanc
       TargetType* t = reinterpret_cast<TargetType*>(target.GetRow(y));
       const SourceType* s = reinterpret_cast<const SourceType*>(source.GetConstRow(y));
 
+      if (ImageProcessingSimd::ConvertRow(t, s, width))
+      {
+        continue;
+      }
+
       for (unsigned int x = 0; x < width; x++, t++, s++)
       {
         if (static_cast<int32_t>(*s) < static_cast<int32_t>(minValue))
@@ -94,6 +110,11 @@ namespace Orthanc
       float* t = reinterpret_cast<float*>(target.GetRow(y));
       const SourceType* s = reinterpret_cast<const SourceType*>(source.GetConstRow(y));
 
+      if (ImageProcessingSimd::ConvertRow(t, s, width))
+      {
+        continue;
+      }
+
       for (unsigned int x = 0; x < width; x++, t++, s++)
       {
         *t = static_cast<float>(*s);
@@ -143,6 +164,11 @@ namespace Orthanc
       TargetType* t = reinterpret_cast<TargetType*>(target.GetRow(y));
       const uint8_t* s = reinterpret_cast<const uint8_t*>(source.GetConstRow(y));
 
+      if (ImageProcessingSimd::ConvertColorToGrayscaleRow(t, s, width))
+      {
+        continue;
+      }
+
       for (unsigned int x = 0; x < width; x++, t++, s += 3)
       {
         // Y = 0.2126 R + 0.7152 G + 0.0722 B
@@ -238,6 +264,11 @@ namespace Orthanc
     {
       const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
 
+      if (ImageProcessingSimd::GetMinMaxRow(minValue, maxValue, p, width))
+      {
+        continue;
+      }
+
       for (unsigned int x = 0; x < width; x++, p++)
       {
         if (*p < minValue)
@@ -316,6 +347,13 @@ namespace Orthanc
     {
       PixelType* p = reinterpret_cast<PixelType*>(image.GetRow(y));
 
+      // Saturating before rounding (as done by the vectorized
+      // kernel) gives the same result as saturating afterwards
+      if (ImageProcessingSimd::ShiftScaleRow(p, width, 0.0f, factor, UseRound))
+      {
+        continue;
+      }
+
       for (unsigned int x = 0; x < width; x++, p++)
       {
         int64_t v;
@@ -364,6 +402,11 @@ namespace Orthanc
     {
       PixelType* p = reinterpret_cast<PixelType*>(image.GetRow(y));
 
+      if (ImageProcessingSimd::ShiftScaleRow(p, width, offset, scaling, UseRound))
+      {
+        continue;
+      }
+
       for (unsigned int x = 0; x < width; x++, p++)
       {
         float v = (static_cast<float>(*p) + offset) * scaling;
@@ -390,6 +433,206 @@ namespace Orthanc
   }
 
 
+  template <typename Accumulator>
+  static inline Accumulator DivideRound(Accumulator value,
+                                        Accumulator divisor)
+  {
+    // Integer division, rounded to the nearest integer (including
+    // for negative values)
+    if (value >= 0)
+    {
+      return (value + divisor / 2) / divisor;
+    }
+    else
+    {
+      return -((-value + divisor / 2) / divisor);
+    }
+  }
+
+
+  static inline double DivideRound(double value,
+                                   double divisor)
+  {
+    return value / divisor;
+  }
+
+
+  static void ComputeBoxRanges(std::vector<unsigned int>& ranges,
+                               unsigned int sourceSize,
+                               unsigned int targetSize)
+  {
+    // The source pixels covered by the target pixel "i" are in the
+    // range [ranges[i], ranges[i + 1]), which contains at least one
+    // pixel if upscaling
+    ranges.resize(targetSize + 1);
+
+    for (unsigned int i = 0; i <= targetSize; i++)
+    {
+      ranges[i] = static_cast<unsigned int>(static_cast<uint64_t>(i) * sourceSize / targetSize);
+    }
+  }
+
+
+  static inline unsigned int GetBoxEnd(const std::vector<unsigned int>& ranges,
+                                       unsigned int i)
+  {
+    return std::max(ranges[i + 1], ranges[i] + 1);
+  }
+
+
+  template <typename PixelType,
+            typename Accumulator,
+            unsigned int Channels>
+  static void ResizeBoxInternal(ImageAccessor& target,
+                                const ImageAccessor& source)
+  {
+    const unsigned int targetWidth = target.GetWidth();
+    const unsigned int targetHeight = target.GetHeight();
+
+    std::vector<unsigned int> columns, rows;
+    ComputeBoxRanges(columns, source.GetWidth(), targetWidth);
+    ComputeBoxRanges(rows, source.GetHeight(), targetHeight);
+
+    std::vector<Accumulator> sums(targetWidth * Channels);
+
+    for (unsigned int y = 0; y < targetHeight; y++)
+    {
+      const unsigned int firstRow = rows[y];
+      const unsigned int endRow = GetBoxEnd(rows, y);
+
+      std::fill(sums.begin(), sums.end(), 0);
+
+      // Accumulate the source rows one after the other, which
+      // follows the memory layout of the source image
+      for (unsigned int row = firstRow; row < endRow; row++)
+      {
+        const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(row));
+        Accumulator* sum = &sums[0];
+
+        for (unsigned int x = 0; x < targetWidth; x++, sum += Channels)
+        {
+          const unsigned int end = GetBoxEnd(columns, x);
+
+          for (unsigned int i = columns[x]; i < end; i++)
+          {
+            for (unsigned int c = 0; c < Channels; c++)
+            {
+              sum[c] += static_cast<Accumulator>(p[i * Channels + c]);
+            }
+          }
+        }
+      }
+
+      PixelType* q = reinterpret_cast<PixelType*>(target.GetRow(y));
+      const Accumulator* sum = &sums[0];
+
+      for (unsigned int x = 0; x < targetWidth; x++, sum += Channels, q += Channels)
+      {
+        const Accumulator count = static_cast<Accumulator>
+          ((GetBoxEnd(columns, x) - columns[x]) * (endRow - firstRow));
+
+        for (unsigned int c = 0; c < Channels; c++)
+        {
+          q[c] = static_cast<PixelType>(DivideRound(sum[c], count));
+        }
+      }
+    }
+  }
+
+
+  static void ComputeBilinearWeights(std::vector<unsigned int>& first,
+                                     std::vector<unsigned int>& weights,
+                                     unsigned int sourceSize,
+                                     unsigned int targetSize)
+  {
+    // Fixed-point source coordinates with 8 fractional bits, that
+    // align the centers of the source and target pixels
+    const int64_t last = (static_cast<int64_t>(sourceSize) - 1) * 256;
+
+    first.resize(targetSize);
+    weights.resize(targetSize);
+
+    for (unsigned int i = 0; i < targetSize; i++)
+    {
+      int64_t position = ((2 * static_cast<int64_t>(i) + 1) * sourceSize * 256 /
+                          (2 * static_cast<int64_t>(targetSize))) - 128;
+      position = std::max(static_cast<int64_t>(0), std::min(position, last));
+
+      first[i] = static_cast<unsigned int>(position / 256);
+      weights[i] = static_cast<unsigned int>(position % 256);
+    }
+  }
+
+
+  template <typename PixelType,
+            typename Accumulator,
+            unsigned int Channels>
+  static void ResizeBilinearInternal(ImageAccessor& target,
+                                     const ImageAccessor& source)
+  {
+    const unsigned int sourceWidth = source.GetWidth();
+    const unsigned int sourceHeight = source.GetHeight();
+    const unsigned int targetWidth = target.GetWidth();
+    const unsigned int targetHeight = target.GetHeight();
+
+    std::vector<unsigned int> columns, columnWeights, rows, rowWeights;
+    ComputeBilinearWeights(columns, columnWeights, sourceWidth, targetWidth);
+    ComputeBilinearWeights(rows, rowWeights, sourceHeight, targetHeight);
+
+    for (unsigned int y = 0; y < targetHeight; y++)
+    {
+      const PixelType* row1 = reinterpret_cast<const PixelType*>(source.GetConstRow(rows[y]));
+      const PixelType* row2 = reinterpret_cast<const PixelType*>
+        (source.GetConstRow(std::min(rows[y] + 1, sourceHeight - 1)));
+
+      const Accumulator fy = static_cast<Accumulator>(rowWeights[y]);
+      PixelType* q = reinterpret_cast<PixelType*>(target.GetRow(y));
+
+      for (unsigned int x = 0; x < targetWidth; x++, q += Channels)
+      {
+        const unsigned int x1 = columns[x] * Channels;
+        const unsigned int x2 = std::min(columns[x] + 1, sourceWidth - 1) * Channels;
+        const Accumulator fx = static_cast<Accumulator>(columnWeights[x]);
+
+        for (unsigned int c = 0; c < Channels; c++)
+        {
+          const Accumulator top = (static_cast<Accumulator>(row1[x1 + c]) * (256 - fx) +
+                                   static_cast<Accumulator>(row1[x2 + c]) * fx);
+          const Accumulator bottom = (static_cast<Accumulator>(row2[x1 + c]) * (256 - fx) +
+                                      static_cast<Accumulator>(row2[x2 + c]) * fx);
+
+          q[c] = static_cast<PixelType>(DivideRound(top * (256 - fy) + bottom * fy,
+                                                    static_cast<Accumulator>(65536)));
+        }
+      }
+    }
+  }
+
+
+  template <typename PixelType,
+            typename BoxAccumulator,
+            typename BilinearAccumulator,
+            unsigned int Channels>
+  static void ResizeInternal(ImageAccessor& target,
+                             const ImageAccessor& source,
+                             ImageInterpolation interpolation)
+  {
+    switch (interpolation)
+    {
+      case ImageInterpolation_Box:
+        ResizeBoxInternal<PixelType, BoxAccumulator, Channels>(target, source);
+        break;
+
+      case ImageInterpolation_Bilinear:
+        ResizeBilinearInternal<PixelType, BilinearAccumulator, Channels>(target, source);
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
   void ImageProcessing::Copy(ImageAccessor& target,
                              const ImageAccessor& source)
   {
@@ -415,7 +658,7 @@ namespace Orthanc
   }
 
 
-  void ImageProcessing::Convert(ImageAccessor& target,
+  static void ConvertSequential(ImageAccessor& target,
                                 const ImageAccessor& source)
   {
     if (target.GetWidth() != source.GetWidth() ||
@@ -429,7 +672,7 @@ namespace Orthanc
 
     if (source.GetFormat() == target.GetFormat())
     {
-      Copy(target, source);
+      ImageProcessing::Copy(target, source);
       return;
     }
 
@@ -783,7 +1026,7 @@ namespace Orthanc
 
 
 
-  void ImageProcessing::Set(ImageAccessor& image,
+  static void SetSequential(ImageAccessor& image,
                             int64_t value)
   {
     switch (image.GetFormat())
@@ -819,7 +1062,7 @@ namespace Orthanc
   }
 
 
-  void ImageProcessing::Set(ImageAccessor& image,
+  static void SetSequential(ImageAccessor& image,
                             uint8_t red,
                             uint8_t green,
                             uint8_t blue,
@@ -892,9 +1135,9 @@ namespace Orthanc
   }
 
 
-  void ImageProcessing::GetMinMaxIntegerValue(int64_t& minValue,
-                                              int64_t& maxValue,
-                                              const ImageAccessor& image)
+  static void GetMinMaxIntegerSequential(int64_t& minValue,
+                                         int64_t& maxValue,
+                                         const ImageAccessor& image)
   {
     switch (image.GetFormat())
     {
@@ -940,9 +1183,9 @@ namespace Orthanc
   }
 
 
-  void ImageProcessing::GetMinMaxFloatValue(float& minValue,
-                                            float& maxValue,
-                                            const ImageAccessor& image)
+  static void GetMinMaxFloatSequential(float& minValue,
+                                       float& maxValue,
+                                       const ImageAccessor& image)
   {
     switch (image.GetFormat())
     {
@@ -1031,7 +1274,7 @@ namespace Orthanc
   }
 
 
-  void ImageProcessing::ShiftScale(ImageAccessor& image,
+  static void ShiftScaleSequential(ImageAccessor& image,
                                    float offset,
                                    float scaling,
                                    bool useRound)
@@ -1077,7 +1320,7 @@ namespace Orthanc
   }
 
 
-  void ImageProcessing::Invert(ImageAccessor& image)
+  static void InvertSequential(ImageAccessor& image)
   {
     const unsigned int width = image.GetWidth();
     const unsigned int height = image.GetHeight();
@@ -1085,12 +1328,21 @@ namespace Orthanc
     switch (image.GetFormat())
     {
       case PixelFormat_Grayscale8:
+      case PixelFormat_RGB24:
       {
+        // Each byte is inverted independently
+        const unsigned int size = width * image.GetBytesPerPixel();
+
         for (unsigned int y = 0; y < height; y++)
         {
           uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y));
 
-          for (unsigned int x = 0; x < width; x++, p++)
+          if (ImageProcessingSimd::InvertRow(p, size))
+          {
+            continue;
+          }
+
+          for (unsigned int x = 0; x < size; x++, p++)
           {
             *p = 255 - (*p);
           }
@@ -1105,6 +1357,614 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    // Operation that is applied independently to each horizontal
+    // band of an image
+    class IBandOperation : public boost::noncopyable
+    {
+    public:
+      virtual ~IBandOperation()
+      {
+      }
+
+      virtual void Apply(size_t band,
+                         unsigned int y,
+                         unsigned int height) = 0;
+    };
+  }
+
+
+#if ORTHANC_SANDBOXED == 0
+  static TaskPool*  workersPool_ = NULL;
+  static uint64_t   workersMinimumPixels_ = 0;
+
+  namespace
+  {
+    class BandTask : public TaskPool::ITask
+    {
+    private:
+      IBandOperation&  operation_;
+      size_t           band_;
+      unsigned int     y_;
+      unsigned int     height_;
+
+    public:
+      BandTask(IBandOperation& operation,
+               size_t band,
+               unsigned int y,
+               unsigned int height) :
+        operation_(operation),
+        band_(band),
+        y_(y),
+        height_(height)
+      {
+      }
+
+      virtual void Execute()
+      {
+        operation_.Apply(band_, y_, height_);
+      }
+    };
+  }
+#endif
+
+
+  void ImageProcessing::SetWorkersPool(TaskPool* pool,
+                                       size_t minimumPixels)
+  {
+#if ORTHANC_SANDBOXED == 0
+    workersPool_ = pool;
+    workersMinimumPixels_ = minimumPixels;
+#else
+    if (pool != NULL)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+#endif
+  }
+
+
+  static size_t GetBandsCount(const ImageAccessor& image)
+  {
+#if ORTHANC_SANDBOXED == 0
+    if (workersPool_ != NULL &&
+        workersPool_->GetThreadsCount() > 0 &&
+        static_cast<uint64_t>(image.GetWidth()) * static_cast<uint64_t>(image.GetHeight()) >= workersMinimumPixels_)
+    {
+      // The calling thread also processes bands while waiting for
+      // the workers, hence the "+ 1"
+      return std::min(static_cast<size_t>(image.GetHeight()),
+                      workersPool_->GetThreadsCount() + 1);
+    }
+#endif
+
+    return 1;
+  }
+
+
+  static void ApplyToBands(IBandOperation& operation,
+                           unsigned int height,
+                           size_t bandsCount)
+  {
+    if (bandsCount <= 1)
+    {
+      operation.Apply(0, 0, height);
+      return;
+    }
+
+#if ORTHANC_SANDBOXED == 0
+    assert(workersPool_ != NULL);
+
+    TaskPool::Batch batch(*workersPool_);
+
+    for (size_t i = 0; i < bandsCount; i++)
+    {
+      unsigned int start = static_cast<unsigned int>(static_cast<uint64_t>(height) * i / bandsCount);
+      unsigned int end = static_cast<unsigned int>(static_cast<uint64_t>(height) * (i + 1) / bandsCount);
+      batch.Submit(new BandTask(operation, i, start, end - start));
+    }
+
+    batch.Join();
+#else
+    throw OrthancException(ErrorCode_InternalError);
+#endif
+  }
+
+
+  static void GetBand(ImageAccessor& band,
+                      const ImageAccessor& image,
+                      unsigned int y,
+                      unsigned int height)
+  {
+    image.GetRegion(band, 0, y, image.GetWidth(), height);
+  }
+
+
+  namespace
+  {
+    class ConvertOperation : public IBandOperation
+    {
+    private:
+      ImageAccessor&        target_;
+      const ImageAccessor&  source_;
+
+    public:
+      ConvertOperation(ImageAccessor& target,
+                       const ImageAccessor& source) :
+        target_(target),
+        source_(source)
+      {
+      }
+
+      virtual void Apply(size_t band,
+                         unsigned int y,
+                         unsigned int height)
+      {
+        ImageAccessor a, b;
+        GetBand(a, target_, y, height);
+        GetBand(b, source_, y, height);
+        ConvertSequential(a, b);
+      }
+    };
+
+
+    class SetOperation : public IBandOperation
+    {
+    private:
+      ImageAccessor&  image_;
+      bool            isColor_;
+      int64_t         value_;
+      uint8_t         red_;
+      uint8_t         green_;
+      uint8_t         blue_;
+      uint8_t         alpha_;
+
+    public:
+      SetOperation(ImageAccessor& image,
+                   int64_t value) :
+        image_(image),
+        isColor_(false),
+        value_(value),
+        red_(0),
+        green_(0),
+        blue_(0),
+        alpha_(0)
+      {
+      }
+
+      SetOperation(ImageAccessor& image,
+                   uint8_t red,
+                   uint8_t green,
+                   uint8_t blue,
+                   uint8_t alpha) :
+        image_(image),
+        isColor_(true),
+        value_(0),
+        red_(red),
+        green_(green),
+        blue_(blue),
+        alpha_(alpha)
+      {
+      }
+
+      virtual void Apply(size_t band,
+                         unsigned int y,
+                         unsigned int height)
+      {
+        ImageAccessor a;
+        GetBand(a, image_, y, height);
+
+        if (isColor_)
+        {
+          SetSequential(a, red_, green_, blue_, alpha_);
+        }
+        else
+        {
+          SetSequential(a, value_);
+        }
+      }
+    };
+
+
+    class MinMaxOperation : public IBandOperation
+    {
+    private:
+      const ImageAccessor&  image_;
+      bool                  isFloat_;
+      std::vector<int64_t>  minInteger_;
+      std::vector<int64_t>  maxInteger_;
+      std::vector<float>    minFloat_;
+      std::vector<float>    maxFloat_;
+
+    public:
+      MinMaxOperation(const ImageAccessor& image,
+                      bool isFloat,
+                      size_t bandsCount) :
+        image_(image),
+        isFloat_(isFloat),
+        minInteger_(bandsCount),
+        maxInteger_(bandsCount),
+        minFloat_(bandsCount),
+        maxFloat_(bandsCount)
+      {
+      }
+
+      virtual void Apply(size_t band,
+                         unsigned int y,
+                         unsigned int height)
+      {
+        ImageAccessor a;
+        GetBand(a, image_, y, height);
+
+        if (isFloat_)
+        {
+          GetMinMaxFloatSequential(minFloat_[band], maxFloat_[band], a);
+        }
+        else
+        {
+          GetMinMaxIntegerSequential(minInteger_[band], maxInteger_[band], a);
+        }
+      }
+
+      // The reduction follows the order of the bands, which gives
+      // the same result as the sequential scan
+      void GetIntegerResult(int64_t& minValue,
+                            int64_t& maxValue) const
+      {
+        minValue = minInteger_[0];
+        maxValue = maxInteger_[0];
+
+        for (size_t i = 1; i < minInteger_.size(); i++)
+        {
+          minValue = std::min(minValue, minInteger_[i]);
+          maxValue = std::max(maxValue, maxInteger_[i]);
+        }
+      }
+
+      void GetFloatResult(float& minValue,
+                          float& maxValue) const
+      {
+        minValue = minFloat_[0];
+        maxValue = maxFloat_[0];
+
+        for (size_t i = 1; i < minFloat_.size(); i++)
+        {
+          if (minFloat_[i] < minValue)
+          {
+            minValue = minFloat_[i];
+          }
+
+          if (maxFloat_[i] > maxValue)
+          {
+            maxValue = maxFloat_[i];
+          }
+        }
+      }
+    };
+
+
+    class ShiftScaleOperation : public IBandOperation
+    {
+    private:
+      ImageAccessor&  image_;
+      float           offset_;
+      float           scaling_;
+      bool            useRound_;
+
+    public:
+      ShiftScaleOperation(ImageAccessor& image,
+                          float offset,
+                          float scaling,
+                          bool useRound) :
+        image_(image),
+        offset_(offset),
+        scaling_(scaling),
+        useRound_(useRound)
+      {
+      }
+
+      virtual void Apply(size_t band,
+                         unsigned int y,
+                         unsigned int height)
+      {
+        ImageAccessor a;
+        GetBand(a, image_, y, height);
+        ShiftScaleSequential(a, offset_, scaling_, useRound_);
+      }
+    };
+
+
+    class InvertOperation : public IBandOperation
+    {
+    private:
+      ImageAccessor&  image_;
+
+    public:
+      InvertOperation(ImageAccessor& image) :
+        image_(image)
+      {
+      }
+
+      virtual void Apply(size_t band,
+                         unsigned int y,
+                         unsigned int height)
+      {
+        ImageAccessor a;
+        GetBand(a, image_, y, height);
+        InvertSequential(a);
+      }
+    };
+  }
+
+
+  void ImageProcessing::Convert(ImageAccessor& target,
+                                const ImageAccessor& source)
+  {
+    if (target.GetWidth() != source.GetWidth() ||
+        target.GetHeight() != source.GetHeight())
+    {
+      throw OrthancException(ErrorCode_IncompatibleImageSize);
+    }
+
+    ConvertOperation operation(target, source);
+    ApplyToBands(operation, source.GetHeight(), GetBandsCount(source));
+  }
+
+
+  void ImageProcessing::Set(ImageAccessor& image,
+                            int64_t value)
+  {
+    SetOperation operation(image, value);
+    ApplyToBands(operation, image.GetHeight(), GetBandsCount(image));
+  }
+
+
+  void ImageProcessing::Set(ImageAccessor& image,
+                            uint8_t red,
+                            uint8_t green,
+                            uint8_t blue,
+                            uint8_t alpha)
+  {
+    SetOperation operation(image, red, green, blue, alpha);
+    ApplyToBands(operation, image.GetHeight(), GetBandsCount(image));
+  }
+
+
+  void ImageProcessing::GetMinMaxIntegerValue(int64_t& minValue,
+                                              int64_t& maxValue,
+                                              const ImageAccessor& image)
+  {
+    const size_t bandsCount = GetBandsCount(image);
+
+    if (bandsCount <= 1)
+    {
+      // This also deals with the empty images
+      GetMinMaxIntegerSequential(minValue, maxValue, image);
+    }
+    else
+    {
+      MinMaxOperation operation(image, false, bandsCount);
+      ApplyToBands(operation, image.GetHeight(), bandsCount);
+      operation.GetIntegerResult(minValue, maxValue);
+    }
+  }
+
+
+  void ImageProcessing::GetMinMaxFloatValue(float& minValue,
+                                            float& maxValue,
+                                            const ImageAccessor& image)
+  {
+    const size_t bandsCount = GetBandsCount(image);
+
+    if (bandsCount <= 1)
+    {
+      GetMinMaxFloatSequential(minValue, maxValue, image);
+    }
+    else
+    {
+      MinMaxOperation operation(image, true, bandsCount);
+      ApplyToBands(operation, image.GetHeight(), bandsCount);
+      operation.GetFloatResult(minValue, maxValue);
+    }
+  }
+
+
+  void ImageProcessing::ShiftScale(ImageAccessor& image,
+                                   float offset,
+                                   float scaling,
+                                   bool useRound)
+  {
+    ShiftScaleOperation operation(image, offset, scaling, useRound);
+    ApplyToBands(operation, image.GetHeight(), GetBandsCount(image));
+  }
+
+
+  void ImageProcessing::Invert(ImageAccessor& image)
+  {
+    InvertOperation operation(image);
+    ApplyToBands(operation, image.GetHeight(), GetBandsCount(image));
+  }
+
+
+  void ImageProcessing::Resize(ImageAccessor& target,
+                               const ImageAccessor& source,
+                               ImageInterpolation interpolation)
+  {
+    if (target.GetFormat() != source.GetFormat())
+    {
+      throw OrthancException(ErrorCode_IncompatibleImageFormat);
+    }
+
+    if (target.GetWidth() == 0 ||
+        target.GetHeight() == 0)
+    {
+      return;
+    }
+
+    if (source.GetWidth() == 0 ||
+        source.GetHeight() == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (target.GetWidth() == source.GetWidth() &&
+        target.GetHeight() == source.GetHeight())
+    {
+      Copy(target, source);
+      return;
+    }
+
+    // The 8bpp formats are interpolated with 32bit integers, the
+    // other integer formats with 64bit integers
+    switch (source.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+        ResizeInternal<uint8_t, int64_t, int32_t, 1>(target, source, interpolation);
+        break;
+
+      case PixelFormat_Grayscale16:
+        ResizeInternal<uint16_t, int64_t, int64_t, 1>(target, source, interpolation);
+        break;
+
+      case PixelFormat_SignedGrayscale16:
+        ResizeInternal<int16_t, int64_t, int64_t, 1>(target, source, interpolation);
+        break;
+
+      case PixelFormat_Grayscale32:
+        ResizeInternal<uint32_t, int64_t, int64_t, 1>(target, source, interpolation);
+        break;
+
+      case PixelFormat_Float32:
+        ResizeInternal<float, double, double, 1>(target, source, interpolation);
+        break;
+
+      case PixelFormat_RGB24:
+        ResizeInternal<uint8_t, int64_t, int32_t, 3>(target, source, interpolation);
+        break;
+
+      case PixelFormat_RGBA32:
+      case PixelFormat_BGRA32:
+        ResizeInternal<uint8_t, int64_t, int32_t, 4>(target, source, interpolation);
+        break;
+
+      case PixelFormat_RGB48:
+        ResizeInternal<uint16_t, int64_t, int64_t, 3>(target, source, interpolation);
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+  }
+
+
+  template <typename PixelType>
+  static void ApplyWindowingInternal(ImageAccessor& target,
+                                     const ImageAccessor& source,
+                                     float windowCenter,
+                                     float windowWidth,
+                                     float rescaleSlope,
+                                     float rescaleIntercept,
+                                     bool invert)
+  {
+    const int32_t minValue = std::numeric_limits<PixelType>::min();
+    const int32_t maxValue = std::numeric_limits<PixelType>::max();
+
+    // Linear VOI LUT function, as defined in DICOM PS3.3 C.11.2.1.2.1
+    const double center = static_cast<double>(windowCenter) - 0.5;
+    const double range = static_cast<double>(windowWidth) - 1.0;
+    const double low = center - range / 2.0;
+    const double high = center + range / 2.0;
+
+    std::vector<uint8_t> lut(static_cast<size_t>(maxValue - minValue + 1));
+
+    for (int32_t value = minValue; value <= maxValue; value++)
+    {
+      const double x = (static_cast<double>(rescaleSlope) * static_cast<double>(value) +
+                        static_cast<double>(rescaleIntercept));
+
+      uint8_t y;
+      if (x <= low)
+      {
+        y = 0;
+      }
+      else if (x > high)
+      {
+        y = 255;
+      }
+      else
+      {
+        // "range" cannot be zero here, as "low == high" in such a case
+        double v = ((x - center) / range + 0.5) * 255.0;
+        y = static_cast<uint8_t>(std::min(255.0, std::max(0.0, boost::math::round(v))));
+      }
+
+      lut[value - minValue] = (invert ? 255 - y : y);
+    }
+
+    const unsigned int width = source.GetWidth();
+    const unsigned int height = source.GetHeight();
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
+      uint8_t* q = reinterpret_cast<uint8_t*>(target.GetRow(y));
+
+      for (unsigned int x = 0; x < width; x++, p++, q++)
+      {
+        *q = lut[static_cast<int32_t>(*p) - minValue];
+      }
+    }
+  }
+
+
+  void ImageProcessing::ApplyWindowing(ImageAccessor& target,
+                                       const ImageAccessor& source,
+                                       float windowCenter,
+                                       float windowWidth,
+                                       float rescaleSlope,
+                                       float rescaleIntercept,
+                                       bool invert)
+  {
+    if (target.GetFormat() != PixelFormat_Grayscale8)
+    {
+      throw OrthancException(ErrorCode_IncompatibleImageFormat);
+    }
+
+    if (target.GetWidth() != source.GetWidth() ||
+        target.GetHeight() != source.GetHeight())
+    {
+      throw OrthancException(ErrorCode_IncompatibleImageSize);
+    }
+
+    if (windowWidth < 1.0f)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    switch (source.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+        ApplyWindowingInternal<uint8_t>(target, source, windowCenter, windowWidth,
+                                        rescaleSlope, rescaleIntercept, invert);
+        break;
+
+      case PixelFormat_Grayscale16:
+        ApplyWindowingInternal<uint16_t>(target, source, windowCenter, windowWidth,
+                                         rescaleSlope, rescaleIntercept, invert);
+        break;
+
+      case PixelFormat_SignedGrayscale16:
+        ApplyWindowingInternal<int16_t>(target, source, windowCenter, windowWidth,
+                                        rescaleSlope, rescaleIntercept, invert);
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+  }
+
+
 
   namespace
   {
@@ -39,8 +39,22 @@
 
 namespace Orthanc
 {
+  class TaskPool;
+
   namespace ImageProcessing
   {
+    /**
+     * Registers a pool of threads (whose ownership is not taken) to
+     * process the images having at least "minimumPixels" pixels in
+     * horizontal bands, in Convert(), Set(), GetMinMaxIntegerValue(),
+     * GetMinMaxFloatValue(), ShiftScale() and Invert(). A NULL pool
+     * restores the single-threaded processing. This must not be
+     * called while images are being processed, and is not available
+     * in sandboxed environments.
+     **/
+    void SetWorkersPool(TaskPool* pool,
+                        size_t minimumPixels);
+
     void Copy(ImageAccessor& target,
               const ImageAccessor& source);
 
@@ -83,6 +97,25 @@ namespace Orthanc
 
     void Invert(ImageAccessor& image);
 
+    // The size of "target" gives the size of the resized image, and
+    // its pixel format must be the same as "source"
+    void Resize(ImageAccessor& target,
+                const ImageAccessor& source,
+                ImageInterpolation interpolation);
+
+    // Applies the DICOM linear VOI windowing to the rescaled values
+    // of a grayscale image ("source" is Grayscale8, Grayscale16 or
+    // SignedGrayscale16). "target" must be a Grayscale8 image of the
+    // same size. The output of each possible stored value is
+    // precomputed in a lookup table, that is applied in one pass.
+    void ApplyWindowing(ImageAccessor& target,
+                        const ImageAccessor& source,
+                        float windowCenter,
+                        float windowWidth,
+                        float rescaleSlope,
+                        float rescaleIntercept,
+                        bool invert);
+
     void DrawLineSegment(ImageAccessor& image,
                          int x0,
                          int y0,
@@ -0,0 +1,1077 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../PrecompiledHeaders.h"
+#include "ImageProcessingSimd.h"
+
+#include <string.h>
+
+/**
+ * The kernels are only built on x86-64, where SSE2 is always
+ * available and where the scalar code also computes in single
+ * precision (which is a requirement for bit-identical results). The
+ * AVX2 kernels additionally require a compiler that can target AVX2
+ * in individual functions, and are selected at runtime.
+ **/
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define ORTHANC_SIMD_SSE2  1
+#else
+#  define ORTHANC_SIMD_SSE2  0
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1 && defined(_MSC_VER)
+#  if _MSC_VER >= 1700
+#    define ORTHANC_SIMD_AVX2  1
+#  endif
+#  define ORTHANC_TARGET_AVX2
+#elif ORTHANC_SIMD_SSE2 == 1 && defined(__clang__)
+#  if __clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8)
+#    define ORTHANC_SIMD_AVX2  1
+#  endif
+#  define ORTHANC_TARGET_AVX2  __attribute__((target("avx2")))
+#elif ORTHANC_SIMD_SSE2 == 1 && defined(__GNUC__)
+#  if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#    define ORTHANC_SIMD_AVX2  1
+#  endif
+#  define ORTHANC_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+#if !defined(ORTHANC_SIMD_AVX2)
+#  define ORTHANC_SIMD_AVX2  0
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+#  include <emmintrin.h>
+#endif
+
+#if ORTHANC_SIMD_AVX2 == 1
+#  include <immintrin.h>
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
+
+
+namespace Orthanc
+{
+  namespace ImageProcessingSimd
+  {
+    static InstructionSet DetectInstructionSet()
+    {
+#if ORTHANC_SIMD_AVX2 == 1
+      // AVX2 requires the support of both the CPU (CPUID leaf 7) and
+      // the operating system (saving of the YMM registers, XGETBV)
+      unsigned int cpuidMax, ecx1, ebx7;
+      uint64_t xcr0 = 0;
+
+#  if defined(_MSC_VER)
+      int info[4];
+      __cpuid(info, 0);
+      cpuidMax = static_cast<unsigned int>(info[0]);
+      __cpuid(info, 1);
+      ecx1 = static_cast<unsigned int>(info[2]);
+      __cpuidex(info, 7, 0);
+      ebx7 = (cpuidMax >= 7 ? static_cast<unsigned int>(info[1]) : 0);
+
+      if (ecx1 & (1u << 27))  // OSXSAVE
+      {
+        xcr0 = _xgetbv(0);
+      }
+#  else
+      unsigned int eax, ebx, edx;
+      cpuidMax = __get_cpuid_max(0, NULL);
+      __cpuid(1, eax, ebx, ecx1, edx);
+
+      ebx7 = 0;
+      if (cpuidMax >= 7)
+      {
+        unsigned int ecx7;
+        __cpuid_count(7, 0, eax, ebx7, ecx7, edx);
+      }
+
+      if (ecx1 & (1u << 27))  // OSXSAVE
+      {
+        uint32_t low, high;
+        __asm__ __volatile__ ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+        xcr0 = (static_cast<uint64_t>(high) << 32) | low;
+      }
+#  endif
+
+      if ((ecx1 & (1u << 28)) &&   // AVX
+          (xcr0 & 6) == 6 &&       // XMM and YMM states
+          (ebx7 & (1u << 5)))      // AVX2
+      {
+        return InstructionSet_AVX2;
+      }
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+      return InstructionSet_SSE2;
+#else
+      return InstructionSet_Scalar;
+#endif
+    }
+
+
+    static const InstructionSet supported_ = DetectInstructionSet();
+    static InstructionSet current_ = supported_;
+
+
+    InstructionSet GetSupportedInstructionSet()
+    {
+      return supported_;
+    }
+
+
+    InstructionSet GetInstructionSet()
+    {
+      return current_;
+    }
+
+
+    void SetInstructionSet(InstructionSet instructionSet)
+    {
+      current_ = (instructionSet < supported_ ? instructionSet : supported_);
+    }
+
+
+#if ORTHANC_SIMD_SSE2 == 1
+    /**
+     * Loading and storing of groups of 4 pixels, as 32-bit integers
+     **/
+
+    static inline __m128i Load4(const uint8_t* p)
+    {
+      int32_t v;
+      memcpy(&v, p, sizeof(v));
+      const __m128i zero = _mm_setzero_si128();
+      return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+    }
+
+    static inline __m128i Load4(const uint16_t* p)
+    {
+      __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+      return _mm_unpacklo_epi16(v, _mm_setzero_si128());
+    }
+
+    static inline __m128i Load4(const int16_t* p)
+    {
+      // Sign extension
+      __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+      return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    }
+
+    // The values must lie in the range of the pixel type
+    static inline void Store4(uint8_t* p,
+                              __m128i v)
+    {
+      v = _mm_packs_epi32(v, v);
+      int32_t w = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+      memcpy(p, &w, sizeof(w));
+    }
+
+    static inline void Store4(uint16_t* p,
+                              __m128i v)
+    {
+      // There is no unsigned saturation from 32 to 16 bits in SSE2
+      const __m128i bias = _mm_set1_epi32(32768);
+      v = _mm_packs_epi32(_mm_sub_epi32(v, bias), _mm_sub_epi32(v, bias));
+      v = _mm_xor_si128(v, _mm_set1_epi16(static_cast<int16_t>(0x8000)));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+    }
+
+    static inline void Store4(int16_t* p,
+                              __m128i v)
+    {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(v, v));
+    }
+
+
+    static inline __m128 ShiftScaleSSE2(__m128 v,
+                                        __m128 offset,
+                                        __m128 scaling,
+                                        __m128 minValue,
+                                        __m128 maxValue)
+    {
+      v = _mm_mul_ps(_mm_add_ps(v, offset), scaling);
+
+      // "_mm_min_ps(v, max)" evaluates "v < max ? v : max"
+      return _mm_max_ps(_mm_min_ps(v, maxValue), minValue);
+    }
+
+
+    static inline __m128i RoundSSE2(__m128 v,
+                                    bool useRound)
+    {
+      __m128i t = _mm_cvttps_epi32(v);
+
+      if (useRound)
+      {
+        // Round half away from zero, as "boost::math::iround()": The
+        // fractional part is exact, as the values are below 2^23
+        __m128 fraction = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+        t = _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f))));
+        t = _mm_add_epi32(t, _mm_castps_si128(_mm_cmple_ps(fraction, _mm_set1_ps(-0.5f))));
+      }
+
+      return t;
+    }
+
+
+    template <typename PixelType>
+    static void ShiftScaleSSE2(PixelType* row,
+                               unsigned int width,
+                               float offset,
+                               float scaling,
+                               float minValue,
+                               float maxValue,
+                               bool useRound)
+    {
+      const __m128 o = _mm_set1_ps(offset);
+      const __m128 s = _mm_set1_ps(scaling);
+      const __m128 a = _mm_set1_ps(minValue);
+      const __m128 b = _mm_set1_ps(maxValue);
+
+      unsigned int x = 0;
+      for (; x + 4 <= width; x += 4)
+      {
+        __m128 v = ShiftScaleSSE2(_mm_cvtepi32_ps(Load4(row + x)), o, s, a, b);
+        Store4(row + x, RoundSSE2(v, useRound));
+      }
+
+      if (x < width)
+      {
+        PixelType tail[4] = { 0, 0, 0, 0 };
+        memcpy(tail, row + x, (width - x) * sizeof(PixelType));
+
+        __m128 v = ShiftScaleSSE2(_mm_cvtepi32_ps(Load4(tail)), o, s, a, b);
+        Store4(tail, RoundSSE2(v, useRound));
+
+        memcpy(row + x, tail, (width - x) * sizeof(PixelType));
+      }
+    }
+
+
+    static void GetMinMaxSSE2(uint8_t& minValue,
+                              uint8_t& maxValue,
+                              const uint8_t* row,
+                              unsigned int width)
+    {
+      unsigned int x = 0;
+
+      if (width >= 16)
+      {
+        __m128i a = _mm_set1_epi8(static_cast<char>(minValue));
+        __m128i b = _mm_set1_epi8(static_cast<char>(maxValue));
+
+        for (; x + 16 <= width; x += 16)
+        {
+          __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+          a = _mm_min_epu8(a, v);
+          b = _mm_max_epu8(b, v);
+        }
+
+        uint8_t lanes[2][16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[0]), a);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[1]), b);
+
+        for (unsigned int i = 0; i < 16; i++)
+        {
+          minValue = (lanes[0][i] < minValue ? lanes[0][i] : minValue);
+          maxValue = (lanes[1][i] > maxValue ? lanes[1][i] : maxValue);
+        }
+      }
+
+      for (; x < width; x++)
+      {
+        minValue = (row[x] < minValue ? row[x] : minValue);
+        maxValue = (row[x] > maxValue ? row[x] : maxValue);
+      }
+    }
+
+
+    // The unsigned 16-bit values are compared as signed values, once
+    // shifted by "bias" (0x8000 for uint16_t, 0 for int16_t)
+    template <typename PixelType>
+    static void GetMinMaxSSE2(PixelType& minValue,
+                              PixelType& maxValue,
+                              const PixelType* row,
+                              unsigned int width,
+                              int16_t bias)
+    {
+      unsigned int x = 0;
+
+      if (width >= 8)
+      {
+        const __m128i shift = _mm_set1_epi16(bias);
+        __m128i a = _mm_xor_si128(_mm_set1_epi16(static_cast<int16_t>(minValue)), shift);
+        __m128i b = _mm_xor_si128(_mm_set1_epi16(static_cast<int16_t>(maxValue)), shift);
+
+        for (; x + 8 <= width; x += 8)
+        {
+          __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), shift);
+          a = _mm_min_epi16(a, v);
+          b = _mm_max_epi16(b, v);
+        }
+
+        PixelType lanes[2][8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[0]), _mm_xor_si128(a, shift));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[1]), _mm_xor_si128(b, shift));
+
+        for (unsigned int i = 0; i < 8; i++)
+        {
+          minValue = (lanes[0][i] < minValue ? lanes[0][i] : minValue);
+          maxValue = (lanes[1][i] > maxValue ? lanes[1][i] : maxValue);
+        }
+      }
+
+      for (; x < width; x++)
+      {
+        minValue = (row[x] < minValue ? row[x] : minValue);
+        maxValue = (row[x] > maxValue ? row[x] : maxValue);
+      }
+    }
+#endif
+
+
+#if ORTHANC_SIMD_AVX2 == 1
+    static inline ORTHANC_TARGET_AVX2 __m256i Load8AVX2(const uint8_t* p)
+    {
+      return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    static inline ORTHANC_TARGET_AVX2 __m256i Load8AVX2(const uint16_t* p)
+    {
+      return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    static inline ORTHANC_TARGET_AVX2 __m256i Load8AVX2(const int16_t* p)
+    {
+      return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    static inline ORTHANC_TARGET_AVX2 void Store8AVX2(uint8_t* p,
+                                                      __m256i v)
+    {
+      __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(w, w));
+    }
+
+    static inline ORTHANC_TARGET_AVX2 void Store8AVX2(uint16_t* p,
+                                                      __m256i v)
+    {
+      __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p), w);
+    }
+
+    static inline ORTHANC_TARGET_AVX2 void Store8AVX2(int16_t* p,
+                                                      __m256i v)
+    {
+      __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p), w);
+    }
+
+
+    template <typename PixelType>
+    static ORTHANC_TARGET_AVX2 void ShiftScaleAVX2(PixelType* row,
+                                                   unsigned int width,
+                                                   float offset,
+                                                   float scaling,
+                                                   float minValue,
+                                                   float maxValue,
+                                                   bool useRound)
+    {
+      const __m256 o = _mm256_set1_ps(offset);
+      const __m256 s = _mm256_set1_ps(scaling);
+      const __m256 a = _mm256_set1_ps(minValue);
+      const __m256 b = _mm256_set1_ps(maxValue);
+      const __m256 half = _mm256_set1_ps(0.5f);
+      const __m256 minusHalf = _mm256_set1_ps(-0.5f);
+
+      unsigned int x = 0;
+      for (; x + 8 <= width; x += 8)
+      {
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(Load8AVX2(row + x)), o), s);
+        v = _mm256_max_ps(_mm256_min_ps(v, b), a);
+
+        __m256i t = _mm256_cvttps_epi32(v);
+
+        if (useRound)
+        {
+          __m256 fraction = _mm256_sub_ps(v, _mm256_cvtepi32_ps(t));
+          t = _mm256_sub_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(fraction, half, _CMP_GE_OQ)));
+          t = _mm256_add_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(fraction, minusHalf, _CMP_LE_OQ)));
+        }
+
+        Store8AVX2(row + x, t);
+      }
+
+      if (x < width)
+      {
+        ShiftScaleSSE2(row + x, width - x, offset, scaling, minValue, maxValue, useRound);
+      }
+    }
+
+
+    static ORTHANC_TARGET_AVX2 void GetMinMaxAVX2(uint8_t& minValue,
+                                                  uint8_t& maxValue,
+                                                  const uint8_t* row,
+                                                  unsigned int width)
+    {
+      unsigned int x = 0;
+
+      if (width >= 32)
+      {
+        __m256i a = _mm256_set1_epi8(static_cast<char>(minValue));
+        __m256i b = _mm256_set1_epi8(static_cast<char>(maxValue));
+
+        for (; x + 32 <= width; x += 32)
+        {
+          __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+          a = _mm256_min_epu8(a, v);
+          b = _mm256_max_epu8(b, v);
+        }
+
+        uint8_t lanes[2][32];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[0]), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[1]), b);
+
+        for (unsigned int i = 0; i < 32; i++)
+        {
+          minValue = (lanes[0][i] < minValue ? lanes[0][i] : minValue);
+          maxValue = (lanes[1][i] > maxValue ? lanes[1][i] : maxValue);
+        }
+      }
+
+      GetMinMaxSSE2(minValue, maxValue, row + x, width - x);
+    }
+
+
+    static ORTHANC_TARGET_AVX2 void GetMinMaxAVX2(uint16_t& minValue,
+                                                  uint16_t& maxValue,
+                                                  const uint16_t* row,
+                                                  unsigned int width)
+    {
+      unsigned int x = 0;
+
+      if (width >= 16)
+      {
+        __m256i a = _mm256_set1_epi16(static_cast<int16_t>(minValue));
+        __m256i b = _mm256_set1_epi16(static_cast<int16_t>(maxValue));
+
+        for (; x + 16 <= width; x += 16)
+        {
+          __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+          a = _mm256_min_epu16(a, v);
+          b = _mm256_max_epu16(b, v);
+        }
+
+        uint16_t lanes[2][16];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[0]), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[1]), b);
+
+        for (unsigned int i = 0; i < 16; i++)
+        {
+          minValue = (lanes[0][i] < minValue ? lanes[0][i] : minValue);
+          maxValue = (lanes[1][i] > maxValue ? lanes[1][i] : maxValue);
+        }
+      }
+
+      GetMinMaxSSE2(minValue, maxValue, row + x, width - x, static_cast<int16_t>(0x8000));
+    }
+
+
+    static ORTHANC_TARGET_AVX2 void GetMinMaxAVX2(int16_t& minValue,
+                                                  int16_t& maxValue,
+                                                  const int16_t* row,
+                                                  unsigned int width)
+    {
+      unsigned int x = 0;
+
+      if (width >= 16)
+      {
+        __m256i a = _mm256_set1_epi16(minValue);
+        __m256i b = _mm256_set1_epi16(maxValue);
+
+        for (; x + 16 <= width; x += 16)
+        {
+          __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+          a = _mm256_min_epi16(a, v);
+          b = _mm256_max_epi16(b, v);
+        }
+
+        int16_t lanes[2][16];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[0]), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[1]), b);
+
+        for (unsigned int i = 0; i < 16; i++)
+        {
+          minValue = (lanes[0][i] < minValue ? lanes[0][i] : minValue);
+          maxValue = (lanes[1][i] > maxValue ? lanes[1][i] : maxValue);
+        }
+      }
+
+      GetMinMaxSSE2(minValue, maxValue, row + x, width - x, 0);
+    }
+
+
+    static ORTHANC_TARGET_AVX2 unsigned int InvertAVX2(uint8_t* row,
+                                                       unsigned int width)
+    {
+      const __m256i ones = _mm256_set1_epi8(static_cast<char>(0xff));
+
+      unsigned int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+        __m256i* p = reinterpret_cast<__m256i*>(row + x);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), ones));
+      }
+
+      return x;
+    }
+
+
+    static ORTHANC_TARGET_AVX2 unsigned int ConvertColorToGrayscaleAVX2(uint8_t* target,
+                                                                        const uint8_t* source,
+                                                                        unsigned int width)
+    {
+      /**
+       * Each pixel is gathered as a 32-bit integer that starts with
+       * its RGB components (hence the last pixel of the row, whose
+       * 4th byte would lie outside of the row, is left to the scalar
+       * code). The integer division by 10000 is computed in single
+       * precision, which is exact: The numerator is below 2^22, and
+       * the quotient is never closer than 10^-4 to an integer
+       * without being one.
+       **/
+
+      const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+      const __m256i mask = _mm256_set1_epi32(0xff);
+      const __m256i r = _mm256_set1_epi32(2126);
+      const __m256i g = _mm256_set1_epi32(7152);
+      const __m256i b = _mm256_set1_epi32(0722);  // Same constant as the scalar code
+      const __m256 divisor = _mm256_set1_ps(10000.0f);
+
+      unsigned int x = 0;
+      for (; x + 9 <= width; x += 8)
+      {
+        __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(source + 3 * x), offsets, 1);
+
+        __m256i y = _mm256_add_epi32(
+          _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(v, mask), r),
+                           _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask), g)),
+          _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask), b));
+
+        y = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(y), divisor));
+        Store8AVX2(target + x, y);
+      }
+
+      return x;
+    }
+#endif
+
+
+    bool GetMinMaxRow(uint8_t& minValue,
+                      uint8_t& maxValue,
+                      const uint8_t* row,
+                      unsigned int width)
+    {
+      switch (current_)
+      {
+#if ORTHANC_SIMD_AVX2 == 1
+        case InstructionSet_AVX2:
+          GetMinMaxAVX2(minValue, maxValue, row, width);
+          return true;
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+        case InstructionSet_SSE2:
+          GetMinMaxSSE2(minValue, maxValue, row, width);
+          return true;
+#endif
+
+        default:
+          return false;
+      }
+    }
+
+
+    bool GetMinMaxRow(uint16_t& minValue,
+                      uint16_t& maxValue,
+                      const uint16_t* row,
+                      unsigned int width)
+    {
+      switch (current_)
+      {
+#if ORTHANC_SIMD_AVX2 == 1
+        case InstructionSet_AVX2:
+          GetMinMaxAVX2(minValue, maxValue, row, width);
+          return true;
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+        case InstructionSet_SSE2:
+          GetMinMaxSSE2(minValue, maxValue, row, width, static_cast<int16_t>(0x8000));
+          return true;
+#endif
+
+        default:
+          return false;
+      }
+    }
+
+
+    bool GetMinMaxRow(int16_t& minValue,
+                      int16_t& maxValue,
+                      const int16_t* row,
+                      unsigned int width)
+    {
+      switch (current_)
+      {
+#if ORTHANC_SIMD_AVX2 == 1
+        case InstructionSet_AVX2:
+          GetMinMaxAVX2(minValue, maxValue, row, width);
+          return true;
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+        case InstructionSet_SSE2:
+          GetMinMaxSSE2(minValue, maxValue, row, width, 0);
+          return true;
+#endif
+
+        default:
+          return false;
+      }
+    }
+
+
+#if ORTHANC_SIMD_SSE2 == 1
+    /**
+     * The conversions between the integer types are memory-bound,
+     * and only use SSE2. The saturation of the unsigned 16-bit values
+     * relies on "v - max(v - limit, 0) == min(v, limit)".
+     **/
+
+    template <typename TargetType,
+              typename SourceType>
+    static void ConvertTail(TargetType* target,
+                            const SourceType* source,
+                            unsigned int width,
+                            int32_t minValue,
+                            int32_t maxValue)
+    {
+      for (unsigned int x = 0; x < width; x++)
+      {
+        const int32_t v = static_cast<int32_t>(source[x]);
+        target[x] = static_cast<TargetType>(v < minValue ? minValue : (v > maxValue ? maxValue : v));
+      }
+    }
+
+
+    // From 8bpp to 16bpp, 16 pixels at once
+    template <typename TargetType>
+    static void WidenSSE2(TargetType* target,
+                          const uint8_t* source,
+                          unsigned int width)
+    {
+      const __m128i zero = _mm_setzero_si128();
+
+      unsigned int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x + 8), _mm_unpackhi_epi8(v, zero));
+      }
+
+      ConvertTail(target + x, source + x, width - x, 0, 255);
+    }
+
+
+    // From 16bpp to 8bpp, 16 pixels at once
+    template <typename SourceType>
+    static void NarrowSSE2(uint8_t* target,
+                           const SourceType* source,
+                           unsigned int width)
+    {
+      const bool isSigned = (static_cast<SourceType>(-1) < 0);
+      const __m128i limit = _mm_set1_epi16(255);
+
+      unsigned int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x + 8));
+
+        if (!isSigned)
+        {
+          // "_mm_packus_epi16()" takes signed values
+          low = _mm_sub_epi16(low, _mm_subs_epu16(low, limit));
+          high = _mm_sub_epi16(high, _mm_subs_epu16(high, limit));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_packus_epi16(low, high));
+      }
+
+      ConvertTail(target + x, source + x, width - x, 0, 255);
+    }
+
+
+    // From uint16_t to int16_t (if "toSigned") or conversely, 8
+    // pixels at once
+    template <typename TargetType,
+              typename SourceType>
+    static void ChangeSignSSE2(TargetType* target,
+                               const SourceType* source,
+                               unsigned int width,
+                               bool toSigned)
+    {
+      const __m128i limit = _mm_set1_epi16(32767);
+      const __m128i zero = _mm_setzero_si128();
+
+      unsigned int x = 0;
+      for (; x + 8 <= width; x += 8)
+      {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+
+        if (toSigned)
+        {
+          v = _mm_sub_epi16(v, _mm_subs_epu16(v, limit));
+        }
+        else
+        {
+          v = _mm_max_epi16(v, zero);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), v);
+      }
+
+      if (toSigned)
+      {
+        ConvertTail(target + x, source + x, width - x, -32768, 32767);
+      }
+      else
+      {
+        ConvertTail(target + x, source + x, width - x, 0, 65535);
+      }
+    }
+
+
+    template <typename SourceType>
+    static void ConvertToFloatSSE2(float* target,
+                                   const SourceType* source,
+                                   unsigned int width)
+    {
+      unsigned int x = 0;
+      for (; x + 4 <= width; x += 4)
+      {
+        _mm_storeu_ps(target + x, _mm_cvtepi32_ps(Load4(source + x)));
+      }
+
+      for (; x < width; x++)
+      {
+        target[x] = static_cast<float>(source[x]);
+      }
+    }
+#endif
+
+
+    bool ConvertRow(uint16_t* target,
+                    const uint8_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        WidenSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(int16_t* target,
+                    const uint8_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        WidenSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(uint8_t* target,
+                    const uint16_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        NarrowSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(int16_t* target,
+                    const uint16_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        ChangeSignSSE2(target, source, width, true);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(uint8_t* target,
+                    const int16_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        NarrowSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(uint16_t* target,
+                    const int16_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        ChangeSignSSE2(target, source, width, false);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(float* target,
+                    const uint8_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        ConvertToFloatSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(float* target,
+                    const uint16_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        ConvertToFloatSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertRow(float* target,
+                    const int16_t* source,
+                    unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        ConvertToFloatSSE2(target, source, width);
+        return true;
+      }
+#endif
+
+      return false;
+    }
+
+
+    bool ConvertColorToGrayscaleRow(uint8_t* target,
+                                    const uint8_t* source,
+                                    unsigned int width)
+    {
+#if ORTHANC_SIMD_AVX2 == 1
+      if (current_ == InstructionSet_AVX2)
+      {
+        unsigned int x = ConvertColorToGrayscaleAVX2(target, source, width);
+
+        for (const uint8_t* s = source + 3 * x; x < width; x++, s += 3)
+        {
+          // The result is at most 248, no saturation is needed
+          target[x] = static_cast<uint8_t>((2126 * static_cast<int32_t>(s[0]) +
+                                            7152 * static_cast<int32_t>(s[1]) +
+                                            0722 * static_cast<int32_t>(s[2])) / 10000);
+        }
+
+        return true;
+      }
+#endif
+
+      // There is no efficient deinterleaving of RGB24 in SSE2
+      return false;
+    }
+
+
+    template <typename PixelType>
+    static bool ShiftScaleRowInternal(PixelType* row,
+                                      unsigned int width,
+                                      float offset,
+                                      float scaling,
+                                      float minValue,
+                                      float maxValue,
+                                      bool useRound)
+    {
+      switch (current_)
+      {
+#if ORTHANC_SIMD_AVX2 == 1
+        case InstructionSet_AVX2:
+          ShiftScaleAVX2(row, width, offset, scaling, minValue, maxValue, useRound);
+          return true;
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+        case InstructionSet_SSE2:
+          ShiftScaleSSE2(row, width, offset, scaling, minValue, maxValue, useRound);
+          return true;
+#endif
+
+        default:
+          return false;
+      }
+    }
+
+
+    bool ShiftScaleRow(uint8_t* row,
+                       unsigned int width,
+                       float offset,
+                       float scaling,
+                       bool useRound)
+    {
+      return ShiftScaleRowInternal(row, width, offset, scaling, 0.0f, 255.0f, useRound);
+    }
+
+
+    bool ShiftScaleRow(uint16_t* row,
+                       unsigned int width,
+                       float offset,
+                       float scaling,
+                       bool useRound)
+    {
+      return ShiftScaleRowInternal(row, width, offset, scaling, 0.0f, 65535.0f, useRound);
+    }
+
+
+    bool ShiftScaleRow(int16_t* row,
+                       unsigned int width,
+                       float offset,
+                       float scaling,
+                       bool useRound)
+    {
+      return ShiftScaleRowInternal(row, width, offset, scaling, -32768.0f, 32767.0f, useRound);
+    }
+
+
+    bool InvertRow(uint8_t* row,
+                   unsigned int width)
+    {
+#if ORTHANC_SIMD_SSE2 == 1
+      if (current_ != InstructionSet_Scalar)
+      {
+        unsigned int x = 0;
+
+#  if ORTHANC_SIMD_AVX2 == 1
+        if (current_ == InstructionSet_AVX2)
+        {
+          x = InvertAVX2(row, width);
+        }
+#  endif
+
+        const __m128i ones = _mm_set1_epi8(static_cast<char>(0xff));
+        for (; x + 16 <= width; x += 16)
+        {
+          __m128i* p = reinterpret_cast<__m128i*>(row + x);
+          _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), ones));
+        }
+
+        for (; x < width; x++)
+        {
+          row[x] = 255 - row[x];
+        }
+
+        return true;
+      }
+#endif
+
+      return false;
+    }
+  }
+}
@@ -0,0 +1,190 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Orthanc
+{
+  /**
+   * Vectorized kernels of ImageProcessing, that process one row of
+   * pixels. Each kernel returns "false" if it is not available for
+   * the pixel types or for the running CPU, in which case the caller
+   * must fall back to its scalar loop. The results are bit-identical
+   * to those of the scalar code.
+   **/
+  namespace ImageProcessingSimd
+  {
+    enum InstructionSet
+    {
+      InstructionSet_Scalar,
+      InstructionSet_SSE2,
+      InstructionSet_AVX2
+    };
+
+    // The best instruction set that is supported by both the build
+    // and the running CPU
+    InstructionSet GetSupportedInstructionSet();
+
+    InstructionSet GetInstructionSet();
+
+    // Restricts the kernels to some instruction set (bounded by the
+    // supported one). This is not thread-safe, and is only intended
+    // for testing and benchmarking.
+    void SetInstructionSet(InstructionSet instructionSet);
+
+
+    template <typename PixelType>
+    inline bool GetMinMaxRow(PixelType& minValue,
+                             PixelType& maxValue,
+                             const PixelType* row,
+                             unsigned int width)
+    {
+      return false;
+    }
+
+    // "minValue" and "maxValue" are updated with the pixels of the row
+    bool GetMinMaxRow(uint8_t& minValue,
+                      uint8_t& maxValue,
+                      const uint8_t* row,
+                      unsigned int width);
+
+    bool GetMinMaxRow(uint16_t& minValue,
+                      uint16_t& maxValue,
+                      const uint16_t* row,
+                      unsigned int width);
+
+    bool GetMinMaxRow(int16_t& minValue,
+                      int16_t& maxValue,
+                      const int16_t* row,
+                      unsigned int width);
+
+
+    template <typename TargetType, typename SourceType>
+    inline bool ConvertRow(TargetType* target,
+                           const SourceType* source,
+                           unsigned int width)
+    {
+      return false;
+    }
+
+    // The integer conversions saturate to the range of the target type
+    bool ConvertRow(uint16_t* target,
+                    const uint8_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(int16_t* target,
+                    const uint8_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(uint8_t* target,
+                    const uint16_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(int16_t* target,
+                    const uint16_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(uint8_t* target,
+                    const int16_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(uint16_t* target,
+                    const int16_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(float* target,
+                    const uint8_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(float* target,
+                    const uint16_t* source,
+                    unsigned int width);
+
+    bool ConvertRow(float* target,
+                    const int16_t* source,
+                    unsigned int width);
+
+    template <typename TargetType>
+    inline bool ConvertColorToGrayscaleRow(TargetType* target,
+                                           const uint8_t* source,
+                                           unsigned int width)
+    {
+      return false;
+    }
+
+    // From RGB24 to Grayscale8
+    bool ConvertColorToGrayscaleRow(uint8_t* target,
+                                    const uint8_t* source,
+                                    unsigned int width);
+
+
+    template <typename PixelType>
+    inline bool ShiftScaleRow(PixelType* row,
+                              unsigned int width,
+                              float offset,
+                              float scaling,
+                              bool useRound)
+    {
+      return false;
+    }
+
+    // Computes "(value + offset) * scaling" in single precision, then
+    // saturates and rounds (half away from zero) or truncates
+    bool ShiftScaleRow(uint8_t* row,
+                       unsigned int width,
+                       float offset,
+                       float scaling,
+                       bool useRound);
+
+    bool ShiftScaleRow(uint16_t* row,
+                       unsigned int width,
+                       float offset,
+                       float scaling,
+                       bool useRound);
+
+    bool ShiftScaleRow(int16_t* row,
+                       unsigned int width,
+                       float offset,
+                       float scaling,
+                       bool useRound);
+
+
+    // Inverts the bytes of a row (Grayscale8, or RGB24 with "width"
+    // counting the bytes)
+    bool InvertRow(uint8_t* row,
+                   unsigned int width);
+  }
+}
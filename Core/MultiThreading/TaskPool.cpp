@@ -0,0 +1,288 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "TaskPool.h"
+
+#include "../Logging.h"
+#include "../OrthancException.h"
+
+#include <cassert>
+#include <memory>
+
+namespace Orthanc
+{
+  void TaskPool::Batch::SetError(ErrorCode code,
+                                 HttpStatus status)
+  {
+    // Must be called with the mutex of the pool locked. Only the
+    // first error is reported.
+    if (!hasError_)
+    {
+      hasError_ = true;
+      errorCode_ = code;
+      httpStatus_ = status;
+    }
+  }
+
+
+  TaskPool::Batch::Batch(TaskPool& pool) :
+    pool_(pool),
+    pending_(0),
+    hasError_(false),
+    errorCode_(ErrorCode_Success),
+    httpStatus_(HttpStatus_200_Ok)
+  {
+  }
+
+
+  TaskPool::Batch::~Batch()
+  {
+    // The tasks refer to this batch, that must not be destroyed
+    // before they complete
+    pool_.WaitBatch(*this);
+  }
+
+
+  void TaskPool::Batch::Submit(ITask* task)
+  {
+    std::auto_ptr<ITask> protection(task);
+
+    if (task == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    if (pool_.threads_.empty())
+    {
+      // No worker thread, execute the task immediately
+      Item item;
+      item.task_ = protection.release();
+      item.batch_ = this;
+
+      {
+        boost::mutex::scoped_lock lock(pool_.mutex_);
+        pending_++;
+      }
+
+      pool_.Execute(item);
+    }
+    else
+    {
+      boost::mutex::scoped_lock lock(pool_.mutex_);
+
+      Item item;
+      item.task_ = protection.release();
+      item.batch_ = this;
+      pool_.queue_.push_back(item);
+      pending_++;
+
+      pool_.available_.notify_one();
+    }
+  }
+
+
+  void TaskPool::Batch::Join()
+  {
+    pool_.WaitBatch(*this);
+
+    boost::mutex::scoped_lock lock(pool_.mutex_);
+
+    if (hasError_)
+    {
+      hasError_ = false;
+      throw OrthancException(errorCode_, httpStatus_);
+    }
+  }
+
+
+  void TaskPool::Execute(const Item& item)
+  {
+    std::auto_ptr<ITask> task(item.task_);
+
+    bool success = false;
+    ErrorCode code = ErrorCode_InternalError;
+    HttpStatus status = HttpStatus_500_InternalServerError;
+
+    try
+    {
+      task->Execute();
+      success = true;
+    }
+    catch (OrthancException& e)
+    {
+      code = e.GetErrorCode();
+      status = e.GetHttpStatus();
+    }
+    catch (std::bad_alloc&)
+    {
+      code = ErrorCode_NotEnoughMemory;
+      status = HttpStatus_500_InternalServerError;
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "std::exception while executing a task: " << e.what();
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception while executing a task";
+    }
+
+    // Destroy the task before signaling its completion, as it might
+    // refer to resources of the submitter
+    task.reset(NULL);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (!success)
+      {
+        item.batch_->SetError(code, status);
+      }
+
+      assert(item.batch_->pending_ > 0);
+      item.batch_->pending_--;
+
+      if (item.batch_->pending_ == 0)
+      {
+        item.batch_->completed_.notify_all();
+      }
+    }
+  }
+
+
+  bool TaskPool::StealTask(Item& item,
+                           const Batch& batch)
+  {
+    // Must be called with "mutex_" locked
+    for (Queue::iterator it = queue_.begin(); it != queue_.end(); ++it)
+    {
+      if (it->batch_ == &batch)
+      {
+        item = *it;
+        queue_.erase(it);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  void TaskPool::WaitBatch(Batch& batch)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (batch.pending_ > 0)
+    {
+      Item item;
+      if (StealTask(item, batch))
+      {
+        lock.unlock();
+        Execute(item);
+        lock.lock();
+      }
+      else
+      {
+        batch.completed_.wait(lock);
+      }
+    }
+  }
+
+
+  void TaskPool::Worker(TaskPool* that)
+  {
+    for (;;)
+    {
+      Item item;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (that->continue_ &&
+               that->queue_.empty())
+        {
+          that->available_.wait(lock);
+        }
+
+        if (that->queue_.empty())
+        {
+          return;   // The pool is being stopped
+        }
+
+        item = that->queue_.front();
+        that->queue_.pop_front();
+      }
+
+      that->Execute(item);
+    }
+  }
+
+
+  TaskPool::TaskPool(size_t threadsCount) :
+    continue_(true)
+  {
+    threads_.resize(threadsCount);
+
+    for (size_t i = 0; i < threadsCount; i++)
+    {
+      threads_[i] = new boost::thread(Worker, this);
+    }
+  }
+
+
+  TaskPool::~TaskPool()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      continue_ = false;
+      available_.notify_all();
+    }
+
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+      if (threads_[i] != NULL)
+      {
+        if (threads_[i]->joinable())
+        {
+          threads_[i]->join();
+        }
+
+        delete threads_[i];
+      }
+    }
+
+    // All the batches must have been joined at this point
+    assert(queue_.empty());
+  }
+}
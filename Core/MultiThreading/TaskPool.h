@@ -0,0 +1,126 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../IDynamicObject.h"
+#include "../Enumerations.h"
+
+#include <list>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Pool of threads executing short-lived tasks that are grouped
+   * into batches, the submitter of a batch waiting for all of its
+   * tasks to complete. While waiting, the submitter executes the
+   * tasks of its batch that are not yet handled by a worker, which
+   * prevents deadlocks if a batch is submitted from a task of the
+   * pool. If the pool has no thread, the tasks are executed by the
+   * submitter.
+   **/
+  class TaskPool : public boost::noncopyable
+  {
+  public:
+    class ITask : public IDynamicObject
+    {
+    public:
+      virtual void Execute() = 0;
+    };
+
+    class Batch : public boost::noncopyable
+    {
+      friend class TaskPool;
+
+    private:
+      TaskPool&                  pool_;
+      size_t                     pending_;
+      bool                       hasError_;
+      ErrorCode                  errorCode_;
+      HttpStatus                 httpStatus_;
+      boost::condition_variable  completed_;
+
+      void SetError(ErrorCode code,
+                    HttpStatus status);
+
+    public:
+      explicit Batch(TaskPool& pool);
+
+      // Waits for the remaining tasks, ignoring their errors
+      ~Batch();
+
+      // Takes the ownership of the task
+      void Submit(ITask* task);
+
+      // Waits for all the submitted tasks to complete, then throws
+      // the error of the first task that has failed, if any
+      void Join();
+    };
+
+  private:
+    struct Item
+    {
+      ITask*  task_;
+      Batch*  batch_;
+    };
+
+    typedef std::list<Item>  Queue;
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    available_;
+    Queue                        queue_;
+    bool                         continue_;
+    std::vector<boost::thread*>  threads_;
+
+    static void Worker(TaskPool* that);
+
+    void Execute(const Item& item);
+
+    bool StealTask(Item& item,
+                   const Batch& batch);
+
+    void WaitBatch(Batch& batch);
+
+  public:
+    explicit TaskPool(size_t threadsCount);
+
+    ~TaskPool();
+
+    size_t GetThreadsCount() const
+    {
+      return threads_.size();
+    }
+  };
+}
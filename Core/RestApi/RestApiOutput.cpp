@@ -58,7 +58,11 @@ namespace Orthanc
 
   void RestApiOutput::Finalize()
   {
-    if (!alreadySent_)
+    if (output_.IsWritingMultipart())
+    {
+      output_.CloseMultipart();
+    }
+    else if (!alreadySent_)
     {
       if (method_ == HttpMethod_Post)
       {
@@ -199,4 +203,53 @@ namespace Orthanc
     // empty string
     SetCookie(name, "", 1);
   }
+
+  void RestApiOutput::SetHttpHeader(const std::string& name,
+                                    const std::string& value)
+  {
+    CheckStatus();
+    output_.AddHeader(name, value);
+  }
+
+  void RestApiOutput::AnswerNotModified()
+  {
+    CheckStatus();
+    output_.SendStatus(HttpStatus_304_NotModified);
+    alreadySent_ = true;
+  }
+
+  void RestApiOutput::StartMultipart(const std::string& subType,
+                                     const std::string& contentType)
+  {
+    CheckStatus();
+    output_.StartMultipart(subType, contentType);
+    alreadySent_ = true;
+  }
+
+  void RestApiOutput::SendMultipartItem(const void* item,
+                                        size_t length)
+  {
+    if (!output_.IsWritingMultipart())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    std::map<std::string, std::string> headers;  // No custom headers
+    output_.SendMultipartItem(item, length, headers);
+  }
+
+  void RestApiOutput::SendMultipartItem(const std::string& item)
+  {
+    SendMultipartItem(item.empty() ? NULL : item.c_str(), item.size());
+  }
+
+  void RestApiOutput::CloseMultipart()
+  {
+    if (!output_.IsWritingMultipart())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    output_.CloseMultipart();
+  }
 }
@@ -94,6 +94,24 @@ namespace Orthanc
 
     void ResetCookie(const std::string& name);
 
+    void SetHttpHeader(const std::string& name,
+                       const std::string& value);
+
+    // Answers "304 Not Modified" to a conditional request
+    void AnswerNotModified();
+
+    // Streams the answer as a sequence of parts, that are sent to
+    // the client as soon as they are available
+    void StartMultipart(const std::string& subType,
+                        const std::string& contentType);
+
+    void SendMultipartItem(const void* item,
+                           size_t length);
+
+    void SendMultipartItem(const std::string& item);
+
+    void CloseMultipart();
+
     void Finalize();
   };
 }
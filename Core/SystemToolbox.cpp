@@ -42,6 +42,7 @@
 #else
 #  include <unistd.h>    // For "execvp()"
 #  include <sys/wait.h>  // For "waitpid()"
+#  include <fcntl.h>     // For "open()" in "SyncFile()" and "SyncFilesystem()"
 #endif
 
 
@@ -283,6 +284,53 @@ namespace Orthanc
   }
 
 
+  void SystemToolbox::ReadFileRange(std::string& content,
+                                    const std::string& path,
+                                    uint64_t start,
+                                    uint64_t end)
+  {
+    if (start > end)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (!IsRegularFile(path))
+    {
+      LOG(ERROR) << "The path does not point to a regular file: " << path;
+      throw OrthancException(ErrorCode_RegularFileExpected);
+    }
+
+    boost::filesystem::ifstream f;
+    f.open(path, std::ifstream::in | std::ifstream::binary);
+    if (!f.good())
+    {
+      throw OrthancException(ErrorCode_InexistentFile);
+    }
+
+    std::streamsize size = GetStreamSize(f);
+    if (size < 0 ||
+        static_cast<uint64_t>(size) < end)
+    {
+      LOG(ERROR) << "Reading beyond the end of the file: " << path;
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    content.resize(static_cast<size_t>(end - start));
+    if (!content.empty())
+    {
+      f.seekg(static_cast<std::streamoff>(start), std::ios::beg);
+      f.read(&content[0], static_cast<std::streamsize>(content.size()));
+
+      if (!f.good())
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+    }
+
+    f.close();
+  }
+
+
   void SystemToolbox::WriteFile(const void* content,
                                 size_t size,
                                 const std::string& path)
@@ -333,6 +381,82 @@ namespace Orthanc
   }
 
 
+  void SystemToolbox::SyncFilesystem(const std::string& path)
+  {
+#if defined(_WIN32)
+    // Windows has no equivalent to "sync()" for a whole volume that
+    // is available to non-administrator users, which is why the
+    // option "StorageDurableWrites" is rejected on this platform
+    throw OrthancException(ErrorCode_NotImplemented);
+
+#elif defined(__linux__) && !defined(__LSB_VERSION__)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw OrthancException(ErrorCode_InexistentFile);
+    }
+
+    int result = syncfs(fd);
+    close(fd);
+
+    if (result != 0)
+    {
+      throw OrthancException(ErrorCode_FileStorageCannotWrite);
+    }
+
+#else
+    // Fallback for the systems without "syncfs()": Flush all the
+    // filesystems
+    sync();
+#endif
+  }
+
+
+  void SystemToolbox::SyncFile(const std::string& path)
+  {
+#if defined(_WIN32)
+    if (boost::filesystem::is_directory(path))
+    {
+      // Windows cannot flush a directory handle, but the directory
+      // entries are protected by the journal of NTFS
+      return;
+    }
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      throw OrthancException(ErrorCode_InexistentFile);
+    }
+
+    BOOL success = FlushFileBuffers(file);
+    CloseHandle(file);
+
+    if (!success)
+    {
+      throw OrthancException(ErrorCode_FileStorageCannotWrite);
+    }
+
+#else
+    // A directory can be opened read-only to be flushed
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw OrthancException(ErrorCode_InexistentFile);
+    }
+
+    int result = fsync(fd);
+    close(fd);
+
+    if (result != 0)
+    {
+      throw OrthancException(ErrorCode_FileStorageCannotWrite);
+    }
+#endif
+  }
+
+
   uint64_t SystemToolbox::GetFileSize(const std::string& path)
   {
     try
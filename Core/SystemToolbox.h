@@ -65,6 +65,12 @@ namespace Orthanc
                     const std::string& path,
                     size_t headerSize);
 
+    // Reads the bytes in the range [start, end) of the file
+    void ReadFileRange(std::string& content,
+                       const std::string& path,
+                       uint64_t start,
+                       uint64_t end);
+
     void WriteFile(const void* content,
                    size_t size,
                    const std::string& path);
@@ -74,6 +80,16 @@ namespace Orthanc
 
     void RemoveFile(const std::string& path);
 
+    // Flushes to the disk all the pending writes of the filesystem
+    // containing "path" (i.e. "syncfs()" on Linux). Not available on
+    // Windows.
+    void SyncFilesystem(const std::string& path);
+
+    // Flushes to the disk the pending writes of one file, or the
+    // entries of one directory (i.e. "fsync()" on UNIX-like systems,
+    // and "FlushFileBuffers()" on Windows)
+    void SyncFile(const std::string& path);
+
     uint64_t GetFileSize(const std::string& path);
 
     void MakeDirectory(const std::string& path);
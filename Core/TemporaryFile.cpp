@@ -41,15 +41,25 @@
 
 namespace Orthanc
 {
-  static std::string CreateTemporaryPath(const char* extension)
+  static std::string CreateTemporaryPath(const std::string& directory,
+                                         const char* extension)
   {
+    boost::filesystem::path tmpDir;
+
+    if (!directory.empty())
+    {
+      tmpDir = directory;
+    }
+    else
+    {
 #if BOOST_HAS_FILESYSTEM_V3 == 1
-    boost::filesystem::path tmpDir = boost::filesystem::temp_directory_path();
+      tmpDir = boost::filesystem::temp_directory_path();
 #elif defined(__linux__)
-    boost::filesystem::path tmpDir("/tmp");
+      tmpDir = "/tmp";
 #else
 #error Support your platform here
 #endif
+    }
 
     // We use UUID to create unique path to temporary files
     std::string filename = "Orthanc-" + Orthanc::Toolbox::GenerateUuid();
@@ -65,13 +75,20 @@ namespace Orthanc
 
 
   TemporaryFile::TemporaryFile() : 
-    path_(CreateTemporaryPath(NULL))
+    path_(CreateTemporaryPath("", NULL))
   {
   }
 
 
   TemporaryFile::TemporaryFile(const char* extension) :
-    path_(CreateTemporaryPath(extension))
+    path_(CreateTemporaryPath("", extension))
+  {
+  }
+
+
+  TemporaryFile::TemporaryFile(const std::string& directory,
+                               const char* extension) :
+    path_(CreateTemporaryPath(directory, extension))
   {
   }
 
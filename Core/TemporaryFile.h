@@ -55,6 +55,11 @@ namespace Orthanc
 
     TemporaryFile(const char* extension);
 
+    // Creates the temporary file in the given directory, or in the
+    // temporary directory of the system if "directory" is empty
+    TemporaryFile(const std::string& directory,
+                  const char* extension);
+
     ~TemporaryFile();
 
     const std::string& GetPath() const
@@ -365,18 +365,47 @@ namespace Orthanc
                            const void* data,
                            size_t size)
   {
-    md5_state_s state;
-    md5_init(&state);
+    MD5Context context;
+    context.Append(data, size);
+    context.Finish(result);
+  }
 
-    if (size > 0)
+
+  Toolbox::MD5Context::MD5Context() :
+    state_(new md5_state_s)
+  {
+    md5_init(state_);
+  }
+
+
+  Toolbox::MD5Context::~MD5Context()
+  {
+    delete state_;
+  }
+
+
+  void Toolbox::MD5Context::Append(const void* data,
+                                   size_t size)
+  {
+    // "md5_append()" takes an "int" as the size of the buffer
+    static const size_t MAX_CHUNK = 1024 * 1024 * 1024;
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+    while (size > 0)
     {
-      md5_append(&state, 
-                 reinterpret_cast<const md5_byte_t*>(data), 
-                 static_cast<int>(size));
+      size_t chunk = (size > MAX_CHUNK ? MAX_CHUNK : size);
+      md5_append(state_, reinterpret_cast<const md5_byte_t*>(p), static_cast<int>(chunk));
+      p += chunk;
+      size -= chunk;
     }
+  }
 
+
+  void Toolbox::MD5Context::Finish(std::string& result)
+  {
     md5_byte_t actualHash[16];
-    md5_finish(&state, actualHash);
+    md5_finish(state_, actualHash);
 
     result.resize(32);
     for (unsigned int i = 0; i < 16; i++)
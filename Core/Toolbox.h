@@ -38,6 +38,7 @@
 #include <stdint.h>
 #include <vector>
 #include <string>
+#include <boost/noncopyable.hpp>
 #include <json/json.h>
 
 
@@ -68,6 +69,10 @@
  **/
 
 
+#if ORTHANC_ENABLE_MD5 == 1
+struct md5_state_s;  // Forward declaration, from "md5.h"
+#endif
+
 
 namespace Orthanc
 {
@@ -121,6 +126,26 @@ namespace Orthanc
                            size_t fromLevel = 0);
 
 #if ORTHANC_ENABLE_MD5 == 1
+    // Incremental computation of a MD5 hash, for data that is
+    // processed chunk by chunk
+    class MD5Context : public boost::noncopyable
+    {
+    private:
+      md5_state_s*  state_;
+
+    public:
+      MD5Context();
+
+      ~MD5Context();
+
+      void Append(const void* data,
+                  size_t size);
+
+      // Returns the hash as a hexadecimal string. The context must
+      // not be used anymore afterwards.
+      void Finish(std::string& result);
+    };
+
     void ComputeMD5(std::string& result,
                     const std::string& data);
 
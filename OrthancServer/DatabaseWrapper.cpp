@@ -370,6 +370,14 @@ namespace Orthanc
       throw OrthancException(ErrorCode_IncompatibleDatabaseVersion);
     }
 
+    if (db_.DoesTableExist("AttachedFiles"))
+    {
+      // This index is not part of the original schema of the
+      // database v6, create it on-the-fly if missing. It speeds up
+      // the lookups of attachments by their UUID.
+      db_.Execute("CREATE INDEX IF NOT EXISTS AttachedFilesUuidIndex ON AttachedFiles(uuid);");
+    }
+
     signalRemainingAncestor_ = new Internals::SignalRemainingAncestor;
     db_.Register(signalRemainingAncestor_);
   }
@@ -747,6 +755,84 @@ namespace Orthanc
   }
 
 
+  bool DatabaseWrapper::LookupAttachmentByUuid(FileInfo& attachment,
+                                               const std::string& uuid)
+  {
+    SQLite::Statement s(db_, SQLITE_FROM_HERE, 
+                        "SELECT fileType, uncompressedSize, compressionType, compressedSize, "
+                        "uncompressedMD5, compressedMD5 FROM AttachedFiles WHERE uuid=? LIMIT 1");
+    s.BindString(0, uuid);
+
+    if (!s.Step())
+    {
+      return false;
+    }
+    else
+    {
+      attachment = FileInfo(uuid,
+                            static_cast<FileContentType>(s.ColumnInt(0)),
+                            s.ColumnInt64(1),
+                            s.ColumnString(4),
+                            static_cast<CompressionType>(s.ColumnInt(2)),
+                            s.ColumnInt64(3),
+                            s.ColumnString(5));
+      return true;
+    }
+  }
+
+
+  void DatabaseWrapper::ListAttachmentUuids(std::list<std::string>& target,
+                                            const std::string& after,
+                                            const std::string& before,
+                                            uint32_t limit)
+  {
+    target.clear();
+
+    // This query is served by the "AttachedFilesUuidIndex" index
+    SQLite::Statement s(db_, SQLITE_FROM_HERE, 
+                        "SELECT DISTINCT uuid FROM AttachedFiles WHERE uuid>? AND uuid<? "
+                        "ORDER BY uuid LIMIT ?");
+    s.BindString(0, after);
+    s.BindString(1, before);
+    s.BindInt64(2, limit);
+
+    while (s.Step())
+    {
+      target.push_back(s.ColumnString(0));
+    }
+  }
+
+
+  void DatabaseWrapper::ListAttachments(std::list<AttachmentOwner>& target,
+                                        const std::string& after,
+                                        uint32_t limit)
+  {
+    target.clear();
+
+    // This query is served by the "AttachedFilesUuidIndex" index. If
+    // several resources share the same uuid (content-addressed
+    // storage), only one of them is returned.
+    SQLite::Statement s(db_, SQLITE_FROM_HERE, 
+                        "SELECT uuid, id, fileType, uncompressedSize, compressionType, compressedSize, "
+                        "uncompressedMD5, compressedMD5 FROM AttachedFiles WHERE uuid>? "
+                        "GROUP BY uuid ORDER BY uuid LIMIT ?");
+    s.BindString(0, after);
+    s.BindInt64(1, limit);
+
+    while (s.Step())
+    {
+      target.push_back(std::make_pair(s.ColumnInt64(1),
+                                      FileInfo(s.ColumnString(0),
+                                               static_cast<FileContentType>(s.ColumnInt(2)),
+                                               s.ColumnInt64(3),
+                                               s.ColumnString(6),
+                                               static_cast<CompressionType>(s.ColumnInt(4)),
+                                               s.ColumnInt64(5),
+                                               s.ColumnString(7))));
+    }
+  }
+
+
   void DatabaseWrapper::ClearMainDicomTags(int64_t id)
   {
     {
@@ -205,6 +205,18 @@ namespace Orthanc
                                   int64_t id,
                                   FileContentType contentType);
 
+    virtual bool LookupAttachmentByUuid(FileInfo& attachment,
+                                        const std::string& uuid);
+
+    virtual void ListAttachmentUuids(std::list<std::string>& target,
+                                     const std::string& after,
+                                     const std::string& before,
+                                     uint32_t limit);
+
+    virtual void ListAttachments(std::list<AttachmentOwner>& target,
+                                 const std::string& after,
+                                 uint32_t limit);
+
     virtual void ClearMainDicomTags(int64_t id);
 
     virtual void SetMainDicomTag(int64_t id,
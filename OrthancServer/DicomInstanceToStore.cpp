@@ -38,6 +38,7 @@
 #include "../Core/DicomParsing/ParsedDicomFile.h"
 #include "../Core/Logging.h"
 #include "../Core/OrthancException.h"
+#include "ServerToolbox.h"
 
 #include <dcmtk/dcmdata/dcfilefo.h>
 #include <dcmtk/dcmdata/dcdeftag.h>
@@ -162,8 +163,7 @@ namespace Orthanc
     void ComputeMissingInformation()
     {
       if (buffer_.HasContent() &&
-          summary_.HasContent() &&
-          json_.HasContent())
+          summary_.HasContent())
       {
         // Fine, everything is available
         return; 
@@ -193,39 +193,35 @@ namespace Orthanc
         }
       }
 
-      if (summary_.HasContent() &&
-          json_.HasContent())
+      if (summary_.HasContent())
       {
         return;
       }
 
       // At this point, we know that the DICOM file is available as a
-      // memory buffer, but that its summary or its JSON version is
-      // missing
+      // memory buffer, but that its summary is missing
 
       if (!parsed_.HasContent())
       {
         parsed_.TakeOwnership(new ParsedDicomFile(buffer_.GetConstContent()));
       }
-
-      // At this point, we have parsed the DICOM file
     
-      if (!summary_.HasContent())
+      summary_.Allocate();
+      FromDcmtkBridge::ExtractDicomSummary(summary_.GetContent(), 
+                                           *parsed_.GetContent().GetDcmtkObject().getDataset());
+    }
+
+
+    ParsedDicomFile& GetParsedDicomFile()
+    {
+      ComputeMissingInformation();
+
+      if (!parsed_.HasContent())
       {
-        summary_.Allocate();
-        FromDcmtkBridge::ExtractDicomSummary(summary_.GetContent(), 
-                                             *parsed_.GetContent().GetDcmtkObject().getDataset());
+        parsed_.TakeOwnership(new ParsedDicomFile(buffer_.GetConstContent()));
       }
-    
-      if (!json_.HasContent())
-      {
-        json_.Allocate();
 
-        std::set<DicomTag> ignoreTagLength;
-        FromDcmtkBridge::ExtractDicomAsJson(json_.GetContent(), 
-                                            *parsed_.GetContent().GetDcmtkObject().getDataset(),
-                                            ignoreTagLength);
-      }
+      return parsed_.GetContent();
     }
 
 
@@ -278,17 +274,39 @@ namespace Orthanc
     
     const Json::Value& GetJson()
     {
-      ComputeMissingInformation();
-    
+      // The JSON version of the DICOM file is only computed on
+      // demand, as its generation by "ServerContext::Store()" can be
+      // deferred
       if (!json_.HasContent())
       {
-        throw OrthancException(ErrorCode_InternalError);
+        json_.Allocate();
+
+        std::set<DicomTag> ignoreTagLength;
+        FromDcmtkBridge::ExtractDicomAsJson(json_.GetContent(), 
+                                            *GetParsedDicomFile().GetDcmtkObject().getDataset(),
+                                            ignoreTagLength);
       }
 
       return json_.GetConstContent();
     }
 
 
+    void GetSimplifiedJson(Json::Value& target)
+    {
+      if (json_.HasContent())
+      {
+        ServerToolbox::SimplifyTags(target, json_.GetConstContent(), DicomToJsonFormat_Human);
+      }
+      else
+      {
+        // Directly generate the simplified version, which is much
+        // cheaper than its full JSON version
+        GetParsedDicomFile().DatasetToJson(target, DicomToJsonFormat_Human,
+                                           DicomToJsonFlags_Default, ORTHANC_MAXIMUM_TAG_LENGTH);
+      }
+    }
+
+
     DicomInstanceHasher& GetHasher()
     {
       if (hasher_.get() == NULL)
@@ -413,6 +431,12 @@ namespace Orthanc
   }
 
 
+  void DicomInstanceToStore::GetSimplifiedJson(Json::Value& target)
+  {
+    pimpl_->GetSimplifiedJson(target);
+  }
+
+
   bool DicomInstanceToStore::LookupTransferSyntax(std::string& result)
   {
     return pimpl_->LookupTransferSyntax(result);
@@ -84,6 +84,11 @@ namespace Orthanc
     
     const Json::Value& GetJson();
 
+    // Equivalent to "ServerToolbox::SimplifyTags()" applied to
+    // "GetJson()", in the "human" format, without computing the full
+    // JSON version if it is not available yet
+    void GetSimplifiedJson(Json::Value& target);
+
     bool LookupTransferSyntax(std::string& result);
 
     DicomInstanceHasher& GetHasher();
@@ -0,0 +1,316 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PrecompiledHeadersServer.h"
+#include "FramesRangeExtractor.h"
+
+#include "../Core/HttpServer/IHttpStreamAnswer.h"
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+
+#include <algorithm>
+#include <cassert>
+#include <boost/lexical_cast.hpp>
+
+namespace Orthanc
+{
+  class FramesRangeExtractor::ExtractTask : public TaskPool::ITask
+  {
+  private:
+    IFrameSource&  source_;
+    unsigned int   slot_;
+    unsigned int   frame_;
+    std::string&   target_;
+    MimeType&      mime_;
+
+  public:
+    ExtractTask(IFrameSource& source,
+                unsigned int slot,
+                unsigned int frame,
+                std::string& target,
+                MimeType& mime) :
+      source_(source),
+      slot_(slot),
+      frame_(frame),
+      target_(target),
+      mime_(mime)
+    {
+    }
+
+    virtual void Execute()
+    {
+      source_.ExtractFrame(target_, mime_, slot_, frame_);
+    }
+  };
+
+
+  static unsigned int ParseArgument(const std::string& name,
+                                    const std::string& value)
+  {
+    // "boost::lexical_cast<unsigned int>()" silently wraps the
+    // negative values around
+    if (value.empty() ||
+        value[0] == '-')
+    {
+      LOG(ERROR) << "Bad value for the \"" << name << "\" argument (must be a positive integer): " << value;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+
+    try
+    {
+      return boost::lexical_cast<unsigned int>(value);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      LOG(ERROR) << "Bad value for the \"" << name << "\" argument (must be a positive integer): " << value;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+  }
+
+
+  FramesRangeExtractor::FramesRangeExtractor(TaskPool& pool) :
+    pool_(pool),
+    chunkSize_(static_cast<unsigned int>(pool.GetThreadsCount()) + 1)
+  {
+  }
+
+
+  void FramesRangeExtractor::ParseRange(unsigned int& first,
+                                        unsigned int& count,
+                                        const std::string& firstArgument,
+                                        const std::string& countArgument)
+  {
+    first = ParseArgument("first", firstArgument);
+    count = ParseArgument("count", countArgument);
+  }
+
+
+  bool FramesRangeExtractor::ClampRange(unsigned int& count,
+                                        unsigned int first,
+                                        unsigned int framesCount)
+  {
+    if (first >= framesCount)
+    {
+      return false;
+    }
+
+    if (count == 0 ||
+        count > framesCount - first)
+    {
+      count = framesCount - first;
+    }
+
+    return true;
+  }
+
+
+  void FramesRangeExtractor::ExtractChunk(std::vector<std::string>& parts,
+                                          std::vector<MimeType>& mimes,
+                                          IFrameSource& source,
+                                          unsigned int first,
+                                          unsigned int size)
+  {
+    assert(size <= chunkSize_);
+
+    parts.clear();
+    parts.resize(size);
+    mimes.clear();
+    mimes.resize(size, MimeType_Binary);
+
+    TaskPool::Batch batch(pool_);
+
+    for (unsigned int i = 0; i < size; i++)
+    {
+      batch.Submit(new ExtractTask(source, i, first + i, parts[i], mimes[i]));
+    }
+
+    batch.Join();
+  }
+
+
+  // Streams the concatenation of the frames, one chunk at a time. As
+  // the length of the answer must be known beforehand, and as the
+  // client must be able to split the frames, all the frames must have
+  // the same size.
+  class FramesRangeExtractor::ConcatenatedFrames : public IHttpStreamAnswer
+  {
+  private:
+    FramesRangeExtractor&  that_;
+    IFrameSource&          source_;
+    unsigned int           first_;
+    unsigned int           count_;
+    unsigned int           position_;
+    size_t                 frameSize_;
+    bool                   pending_;
+    std::string            chunk_;
+
+    void ReadChunk()
+    {
+      const unsigned int size = std::min(that_.chunkSize_, count_ - position_);
+
+      std::vector<std::string> parts;
+      std::vector<MimeType> mimes;
+      that_.ExtractChunk(parts, mimes, source_, first_ + position_, size);
+
+      if (position_ == 0)
+      {
+        frameSize_ = parts[0].size();
+      }
+
+      chunk_.clear();
+      chunk_.reserve(size * frameSize_);
+
+      for (unsigned int i = 0; i < size; i++)
+      {
+        if (parts[i].size() != frameSize_)
+        {
+          LOG(ERROR) << "The frames cannot be concatenated, as their size is not constant";
+          throw OrthancException(ErrorCode_NotAcceptable);
+        }
+
+        chunk_.append(parts[i]);
+      }
+
+      position_ += size;
+    }
+
+  public:
+    ConcatenatedFrames(FramesRangeExtractor& that,
+                       IFrameSource& source,
+                       unsigned int first,
+                       unsigned int count) :
+      that_(that),
+      source_(source),
+      first_(first),
+      count_(count),
+      position_(0),
+      frameSize_(0),
+      pending_(true)
+    {
+      // The first chunk gives the size of the frames, before the
+      // answer is started
+      ReadChunk();
+    }
+
+    virtual HttpCompression SetupHttpCompression(bool gzipAllowed,
+                                                 bool deflateAllowed)
+    {
+      return HttpCompression_None;
+    }
+
+    virtual bool HasContentFilename(std::string& filename)
+    {
+      return false;
+    }
+
+    virtual std::string GetContentType()
+    {
+      return EnumerationToString(MimeType_Binary);
+    }
+
+    virtual uint64_t GetContentLength()
+    {
+      return static_cast<uint64_t>(count_) * static_cast<uint64_t>(frameSize_);
+    }
+
+    virtual bool ReadNextChunk()
+    {
+      if (pending_)
+      {
+        pending_ = false;
+        return true;
+      }
+      else if (position_ == count_)
+      {
+        return false;
+      }
+      else
+      {
+        ReadChunk();
+        return true;
+      }
+    }
+
+    virtual const char* GetChunkContent()
+    {
+      return chunk_.c_str();
+    }
+
+    virtual size_t GetChunkSize()
+    {
+      return chunk_.size();
+    }
+  };
+
+
+  void FramesRangeExtractor::Answer(RestApiOutput& output,
+                                    IFrameSource& source,
+                                    unsigned int first,
+                                    unsigned int count,
+                                    bool multipart)
+  {
+    if (count == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (!multipart)
+    {
+      ConcatenatedFrames stream(*this, source, first, count);
+      output.AnswerStream(stream);
+      return;
+    }
+
+    for (unsigned int start = 0; start < count; start += chunkSize_)
+    {
+      const unsigned int size = std::min(chunkSize_, count - start);
+
+      std::vector<std::string> parts;
+      std::vector<MimeType> mimes;
+      ExtractChunk(parts, mimes, source, first + start, size);
+
+      if (start == 0)
+      {
+        // The frames of one DICOM file share their transfer syntax,
+        // hence their MIME type
+        output.StartMultipart("related", EnumerationToString(mimes[0]));
+      }
+
+      for (unsigned int i = 0; i < size; i++)
+      {
+        output.SendMultipartItem(parts[i]);
+      }
+    }
+
+    output.CloseMultipart();
+  }
+}
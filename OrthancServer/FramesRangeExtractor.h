@@ -0,0 +1,115 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Core/MultiThreading/TaskPool.h"
+#include "../Core/RestApi/RestApiOutput.h"
+
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * Answers a range of frames of one DICOM instance, either as a
+   * "multipart/related" stream or as the concatenation of the frames
+   * (that must all have the same size, i.e. uncompressed raw frames).
+   * The frames are extracted by chunks that are processed in parallel
+   * by a pool of workers, and each chunk is sent before extracting the
+   * next one, which bounds the memory used by the answer. The frames
+   * are always sent in increasing order.
+   **/
+  class FramesRangeExtractor : public boost::noncopyable
+  {
+  public:
+    class IFrameSource : public boost::noncopyable
+    {
+    public:
+      virtual ~IFrameSource()
+      {
+      }
+
+      /**
+       * Invoked concurrently by the workers of the pool. The "slot"
+       * is smaller than "GetChunkSize()", and two concurrent calls
+       * never share the same slot: It can index the copies of the
+       * resources that cannot be shared between threads (such as a
+       * parsed DICOM file).
+       **/
+      virtual void ExtractFrame(std::string& target,
+                                MimeType& mime,
+                                unsigned int slot,
+                                unsigned int frame) = 0;
+    };
+
+  private:
+    TaskPool&     pool_;
+    unsigned int  chunkSize_;
+
+    class ExtractTask;
+    class ConcatenatedFrames;
+
+    void ExtractChunk(std::vector<std::string>& parts,
+                      std::vector<MimeType>& mimes,
+                      IFrameSource& source,
+                      unsigned int first,
+                      unsigned int size);
+
+  public:
+    explicit FramesRangeExtractor(TaskPool& pool);
+
+    // Number of frames that are extracted in parallel
+    unsigned int GetChunkSize() const
+    {
+      return chunkSize_;
+    }
+
+    // Parses the "first" and "count" arguments of the REST API, that
+    // must be positive integers. A null "count" means "all frames".
+    static void ParseRange(unsigned int& first,
+                           unsigned int& count,
+                           const std::string& firstArgument,
+                           const std::string& countArgument);
+
+    // Restricts the range to the frames of the instance. Returns
+    // "false" if the range starts after the last frame.
+    static bool ClampRange(unsigned int& count,
+                           unsigned int first,
+                           unsigned int framesCount);
+
+    void Answer(RestApiOutput& output,
+                IFrameSource& source,
+                unsigned int first,
+                unsigned int count,
+                bool multipart);
+  };
+}
@@ -41,6 +41,7 @@
 #include "ExportedResource.h"
 
 #include <list>
+#include <utility>
 #include <boost/noncopyable.hpp>
 
 namespace Orthanc
@@ -48,6 +49,9 @@ namespace Orthanc
   class IDatabaseWrapper : public boost::noncopyable
   {
   public:
+    // Internal identifier of a resource, and one of its attachments
+    typedef std::pair<int64_t, FileInfo>  AttachmentOwner;
+
     virtual ~IDatabaseWrapper()
     {
     }
@@ -147,6 +151,27 @@ namespace Orthanc
                                   int64_t id,
                                   FileContentType contentType) = 0;
 
+    // Returns one of the attachments whose content is stored under
+    // "uuid" (used by content-addressed storage)
+    virtual bool LookupAttachmentByUuid(FileInfo& attachment,
+                                        const std::string& uuid) = 0;
+
+    // Lists, in increasing order and without duplicates, at most
+    // "limit" uuids of attachments that are strictly between "after"
+    // and "before" (used by the storage consistency checks)
+    virtual void ListAttachmentUuids(std::list<std::string>& target,
+                                     const std::string& after,
+                                     const std::string& before,
+                                     uint32_t limit) = 0;
+
+    // Lists, in increasing order of uuid and without duplicates, at
+    // most "limit" attachments whose uuid is strictly greater than
+    // "after", together with the internal identifier of one of the
+    // resources they belong to (used by the integrity checks)
+    virtual void ListAttachments(std::list<AttachmentOwner>& target,
+                                 const std::string& after,
+                                 uint32_t limit) = 0;
+
     virtual bool LookupGlobalProperty(std::string& target,
                                       GlobalProperty property) = 0;
 
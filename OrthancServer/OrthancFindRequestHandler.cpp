@@ -140,18 +140,13 @@ namespace Orthanc
     // WARNING: This function is slow, as it reads the JSON file
     // summarizing each instance of interest from the hard drive.
 
-    std::string formatted = tag.Format();
-
     for (std::list<std::string>::const_iterator
            it = instances.begin(); it != instances.end(); ++it)
     {
-      Json::Value dicom;
-      context.ReadDicomAsJson(dicom, *it);
+      Json::Value source;
 
-      if (dicom.isMember(formatted))
+      if (context.LookupDicomAsJsonTag(source, *it, tag))
       {
-        const Json::Value& source = dicom[formatted];
-
         if (source.type() == Json::objectValue &&
             source.isMember("Type") &&
             source.isMember("Value") &&
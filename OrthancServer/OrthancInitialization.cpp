@@ -46,6 +46,8 @@
 #include "../Core/OrthancException.h"
 #include "../Core/Toolbox.h"
 #include "../Core/FileStorage/FilesystemStorage.h"
+#include "../Core/FileStorage/PackedStorageArea.h"
+#include "../Core/FileStorage/TieredStorageArea.h"
 
 #include "ServerEnumerations.h"
 #include "DatabaseWrapper.h"
@@ -1074,10 +1076,11 @@ namespace Orthanc
     class FilesystemStorageWithoutDicom : public IStorageArea
     {
     private:
-      FilesystemStorage storage_;
+      std::auto_ptr<IStorageArea> storage_;
 
     public:
-      FilesystemStorageWithoutDicom(const std::string& path) : storage_(path)
+      // Takes the ownership of "storage"
+      FilesystemStorageWithoutDicom(IStorageArea* storage) : storage_(storage)
       {
       }
 
@@ -1088,7 +1091,7 @@ namespace Orthanc
       {
         if (type != FileContentType_Dicom)
         {
-          storage_.Create(uuid, content, size, type);
+          storage_->Create(uuid, content, size, type);
         }
       }
 
@@ -1098,7 +1101,28 @@ namespace Orthanc
       {
         if (type != FileContentType_Dicom)
         {
-          storage_.Read(content, uuid, type);
+          storage_->Read(content, uuid, type);
+        }
+        else
+        {
+          throw OrthancException(ErrorCode_UnknownResource);
+        }
+      }
+
+      virtual bool HasReadRange() const
+      {
+        return storage_->HasReadRange();
+      }
+
+      virtual void ReadRange(std::string& content,
+                             const std::string& uuid,
+                             FileContentType type,
+                             uint64_t start,
+                             uint64_t end)
+      {
+        if (type != FileContentType_Dicom)
+        {
+          storage_->ReadRange(content, uuid, type, start, end);
         }
         else
         {
@@ -1111,9 +1135,28 @@ namespace Orthanc
       {
         if (type != FileContentType_Dicom)
         {
-          storage_.Remove(uuid, type);
+          storage_->Remove(uuid, type);
         }
       }
+
+      virtual void ReadBatch(std::vector<std::string>& contents,
+                             const std::vector<std::string>& uuids,
+                             FileContentType type)
+      {
+        if (type != FileContentType_Dicom)
+        {
+          storage_->ReadBatch(contents, uuids, type);
+        }
+        else
+        {
+          throw OrthancException(ErrorCode_UnknownResource);
+        }
+      }
+
+      virtual void ComputeStatistics(Json::Value& target)
+      {
+        storage_->ComputeStatistics(target);
+      }
     };
   }
 
@@ -1125,14 +1168,94 @@ namespace Orthanc
     boost::filesystem::path storageDirectory = Configuration::InterpretStringParameterAsPath(storageDirectoryStr);
     LOG(WARNING) << "Storage directory: " << storageDirectory;
 
+    std::auto_ptr<IStorageArea> storage;
+
+    std::string coldDirectoryStr = Configuration::GetGlobalStringParameter("ColdStorageDirectory", "");
+    unsigned int packThreshold = Configuration::GetGlobalUnsignedIntegerParameter("PackedStorageThreshold", 0);
+    bool durableWrites = Configuration::GetGlobalBoolParameter("StorageDurableWrites", false);
+
+#if defined(_WIN32)
+    if (durableWrites)
+    {
+      // "SystemToolbox::SyncFilesystem()" is not available on Windows
+      LOG(ERROR) << "The option \"StorageDurableWrites\" is not supported on Windows";
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+#endif
+
+    if (packThreshold != 0)
+    {
+      if (!coldDirectoryStr.empty())
+      {
+        LOG(ERROR) << "The options \"PackedStorageThreshold\" and \"ColdStorageDirectory\" cannot be used together";
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      unsigned int segmentSize = Configuration::GetGlobalUnsignedIntegerParameter("PackedStorageSegmentSize", 256);
+
+      LOG(WARNING) << "Attachments below " << packThreshold << "KB are packed into segments of "
+                   << segmentSize << "MB";
+
+      std::auto_ptr<PackedStorageArea> packed
+        (new PackedStorageArea(storageDirectory.string(), 
+                               static_cast<size_t>(packThreshold) * 1024,
+                               static_cast<uint64_t>(segmentSize) * 1024 * 1024));
+
+      if (durableWrites)
+      {
+        LOG(WARNING) << "The attachments and the segments are flushed to the disk before being indexed";
+        packed->SetDurableWrites(true);
+      }
+
+      packed->Start();
+      storage.reset(packed.release());
+    }
+    else if (coldDirectoryStr.empty())
+    {
+      std::auto_ptr<FilesystemStorage> filesystem(new FilesystemStorage(storageDirectory.string()));
+      filesystem->SetIoThreadsCount(Configuration::GetGlobalUnsignedIntegerParameter("StorageIoThreads", 4));
+
+      if (durableWrites)
+      {
+        LOG(WARNING) << "The attachments are flushed to the disk before being indexed";
+        filesystem->SetDurableWrites(true);
+      }
+
+      storage.reset(filesystem.release());
+    }
+    else
+    {
+      boost::filesystem::path coldDirectory = Configuration::InterpretStringParameterAsPath(coldDirectoryStr);
+      unsigned int delay = Configuration::GetGlobalUnsignedIntegerParameter("ColdStorageDelay", 90);
+      unsigned int bandwidth = Configuration::GetGlobalUnsignedIntegerParameter("ColdStorageBandwidth", 20);
+
+      LOG(WARNING) << "Cold storage directory: " << coldDirectory << " (attachments not accessed for "
+                   << delay << " days are moved there)";
+
+      std::auto_ptr<TieredStorageArea> tiered
+        (new TieredStorageArea(storageDirectory.string(), coldDirectory.string()));
+      tiered->SetMigrationDelay(delay * 24 * 3600);
+      tiered->SetMigrationBandwidth(static_cast<uint64_t>(bandwidth) * 1024 * 1024);
+      tiered->SetIoThreadsCount(Configuration::GetGlobalUnsignedIntegerParameter("StorageIoThreads", 4));
+
+      if (durableWrites)
+      {
+        LOG(WARNING) << "The attachments are flushed to the disk before being indexed";
+        tiered->SetDurableWrites(true);
+      }
+
+      tiered->Start();
+      storage.reset(tiered.release());
+    }
+
     if (Configuration::GetGlobalBoolParameter("StoreDicom", true))
     {
-      return new FilesystemStorage(storageDirectory.string());
+      return storage.release();
     }
     else
     {
       LOG(WARNING) << "The DICOM files will not be stored, Orthanc running in index-only mode";
-      return new FilesystemStorageWithoutDicom(storageDirectory.string());
+      return new FilesystemStorageWithoutDicom(storage.release());
     }
   }
 
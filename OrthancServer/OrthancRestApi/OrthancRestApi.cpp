@@ -174,12 +174,12 @@ namespace Orthanc
   static const char* KEY_SYNCHRONOUS = "Synchronous";
   static const char* KEY_ASYNCHRONOUS = "Asynchronous";
   
-  void OrthancRestApi::SubmitCommandsJob(RestApiPostCall& call,
-                                         SetOfCommandsJob* job,
-                                         bool isDefaultSynchronous,
-                                         const Json::Value& body) const
+  void OrthancRestApi::SubmitGenericJob(RestApiPostCall& call,
+                                        IJob* job,
+                                        bool isDefaultSynchronous,
+                                        const Json::Value& body) const
   {
-    std::auto_ptr<SetOfCommandsJob> raii(job);
+    std::auto_ptr<IJob> raii(job);
     
     if (job == NULL)
     {
@@ -191,17 +191,6 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadFileFormat);
     }
 
-    job->SetDescription("REST API");
-    
-    if (body.isMember(KEY_PERMISSIVE))
-    {
-      job->SetPermissive(SerializationToolbox::ReadBoolean(body, KEY_PERMISSIVE));
-    }
-    else
-    {
-      job->SetPermissive(false);
-    }
-
     int priority = 0;
 
     if (body.isMember(KEY_PRIORITY))
@@ -247,6 +236,38 @@ namespace Orthanc
       call.GetOutput().AnswerJson(v);
     }
   }
+
+
+  void OrthancRestApi::SubmitCommandsJob(RestApiPostCall& call,
+                                         SetOfCommandsJob* job,
+                                         bool isDefaultSynchronous,
+                                         const Json::Value& body) const
+  {
+    std::auto_ptr<SetOfCommandsJob> raii(job);
+    
+    if (job == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    if (body.type() != Json::objectValue)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    job->SetDescription("REST API");
+    
+    if (body.isMember(KEY_PERMISSIVE))
+    {
+      job->SetPermissive(SerializationToolbox::ReadBoolean(body, KEY_PERMISSIVE));
+    }
+    else
+    {
+      job->SetPermissive(false);
+    }
+
+    SubmitGenericJob(call, raii.release(), isDefaultSynchronous, body);
+  }
   
 
   void OrthancRestApi::SubmitCommandsJob(RestApiPostCall& call,
@@ -103,6 +103,11 @@ namespace Orthanc
                               ResourceType resourceType,
                               StoreStatus status) const;
 
+    void SubmitGenericJob(RestApiPostCall& call,
+                          IJob* job,
+                          bool isDefaultSynchronous,
+                          const Json::Value& body) const;
+
     void SubmitCommandsJob(RestApiPostCall& call,
                            SetOfCommandsJob* job,
                            bool isDefaultSynchronous,
@@ -38,13 +38,19 @@
 #include "../../Core/DicomParsing/FromDcmtkBridge.h"
 #include "../../Core/DicomParsing/Internals/DicomImageDecoder.h"
 #include "../../Core/HttpServer/HttpContentNegociation.h"
+#include "../../Core/Images/Image.h"
+#include "../../Core/Images/ImageProcessing.h"
 #include "../../Core/Logging.h"
+#include "../FramesRangeExtractor.h"
 #include "../OrthancInitialization.h"
 #include "../Search/LookupResource.h"
 #include "../ServerContext.h"
 #include "../ServerToolbox.h"
 #include "../SliceOrdering.h"
 
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcsequen.h>
+
 
 namespace Orthanc
 {
@@ -239,6 +245,7 @@ namespace Orthanc
     ServerContext& context = OrthancRestApi::GetContext(call);
 
     std::string publicId = call.GetUriComponent("id", "");
+    context.PrefetchNeighbors(publicId);
     context.AnswerAttachment(call.GetOutput(), publicId, FileContentType_Dicom);
   }
 
@@ -334,56 +341,120 @@ namespace Orthanc
 
   namespace
   {
-    class ImageToEncode
+    class ImageEncoding
     {
     private:
-      std::auto_ptr<ImageAccessor>&  image_;
-      ImageExtractionMode            mode_;
-      bool                           invert_;
-      MimeType                       format_;
-      std::string                    answer_;
+      MimeType      format_;
+      uint8_t       quality_;
+      unsigned int  maxWidth_;
+      unsigned int  maxHeight_;
 
     public:
-      ImageToEncode(std::auto_ptr<ImageAccessor>& image,
-                    ImageExtractionMode mode,
-                    bool invert) :
-        image_(image),
-        mode_(mode),
-        invert_(invert)
+      ImageEncoding() :
+        format_(MimeType_Png),
+        quality_(0),
+        maxWidth_(0),
+        maxHeight_(0)
       {
       }
 
-      void Answer(RestApiOutput& output)
+      // "0" means no constraint on the corresponding dimension
+      void SetMaximumSize(unsigned int width,
+                          unsigned int height)
       {
-        output.AnswerBuffer(answer_, format_);
+        maxWidth_ = width;
+        maxHeight_ = height;
       }
 
-      void EncodeUsingPng()
+      void SetFormat(MimeType format,
+                     uint8_t quality)
       {
-        format_ = MimeType_Png;
-        DicomImageDecoder::ExtractPngImage(answer_, image_, mode_, invert_);
+        format_ = format;
+        quality_ = quality;
       }
 
-      void EncodeUsingPam()
+      MimeType GetFormat() const
       {
-        format_ = MimeType_Pam;
-        DicomImageDecoder::ExtractPamImage(answer_, image_, mode_, invert_);
+        return format_;
       }
 
-      void EncodeUsingJpeg(uint8_t quality)
+      // Identifies the encoding in the key of the cached renderings
+      std::string Format() const
       {
-        format_ = MimeType_Jpeg;
-        DicomImageDecoder::ExtractJpegImage(answer_, image_, mode_, invert_, quality);
+        return (std::string(EnumerationToString(format_)) + "|" +
+                boost::lexical_cast<std::string>(static_cast<unsigned int>(quality_)) + "|" +
+                boost::lexical_cast<std::string>(maxWidth_) + "x" +
+                boost::lexical_cast<std::string>(maxHeight_));
+      }
+
+      // Downscales the decoded image so that it fits the maximum
+      // size, preserving its aspect ratio. This is done before the
+      // extraction mode is applied, so that the cost of the
+      // remaining steps shrinks with the size of the output.
+      void Downscale(std::auto_ptr<ImageAccessor>& image) const
+      {
+        const unsigned int width = image->GetWidth();
+        const unsigned int height = image->GetHeight();
+
+        double scale = 1.0;
+
+        if (maxWidth_ != 0 &&
+            maxWidth_ < width)
+        {
+          scale = std::min(scale, static_cast<double>(maxWidth_) / static_cast<double>(width));
+        }
+
+        if (maxHeight_ != 0 &&
+            maxHeight_ < height)
+        {
+          scale = std::min(scale, static_cast<double>(maxHeight_) / static_cast<double>(height));
+        }
+
+        if (scale < 1.0)
+        {
+          // The images are never upscaled
+          unsigned int w = static_cast<unsigned int>(static_cast<double>(width) * scale + 0.5);
+          unsigned int h = static_cast<unsigned int>(static_cast<double>(height) * scale + 0.5);
+
+          std::auto_ptr<ImageAccessor> resized
+            (new Image(image->GetFormat(), std::max(1u, w), std::max(1u, h), false));
+          ImageProcessing::Resize(*resized, *image, ImageInterpolation_Box);
+          image = resized;
+        }
+      }
+
+      void Encode(std::string& target,
+                  std::auto_ptr<ImageAccessor>& image,
+                  ImageExtractionMode mode,
+                  bool invert) const
+      {
+        switch (format_)
+        {
+          case MimeType_Png:
+            DicomImageDecoder::ExtractPngImage(target, image, mode, invert);
+            break;
+
+          case MimeType_Pam:
+            DicomImageDecoder::ExtractPamImage(target, image, mode, invert);
+            break;
+
+          case MimeType_Jpeg:
+            DicomImageDecoder::ExtractJpegImage(target, image, mode, invert, quality_);
+            break;
+
+          default:
+            throw OrthancException(ErrorCode_InternalError);
+        }
       }
     };
 
     class EncodePng : public HttpContentNegociation::IHandler
     {
     private:
-      ImageToEncode&  image_;
+      ImageEncoding&  encoding_;
 
     public:
-      EncodePng(ImageToEncode& image) : image_(image)
+      EncodePng(ImageEncoding& encoding) : encoding_(encoding)
       {
       }
 
@@ -392,17 +463,17 @@ namespace Orthanc
       {
         assert(type == "image");
         assert(subtype == "png");
-        image_.EncodeUsingPng();
+        encoding_.SetFormat(MimeType_Png, 0);
       }
     };
 
     class EncodePam : public HttpContentNegociation::IHandler
     {
     private:
-      ImageToEncode&  image_;
+      ImageEncoding&  encoding_;
 
     public:
-      EncodePam(ImageToEncode& image) : image_(image)
+      EncodePam(ImageEncoding& encoding) : encoding_(encoding)
       {
       }
 
@@ -411,20 +482,20 @@ namespace Orthanc
       {
         assert(type == "image");
         assert(subtype == "x-portable-arbitrarymap");
-        image_.EncodeUsingPam();
+        encoding_.SetFormat(MimeType_Pam, 0);
       }
     };
 
     class EncodeJpeg : public HttpContentNegociation::IHandler
     {
     private:
-      ImageToEncode&  image_;
+      ImageEncoding&  encoding_;
       unsigned int    quality_;
 
     public:
-      EncodeJpeg(ImageToEncode& image,
+      EncodeJpeg(ImageEncoding& encoding,
                  const RestApiGetCall& call) :
-        image_(image)
+        encoding_(encoding)
       {
         std::string v = call.GetArgument("quality", "90" /* default JPEG quality */);
         bool ok = false;
@@ -450,14 +521,325 @@ namespace Orthanc
       {
         assert(type == "image");
         assert(subtype == "jpeg");
-        image_.EncodeUsingJpeg(quality_);
+        encoding_.SetFormat(MimeType_Jpeg, static_cast<uint8_t>(quality_));
+      }
+    };
+
+    // Rescale and VOI windowing of the grayscale frames. The window
+    // is read from the "window-center" and "window-width" arguments
+    // if present, otherwise from the DICOM dataset, and in last
+    // resort from the range of the rescaled values of the frame. In
+    // the enhanced multi-frame instances, the values of the
+    // per-frame functional groups take precedence over those of the
+    // shared functional groups, that override the top-level tags.
+    class FrameWindowing
+    {
+    private:
+      // Rescale and window of one frame, as read from the dataset
+      struct FrameParameters
+      {
+        bool   hasRescale;
+        float  slope;
+        float  intercept;
+        bool   hasWindow;
+        float  center;
+        float  width;
+
+        FrameParameters() :
+          hasRescale(false),
+          slope(1),
+          intercept(0),
+          hasWindow(false),
+          center(0),
+          width(0)
+        {
+        }
+
+        void Read(DcmItem& item)
+        {
+          float s, i;
+          if (ParseFirstValue(s, item, DCM_RescaleSlope) &&
+              ParseFirstValue(i, item, DCM_RescaleIntercept))
+          {
+            hasRescale = true;
+            slope = s;
+            intercept = i;
+          }
+
+          float c, w;
+          if (ParseFirstValue(c, item, DCM_WindowCenter) &&
+              ParseFirstValue(w, item, DCM_WindowWidth) &&
+              w >= 1.0f)
+          {
+            hasWindow = true;
+            center = c;
+            width = w;
+          }
+        }
+
+        // Reads the "Pixel Value Transformation" and "Frame VOI LUT"
+        // macros of one item of a functional groups sequence
+        void ReadFunctionalGroup(DcmItem& group)
+        {
+          DcmItem* item = NULL;
+
+          if (group.findAndGetSequenceItem(DCM_PixelValueTransformationSequence, item, 0).good() &&
+              item != NULL)
+          {
+            Read(*item);
+          }
+
+          item = NULL;
+          if (group.findAndGetSequenceItem(DCM_FrameVOILUTSequence, item, 0).good() &&
+              item != NULL)
+          {
+            Read(*item);
+          }
+        }
+
+        void Override(const FrameParameters& other)
+        {
+          if (other.hasRescale)
+          {
+            hasRescale = true;
+            slope = other.slope;
+            intercept = other.intercept;
+          }
+
+          if (other.hasWindow)
+          {
+            hasWindow = true;
+            center = other.center;
+            width = other.width;
+          }
+        }
+      };
+
+      bool   hasArguments_;
+      float  center_;
+      float  width_;
+
+      FrameParameters               dataset_;  // Top-level tags and shared functional groups
+      std::vector<FrameParameters>  frames_;   // Per-frame functional groups
+
+      static float ParseArgument(const RestApiGetCall& call,
+                                 const std::string& name)
+      {
+        std::string v = call.GetArgument(name, "");
+
+        try
+        {
+          return boost::lexical_cast<float>(v);
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+          LOG(ERROR) << "Bad value for the \"" << name << "\" argument (must be a number): " << v;
+          throw OrthancException(ErrorCode_BadRequest);
+        }
+      }
+
+      static bool ParseFirstValue(float& target,
+                                  DcmItem& item,
+                                  const DcmTagKey& tag)
+      {
+        // These tags are multi-valued (e.g. "40\400" for a window
+        // center), in which case the first value is used
+        Float64 value;
+        if (item.findAndGetFloat64(tag, value, 0).good())
+        {
+          target = static_cast<float>(value);
+          return true;
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+    public:
+      FrameWindowing() :
+        hasArguments_(false),
+        center_(0),
+        width_(0)
+      {
+      }
+
+      void ReadArguments(const RestApiGetCall& call)
+      {
+        bool hasCenter = call.HasArgument("window-center");
+        bool hasWidth = call.HasArgument("window-width");
+
+        if (hasCenter != hasWidth)
+        {
+          LOG(ERROR) << "The \"window-center\" and \"window-width\" arguments must be provided together";
+          throw OrthancException(ErrorCode_BadRequest);
+        }
+
+        if (hasCenter)
+        {
+          center_ = ParseArgument(call, "window-center");
+          width_ = ParseArgument(call, "window-width");
+
+          if (width_ < 1.0f)
+          {
+            LOG(ERROR) << "The \"window-width\" argument must be greater or equal to 1";
+            throw OrthancException(ErrorCode_BadRequest);
+          }
+
+          hasArguments_ = true;
+        }
+      }
+
+      void ReadDataset(const ParsedDicomFile& dicom)
+      {
+        DcmDataset& dataset = *dicom.GetDcmtkObject().getDataset();
+
+        dataset_ = FrameParameters();
+        dataset_.Read(dataset);
+
+        DcmItem* shared = NULL;
+        if (dataset.findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, shared, 0).good() &&
+            shared != NULL)
+        {
+          FrameParameters p;
+          p.ReadFunctionalGroup(*shared);
+          dataset_.Override(p);
+        }
+
+        frames_.clear();
+
+        DcmSequenceOfItems* perFrame = NULL;
+        if (dataset.findAndGetSequence(DCM_PerFrameFunctionalGroupsSequence, perFrame).good() &&
+            perFrame != NULL)
+        {
+          frames_.resize(perFrame->card());
+
+          for (unsigned long i = 0; i < perFrame->card(); i++)
+          {
+            DcmItem* item = perFrame->getItem(i);
+            if (item != NULL)
+            {
+              frames_[i].ReadFunctionalGroup(*item);
+            }
+          }
+        }
+      }
+
+      // Identifies the arguments that were provided in the request,
+      // to distinguish between renderings in the cache
+      std::string Format() const
+      {
+        if (hasArguments_)
+        {
+          return (boost::lexical_cast<std::string>(center_) + "|" +
+                  boost::lexical_cast<std::string>(width_));
+        }
+        else
+        {
+          return "dataset";
+        }
+      }
+
+      // Returns "false" if the image is not grayscale, in which case
+      // it is left unchanged
+      bool Apply(std::auto_ptr<ImageAccessor>& image,
+                 unsigned int frame,
+                 bool invert) const
+      {
+        if (image->GetFormat() != PixelFormat_Grayscale8 &&
+            image->GetFormat() != PixelFormat_Grayscale16 &&
+            image->GetFormat() != PixelFormat_SignedGrayscale16)
+        {
+          return false;
+        }
+
+        FrameParameters p = dataset_;
+        if (frame < frames_.size())
+        {
+          p.Override(frames_[frame]);
+        }
+
+        if (hasArguments_)
+        {
+          p.hasWindow = true;
+          p.center = center_;
+          p.width = width_;
+        }
+
+        if (!p.hasWindow)
+        {
+          int64_t a, b;
+          ImageProcessing::GetMinMaxIntegerValue(a, b, *image);
+
+          float low = p.slope * static_cast<float>(a) + p.intercept;
+          float high = p.slope * static_cast<float>(b) + p.intercept;
+          if (low > high)
+          {
+            std::swap(low, high);
+          }
+
+          p.center = (low + high) / 2.0f;
+          p.width = std::max(1.0f, high - low);
+        }
+
+        std::auto_ptr<ImageAccessor> windowed
+          (new Image(PixelFormat_Grayscale8, image->GetWidth(), image->GetHeight(), false));
+        ImageProcessing::ApplyWindowing(*windowed, *image, p.center, p.width, p.slope, p.intercept, invert);
+        image = windowed;
+
+        return true;
       }
     };
   }
 
 
-  template <enum ImageExtractionMode mode>
-  static void GetImage(RestApiGetCall& call)
+  static unsigned int GetUnsignedIntegerArgument(const RestApiGetCall& call,
+                                                 const std::string& name)
+  {
+    std::string v = call.GetArgument(name, "0");
+
+    try
+    {
+      return boost::lexical_cast<unsigned int>(v);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      LOG(ERROR) << "Bad value for the \"" << name << "\" argument (must be a positive integer): " << v;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+  }
+
+
+  static bool IsNotModified(const RestApiGetCall& call,
+                            const std::string& etag)
+  {
+    IHttpHandler::Arguments::const_iterator found = call.GetHttpHeaders().find("if-none-match");
+    if (found == call.GetHttpHeaders().end())
+    {
+      return false;
+    }
+
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, found->second, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      std::string token = Toolbox::StripSpaces(tokens[i]);
+      if (token == "*" ||
+          token == etag ||
+          token == "W/" + etag)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  static void AnswerImage(RestApiGetCall& call,
+                          ImageExtractionMode mode,
+                          bool rendered)
   {
     ServerContext& context = OrthancRestApi::GetContext(call);
 
@@ -473,95 +855,189 @@ namespace Orthanc
       return;
     }
 
-    bool invert = false;
-    std::auto_ptr<ImageAccessor> decoded;
+    ImageEncoding encoding;
 
-    try
+    HttpContentNegociation negociation;
+    EncodePng png(encoding);
+    negociation.Register(MIME_PNG, png);
+
+    EncodeJpeg jpeg(encoding, call);
+    negociation.Register(MIME_JPEG, jpeg);
+
+    EncodePam pam(encoding);
+    negociation.Register(MIME_PAM, pam);
+
+    if (!negociation.Apply(call.GetHttpHeaders()))
+    {
+      return;
+    }
+
+    encoding.SetMaximumSize(GetUnsignedIntegerArgument(call, "width"),
+                            GetUnsignedIntegerArgument(call, "height"));
+
+    FrameWindowing windowing;
+    if (rendered)
+    {
+      windowing.ReadArguments(call);
+    }
+
+    std::string publicId = call.GetUriComponent("id", "");
+    context.PrefetchNeighbors(publicId);
+
+    // The renderings are identified by the DICOM file they are
+    // computed from, which changes if the instance is overwritten.
+    // The generation of the cache is retrieved beforehand, so that the
+    // rendering is not cached if this file is removed meanwhile.
+    const uint64_t generation = context.GetRenderingsCache().GetGeneration();
+
+    FileInfo dicom;
+    if (!context.GetIndex().LookupAttachment(dicom, publicId, FileContentType_Dicom))
     {
-      std::string publicId = call.GetUriComponent("id", "");
+      return;
+    }
+
+    std::string parameters = (boost::lexical_cast<std::string>(frame) + "|" +
+                              boost::lexical_cast<std::string>(mode) + "|" +
+                              encoding.Format());
+    if (rendered)
+    {
+      parameters += "|rendered|" + windowing.Format();
+    }
+
+    const std::string key = RenderedImageCache::ComputeKey(dicom.GetUuid(), parameters);
+    const std::string etag = RenderedImageCache::ComputeETag(key);
+
+    if (IsNotModified(call, etag))
+    {
+      call.GetOutput().SetHttpHeader("ETag", etag);
+      call.GetOutput().AnswerNotModified();
+      return;
+    }
 
+    std::string rendering;
+    MimeType mime;
+
+    if (!context.GetRenderingsCache().Fetch(rendering, mime, key))
+    {
+      bool invert = false;
+      std::auto_ptr<ImageAccessor> decoded;
+
+      try
+      {
 #if ORTHANC_ENABLE_PLUGINS == 1
-      if (context.GetPlugins().HasCustomImageDecoder())
-      {
-        // TODO create a cache of file
-        std::string dicomContent;
-        context.ReadDicom(dicomContent, publicId);
-        decoded.reset(context.GetPlugins().DecodeUnsafe(dicomContent.c_str(), dicomContent.size(), frame));
-
-        /**
-         * Note that we call "DecodeUnsafe()": We do not fallback to
-         * the builtin decoder if no installed decoder plugin is able
-         * to decode the image. This allows us to take advantage of
-         * the cache below.
-         **/
-
-        if (mode == ImageExtractionMode_Preview &&
-            decoded.get() != NULL)
+        if (context.GetPlugins().HasCustomImageDecoder())
         {
-          // TODO Optimize this lookup for photometric interpretation:
-          // It should be implemented by the plugin to avoid parsing
-          // twice the DICOM file
-          ParsedDicomFile parsed(dicomContent);
+          // TODO create a cache of file
+          std::string dicomContent;
+          context.ReadDicom(dicomContent, publicId);
+          decoded.reset(context.GetPlugins().DecodeUnsafe(dicomContent.c_str(), dicomContent.size(), frame));
+
+          /**
+           * Note that we call "DecodeUnsafe()": We do not fallback to
+           * the builtin decoder if no installed decoder plugin is able
+           * to decode the image. This allows us to take advantage of
+           * the cache below.
+           **/
+
+          if (mode == ImageExtractionMode_Preview &&
+              decoded.get() != NULL)
+          {
+            // TODO Optimize this lookup for photometric interpretation:
+            // It should be implemented by the plugin to avoid parsing
+            // twice the DICOM file
+            ParsedDicomFile parsed(dicomContent);
           
+            PhotometricInterpretation photometric;
+            if (parsed.LookupPhotometricInterpretation(photometric))
+            {
+              invert = (photometric == PhotometricInterpretation_Monochrome1);
+            }
+
+            if (rendered)
+            {
+              windowing.ReadDataset(parsed);
+            }
+          }
+        }
+#endif
+
+        if (decoded.get() == NULL)
+        {
+          // Use Orthanc's built-in decoder, using the cache to speed-up
+          // things on multi-frame images
+          ServerContext::DicomCacheLocker locker(context, publicId);        
+          decoded.reset(DicomImageDecoder::Decode(locker.GetDicom(), frame));
+
           PhotometricInterpretation photometric;
-          if (parsed.LookupPhotometricInterpretation(photometric))
+          if (mode == ImageExtractionMode_Preview &&
+              locker.GetDicom().LookupPhotometricInterpretation(photometric))
           {
             invert = (photometric == PhotometricInterpretation_Monochrome1);
           }
+
+          if (rendered)
+          {
+            windowing.ReadDataset(locker.GetDicom());
+          }
         }
-      }
-#endif
 
-      if (decoded.get() == NULL)
+        // Inside the "try" block, as the pixel format might not be
+        // supported by the resizing
+        encoding.Downscale(decoded);
+      }
+      catch (OrthancException& e)
       {
-        // Use Orthanc's built-in decoder, using the cache to speed-up
-        // things on multi-frame images
-        ServerContext::DicomCacheLocker locker(context, publicId);        
-        decoded.reset(DicomImageDecoder::Decode(locker.GetDicom(), frame));
-
-        PhotometricInterpretation photometric;
-        if (mode == ImageExtractionMode_Preview &&
-            locker.GetDicom().LookupPhotometricInterpretation(photometric))
+        if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
         {
-          invert = (photometric == PhotometricInterpretation_Monochrome1);
+          // The frame number is out of the range for this DICOM
+          // instance, the resource is not existent
         }
+        else
+        {
+          std::string root = "";
+          for (size_t i = 1; i < call.GetFullUri().size(); i++)
+          {
+            root += "../";
+          }
+
+          call.GetOutput().Redirect(root + "app/images/unsupported.png");
+        }
+
+        return;
       }
-    }
-    catch (OrthancException& e)
-    {
-      if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
+
+      if (rendered &&
+          windowing.Apply(decoded, frame, invert))
       {
-        // The frame number is out of the range for this DICOM
-        // instance, the resource is not existent
+        // The windowing produces the final 8bpp image, which reduces
+        // the encoding to a plain copy of the pixels
+        encoding.Encode(rendering, decoded, ImageExtractionMode_UInt8, false);
       }
       else
       {
-        std::string root = "";
-        for (size_t i = 1; i < call.GetFullUri().size(); i++)
-        {
-          root += "../";
-        }
-
-        call.GetOutput().Redirect(root + "app/images/unsupported.png");
+        encoding.Encode(rendering, decoded, mode, invert);
       }
+
+      mime = encoding.GetFormat();
+
+      context.GetRenderingsCache().Add(key, rendering, mime, generation);
     }
 
-    ImageToEncode image(decoded, mode, invert);
+    call.GetOutput().SetHttpHeader("ETag", etag);
+    call.GetOutput().AnswerBuffer(rendering, mime);
+  }
 
-    HttpContentNegociation negociation;
-    EncodePng png(image);
-    negociation.Register(MIME_PNG, png);
 
-    EncodeJpeg jpeg(image, call);
-    negociation.Register(MIME_JPEG, jpeg);
+  template <enum ImageExtractionMode mode>
+  static void GetImage(RestApiGetCall& call)
+  {
+    AnswerImage(call, mode, false);
+  }
 
-    EncodePam pam(image);
-    negociation.Register(MIME_PAM, pam);
 
-    if (negociation.Apply(call.GetHttpHeaders()))
-    {
-      image.Answer(call.GetOutput());
-    }
+  static void GetRenderedFrame(RestApiGetCall& call)
+  {
+    AnswerImage(call, ImageExtractionMode_Preview, true);
   }
 
 
@@ -619,8 +1095,13 @@ namespace Orthanc
     std::string raw;
     MimeType mime;
 
+    ServerContext& context = OrthancRestApi::GetContext(call);
+    context.PrefetchNeighbors(publicId);
+
+    if (!context.ReadRawFrame(raw, mime, publicId, frame))
     {
-      ServerContext::DicomCacheLocker locker(OrthancRestApi::GetContext(call), publicId);
+      // No offset table for this instance: Parse the DICOM file
+      ServerContext::DicomCacheLocker locker(context, publicId);
       locker.GetDicom().GetRawFrame(raw, mime, frame);
     }
 
@@ -638,6 +1119,452 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    // Reads the raw frames directly from the storage area, using the
+    // "FrameOffsets" metadata: No DICOM file is parsed
+    class StoredRawFrames : public FramesRangeExtractor::IFrameSource
+    {
+    private:
+      ServerContext&                context_;
+      const DicomFrameOffsetTable&  offsets_;
+      const FileInfo&               attachment_;
+
+    public:
+      StoredRawFrames(ServerContext& context,
+                      const DicomFrameOffsetTable& offsets,
+                      const FileInfo& attachment) :
+        context_(context),
+        offsets_(offsets),
+        attachment_(attachment)
+      {
+      }
+
+      virtual void ExtractFrame(std::string& target,
+                                MimeType& mime,
+                                unsigned int slot,
+                                unsigned int frame)
+      {
+        context_.ReadRawFrame(target, offsets_, attachment_, frame);
+        mime = offsets_.GetMimeType();
+      }
+    };
+
+
+    // Copies the raw frames out of one parsed DICOM file. This is a
+    // mere copy of memory, so the accesses to the parsed file are
+    // simply serialized, as DCMTK is not thread-safe.
+    class ParsedRawFrames : public FramesRangeExtractor::IFrameSource
+    {
+    private:
+      boost::mutex      mutex_;
+      ParsedDicomFile&  dicom_;
+
+    public:
+      explicit ParsedRawFrames(ParsedDicomFile& dicom) :
+        dicom_(dicom)
+      {
+      }
+
+      virtual void ExtractFrame(std::string& target,
+                                MimeType& mime,
+                                unsigned int slot,
+                                unsigned int frame)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        dicom_.GetRawFrame(target, mime, frame);
+      }
+    };
+
+
+    /**
+     * Decodes and encodes the frames in parallel. The DICOM file is
+     * not copied for each thread: Each frame is decoded from a small
+     * DICOM file made of the header of the instance and of this only
+     * raw frame, which is extracted by "rawFrames". If the header
+     * cannot be separated from the pixel data (e.g. big endian
+     * transfer syntax), the frames are decoded from the cached DICOM
+     * file, whose accesses are serialized as DCMTK is not
+     * thread-safe. The renderings are shared with the cache of
+     * "/instances/{id}/frames/{frame}/rendered".
+     **/
+    class RenderedFrames : public FramesRangeExtractor::IFrameSource
+    {
+    private:
+      ServerContext&                        context_;
+      const std::string&                    dicom_;
+      FramesRangeExtractor::IFrameSource*   rawFrames_;
+      ParsedDicomFile&                      parsed_;
+      boost::mutex                          mutex_;
+      const ImageEncoding&                  encoding_;
+      const FrameWindowing&                 windowing_;
+      bool                                  invert_;
+      std::string                           uuid_;
+      uint64_t                              generation_;
+      std::string                           parameters_;
+      bool                                  customDecoder_;
+
+      ImageAccessor* Decode(unsigned int slot,
+                            unsigned int frame)
+      {
+        if (rawFrames_ != NULL)
+        {
+          // "dicom_" only contains the header of the DICOM file
+          std::string raw;
+          MimeType mime;
+          rawFrames_->ExtractFrame(raw, mime, slot, frame);
+
+          std::auto_ptr<ParsedDicomFile> single
+            (ParsedDicomFile::CreateSingleFrame(dicom_.c_str(), dicom_.size(), raw));
+
+#if ORTHANC_ENABLE_PLUGINS == 1
+          if (customDecoder_)
+          {
+            std::string buffer;
+            single->SaveToMemoryBuffer(buffer);
+
+            std::auto_ptr<ImageAccessor> decoded
+              (context_.GetPlugins().DecodeUnsafe(buffer.c_str(), buffer.size(), 0));
+            if (decoded.get() != NULL)
+            {
+              return decoded.release();
+            }
+          }
+#endif
+
+          return DicomImageDecoder::Decode(*single, 0);
+        }
+        else
+        {
+#if ORTHANC_ENABLE_PLUGINS == 1
+          if (customDecoder_)
+          {
+            // "dicom_" contains the whole DICOM file
+            std::auto_ptr<ImageAccessor> decoded
+              (context_.GetPlugins().DecodeUnsafe(dicom_.c_str(), dicom_.size(), frame));
+            if (decoded.get() != NULL)
+            {
+              return decoded.release();
+            }
+          }
+#endif
+
+          boost::mutex::scoped_lock lock(mutex_);
+          return DicomImageDecoder::Decode(parsed_, frame);
+        }
+      }
+
+    public:
+      /**
+       * If "rawFrames" is not NULL, "dicom" is the beginning of the
+       * DICOM file up to the header of its pixel data, and "parsed"
+       * is parsed from it. Otherwise, "dicom" is the whole DICOM file
+       * (only used by the decoder plugins), and "parsed" is the
+       * cached DICOM file, that must stay locked.
+       **/
+      RenderedFrames(ServerContext& context,
+                     const std::string& dicom,
+                     FramesRangeExtractor::IFrameSource* rawFrames,
+                     ParsedDicomFile& parsed,
+                     const FileInfo& attachment,
+                     uint64_t generation,
+                     const ImageEncoding& encoding,
+                     const FrameWindowing& windowing) :
+        context_(context),
+        dicom_(dicom),
+        rawFrames_(rawFrames),
+        parsed_(parsed),
+        encoding_(encoding),
+        windowing_(windowing),
+        invert_(false),
+        uuid_(attachment.GetUuid()),
+        generation_(generation),
+        parameters_("|" + boost::lexical_cast<std::string>(ImageExtractionMode_Preview) +
+                    "|" + encoding.Format() + "|rendered|" + windowing.Format()),
+        customDecoder_(false)
+      {
+#if ORTHANC_ENABLE_PLUGINS == 1
+        customDecoder_ = context.GetPlugins().HasCustomImageDecoder();
+#endif
+      }
+
+      void SetInvert(bool invert)
+      {
+        invert_ = invert;
+      }
+
+      virtual void ExtractFrame(std::string& target,
+                                MimeType& mime,
+                                unsigned int slot,
+                                unsigned int frame)
+      {
+        const std::string key = RenderedImageCache::ComputeKey
+          (uuid_, boost::lexical_cast<std::string>(frame) + parameters_);
+
+        if (context_.GetRenderingsCache().Fetch(target, mime, key))
+        {
+          return;
+        }
+
+        std::auto_ptr<ImageAccessor> decoded(Decode(slot, frame));
+
+        encoding_.Downscale(decoded);
+
+        if (windowing_.Apply(decoded, frame, invert_))
+        {
+          encoding_.Encode(target, decoded, ImageExtractionMode_UInt8, false);
+        }
+        else
+        {
+          encoding_.Encode(target, decoded, ImageExtractionMode_Preview, invert_);
+        }
+
+        mime = encoding_.GetFormat();
+        context_.GetRenderingsCache().Add(key, target, mime, generation_);
+      }
+    };
+
+
+    class FramesContainer : public HttpContentNegociation::IHandler
+    {
+    private:
+      bool&  multipart_;
+
+    public:
+      FramesContainer(bool& multipart) : multipart_(multipart)
+      {
+      }
+
+      virtual void Handle(const std::string& type,
+                          const std::string& subtype)
+      {
+        multipart_ = (type == "multipart");
+      }
+    };
+  }
+
+
+  static void ReadRenderedFormat(ImageEncoding& encoding,
+                                 const RestApiGetCall& call)
+  {
+    // The "Accept" header selects the container of the frames, so
+    // their encoding is given as an argument
+    std::string format = call.GetArgument("format", "png");
+
+    if (format == "png")
+    {
+      encoding.SetFormat(MimeType_Png, 0);
+    }
+    else if (format == "pam")
+    {
+      encoding.SetFormat(MimeType_Pam, 0);
+    }
+    else if (format == "jpeg")
+    {
+      EncodeJpeg jpeg(encoding, call);
+      jpeg.Handle("image", "jpeg");
+    }
+    else
+    {
+      LOG(ERROR) << "Unsupported format for the rendered frames (must be \"png\", \"jpeg\" or \"pam\"): " << format;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+  }
+
+
+  static bool IsUncompressedTransferSyntax(const std::string& transferSyntax)
+  {
+    return (transferSyntax == "1.2.840.10008.1.2" ||       // Implicit VR Little Endian
+            transferSyntax == "1.2.840.10008.1.2.1" ||     // Explicit VR Little Endian
+            transferSyntax == "1.2.840.10008.1.2.1.99" ||  // Deflated Explicit VR Little Endian
+            transferSyntax == "1.2.840.10008.1.2.2");      // Explicit VR Big Endian
+  }
+
+
+  static void RejectConcatenation()
+  {
+    LOG(ERROR) << "The raw frames can only be concatenated for the uncompressed "
+               << "transfer syntaxes, accept \"multipart/related\" instead";
+    throw OrthancException(ErrorCode_NotAcceptable);
+  }
+
+
+  /**
+   * Answers the range of frames given by the "first" and "count"
+   * arguments, either as a "multipart/related" stream or as the
+   * concatenation of the frames (if "application/octet-stream" is
+   * accepted, only for the uncompressed raw frames, whose size is
+   * constant). The raw frames are read from the storage area if
+   * their offsets are known, and copied from the cached DICOM file
+   * otherwise. The rendered frames are decoded in parallel.
+   **/
+  static void AnswerFrames(RestApiGetCall& call,
+                           bool rendered)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    bool multipart = true;
+    FramesContainer container(multipart);
+
+    HttpContentNegociation negociation;
+    negociation.Register("multipart/related", container);
+
+    if (!rendered)
+    {
+      // The rendered frames have no constant size, so they cannot be
+      // split by the client if they are concatenated
+      negociation.Register(MIME_BINARY, container);
+    }
+
+    if (!negociation.Apply(call.GetHttpHeaders()))
+    {
+      return;
+    }
+
+    ImageEncoding encoding;
+    FrameWindowing windowing;
+
+    if (rendered)
+    {
+      ReadRenderedFormat(encoding, call);
+      encoding.SetMaximumSize(GetUnsignedIntegerArgument(call, "width"),
+                              GetUnsignedIntegerArgument(call, "height"));
+      windowing.ReadArguments(call);
+    }
+
+    unsigned int first, count;
+    FramesRangeExtractor::ParseRange(first, count, call.GetArgument("first", "0"),
+                                     call.GetArgument("count", "0"));
+
+    std::string publicId = call.GetUriComponent("id", "");
+
+    const uint64_t generation = context.GetRenderingsCache().GetGeneration();
+
+    FileInfo attachment;
+    if (!context.GetIndex().LookupAttachment(attachment, publicId, FileContentType_Dicom))
+    {
+      return;
+    }
+
+    FramesRangeExtractor extractor(context.GetImageProcessingPool());
+
+    if (rendered)
+    {
+      // Only the header of the DICOM file is read and parsed here
+      // (unless its transfer syntax prevents it)
+      std::string dicom;
+      context.ReadDicomUntilPixelData(dicom, publicId);
+
+      uint64_t headerStart, valueStart;
+      const bool hasHeader = (!dicom.empty() &&
+                              DicomFrameOffsetTable::LookupPixelData
+                              (headerStart, valueStart, dicom.c_str(), dicom.size()) ==
+                              DicomFrameOffsetTable::PixelDataLookup_Found);
+
+      std::auto_ptr<ParsedDicomFile> header;
+      std::auto_ptr<ServerContext::DicomCacheLocker> locker;
+      std::auto_ptr<FramesRangeExtractor::IFrameSource> rawFrames;
+      DicomFrameOffsetTable offsets;
+
+      if (hasHeader)
+      {
+        dicom.resize(static_cast<size_t>(valueStart));
+        header.reset(ParsedDicomFile::CreateUntilPixelData(dicom.c_str(), dicom.size()));
+
+        if (context.LookupFrameOffsets(offsets, attachment, publicId))
+        {
+          rawFrames.reset(new StoredRawFrames(context, offsets, attachment));
+        }
+        else
+        {
+          locker.reset(new ServerContext::DicomCacheLocker(context, publicId));
+          rawFrames.reset(new ParsedRawFrames(locker->GetDicom()));
+        }
+      }
+      else
+      {
+        locker.reset(new ServerContext::DicomCacheLocker(context, publicId));
+
+#if ORTHANC_ENABLE_PLUGINS == 1
+        if (!context.GetPlugins().HasCustomImageDecoder())
+#endif
+        {
+          // The whole DICOM file is only kept for the decoder plugins
+          dicom.clear();
+        }
+      }
+
+      ParsedDicomFile& parsed = (hasHeader ? *header : locker->GetDicom());
+
+      RenderedFrames source(context, dicom, rawFrames.get(), parsed, attachment,
+                            generation, encoding, windowing);
+
+      if (!FramesRangeExtractor::ClampRange(count, first, parsed.GetFramesCount()))
+      {
+        return;
+      }
+
+      PhotometricInterpretation photometric;
+      if (parsed.LookupPhotometricInterpretation(photometric))
+      {
+        source.SetInvert(photometric == PhotometricInterpretation_Monochrome1);
+      }
+
+      windowing.ReadDataset(parsed);
+
+      extractor.Answer(call.GetOutput(), source, first, count, multipart);
+    }
+    else
+    {
+      DicomFrameOffsetTable offsets;
+      if (context.LookupFrameOffsets(offsets, attachment, publicId))
+      {
+        if (!multipart &&
+            !offsets.IsNative())
+        {
+          RejectConcatenation();
+        }
+
+        if (FramesRangeExtractor::ClampRange(count, first, offsets.GetFramesCount()))
+        {
+          StoredRawFrames source(context, offsets, attachment);
+          extractor.Answer(call.GetOutput(), source, first, count, multipart);
+        }
+      }
+      else
+      {
+        // No offset table for this instance: Parse the DICOM file
+        ServerContext::DicomCacheLocker locker(context, publicId);
+
+        std::string transferSyntax;
+        if (!multipart &&
+            (!locker.GetDicom().LookupTransferSyntax(transferSyntax) ||
+             !IsUncompressedTransferSyntax(transferSyntax)))
+        {
+          RejectConcatenation();
+        }
+
+        if (FramesRangeExtractor::ClampRange(count, first, locker.GetDicom().GetFramesCount()))
+        {
+          ParsedRawFrames source(locker.GetDicom());
+          extractor.Answer(call.GetOutput(), source, first, count, multipart);
+        }
+      }
+    }
+  }
+
+
+  static void GetRawFrames(RestApiGetCall& call)
+  {
+    AnswerFrames(call, false);
+  }
+
+
+  static void GetRenderedFrames(RestApiGetCall& call)
+  {
+    AnswerFrames(call, true);
+  }
+
 
   static void GetResourceStatistics(RestApiGetCall& call)
   {
@@ -856,12 +1783,36 @@ namespace Orthanc
   }
 
 
+  // The "dicom-as-json" attachment of an instance is always answered
+  // as a textual JSON document, even if it is stored in the binary
+  // format (cf. "ServerContext::AnswerAttachment()"): Its size and its
+  // MD5 must describe the answered document, not the stored one
+  static bool ReadAnsweredDicomAsJson(std::string& json,
+                                      RestApiGetCall& call)
+  {
+    if (StringToContentType(call.GetUriComponent("name", "")) == FileContentType_DicomAsJson &&
+        StringToResourceType(call.GetUriComponent("resourceType", "").c_str()) == ResourceType_Instance)
+    {
+      OrthancRestApi::GetContext(call).ReadDicomAsJson(json, call.GetUriComponent("id", ""));
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
   static void GetAttachmentSize(RestApiGetCall& call)
   {
     FileInfo info;
     if (GetAttachmentInfo(info, call))
     {
-      call.GetOutput().AnswerBuffer(boost::lexical_cast<std::string>(info.GetUncompressedSize()), MimeType_PlainText);
+      std::string json;
+      uint64_t size = (ReadAnsweredDicomAsJson(json, call) ?
+                       static_cast<uint64_t>(json.size()) : info.GetUncompressedSize());
+
+      call.GetOutput().AnswerBuffer(boost::lexical_cast<std::string>(size), MimeType_PlainText);
     }
   }
 
@@ -882,7 +1833,17 @@ namespace Orthanc
     if (GetAttachmentInfo(info, call) &&
         info.GetUncompressedMD5() != "")
     {
-      call.GetOutput().AnswerBuffer(boost::lexical_cast<std::string>(info.GetUncompressedMD5()), MimeType_PlainText);
+      std::string json;
+      if (ReadAnsweredDicomAsJson(json, call))
+      {
+        std::string md5;
+        Toolbox::ComputeMD5(md5, json);
+        call.GetOutput().AnswerBuffer(md5, MimeType_PlainText);
+      }
+      else
+      {
+        call.GetOutput().AnswerBuffer(boost::lexical_cast<std::string>(info.GetUncompressedMD5()), MimeType_PlainText);
+      }
     }
   }
 
@@ -1040,11 +2001,28 @@ namespace Orthanc
 
   static void GetRawContent(RestApiGetCall& call)
   {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
     std::string id = call.GetUriComponent("id", "");
+    const UriComponents& path = call.GetTrailingUri();
 
-    ServerContext::DicomCacheLocker locker(OrthancRestApi::GetContext(call), id);
+    if (!path.empty() &&
+        !(FromDcmtkBridge::ParseTag(path[0]) < DICOM_TAG_PIXEL_DATA))
+    {
+      // Access to the pixel data, or to one of the few elements that
+      // come after it: The full DICOM file is needed
+      ServerContext::DicomCacheLocker locker(context, id);
+      locker.GetDicom().SendPathValue(call.GetOutput(), path);
+    }
+    else
+    {
+      std::string dicom;
+      context.ReadDicomUntilPixelData(dicom, id);
 
-    locker.GetDicom().SendPathValue(call.GetOutput(), call.GetTrailingUri());
+      std::auto_ptr<ParsedDicomFile> parsed
+        (ParsedDicomFile::CreateUntilPixelData(dicom.empty() ? NULL : dicom.c_str(), dicom.size()));
+      parsed->SendPathValue(call.GetOutput(), path);
+    }
   }
 
 
@@ -1493,16 +2471,18 @@ namespace Orthanc
 
     std::string publicId = call.GetUriComponent("id", "");
 
-    std::string dicomContent;
-    context.ReadDicom(dicomContent, publicId);
-
     // TODO Consider using "DicomMap::ParseDicomMetaInformation()" to
     // speed up things here
 
-    ParsedDicomFile dicom(dicomContent);
+    std::string dicomContent;
+    context.ReadDicomUntilPixelData(dicomContent, publicId);
+
+    std::auto_ptr<ParsedDicomFile> dicom
+      (ParsedDicomFile::CreateUntilPixelData(dicomContent.empty() ? NULL : dicomContent.c_str(),
+                                             dicomContent.size()));
 
     Json::Value header;
-    dicom.HeaderToJson(header, DicomToJsonFormat_Full);
+    dicom->HeaderToJson(header, DicomToJsonFormat_Full);
 
     AnswerDicomAsJson(call, header);
   }
@@ -1602,14 +2582,18 @@ namespace Orthanc
     Register("/instances/{id}/frames/{frame}/image-uint16", GetImage<ImageExtractionMode_UInt16>);
     Register("/instances/{id}/frames/{frame}/image-int16", GetImage<ImageExtractionMode_Int16>);
     Register("/instances/{id}/frames/{frame}/matlab", GetMatlabImage);
+    Register("/instances/{id}/frames/{frame}/rendered", GetRenderedFrame);
     Register("/instances/{id}/frames/{frame}/raw", GetRawFrame<false>);
     Register("/instances/{id}/frames/{frame}/raw.gz", GetRawFrame<true>);
+    Register("/instances/{id}/raw-frames", GetRawFrames);
+    Register("/instances/{id}/rendered-frames", GetRenderedFrames);
     Register("/instances/{id}/pdf", ExtractPdf);
     Register("/instances/{id}/preview", GetImage<ImageExtractionMode_Preview>);
     Register("/instances/{id}/image-uint8", GetImage<ImageExtractionMode_UInt8>);
     Register("/instances/{id}/image-uint16", GetImage<ImageExtractionMode_UInt16>);
     Register("/instances/{id}/image-int16", GetImage<ImageExtractionMode_Int16>);
     Register("/instances/{id}/matlab", GetMatlabImage);
+    Register("/instances/{id}/rendered", GetRenderedFrame);
     Register("/instances/{id}/header", GetInstanceHeader);
 
     Register("/patients/{id}/protected", IsProtectedPatient);
@@ -36,9 +36,14 @@
 
 #include "../OrthancInitialization.h"
 #include "../../Core/DicomParsing/FromDcmtkBridge.h"
+#include "../../Core/Logging.h"
+#include "../../Core/SerializationToolbox.h"
 #include "../../Plugins/Engine/PluginsManager.h"
 #include "../../Plugins/Engine/OrthancPlugins.h"
 #include "../ServerContext.h"
+#include "../ServerJobs/DicomAsJsonConversionJob.h"
+#include "../ServerJobs/StorageConsistencyJob.h"
+#include "../ServerJobs/StorageIntegrityJob.h"
 
 
 namespace Orthanc
@@ -91,6 +96,9 @@ namespace Orthanc
   {
     Json::Value result = Json::objectValue;
     OrthancRestApi::GetIndex(call).ComputeStatistics(result);
+    OrthancRestApi::GetContext(call).ComputeDicomAsJsonStatistics(result);
+    OrthancRestApi::GetContext(call).ComputeStorageCacheStatistics(result);
+    OrthancRestApi::GetContext(call).GetStorageArea().ComputeStatistics(result);
     call.GetOutput().AnswerJson(result);
   }
 
@@ -271,6 +279,111 @@ namespace Orthanc
 
 
 
+  // Storage consistency ---------------------------------------------------
+
+  static void CheckStorage(RestApiPostCall& call)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    Json::Value request;
+    if (!call.ParseJsonRequest(request) ||
+        request.type() != Json::objectValue)
+    {
+      request = Json::objectValue;
+    }
+
+    static const char* REMOVE_ORPHANS = "RemoveOrphans";
+    static const char* THREADS = "Threads";
+
+    bool removeOrphans = false;
+    if (request.isMember(REMOVE_ORPHANS))
+    {
+      removeOrphans = SerializationToolbox::ReadBoolean(request, REMOVE_ORPHANS);
+    }
+
+    unsigned int threads = 4;
+    if (request.isMember(THREADS))
+    {
+      threads = SerializationToolbox::ReadUnsignedInteger(request, THREADS);
+    }
+
+    std::auto_ptr<StorageConsistencyJob> job
+      (new StorageConsistencyJob(context, threads, removeOrphans));
+
+    OrthancRestApi::GetApi(call).SubmitGenericJob
+      (call, job.release(), false /* asynchronous by default */, request);
+  }
+
+
+  static void VerifyStorage(RestApiPostCall& call)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    Json::Value request;
+    if (!call.ParseJsonRequest(request) ||
+        request.type() != Json::objectValue)
+    {
+      request = Json::objectValue;
+    }
+
+    static const char* BANDWIDTH = "Bandwidth";
+
+    // Maximum number of megabytes read per second, "0" means no throttling
+    unsigned int bandwidth = Configuration::GetGlobalUnsignedIntegerParameter("StorageIntegrityBandwidth", 20);
+    if (request.isMember(BANDWIDTH))
+    {
+      bandwidth = SerializationToolbox::ReadUnsignedInteger(request, BANDWIDTH);
+    }
+
+    std::auto_ptr<StorageIntegrityJob> job
+      (new StorageIntegrityJob(context, static_cast<uint64_t>(bandwidth) * 1024 * 1024));
+
+    OrthancRestApi::GetApi(call).SubmitGenericJob
+      (call, job.release(), false /* asynchronous by default */, request);
+  }
+
+
+  static void ConvertDicomAsJson(RestApiPostCall& call)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    Json::Value request;
+    if (!call.ParseJsonRequest(request) ||
+        request.type() != Json::objectValue)
+    {
+      request = Json::objectValue;
+    }
+
+    static const char* FORMAT = "Format";
+
+    bool binary = context.IsBinaryDicomAsJson();
+    if (request.isMember(FORMAT))
+    {
+      std::string format = SerializationToolbox::ReadString(request, FORMAT);
+      if (format == "Binary")
+      {
+        binary = true;
+      }
+      else if (format == "Json")
+      {
+        binary = false;
+      }
+      else
+      {
+        LOG(ERROR) << "Unknown format for the DICOM-as-JSON summaries: " << format;
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    std::auto_ptr<DicomAsJsonConversionJob> job
+      (new DicomAsJsonConversionJob(context, binary));
+
+    OrthancRestApi::GetApi(call).SubmitGenericJob
+      (call, job.release(), false /* asynchronous by default */, request);
+  }
+
+
+
   // Jobs information ------------------------------------------------------
 
   static void ListJobs(RestApiGetCall& call)
@@ -374,6 +487,9 @@ namespace Orthanc
     Register("/tools/dicom-conformance", GetDicomConformanceStatement);
     Register("/tools/default-encoding", GetDefaultEncoding);
     Register("/tools/default-encoding", SetDefaultEncoding);
+    Register("/tools/check-storage", CheckStorage);
+    Register("/tools/verify-storage", VerifyStorage);
+    Register("/tools/convert-dicom-as-json", ConvertDicomAsJson);
 
     Register("/plugins", ListPlugins);
     Register("/plugins/{id}", GetPlugin);
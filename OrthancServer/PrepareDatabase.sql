@@ -88,6 +88,10 @@ CREATE INDEX DicomIdentifiersIndexValues ON DicomIdentifiers(value COLLATE BINAR
 
 CREATE INDEX ChangesIndex ON Changes(internalId);
 
+-- The following index is created on-the-fly by "DatabaseWrapper::Open()"
+-- if missing (database v6), to look up the attachments by UUID
+CREATE INDEX AttachedFilesUuidIndex ON AttachedFiles(uuid);
+
 CREATE TRIGGER AttachedFileDeleted
 AFTER DELETE ON AttachedFiles
 BEGIN
@@ -0,0 +1,594 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "RenderedImageCache.h"
+
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+#include "../Core/SystemToolbox.h"
+#include "../Core/Toolbox.h"
+
+#include <algorithm>
+#include <memory>  // For std::auto_ptr
+#include <boost/lexical_cast.hpp>
+
+namespace Orthanc
+{
+  // Version of the renderings, that must be incremented whenever the
+  // algorithms that compute them change (e.g. the downscaling or the
+  // encoders). It is part of the keys, thus of the ETags, and the
+  // on-disk tier is emptied if it was filled by another version.
+  static const unsigned int RENDERINGS_VERSION = 1;
+
+  // Number of invalidated DICOM files that are remembered to reject
+  // the renderings that were computed before their invalidation
+  static const size_t MAX_INVALIDATIONS = 1024;
+
+  static const char* const VERSION_FILE = "version";
+
+
+  static std::string GetVersionSalt()
+  {
+    return (std::string(ORTHANC_VERSION) + "-" +
+            boost::lexical_cast<std::string>(RENDERINGS_VERSION));
+  }
+
+
+  std::string RenderedImageCache::GetGroup(const std::string& key)
+  {
+    size_t separator = key.find('/');
+    if (separator == std::string::npos)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    return key.substr(0, separator);
+  }
+
+
+  boost::filesystem::path RenderedImageCache::GetPath(const std::string& key) const
+  {
+    std::string group = GetGroup(key);
+    return root_ / group.substr(0, 2) / group / key.substr(group.size() + 1);
+  }
+
+
+  bool RenderedImageCache::IsInvalidatedSince(const std::string& group,
+                                              uint64_t generation) const
+  {
+    if (generation >= generation_)
+    {
+      return false;  // No invalidation since "generation"
+    }
+
+    if (generation < forgottenGeneration_)
+    {
+      // Some invalidations that happened since "generation" are not
+      // remembered anymore: Be conservative
+      return true;
+    }
+
+    std::map<std::string, uint64_t>::const_iterator found = invalidated_.find(group);
+    return (found != invalidated_.end() &&
+            found->second > generation);
+  }
+
+
+  void RenderedImageCache::ForgetKey(const std::string& key)
+  {
+    if (!memory_.Contains(key) &&
+        !disk_.Contains(key))
+    {
+      Groups::iterator group = groups_.find(GetGroup(key));
+      if (group != groups_.end())
+      {
+        group->second.erase(key);
+        if (group->second.empty())
+        {
+          groups_.erase(group);
+        }
+      }
+    }
+  }
+
+
+  void RenderedImageCache::RemoveOldestFromMemory()
+  {
+    Rendering* rendering = NULL;
+    std::string key = memory_.RemoveOldest(rendering);
+
+    assert(rendering != NULL &&
+           memorySize_ >= rendering->content_.size());
+    memorySize_ -= rendering->content_.size();
+    delete rendering;
+
+    ForgetKey(key);
+  }
+
+
+  void RenderedImageCache::RemoveOldestFromDisk()
+  {
+    uint64_t size = 0;
+    std::string key = disk_.RemoveOldest(size);
+
+    assert(diskSize_ >= size);
+    diskSize_ -= size;
+
+    boost::system::error_code error;
+    boost::filesystem::remove(GetPath(key), error);
+
+    ForgetKey(key);
+  }
+
+
+  void RenderedImageCache::AddToMemory(const std::string& key,
+                                       const std::string& content,
+                                       MimeType mime)
+  {
+    if (memory_.Contains(key) ||
+        content.size() > maxMemorySize_)
+    {
+      return;
+    }
+
+    while (memorySize_ + content.size() > maxMemorySize_)
+    {
+      RemoveOldestFromMemory();
+    }
+
+    std::auto_ptr<Rendering> rendering(new Rendering);
+    rendering->mime_ = mime;
+    rendering->content_ = content;
+    memory_.Add(key, rendering.get());
+    rendering.release();
+
+    memorySize_ += content.size();
+    groups_[GetGroup(key)].insert(key);
+  }
+
+
+  void RenderedImageCache::ScanDisk()
+  {
+    // Register the renderings that were stored by a previous
+    // execution, from the oldest to the most recent one
+    std::vector< std::pair<std::time_t, std::string> > files;
+
+    // The layout of the directory is "<prefix>/<group>/<hash>"
+    typedef boost::filesystem::directory_iterator  Iterator;
+
+    for (Iterator prefix(root_), end; prefix != end; ++prefix)
+    {
+      if (!boost::filesystem::is_directory(prefix->status()))
+      {
+        continue;
+      }
+
+      for (Iterator group(prefix->path()); group != end; ++group)
+      {
+        if (!boost::filesystem::is_directory(group->status()))
+        {
+          continue;
+        }
+
+        for (Iterator file(group->path()); file != end; ++file)
+        {
+          const boost::filesystem::path& path = file->path();
+
+          if (!boost::filesystem::is_regular_file(file->status()))
+          {
+            continue;
+          }
+          else if (path.extension() == ".tmp")
+          {
+            // Interrupted write
+            boost::system::error_code error;
+            boost::filesystem::remove(path, error);
+          }
+          else
+          {
+            files.push_back(std::make_pair(boost::filesystem::last_write_time(path),
+                                           group->path().filename().string() + "/" +
+                                           path.filename().string()));
+          }
+        }
+      }
+    }
+
+    std::sort(files.begin(), files.end());
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      const std::string& key = files[i].second;
+      uint64_t size = boost::filesystem::file_size(GetPath(key));
+
+      disk_.Add(key, size);
+      diskSize_ += size;
+      groups_[GetGroup(key)].insert(key);
+    }
+
+    while (diskSize_ > maxDiskSize_)
+    {
+      RemoveOldestFromDisk();
+    }
+  }
+
+
+  RenderedImageCache::RenderedImageCache(size_t maxMemorySize) :
+    memorySize_(0),
+    maxMemorySize_(maxMemorySize),
+    hasDisk_(false),
+    diskSize_(0),
+    maxDiskSize_(0),
+    hits_(0),
+    misses_(0),
+    generation_(0),
+    forgottenGeneration_(0)
+  {
+  }
+
+
+  RenderedImageCache::~RenderedImageCache()
+  {
+    while (!memory_.IsEmpty())
+    {
+      Rendering* rendering = NULL;
+      memory_.RemoveOldest(rendering);
+      delete rendering;
+    }
+  }
+
+
+  void RenderedImageCache::SetMaximumMemorySize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    maxMemorySize_ = size;
+
+    while (memorySize_ > maxMemorySize_)
+    {
+      RemoveOldestFromMemory();
+    }
+  }
+
+
+  void RenderedImageCache::SetDiskTier(const std::string& directory,
+                                       uint64_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (hasDisk_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    LOG(WARNING) << "Storing the renderings of the images in: " << directory;
+
+    root_ = directory;
+    maxDiskSize_ = maxSize;
+
+    SystemToolbox::MakeDirectory(directory);
+
+    const boost::filesystem::path versionPath = root_ / VERSION_FILE;
+    const std::string salt = GetVersionSalt();
+
+    std::string version;
+    if (!SystemToolbox::IsRegularFile(versionPath.string()) ||
+        (SystemToolbox::ReadFile(version, versionPath.string()), version != salt))
+    {
+      // The renderings were computed by another version: Their keys
+      // cannot be computed anymore, so they are discarded at once
+      LOG(WARNING) << "Discarding the renderings of a previous version in: " << directory;
+
+      for (boost::filesystem::directory_iterator it(root_), end; it != end; ++it)
+      {
+        boost::system::error_code error;
+        boost::filesystem::remove_all(it->path(), error);
+      }
+
+      SystemToolbox::WriteFile(salt, versionPath.string());
+    }
+
+    ScanDisk();
+
+    hasDisk_ = true;
+  }
+
+
+  std::string RenderedImageCache::ComputeKey(const std::string& dicomUuid,
+                                             const std::string& parameters)
+  {
+    if (!Toolbox::IsUuid(dicomUuid))
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    std::string hash;
+    Toolbox::ComputeSHA1(hash, GetVersionSalt() + "|" + parameters);
+
+    return dicomUuid + "/" + hash;
+  }
+
+
+  std::string RenderedImageCache::ComputeETag(const std::string& key)
+  {
+    std::string hash;
+    Toolbox::ComputeSHA1(hash, key);
+
+    return "\"" + hash + "\"";
+  }
+
+
+  uint64_t RenderedImageCache::GetGeneration()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return generation_;
+  }
+
+
+  bool RenderedImageCache::Fetch(std::string& content,
+                                 MimeType& mime,
+                                 const std::string& key)
+  {
+    boost::filesystem::path path;
+    uint64_t generation;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      generation = generation_;
+
+      Rendering* rendering = NULL;
+      if (memory_.Contains(key, rendering))
+      {
+        assert(rendering != NULL);
+        memory_.MakeMostRecent(key);
+        content = rendering->content_;
+        mime = rendering->mime_;
+        hits_++;
+        return true;
+      }
+
+      if (!disk_.Contains(key))
+      {
+        misses_++;
+        return false;
+      }
+
+      disk_.MakeMostRecent(key);
+      path = GetPath(key);
+    }
+
+    // The file is read outside of the lock. The first line of the
+    // file contains the MIME type of the rendering.
+    std::string file;
+
+    try
+    {
+      SystemToolbox::ReadFile(file, path.string());
+    }
+    catch (OrthancException&)
+    {
+      // The file has been removed meanwhile
+      boost::mutex::scoped_lock lock(mutex_);
+      misses_++;
+      return false;
+    }
+
+    size_t separator = file.find('\n');
+    if (separator == std::string::npos)
+    {
+      LOG(WARNING) << "Corrupted rendering in the cache: " << path.string();
+      boost::mutex::scoped_lock lock(mutex_);
+      misses_++;
+      return false;
+    }
+
+    mime = StringToMimeType(file.substr(0, separator));
+    content = file.substr(separator + 1);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!IsInvalidatedSince(GetGroup(key), generation))
+    {
+      AddToMemory(key, content, mime);
+    }
+
+    hits_++;
+
+    return true;
+  }
+
+
+  void RenderedImageCache::Add(const std::string& key,
+                               const std::string& content,
+                               MimeType mime,
+                               uint64_t generation)
+  {
+    const std::string group = GetGroup(key);
+
+    bool writeToDisk;
+    boost::filesystem::path path;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (IsInvalidatedSince(group, generation))
+      {
+        // The DICOM file was removed while the rendering was computed
+        return;
+      }
+
+      AddToMemory(key, content, mime);
+
+      writeToDisk = (hasDisk_ &&
+                     !disk_.Contains(key) &&
+                     content.size() <= maxDiskSize_);
+
+      if (writeToDisk)
+      {
+        path = GetPath(key);
+      }
+    }
+
+    if (!writeToDisk)
+    {
+      return;
+    }
+
+    // Write the file outside of the lock, through a temporary file so
+    // that a partially written rendering is never read
+    std::string file = std::string(EnumerationToString(mime)) + "\n" + content;
+    boost::filesystem::path tmp = path;
+    tmp += ".tmp";
+
+    try
+    {
+      boost::filesystem::create_directories(path.parent_path());
+      SystemToolbox::WriteFile(file, tmp.string());
+      boost::filesystem::rename(tmp, path);
+    }
+    catch (OrthancException&)
+    {
+      LOG(WARNING) << "Cannot store a rendering in the cache: " << path.string();
+      return;
+    }
+    catch (boost::filesystem::filesystem_error&)
+    {
+      LOG(WARNING) << "Cannot store a rendering in the cache: " << path.string();
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (IsInvalidatedSince(group, generation))
+    {
+      // The DICOM file was invalidated while the rendering was being
+      // written: The file might have escaped the removal of the group
+      boost::system::error_code error;
+      boost::filesystem::remove(path, error);
+      return;
+    }
+
+    if (!disk_.Contains(key))
+    {
+      while (diskSize_ + file.size() > maxDiskSize_)
+      {
+        RemoveOldestFromDisk();
+      }
+
+      disk_.Add(key, file.size());
+      diskSize_ += file.size();
+      groups_[GetGroup(key)].insert(key);
+    }
+  }
+
+
+  void RenderedImageCache::Invalidate(const std::string& dicomUuid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // Remember the invalidation, even if no rendering is cached yet,
+    // as a rendering of this DICOM file might be under computation
+    generation_++;
+    invalidated_[dicomUuid] = generation_;
+    invalidations_.push_back(std::make_pair(dicomUuid, generation_));
+
+    while (invalidations_.size() > MAX_INVALIDATIONS)
+    {
+      const std::pair<std::string, uint64_t>& oldest = invalidations_.front();
+
+      std::map<std::string, uint64_t>::iterator found = invalidated_.find(oldest.first);
+      if (found != invalidated_.end() &&
+          found->second == oldest.second)
+      {
+        invalidated_.erase(found);
+      }
+
+      forgottenGeneration_ = oldest.second;
+      invalidations_.pop_front();
+    }
+
+    Groups::iterator group = groups_.find(dicomUuid);
+    if (group == groups_.end())
+    {
+      return;
+    }
+
+    for (std::set<std::string>::const_iterator
+           it = group->second.begin(); it != group->second.end(); ++it)
+    {
+      Rendering* rendering = NULL;
+      if (memory_.Contains(*it, rendering))
+      {
+        assert(rendering != NULL &&
+               memorySize_ >= rendering->content_.size());
+        memorySize_ -= rendering->content_.size();
+        memory_.Invalidate(*it);
+        delete rendering;
+      }
+
+      if (disk_.Contains(*it))
+      {
+        uint64_t size = disk_.Invalidate(*it);
+        assert(diskSize_ >= size);
+        diskSize_ -= size;
+      }
+    }
+
+    groups_.erase(group);
+
+    if (hasDisk_)
+    {
+      boost::system::error_code error;
+      boost::filesystem::remove_all(root_ / dicomUuid.substr(0, 2) / dicomUuid, error);
+    }
+  }
+
+
+  void RenderedImageCache::ComputeStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target["RenderingsCacheSize"] = boost::lexical_cast<std::string>(memorySize_);
+    target["RenderingsCacheCount"] = static_cast<unsigned int>(memory_.GetSize());
+    target["RenderingsCacheHits"] = boost::lexical_cast<std::string>(hits_);
+    target["RenderingsCacheMisses"] = boost::lexical_cast<std::string>(misses_);
+
+    if (hasDisk_)
+    {
+      target["RenderingsCacheDiskSize"] = boost::lexical_cast<std::string>(diskSize_);
+      target["RenderingsCacheDiskCount"] = static_cast<unsigned int>(disk_.GetSize());
+    }
+  }
+}
@@ -0,0 +1,161 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Core/Cache/LeastRecentlyUsedIndex.h"
+#include "../Core/Enumerations.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <json/value.h>
+
+namespace Orthanc
+{
+  /**
+   * Cache of the encoded renderings of the DICOM frames (previews,
+   * PNG/JPEG/PAM images). The renderings are kept in memory, and
+   * optionally in a directory of the filesystem that acts as a
+   * second, larger tier surviving restarts. The key of a rendering
+   * combines the UUID of the DICOM file it was computed from (its
+   * "group") with the parameters of the rendering, which makes it
+   * suitable as a strong HTTP entity tag. The key also depends on
+   * the version of the rendering algorithms, so that the renderings
+   * of a previous version are neither reused nor validated. All the
+   * renderings of a DICOM file are discarded together once this file
+   * is removed.
+   **/
+  class RenderedImageCache : public boost::noncopyable
+  {
+  private:
+    struct Rendering
+    {
+      MimeType     mime_;
+      std::string  content_;
+    };
+
+    typedef LeastRecentlyUsedIndex<std::string, Rendering*>  MemoryIndex;
+    typedef LeastRecentlyUsedIndex<std::string, uint64_t>    DiskIndex;
+    typedef std::map<std::string, std::set<std::string> >    Groups;
+    typedef std::deque< std::pair<std::string, uint64_t> >   Invalidations;
+
+    boost::mutex  mutex_;
+
+    MemoryIndex   memory_;
+    size_t        memorySize_;
+    size_t        maxMemorySize_;
+
+    bool                     hasDisk_;
+    boost::filesystem::path  root_;
+    DiskIndex                disk_;
+    uint64_t                 diskSize_;
+    uint64_t                 maxDiskSize_;
+
+    // Keys of the renderings of each DICOM file, in either tier
+    Groups        groups_;
+
+    uint64_t      hits_;
+    uint64_t      misses_;
+
+    // Generation of the cache, that is incremented by each call to
+    // "Invalidate()", together with the generations at which the
+    // last groups have been invalidated. This prevents a rendering
+    // whose computation has started before the invalidation of its
+    // DICOM file from being added afterwards.
+    uint64_t               generation_;
+    Invalidations          invalidations_;
+    std::map<std::string, uint64_t>  invalidated_;
+    uint64_t               forgottenGeneration_;
+
+    static std::string GetGroup(const std::string& key);
+
+    bool IsInvalidatedSince(const std::string& group,
+                            uint64_t generation) const;
+
+    boost::filesystem::path GetPath(const std::string& key) const;
+
+    void ForgetKey(const std::string& key);
+
+    void RemoveOldestFromMemory();
+
+    void RemoveOldestFromDisk();
+
+    void AddToMemory(const std::string& key,
+                     const std::string& content,
+                     MimeType mime);
+
+    void ScanDisk();
+
+  public:
+    explicit RenderedImageCache(size_t maxMemorySize);
+
+    ~RenderedImageCache();
+
+    // "0" disables the in-memory tier
+    void SetMaximumMemorySize(size_t size);
+
+    // Enables the on-disk tier. The renderings that are already
+    // stored in the directory are reused.
+    void SetDiskTier(const std::string& directory,
+                     uint64_t maxSize);
+
+    static std::string ComputeKey(const std::string& dicomUuid,
+                                  const std::string& parameters);
+
+    // Strong HTTP entity tag of the rendering, including the quotes
+    static std::string ComputeETag(const std::string& key);
+
+    // Must be called before looking up the DICOM file whose rendering
+    // will be given to "Add()"
+    uint64_t GetGeneration();
+
+    bool Fetch(std::string& content,
+               MimeType& mime,
+               const std::string& key);
+
+    // The rendering is not cached if its DICOM file has been
+    // invalidated since "generation" was retrieved
+    void Add(const std::string& key,
+             const std::string& content,
+             MimeType mime,
+             uint64_t generation);
+
+    void Invalidate(const std::string& dicomUuid);
+
+    void ComputeStatistics(Json::Value& target);
+  };
+}
@@ -0,0 +1,279 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "SeriesPrefetcher.h"
+
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+#include "ServerContext.h"
+#include "SliceOrdering.h"
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+namespace Orthanc
+{
+  // Maximum number of series whose ordering is kept in memory
+  static const size_t MAX_ORDERINGS = 16;
+
+  // Maximum number of pending accesses. If the background thread is
+  // late, the oldest accesses are discarded.
+  static const unsigned int MAX_PENDING = 16;
+
+
+  void SeriesPrefetcher::Worker(SeriesPrefetcher* that)
+  {
+    while (!that->done_)
+    {
+      std::auto_ptr<IDynamicObject> obj(that->queue_.Dequeue(100));
+
+      if (obj.get() != NULL)
+      {
+        const std::string& instance =
+          dynamic_cast<const SingleValueObject<std::string>&>(*obj).GetValue();
+
+        try
+        {
+          that->Process(instance);
+        }
+        catch (OrthancException& e)
+        {
+          // The instance might have been deleted in the meantime
+          VLOG(1) << "Cannot prefetch the neighbors of instance " << instance << ": " << e.What();
+        }
+      }
+    }
+  }
+
+
+  const SeriesPrefetcher::Ordering& SeriesPrefetcher::GetOrdering(size_t& position,
+                                                                  const std::string& series,
+                                                                  const std::string& instance)
+  {
+    Ordering* ordering = NULL;
+
+    if (orderings_.Contains(series, ordering))
+    {
+      assert(ordering != NULL);
+      orderings_.MakeMostRecent(series);
+
+      Ordering::const_iterator found = std::find(ordering->begin(), ordering->end(), instance);
+      if (found != ordering->end())
+      {
+        position = found - ordering->begin();
+        return *ordering;
+      }
+
+      // The instance was received after the ordering was computed
+      delete orderings_.Invalidate(series);
+    }
+
+    std::auto_ptr<Ordering> computed(new Ordering);
+
+    try
+    {
+      SliceOrdering slices(context_.GetIndex(), series);
+
+      computed->resize(slices.GetInstancesCount());
+      for (size_t i = 0; i < slices.GetInstancesCount(); i++)
+      {
+        (*computed) [i] = slices.GetInstanceId(i);
+      }
+    }
+    catch (OrthancException&)
+    {
+      // The slices cannot be ordered, use the order of the index
+      std::list<std::string> children;
+      context_.GetIndex().GetChildren(children, series);
+      computed->assign(children.begin(), children.end());
+    }
+
+    Ordering::const_iterator found = std::find(computed->begin(), computed->end(), instance);
+    if (found == computed->end())
+    {
+      throw OrthancException(ErrorCode_UnknownResource);
+    }
+
+    position = found - computed->begin();
+
+    if (orderings_.GetSize() >= MAX_ORDERINGS)
+    {
+      Ordering* oldest = NULL;
+      orderings_.RemoveOldest(oldest);
+      delete oldest;
+    }
+
+    ordering = computed.release();
+    orderings_.Add(series, ordering);
+
+    return *ordering;
+  }
+
+
+  void SeriesPrefetcher::Process(const std::string& instance)
+  {
+    std::string series;
+    if (!context_.GetIndex().LookupParent(series, instance))
+    {
+      return;
+    }
+
+    size_t position;
+    const Ordering& ordering = GetOrdering(position, series, instance);
+
+    // Alternate between the next and the previous instances, starting
+    // with the closest ones
+    std::vector<std::string> neighbors;
+    neighbors.reserve(2 * window_);
+
+    for (size_t distance = 1; distance <= window_; distance++)
+    {
+      if (position + distance < ordering.size())
+      {
+        neighbors.push_back(ordering[position + distance]);
+      }
+
+      if (distance <= position)
+      {
+        neighbors.push_back(ordering[position - distance]);
+      }
+    }
+
+    unsigned int count;
+    uint64_t size = context_.PrefetchAttachments(count, neighbors, FileContentType_Dicom, budget_);
+
+    if (count > 0)
+    {
+      VLOG(1) << "Prefetched " << count << " instances (" << size
+              << " bytes) around instance " << instance;
+
+      boost::mutex::scoped_lock lock(mutex_);
+      prefetchedCount_ += count;
+      prefetchedSize_ += size;
+    }
+  }
+
+
+  SeriesPrefetcher::SeriesPrefetcher(ServerContext& context) :
+    context_(context),
+    window_(0),
+    budget_(0),
+    queue_(MAX_PENDING),
+    done_(false),
+    prefetchedCount_(0),
+    prefetchedSize_(0)
+  {
+    // The most recent accesses are the most relevant ones
+    queue_.SetLifoPolicy();
+  }
+
+
+  SeriesPrefetcher::~SeriesPrefetcher()
+  {
+    Stop();
+
+    while (!orderings_.IsEmpty())
+    {
+      Ordering* ordering = NULL;
+      orderings_.RemoveOldest(ordering);
+      delete ordering;
+    }
+  }
+
+
+  void SeriesPrefetcher::SetWindow(unsigned int window)
+  {
+    if (thread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    window_ = window;
+  }
+
+
+  void SeriesPrefetcher::SetBudget(uint64_t budget)
+  {
+    if (thread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    budget_ = budget;
+  }
+
+
+  void SeriesPrefetcher::Start()
+  {
+    if (thread_.joinable())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (window_ > 0 &&
+        budget_ > 0)
+    {
+      done_ = false;
+      thread_ = boost::thread(Worker, this);
+    }
+  }
+
+
+  void SeriesPrefetcher::Stop()
+  {
+    done_ = true;
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+
+  void SeriesPrefetcher::SignalAccess(const std::string& instancePublicId)
+  {
+    if (thread_.joinable())
+    {
+      queue_.Enqueue(new SingleValueObject<std::string>(instancePublicId));
+    }
+  }
+
+
+  void SeriesPrefetcher::ComputeStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    target["SeriesPrefetchedCount"] = boost::lexical_cast<std::string>(prefetchedCount_);
+    target["SeriesPrefetchedSize"] = boost::lexical_cast<std::string>(prefetchedSize_);
+  }
+}
@@ -0,0 +1,105 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Core/Cache/LeastRecentlyUsedIndex.h"
+#include "../Core/MultiThreading/SharedMessageQueue.h"
+
+#include <stdint.h>
+#include <boost/thread.hpp>
+#include <json/value.h>
+
+namespace Orthanc
+{
+  class ServerContext;
+
+  /**
+   * Read-ahead of the series that are browsed by the viewers: Each
+   * time an instance is accessed, a background thread loads the DICOM
+   * files of the neighboring instances of the same series (in the
+   * order given by "SliceOrdering") into the cache of attachments of
+   * the server context. The I/O that is triggered by one access is
+   * bounded by a number of bytes.
+   **/
+  class SeriesPrefetcher : public boost::noncopyable
+  {
+  private:
+    typedef std::vector<std::string>  Ordering;
+    typedef LeastRecentlyUsedIndex<std::string, Ordering*>  Orderings;
+
+    ServerContext&      context_;
+    unsigned int        window_;
+    uint64_t            budget_;
+    SharedMessageQueue  queue_;
+    bool                done_;
+    boost::thread       thread_;
+
+    // Cache of the ordered instances of the recently accessed series,
+    // that is only used by the background thread
+    Orderings           orderings_;
+
+    boost::mutex        mutex_;
+    uint64_t            prefetchedCount_;
+    uint64_t            prefetchedSize_;
+
+    static void Worker(SeriesPrefetcher* that);
+
+    const Ordering& GetOrdering(size_t& position,
+                                const std::string& series,
+                                const std::string& instance);
+
+    void Process(const std::string& instance);
+
+  public:
+    explicit SeriesPrefetcher(ServerContext& context);
+
+    ~SeriesPrefetcher();
+
+    // Number of instances that are prefetched before and after the
+    // accessed instance. "0" disables the prefetching.
+    void SetWindow(unsigned int window);
+
+    // Maximum number of bytes that are read from the storage area
+    // after one access
+    void SetBudget(uint64_t budget);
+
+    void Start();
+
+    void Stop();
+
+    void SignalAccess(const std::string& instancePublicId);
+
+    void ComputeStatistics(Json::Value& target);
+  };
+}
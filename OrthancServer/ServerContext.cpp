@@ -34,10 +34,14 @@
 #include "PrecompiledHeadersServer.h"
 #include "ServerContext.h"
 
+#include "../Core/BinaryJson.h"
+#include "../Core/Compression/BufferCompressorFactory.h"
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
 #include "../Core/FileStorage/StorageAccessor.h"
 #include "../Core/HttpServer/FilesystemHttpSender.h"
 #include "../Core/HttpServer/HttpStreamTranscoder.h"
+#include "../Core/Images/ImageBufferPool.h"
+#include "../Core/Images/ImageProcessing.h"
 #include "../Core/Logging.h"
 #include "../Plugins/Engine/OrthancPlugins.h"
 #include "OrthancInitialization.h"
@@ -48,12 +52,16 @@
 
 #include <EmbeddedResources.h>
 #include <dcmtk/dcmdata/dcfilefo.h>
+#include <boost/lexical_cast.hpp>
 
 
 
-#define ENABLE_DICOM_CACHE  1
+static const unsigned int DICOM_CACHE_SHARDS = 16;
 
-static const size_t DICOM_CACHE_SIZE = 2;
+// Size of the first read of a DICOM file whose tags are accessed
+// without its pixel data. This size is doubled until the pixel data
+// is found, for the files with a large header.
+static const uint64_t DICOM_HEADER_READ_SIZE = 64 * 1024;
 
 /**
  * IMPORTANT: We make the assumption that the same instance of
@@ -132,6 +140,65 @@ namespace Orthanc
   }
   
 
+  void ServerContext::DicomAsJsonThread(ServerContext* that,
+                                        unsigned int sleepDelay)
+  {
+    while (!that->done_)
+    {
+      std::auto_ptr<IDynamicObject> obj(that->pendingDicomAsJson_.Dequeue(sleepDelay));
+
+      if (obj.get() != NULL)
+      {
+        const std::string& instance =
+          dynamic_cast<const SingleValueObject<std::string>&>(*obj).GetValue();
+
+        bool generated = false;
+        bool failure = false;
+
+        try
+        {
+          // The summary might have been generated in the meantime by
+          // a reader of the instance
+          FileInfo attachment;
+          if (!that->index_.LookupAttachment(attachment, instance, FileContentType_DicomAsJson))
+          {
+            std::string summary;
+            that->GenerateDicomAsJson(summary, instance);
+            generated = true;
+          }
+        }
+        catch (OrthancException& e)
+        {
+          if (e.GetErrorCode() == ErrorCode_UnknownResource)
+          {
+            VLOG(1) << "Instance " << instance << " was deleted before its DICOM-as-JSON summary was generated";
+          }
+          else
+          {
+            LOG(ERROR) << "Cannot generate the DICOM-as-JSON summary of instance "
+                       << instance << ": " << e.What();
+            failure = true;
+          }
+        }
+
+        boost::mutex::scoped_lock lock(that->dicomAsJsonMutex_);
+        assert(that->dicomAsJsonBacklog_ > 0);
+        that->dicomAsJsonBacklog_--;
+
+        if (generated)
+        {
+          that->dicomAsJsonGenerated_++;
+        }
+
+        if (failure)
+        {
+          that->dicomAsJsonFailures_++;
+        }
+      }
+    }
+  }
+
+
   void ServerContext::SignalJobSubmitted(const std::string& jobId)
   {
     haveJobsChanged_ = true;
@@ -219,8 +286,15 @@ namespace Orthanc
     area_(area),
     compressionEnabled_(false),
     storeMD5_(true),
-    provider_(*this),
-    dicomCache_(provider_, DICOM_CACHE_SIZE),
+    binaryDicomAsJson_(false),
+    dicomAsJsonGeneration_(DicomAsJsonGeneration_Immediate),
+    storagePool_(Configuration::GetGlobalUnsignedIntegerParameter("StorageThreadsCount", 4)),
+    storageCache_(static_cast<size_t>(Configuration::GetGlobalUnsignedIntegerParameter("MaximumStorageCacheSize", 128)) * 1024 * 1024),
+    prefetcher_(*this),
+    dicomCache_(static_cast<size_t>(Configuration::GetGlobalUnsignedIntegerParameter("MaximumDicomCacheSize", 128)) * 1024 * 1024,
+                DICOM_CACHE_SHARDS),
+    renderingsCache_(static_cast<size_t>(Configuration::GetGlobalUnsignedIntegerParameter("MaximumRenderingsCacheSize", 64)) * 1024 * 1024),
+    imageProcessingPool_(Configuration::GetGlobalUnsignedIntegerParameter("ImageProcessingThreads", 4)),
     mainLua_(*this),
     filterLua_(*this),
     luaListener_(*this),
@@ -230,14 +304,36 @@ namespace Orthanc
     done_(false),
     haveJobsChanged_(false),
     isJobsEngineUnserialized_(false),
+    dicomAsJsonBacklog_(0),
+    dicomAsJsonGenerated_(0),
+    dicomAsJsonFailures_(0),
     queryRetrieveArchive_(Configuration::GetGlobalUnsignedIntegerParameter("QueryRetrieveSize", 10)),
     defaultLocalAet_(Configuration::GetGlobalStringParameter("DicomAet", "ORTHANC"))
   {
+    std::string renderingsDirectory = Configuration::GetGlobalStringParameter("RenderingsCacheDirectory", "");
+    if (!renderingsDirectory.empty())
+    {
+      renderingsCache_.SetDiskTier(
+        Configuration::InterpretStringParameterAsPath(renderingsDirectory),
+        static_cast<uint64_t>(Configuration::GetGlobalUnsignedIntegerParameter("RenderingsCacheDiskSize", 1024)) * 1024 * 1024);
+    }
+
+    ImageProcessing::SetWorkersPool(&imageProcessingPool_,
+                                    Configuration::GetGlobalUnsignedIntegerParameter("ImageProcessingParallelThreshold", 1024 * 1024));
+
+    ImageBufferPool::GetGlobalInstance().SetMaximumRetainedSize(
+      static_cast<size_t>(Configuration::GetGlobalUnsignedIntegerParameter("ImageBufferPoolSize", 64)) * 1024 * 1024);
+
     jobsEngine_.SetWorkersCount(Configuration::GetGlobalUnsignedIntegerParameter("ConcurrentJobs", 2));
     jobsEngine_.SetThreadSleep(unitTesting ? 20 : 200);
 
     listeners_.push_back(ServerListener(luaListener_, "Lua"));
     changeThread_ = boost::thread(ChangeThread, this, (unitTesting ? 20 : 100));
+    dicomAsJsonThread_ = boost::thread(DicomAsJsonThread, this, (unitTesting ? 20 : 100));
+
+    prefetcher_.SetWindow(Configuration::GetGlobalUnsignedIntegerParameter("SeriesPrefetchWindow", 8));
+    prefetcher_.SetBudget(static_cast<uint64_t>(Configuration::GetGlobalUnsignedIntegerParameter("SeriesPrefetchBudget", 64)) * 1024 * 1024);
+    prefetcher_.Start();
   }
 
 
@@ -263,6 +359,8 @@ namespace Orthanc
 
       done_ = true;
 
+      prefetcher_.Stop();
+
       if (changeThread_.joinable())
       {
         changeThread_.join();
@@ -273,6 +371,11 @@ namespace Orthanc
         saveJobsThread_.join();
       }
 
+      if (dicomAsJsonThread_.joinable())
+      {
+        dicomAsJsonThread_.join();
+      }
+
       jobsEngine_.GetRegistry().ResetObserver();
 
       if (isJobsEngineUnserialized_)
@@ -284,6 +387,9 @@ namespace Orthanc
       // Do not change the order below!
       jobsEngine_.Stop();
       index_.Stop();
+
+      ImageProcessing::SetWorkersPool(NULL, 0);
+      ImageBufferPool::GetGlobalInstance().SetMaximumRetainedSize(0);
     }
   }
 
@@ -299,13 +405,311 @@ namespace Orthanc
   }
 
 
+  void ServerContext::SetDicomAsJsonGeneration(DicomAsJsonGeneration generation)
+  {
+    if (generation != DicomAsJsonGeneration_Immediate)
+    {
+      LOG(WARNING) << "Generation of the DICOM-as-JSON summaries: " << EnumerationToString(generation);
+    }
+
+    dicomAsJsonGeneration_ = generation;
+  }
+
+
+  void ServerContext::ComputeDicomAsJsonStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(dicomAsJsonMutex_);
+
+    target["DicomAsJsonGeneration"] = EnumerationToString(dicomAsJsonGeneration_);
+    target["DicomAsJsonBacklog"] = static_cast<unsigned int>(dicomAsJsonBacklog_);
+    target["DicomAsJsonGenerated"] = static_cast<unsigned int>(dicomAsJsonGenerated_);
+    target["DicomAsJsonFailures"] = static_cast<unsigned int>(dicomAsJsonFailures_);
+  }
+
+
+  void ServerContext::SetCompressionPolicy(FileContentType type,
+                                           CompressionType compression,
+                                           int level)
+  {
+    if (!BufferCompressorFactory::IsSupported(compression))
+    {
+      LOG(ERROR) << "This version of Orthanc was built without support for the "
+                 << EnumerationToString(compression) << " compression";
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    if (compression != CompressionType_None)
+    {
+      // Validate the compression level
+      std::auto_ptr<IBufferCompressor> compressor(BufferCompressorFactory::Create(compression, level));
+    }
+
+    LOG(WARNING) << "Compression of the attachments of type \""
+                 << EnumerationToString(type) << "\": " << EnumerationToString(compression)
+                 << (level == 0 ? "" : " (level " + boost::lexical_cast<std::string>(level) + ")");
+
+    compressionPolicies_[type] = std::make_pair(compression, level);
+  }
+
+
+  CompressionType ServerContext::GetCompressionPolicy(int& level,
+                                                      FileContentType type) const
+  {
+    CompressionPolicies::const_iterator found = compressionPolicies_.find(type);
+    if (found == compressionPolicies_.end())
+    {
+      // TODO Should we use "gzip" instead?
+      level = 0;
+      return (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
+    }
+    else
+    {
+      level = found->second.second;
+      return found->second.first;
+    }
+  }
+
+
   void ServerContext::RemoveFile(const std::string& fileUuid,
                                  FileContentType type)
   {
+    storageCache_.Invalidate(fileUuid);
+
+    if (type == FileContentType_Dicom)
+    {
+      renderingsCache_.Invalidate(fileUuid);
+    }
+
     area_.Remove(fileUuid, type);
   }
 
 
+  void ServerContext::ComputeStorageCacheStatistics(Json::Value& target)
+  {
+    target["StorageCacheSize"] = boost::lexical_cast<std::string>(storageCache_.GetCurrentSize());
+    target["StorageCacheCount"] = static_cast<unsigned int>(storageCache_.GetCount());
+    target["StorageCacheHits"] = boost::lexical_cast<std::string>(storageCache_.GetHits());
+    target["StorageCacheMisses"] = boost::lexical_cast<std::string>(storageCache_.GetMisses());
+    target["DicomCacheSize"] = boost::lexical_cast<std::string>(dicomCache_.GetCurrentSize());
+    target["DicomCacheCount"] = static_cast<unsigned int>(dicomCache_.GetCount());
+    target["DicomCacheHits"] = boost::lexical_cast<std::string>(dicomCache_.GetHits());
+    target["DicomCacheMisses"] = boost::lexical_cast<std::string>(dicomCache_.GetMisses());
+    renderingsCache_.ComputeStatistics(target);
+    prefetcher_.ComputeStatistics(target);
+
+    ImageBufferPool& pool = ImageBufferPool::GetGlobalInstance();
+    target["ImageBufferPoolSize"] = boost::lexical_cast<std::string>(pool.GetRetainedSize());
+    target["ImageBufferPoolCount"] = static_cast<unsigned int>(pool.GetRetainedCount());
+    target["ImageBufferPoolHits"] = boost::lexical_cast<std::string>(pool.GetHits());
+    target["ImageBufferPoolMisses"] = boost::lexical_cast<std::string>(pool.GetMisses());
+  }
+
+
+  static std::string ComputeContentAddress(const void* data,
+                                          size_t size,
+                                          CompressionType compression)
+  {
+    // The stored content depends on the compression type, that is
+    // thus combined with the SHA-1 hash of the raw content
+    std::string sha1;
+    Toolbox::ComputeSHA1(sha1, data, size);
+
+    std::string key;
+    Toolbox::ComputeSHA1(key, sha1 + "|" + boost::lexical_cast<std::string>(compression));
+
+    // Format the 128 first bits of the hash as an UUID
+    std::string hex;
+    hex.reserve(40);
+    for (size_t i = 0; i < key.size(); i++)
+    {
+      if (key[i] != '-')
+      {
+        hex.push_back(key[i]);
+      }
+    }
+
+    assert(hex.size() == 40);
+    return (hex.substr(0, 8) + "-" + hex.substr(8, 4) + "-" + hex.substr(12, 4) + "-" +
+            hex.substr(16, 4) + "-" + hex.substr(20, 12));
+  }
+
+
+  FileInfo ServerContext::WriteRandomAttachment(StorageAccessor& accessor,
+                                                const void* data,
+                                                size_t size,
+                                                FileContentType type,
+                                                CompressionType compression)
+  {
+    // The UUID is registered as pending before the file is created,
+    // so that the consistency checks do not consider the file as an
+    // orphan until it is indexed (cf. "ReleaseAttachment()")
+    const std::string uuid = Toolbox::GenerateUuid();
+    index_.AddPendingAttachment(uuid);
+
+    try
+    {
+      return accessor.Write(uuid, data, size, type, compression, storeMD5_);
+    }
+    catch (OrthancException&)
+    {
+      index_.RemovePendingAttachment(uuid);
+      throw;
+    }
+  }
+
+
+  FileInfo ServerContext::WriteAttachment(StorageAccessor& accessor,
+                                          const void* data,
+                                          size_t size,
+                                          FileContentType type,
+                                          CompressionType compression,
+                                          int compressionLevel)
+  {
+    accessor.SetCompressionLevel(compressionLevel);
+
+    if (!index_.IsStorageDeduplication())
+    {
+      return WriteRandomAttachment(accessor, data, size, type, compression);
+    }
+
+    const std::string uuid = ComputeContentAddress(data, size, compression);
+
+    bool isStored;
+    FileInfo existing;
+    if (!index_.ReserveAttachmentUuid(isStored, existing, uuid))
+    {
+      // The same content is being written by another thread: Don't
+      // wait for it, and store this copy under a random UUID
+      VLOG(1) << "Concurrent write of attachment " << uuid << ", not deduplicating";
+      return WriteRandomAttachment(accessor, data, size, type, compression);
+    }
+
+    try
+    {
+      if (isStored)
+      {
+        LOG(INFO) << "Reusing the deduplicated content of attachment " << uuid;
+        return FileInfo(uuid, type,
+                        existing.GetUncompressedSize(), existing.GetUncompressedMD5(),
+                        existing.GetCompressionType(),
+                        existing.GetCompressedSize(), existing.GetCompressedMD5());
+      }
+
+      try
+      {
+        return accessor.Write(uuid, data, size, type, compression, storeMD5_);
+      }
+      catch (OrthancException& e)
+      {
+        if (e.GetErrorCode() != ErrorCode_DuplicateResource)
+        {
+          throw;
+        }
+
+        // The content is not indexed, but the file has been left over
+        // by a previous execution of Orthanc: Retry once
+        LOG(WARNING) << "Overwriting the orphan content of attachment " << uuid;
+        area_.Remove(uuid, type);
+        return accessor.Write(uuid, data, size, type, compression, storeMD5_);
+      }
+    }
+    catch (OrthancException&)
+    {
+      index_.ReleaseAttachmentUuid(uuid, type);
+      throw;
+    }
+  }
+
+
+  class ServerContext::WriteAttachmentTask : public TaskPool::ITask
+  {
+  private:
+    ServerContext&      context_;
+    FileInfo&           target_;
+    bool&               done_;
+    FileContentType     type_;
+    const void*         data_;
+    size_t              size_;
+    const Json::Value*  json_;
+
+  public:
+    WriteAttachmentTask(ServerContext& context,
+                        FileInfo& target,
+                        bool& done,
+                        FileContentType type,
+                        const void* data,
+                        size_t size) :
+      context_(context),
+      target_(target),
+      done_(done),
+      type_(type),
+      data_(data),
+      size_(size),
+      json_(NULL)
+    {
+    }
+
+    // The JSON summary is serialized by the task itself
+    WriteAttachmentTask(ServerContext& context,
+                        FileInfo& target,
+                        bool& done,
+                        FileContentType type,
+                        const Json::Value& json) :
+      context_(context),
+      target_(target),
+      done_(done),
+      type_(type),
+      data_(NULL),
+      size_(0),
+      json_(&json)
+    {
+    }
+
+    virtual void Execute()
+    {
+      int level;
+      CompressionType compression = context_.GetCompressionPolicy(level, type_);
+
+      StorageAccessor accessor(context_.area_);
+
+      if (json_ == NULL)
+      {
+        target_ = context_.WriteAttachment(accessor, data_, size_, type_, compression, level);
+      }
+      else
+      {
+        std::string s;
+        context_.SerializeDicomAsJson(s, *json_);
+        target_ = context_.WriteAttachment(accessor, s.empty() ? NULL : s.c_str(), s.size(),
+                                           type_, compression, level);
+      }
+
+      done_ = true;
+    }
+  };
+
+
+  void ServerContext::ReleaseAttachment(StorageAccessor& accessor,
+                                        const FileInfo& attachment,
+                                        bool isIndexed)
+  {
+    if (index_.IsStorageDeduplication())
+    {
+      // The content is only removed if no other attachment refers to it
+      index_.ReleaseAttachmentUuid(attachment.GetUuid(), attachment.GetContentType());
+    }
+    else
+    {
+      if (!isIndexed)
+      {
+        accessor.Remove(attachment);
+      }
+
+      index_.RemovePendingAttachment(attachment.GetUuid());
+    }
+  }
+
+
   StoreStatus ServerContext::Store(std::string& resultPublicId,
                                    DicomInstanceToStore& dicom)
   {
@@ -316,7 +720,7 @@ namespace Orthanc
       resultPublicId = dicom.GetHasher().HashInstance();
 
       Json::Value simplifiedTags;
-      ServerToolbox::SimplifyTags(simplifiedTags, dicom.GetJson(), DicomToJsonFormat_Human);
+      dicom.GetSimplifiedJson(simplifiedTags);
 
       // Test if the instance must be filtered out
       bool accepted = true;
@@ -353,25 +757,89 @@ namespace Orthanc
       {
         // Remove the file from the DicomCache (useful if
         // "OverwriteInstances" is set to "true")
-        boost::mutex::scoped_lock lock(dicomCacheMutex_);
         dicomCache_.Invalidate(resultPublicId);
       }
 
-      // TODO Should we use "gzip" instead?
-      CompressionType compression = (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
+      // Write the DICOM file and its JSON summary in parallel. The
+      // lazy members of "dicom" are computed beforehand, as they are
+      // not thread-safe. The JSON summary is neither computed nor
+      // written if its generation is deferred: It will be
+      // reconstructed from the DICOM file afterwards.
+      const char* dicomBuffer = dicom.GetBufferData();
+      size_t dicomSize = dicom.GetBufferSize();
+      const bool writeJson = (dicomAsJsonGeneration_ == DicomAsJsonGeneration_Immediate);
+      const Json::Value* json = (writeJson ? &dicom.GetJson() : NULL);
+
+      FileInfo dicomInfo, jsonInfo;
+      bool hasDicom = false, hasJson = false;
+
+      try
+      {
+        TaskPool::Batch batch(storagePool_);
+        batch.Submit(new WriteAttachmentTask(*this, dicomInfo, hasDicom, FileContentType_Dicom,
+                                             dicomBuffer, dicomSize));
+
+        if (writeJson)
+        {
+          batch.Submit(new WriteAttachmentTask(*this, jsonInfo, hasJson, FileContentType_DicomAsJson, *json));
+        }
+
+        batch.Join();
+      }
+      catch (OrthancException&)
+      {
+        if (hasDicom)
+        {
+          ReleaseAttachment(accessor, dicomInfo, false);
+        }
+
+        if (hasJson)
+        {
+          ReleaseAttachment(accessor, jsonInfo, false);
+        }
+
+        throw;
+      }
 
-      FileInfo dicomInfo = accessor.Write(dicom.GetBufferData(), dicom.GetBufferSize(), 
-                                          FileContentType_Dicom, compression, storeMD5_);
-      FileInfo jsonInfo = accessor.Write(dicom.GetJson().toStyledString(), 
-                                         FileContentType_DicomAsJson, compression, storeMD5_);
+      {
+        // Locate the frames inside the DICOM file, so that they can
+        // later be read from the storage area without parsing it
+        DicomFrameOffsetTable offsets;
+        if (offsets.Compute(dicomBuffer, dicomSize, dicom.GetSummary()))
+        {
+          std::string s;
+          offsets.Serialize(s);
+          dicom.AddMetadata(ResourceType_Instance, MetadataType_Instance_FrameOffsets, s);
+        }
+      }
 
       ServerIndex::Attachments attachments;
       attachments.push_back(dicomInfo);
-      attachments.push_back(jsonInfo);
+
+      if (hasJson)
+      {
+        attachments.push_back(jsonInfo);
+      }
 
       typedef std::map<MetadataType, std::string>  InstanceMetadata;
       InstanceMetadata  instanceMetadata;
-      StoreStatus status = index_.Store(instanceMetadata, dicom, attachments);
+      StoreStatus status;
+
+      try
+      {
+        status = index_.Store(instanceMetadata, dicom, attachments);
+      }
+      catch (OrthancException&)
+      {
+        ReleaseAttachment(accessor, dicomInfo, false);
+
+        if (hasJson)
+        {
+          ReleaseAttachment(accessor, jsonInfo, false);
+        }
+
+        throw;
+      }
 
       // Only keep the metadata for the "instance" level
       dicom.GetMetadata().clear();
@@ -383,10 +851,22 @@ namespace Orthanc
                                                   it->second));
       }
             
-      if (status != StoreStatus_Success)
+      ReleaseAttachment(accessor, dicomInfo, status == StoreStatus_Success);
+
+      if (hasJson)
       {
-        accessor.Remove(dicomInfo);
-        accessor.Remove(jsonInfo);
+        ReleaseAttachment(accessor, jsonInfo, status == StoreStatus_Success);
+      }
+
+      if (status == StoreStatus_Success &&
+          dicomAsJsonGeneration_ == DicomAsJsonGeneration_Deferred)
+      {
+        {
+          boost::mutex::scoped_lock lock(dicomAsJsonMutex_);
+          dicomAsJsonBacklog_++;
+        }
+
+        pendingDicomAsJson_.Enqueue(new SingleValueObject<std::string>(resultPublicId));
       }
 
       switch (status)
@@ -446,6 +926,20 @@ namespace Orthanc
                                        const std::string& resourceId,
                                        FileContentType content)
   {
+    ResourceType type;
+    if (content == FileContentType_DicomAsJson &&
+        index_.LookupResourceType(type, resourceId) &&
+        type == ResourceType_Instance)
+    {
+      // The binary format is internal to Orthanc, always answer the
+      // summary as a textual JSON document. The summary is
+      // reconstructed if its generation has not taken place yet.
+      std::string json;
+      ReadDicomAsJson(json, resourceId);
+      output.AnswerBuffer(json, MimeType_Json);
+      return;
+    }
+
     FileInfo attachment;
     if (!index_.LookupAttachment(attachment, resourceId, content))
     {
@@ -453,7 +947,17 @@ namespace Orthanc
     }
 
     StorageAccessor accessor(area_);
-    accessor.AnswerFile(output, attachment, GetFileContentMime(content));
+
+    std::string cached;
+    if (storageCache_.Fetch(cached, attachment.GetUuid()))
+    {
+      // The attachment was recently read or prefetched
+      accessor.AnswerUncompressedFile(output, attachment, cached, GetFileContentMime(content));
+    }
+    else
+    {
+      accessor.AnswerFile(output, attachment, GetFileContentMime(content));
+    }
   }
 
 
@@ -483,23 +987,27 @@ namespace Orthanc
     StorageAccessor accessor(area_);
     accessor.Read(content, attachment);
 
-    FileInfo modified = accessor.Write(content.empty() ? NULL : content.c_str(),
-                                       content.size(), attachmentType, compression, storeMD5_);
+    FileInfo modified = WriteAttachment(accessor, content.empty() ? NULL : content.c_str(),
+                                        content.size(), attachmentType, compression, 0);
+
+    StoreStatus status;
 
     try
     {
-      StoreStatus status = index_.AddAttachment(modified, resourceId);
-      if (status != StoreStatus_Success)
-      {
-        accessor.Remove(modified);
-        throw OrthancException(ErrorCode_Database);
-      }
+      status = index_.AddAttachment(modified, resourceId);
     }
     catch (OrthancException&)
     {
-      accessor.Remove(modified);
+      ReleaseAttachment(accessor, modified, false);
       throw;
     }    
+
+    ReleaseAttachment(accessor, modified, status == StoreStatus_Success);
+
+    if (status != StoreStatus_Success)
+    {
+      throw OrthancException(ErrorCode_Database);
+    }
   }
 
 
@@ -514,26 +1022,35 @@ namespace Orthanc
     else
     {
       // The "DICOM as JSON" summary is not available from the Orthanc
-      // store (most probably deleted), reconstruct it from the DICOM file
-      std::string dicom;
-      ReadDicom(dicom, instancePublicId);
-
+      // store (most probably deleted, or not generated yet),
+      // reconstruct it from the DICOM file
       LOG(INFO) << "Reconstructing the missing DICOM-as-JSON summary for instance: "
                 << instancePublicId;
-    
-      ParsedDicomFile parsed(dicom);
 
-      Json::Value summary;
-      parsed.DatasetToJson(summary);
+      GenerateDicomAsJson(result, instancePublicId);
+    }
+  }
 
-      result = summary.toStyledString();
 
-      if (!AddAttachment(instancePublicId, FileContentType_DicomAsJson,
-                         result.c_str(), result.size()))
-      {
-        LOG(WARNING) << "Cannot associate the DICOM-as-JSON summary to instance: " << instancePublicId;
-        throw OrthancException(ErrorCode_InternalError);
-      }
+  void ServerContext::GenerateDicomAsJson(std::string& result,
+                                          const std::string& instancePublicId)
+  {
+    std::string dicom;
+    ReadDicomUntilPixelData(dicom, instancePublicId);
+
+    std::auto_ptr<ParsedDicomFile> parsed
+      (ParsedDicomFile::CreateUntilPixelData(dicom.empty() ? NULL : dicom.c_str(), dicom.size()));
+
+    Json::Value summary;
+    parsed->DatasetToJson(summary);
+
+    SerializeDicomAsJson(result, summary);
+
+    if (!AddAttachment(instancePublicId, FileContentType_DicomAsJson,
+                       result.c_str(), result.size()))
+    {
+      LOG(WARNING) << "Cannot associate the DICOM-as-JSON summary to instance: " << instancePublicId;
+      throw OrthancException(ErrorCode_InternalError);
     }
   }
 
@@ -545,6 +1062,13 @@ namespace Orthanc
     if (ignoreTagLength.empty())
     {
       ReadDicomAsJsonInternal(result, instancePublicId);
+
+      if (BinaryJson::IsBinaryJson(result))
+      {
+        Json::Value tmp;
+        BinaryJson::Decode(tmp, result);
+        result = tmp.toStyledString();
+      }
     }
     else
     {
@@ -564,21 +1088,79 @@ namespace Orthanc
       std::string tmp;
       ReadDicomAsJsonInternal(tmp, instancePublicId);
 
-      Json::Reader reader;
-      if (!reader.parse(tmp, result))
+      if (BinaryJson::IsBinaryJson(tmp))
       {
-        throw OrthancException(ErrorCode_CorruptedFile);
+        BinaryJson::Decode(result, tmp);
+      }
+      else
+      {
+        Json::Reader reader;
+        if (!reader.parse(tmp, result))
+        {
+          throw OrthancException(ErrorCode_CorruptedFile);
+        }
       }
     }
     else
     {
       // The "DicomAsJson" attachment might have stored some tags as
-      // "too long". We are forced to re-parse the DICOM file.
+      // "too long". We are forced to re-parse the DICOM file, but its
+      // pixel data is not needed.
       std::string dicom;
-      ReadDicom(dicom, instancePublicId);
+      ReadDicomUntilPixelData(dicom, instancePublicId);
+
+      std::auto_ptr<ParsedDicomFile> parsed
+        (ParsedDicomFile::CreateUntilPixelData(dicom.empty() ? NULL : dicom.c_str(), dicom.size()));
+      parsed->DatasetToJson(result, ignoreTagLength);
+    }
+  }
+
+
+  bool ServerContext::LookupDicomAsJsonTag(Json::Value& result,
+                                           const std::string& instancePublicId,
+                                           const DicomTag& tag)
+  {
+    std::string tmp;
+    ReadDicomAsJsonInternal(tmp, instancePublicId);
+
+    if (BinaryJson::IsBinaryJson(tmp))
+    {
+      return BinaryJson::LookupMember(result, tmp, tag.Format());
+    }
+    else
+    {
+      Json::Value summary;
+      Json::Reader reader;
+      if (!reader.parse(tmp, summary))
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      std::string formatted = tag.Format();
+      if (summary.type() == Json::objectValue &&
+          summary.isMember(formatted))
+      {
+        result = summary[formatted];
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+  }
+
 
-      ParsedDicomFile parsed(dicom);
-      parsed.DatasetToJson(result, ignoreTagLength);
+  void ServerContext::SerializeDicomAsJson(std::string& target,
+                                           const Json::Value& source) const
+  {
+    if (binaryDicomAsJson_)
+    {
+      BinaryJson::Encode(target, source);
+    }
+    else
+    {
+      target = source.toStyledString();
     }
   }
 
@@ -611,32 +1193,291 @@ namespace Orthanc
   void ServerContext::ReadAttachment(std::string& result,
                                      const FileInfo& attachment)
   {
+    // The content of an attachment never changes once it is stored:
+    // Its UUID can be used as the key of the cache, that is only
+    // invalidated when the file is removed
+    if (storageCache_.Fetch(result, attachment.GetUuid()))
+    {
+      return;
+    }
+
     // This will decompress the attachment
     StorageAccessor accessor(area_);
     accessor.Read(result, attachment);
+
+    storageCache_.Add(attachment.GetUuid(), result);
   }
 
 
-  IDynamicObject* ServerContext::DicomCacheProvider::Provide(const std::string& instancePublicId)
+  void ServerContext::ReadAttachments(std::vector<std::string>& contents,
+                                      const std::vector<FileInfo>& attachments)
   {
-    std::string content;
-    context_.ReadDicom(content, instancePublicId);
-    return new ParsedDicomFile(content);
+    contents.clear();
+    contents.resize(attachments.size());
+
+    std::vector<FileInfo> missing;
+    std::vector<size_t> indexes;
+
+    for (size_t i = 0; i < attachments.size(); i++)
+    {
+      if (!storageCache_.Fetch(contents[i], attachments[i].GetUuid()))
+      {
+        missing.push_back(attachments[i]);
+        indexes.push_back(i);
+      }
+    }
+
+    if (!missing.empty())
+    {
+      std::vector<std::string> read;
+      StorageAccessor accessor(area_);
+      accessor.ReadBatch(read, missing);
+
+      for (size_t i = 0; i < missing.size(); i++)
+      {
+        contents[indexes[i]].swap(read[i]);
+      }
+    }
+  }
+
+
+  bool ServerContext::LookupFrameOffsets(DicomFrameOffsetTable& offsets,
+                                         FileInfo& attachment,
+                                         const std::string& instancePublicId)
+  {
+    std::string s;
+
+    return (area_.HasReadRange() &&
+            index_.LookupMetadata(s, instancePublicId, MetadataType_Instance_FrameOffsets) &&
+            offsets.Unserialize(s) &&
+            index_.LookupAttachment(attachment, instancePublicId, FileContentType_Dicom) &&
+            // The compressed DICOM files are better served by the cache
+            // of the parsed DICOM files than by uncompressing them at
+            // each read
+            attachment.GetCompressionType() == CompressionType_None);
+  }
+
+
+  void ServerContext::ReadRawFrame(std::string& target,
+                                   const DicomFrameOffsetTable& offsets,
+                                   const FileInfo& attachment,
+                                   unsigned int frame)
+  {
+    uint64_t start, end;
+    offsets.GetFrameRange(start, end, frame);
+
+    std::string range;
+    StorageAccessor accessor(area_);
+    accessor.ReadRange(range, attachment, start, end);
+
+    offsets.ExtractFrame(target, range, frame);
+  }
+
+
+  bool ServerContext::ReadRawFrame(std::string& target,
+                                   MimeType& mime,
+                                   const std::string& instancePublicId,
+                                   unsigned int frame)
+  {
+    DicomFrameOffsetTable offsets;
+    FileInfo attachment;
+
+    if (LookupFrameOffsets(offsets, attachment, instancePublicId))
+    {
+      ReadRawFrame(target, offsets, attachment, frame);
+      mime = offsets.GetMimeType();
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void ServerContext::ReadDicomUntilPixelData(std::string& dicom,
+                                              const std::string& instancePublicId)
+  {
+    FileInfo attachment;
+    if (!index_.LookupAttachment(attachment, instancePublicId, FileContentType_Dicom))
+    {
+      LOG(WARNING) << "Unable to read attachment " << EnumerationToString(FileContentType_Dicom)
+                   << " of instance " << instancePublicId;
+      throw OrthancException(ErrorCode_InternalError);
+    }
+
+    if (!area_.HasReadRange() ||
+        attachment.GetCompressionType() != CompressionType_None ||
+        storageCache_.IsCached(attachment.GetUuid()))
+    {
+      // The whole file has to be read (or is already in memory)
+      ReadAttachment(dicom, attachment);
+      return;
+    }
+
+    const uint64_t size = attachment.GetUncompressedSize();
+    uint64_t end = std::min(size, DICOM_HEADER_READ_SIZE);
+
+    StorageAccessor accessor(area_);
+    accessor.ReadRange(dicom, attachment, 0, end);
+
+    for (;;)
+    {
+      uint64_t headerStart, valueStart;
+      DicomFrameOffsetTable::PixelDataLookup lookup =
+        DicomFrameOffsetTable::LookupPixelData(headerStart, valueStart,
+                                               dicom.empty() ? NULL : dicom.c_str(), dicom.size());
+
+      if (lookup == DicomFrameOffsetTable::PixelDataLookup_Found)
+      {
+        dicom.resize(static_cast<size_t>(valueStart));
+        return;
+      }
+
+      if (end == size)
+      {
+        return;  // The whole file has been read
+      }
+
+      // Read the next bytes of the file: Either the remaining of the
+      // file (no pixel data, or unsupported transfer syntax), or the
+      // next block of the header
+      uint64_t next;
+      if (lookup == DicomFrameOffsetTable::PixelDataLookup_NotFound)
+      {
+        next = size;
+      }
+      else
+      {
+        next = std::min(size, 2 * end);
+      }
+
+      std::string block;
+      accessor.ReadRange(block, attachment, end, next);
+      dicom.append(block);
+      end = next;
+    }
+  }
+
+
+  void ServerContext::ReconstructFrameOffsets(const std::string& instancePublicId,
+                                              const DicomMap& summary)
+  {
+    std::string dicom;
+    ReadDicom(dicom, instancePublicId);
+
+    DicomFrameOffsetTable offsets;
+    if (offsets.Compute(dicom.empty() ? NULL : dicom.c_str(), dicom.size(), summary))
+    {
+      std::string s;
+      offsets.Serialize(s);
+      index_.SetMetadata(instancePublicId, MetadataType_Instance_FrameOffsets, s);
+    }
+    else
+    {
+      index_.DeleteMetadata(instancePublicId, MetadataType_Instance_FrameOffsets);
+    }
+  }
+
+
+  uint64_t ServerContext::PrefetchAttachments(unsigned int& count,
+                                              const std::vector<std::string>& instances,
+                                              FileContentType content,
+                                              uint64_t budget)
+  {
+    std::vector<FileInfo> attachments;
+    attachments.reserve(instances.size());
+
+    uint64_t size = 0;
+
+    for (size_t i = 0; i < instances.size() && size < budget; i++)
+    {
+      FileInfo attachment;
+      if (index_.LookupAttachment(attachment, instances[i], content) &&
+          attachment.GetUncompressedSize() <= storageCache_.GetMaximumSize() &&
+          !storageCache_.IsCached(attachment.GetUuid()))
+      {
+        if (size + attachment.GetCompressedSize() > budget)
+        {
+          // The attachments are prefetched in the order of the
+          // instances, which is the order they will be accessed
+          break;
+        }
+
+        attachments.push_back(attachment);
+        size += attachment.GetCompressedSize();
+      }
+    }
+
+    count = static_cast<unsigned int>(attachments.size());
+
+    if (!attachments.empty())
+    {
+      // Submit the reads as one batch, so that the storage area can
+      // overlap them
+      std::vector<std::string> contents;
+      StorageAccessor accessor(area_);
+      accessor.ReadBatch(contents, attachments);
+
+      for (size_t i = 0; i < attachments.size(); i++)
+      {
+        storageCache_.Add(attachments[i].GetUuid(), contents[i]);
+      }
+    }
+
+    return size;
   }
 
 
+  // Entry of the DICOM cache, that associates the parsed file with
+  // the mutex serializing the accesses to it
+  class ServerContext::CachedDicomFile : public IDynamicObject
+  {
+  private:
+    boost::mutex                    mutex_;
+    std::auto_ptr<ParsedDicomFile>  dicom_;
+
+  public:
+    explicit CachedDicomFile(ParsedDicomFile* dicom) :
+      dicom_(dicom)
+    {
+      if (dicom == NULL)
+      {
+        throw OrthancException(ErrorCode_NullPointer);
+      }
+    }
+
+    boost::mutex& GetMutex()
+    {
+      return mutex_;
+    }
+
+    ParsedDicomFile& GetDicom()
+    {
+      return *dicom_;
+    }
+  };
+
+
   ServerContext::DicomCacheLocker::DicomCacheLocker(ServerContext& that,
-                                                    const std::string& instancePublicId) : 
-    that_(that),
-    lock_(that_.dicomCacheMutex_)
-  {
-#if ENABLE_DICOM_CACHE == 0
-    static std::auto_ptr<IDynamicObject> p;
-    p.reset(provider_.Provide(instancePublicId));
-    dicom_ = dynamic_cast<ParsedDicomFile*>(p.get());
-#else
-    dicom_ = &dynamic_cast<ParsedDicomFile&>(that_.dicomCache_.Access(instancePublicId));
-#endif
+                                                    const std::string& instancePublicId)
+  {
+    if (!that.dicomCache_.Fetch(item_, instancePublicId))
+    {
+      // The file is read and parsed outside of any lock. If another
+      // thread parses the same instance meanwhile, the first parsed
+      // file to enter the cache is shared by both threads.
+      std::string content;
+      that.ReadDicom(content, instancePublicId);
+
+      std::auto_ptr<ParsedDicomFile> dicom(new ParsedDicomFile(content));
+      SharedObjectCache::Item parsed(new CachedDicomFile(dicom.release()));
+      item_ = that.dicomCache_.Add(instancePublicId, parsed, content.size());
+    }
+
+    CachedDicomFile& entry = dynamic_cast<CachedDicomFile&>(*item_);
+    lock_.reset(new boost::mutex::scoped_lock(entry.GetMutex()));
+    dicom_ = &entry.GetDicom();
   }
 
 
@@ -659,22 +1500,27 @@ namespace Orthanc
   {
     LOG(INFO) << "Adding attachment " << EnumerationToString(attachmentType) << " to resource " << resourceId;
     
-    // TODO Should we use "gzip" instead?
-    CompressionType compression = (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
+    int level;
+    CompressionType compression = GetCompressionPolicy(level, attachmentType);
 
     StorageAccessor accessor(area_);
-    FileInfo attachment = accessor.Write(data, size, attachmentType, compression, storeMD5_);
+    FileInfo attachment = WriteAttachment(accessor, data, size, attachmentType, compression, level);
 
-    StoreStatus status = index_.AddAttachment(attachment, resourceId);
-    if (status != StoreStatus_Success)
+    StoreStatus status;
+
+    try
     {
-      accessor.Remove(attachment);
-      return false;
+      status = index_.AddAttachment(attachment, resourceId);
     }
-    else
+    catch (OrthancException&)
     {
-      return true;
+      ReleaseAttachment(accessor, attachment, false);
+      throw;
     }
+
+    ReleaseAttachment(accessor, attachment, status == StoreStatus_Success);
+
+    return (status == StoreStatus_Success);
   }
 
 
@@ -685,7 +1531,6 @@ namespace Orthanc
     if (expectedType == ResourceType_Instance)
     {
       // remove the file from the DicomCache
-      boost::mutex::scoped_lock lock(dicomCacheMutex_);
       dicomCache_.Invalidate(uuid);
     }
 
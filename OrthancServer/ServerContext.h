@@ -37,14 +37,19 @@
 #include "IServerListener.h"
 #include "LuaScripting.h"
 #include "OrthancHttpHandler.h"
+#include "RenderedImageCache.h"
+#include "SeriesPrefetcher.h"
 #include "ServerIndex.h"
 
-#include "../Core/Cache/MemoryCache.h"
+#include "../Core/Cache/MemoryStringCache.h"
 #include "../Core/Cache/SharedArchive.h"
+#include "../Core/Cache/SharedObjectCache.h"
+#include "../Core/DicomFormat/DicomFrameOffsetTable.h"
 #include "../Core/DicomParsing/ParsedDicomFile.h"
 #include "../Core/FileStorage/IStorageArea.h"
 #include "../Core/JobsEngine/JobsEngine.h"
 #include "../Core/JobsEngine/SetOfInstancesJob.h"
+#include "../Core/MultiThreading/TaskPool.h"
 #include "../Core/MultiThreading/SharedMessageQueue.h"
 #include "../Core/RestApi/RestApiOutput.h"
 #include "../Plugins/Engine/OrthancPlugins.h"
@@ -55,6 +60,8 @@
 
 namespace Orthanc
 {
+  class StorageAccessor;
+
   /**
    * This class is responsible for maintaining the storage area on the
    * filesystem (including compression), as well as the index of the
@@ -93,19 +100,6 @@ namespace Orthanc
       }
     };
     
-    class DicomCacheProvider : public ICachePageProvider
-    {
-    private:
-      ServerContext& context_;
-
-    public:
-      DicomCacheProvider(ServerContext& context) : context_(context)
-      {
-      }
-      
-      virtual IDynamicObject* Provide(const std::string& id);
-    };
-
     class ServerListener
     {
     private:
@@ -140,9 +134,39 @@ namespace Orthanc
     static void SaveJobsThread(ServerContext* that,
                                unsigned int sleepDelay);
 
+    static void DicomAsJsonThread(ServerContext* that,
+                                  unsigned int sleepDelay);
+
+    void GenerateDicomAsJson(std::string& result,
+                             const std::string& instancePublicId);
+
     void ReadDicomAsJsonInternal(std::string& result,
                                  const std::string& instancePublicId);
 
+    FileInfo WriteRandomAttachment(StorageAccessor& accessor,
+                                   const void* data,
+                                   size_t size,
+                                   FileContentType type,
+                                   CompressionType compression);
+
+    FileInfo WriteAttachment(StorageAccessor& accessor,
+                             const void* data,
+                             size_t size,
+                             FileContentType type,
+                             CompressionType compression,
+                             int compressionLevel);
+
+    CompressionType GetCompressionPolicy(int& level,
+                                         FileContentType type) const;
+
+    class WriteAttachmentTask;
+
+    class CachedDicomFile;
+
+    void ReleaseAttachment(StorageAccessor& accessor,
+                           const FileInfo& attachment,
+                           bool isIndexed);
+
     void SaveJobsEngine();
 
     virtual void SignalJobSubmitted(const std::string& jobId);
@@ -156,10 +180,37 @@ namespace Orthanc
 
     bool compressionEnabled_;
     bool storeMD5_;
+    bool binaryDicomAsJson_;
+    DicomAsJsonGeneration dicomAsJsonGeneration_;
+
+    // Compression (codec and level) of the content types whose
+    // policy overrides "compressionEnabled_"
+    typedef std::map<FileContentType, std::pair<CompressionType, int> >  CompressionPolicies;
+    CompressionPolicies compressionPolicies_;
+
+    // Pool that compresses and writes the attachments of the incoming
+    // instances in parallel
+    TaskPool storagePool_;
+
+    // Uncompressed content of the recently read attachments, indexed
+    // by the UUID of the attachment
+    MemoryStringCache storageCache_;
+
+    // Read-ahead of the neighbors of the accessed instances into
+    // "storageCache_"
+    SeriesPrefetcher prefetcher_;
     
-    DicomCacheProvider provider_;
-    boost::mutex dicomCacheMutex_;
-    MemoryCache dicomCache_;
+    // Parsed DICOM files of the recently accessed instances, indexed
+    // by their public ID and shared between the concurrent readers
+    SharedObjectCache dicomCache_;
+
+    // Encoded renderings of the frames (previews and images)
+    RenderedImageCache renderingsCache_;
+
+    // Pool that processes the large images by horizontal bands (it is
+    // registered into ImageProcessing), and that decodes the frames
+    // of the batch extractions in parallel
+    TaskPool imageProcessingPool_;
     JobsEngine jobsEngine_;
 
     LuaScripting mainLua_;
@@ -179,18 +230,36 @@ namespace Orthanc
     SharedMessageQueue  pendingChanges_;
     boost::thread  changeThread_;
     boost::thread  saveJobsThread_;
+
+    // Instances whose "DICOM-as-JSON" summary is generated in the
+    // background (if "dicomAsJsonGeneration_" is "Deferred")
+    SharedMessageQueue  pendingDicomAsJson_;
+    boost::thread  dicomAsJsonThread_;
+    boost::mutex  dicomAsJsonMutex_;
+    uint64_t  dicomAsJsonBacklog_;
+    uint64_t  dicomAsJsonGenerated_;
+    uint64_t  dicomAsJsonFailures_;
         
     SharedArchive  queryRetrieveArchive_;
     std::string defaultLocalAet_;
     OrthancHttpHandler  httpHandler_;
 
   public:
+    /**
+     * Gives access to the parsed DICOM file of one instance. The
+     * locker shares the ownership of the parsed file with the DICOM
+     * cache, and holds the mutex of this cache entry during its
+     * lifetime, as DCMTK is not thread-safe, even for reading. The
+     * cache itself is not locked: Different instances can be
+     * accessed concurrently. The parsed file must not be handed to
+     * other threads.
+     **/
     class DicomCacheLocker : public boost::noncopyable
     {
     private:
-      ServerContext& that_;
-      ParsedDicomFile *dicom_;
-      boost::mutex::scoped_lock lock_;
+      SharedObjectCache::Item                   item_;
+      std::auto_ptr<boost::mutex::scoped_lock>  lock_;
+      ParsedDicomFile*                          dicom_;
 
     public:
       DicomCacheLocker(ServerContext& that,
@@ -218,6 +287,11 @@ namespace Orthanc
       return index_;
     }
 
+    IStorageArea& GetStorageArea()
+    {
+      return area_;
+    }
+
     void SetCompressionEnabled(bool enabled);
 
     bool IsCompressionEnabled() const
@@ -225,6 +299,11 @@ namespace Orthanc
       return compressionEnabled_;
     }
 
+    // Overrides the global compression setting for one content type
+    void SetCompressionPolicy(FileContentType type,
+                              CompressionType compression,
+                              int level);
+
     void RemoveFile(const std::string& fileUuid,
                     FileContentType type);
 
@@ -266,13 +345,24 @@ namespace Orthanc
       ReadDicomAsJson(result, instancePublicId, ignoreTagLength);
     }
 
+    // Reads one tag of the "DICOM-as-JSON" summary, without decoding
+    // the full summary if it is stored in the binary format. Returns
+    // "false" if the tag is absent.
+    bool LookupDicomAsJsonTag(Json::Value& result,
+                              const std::string& instancePublicId,
+                              const DicomTag& tag);
+
+    // Serializes a "DICOM-as-JSON" summary, using the format that is
+    // configured for the storage area
+    void SerializeDicomAsJson(std::string& target,
+                              const Json::Value& source) const;
+
     void ReadDicom(std::string& dicom,
                    const std::string& instancePublicId)
     {
       ReadAttachment(dicom, instancePublicId, FileContentType_Dicom, true);
     }
-    
-    // TODO CACHING MECHANISM AT THIS POINT
+
     void ReadAttachment(std::string& result,
                         const std::string& instancePublicId,
                         FileContentType content,
@@ -281,8 +371,102 @@ namespace Orthanc
     void ReadAttachment(std::string& result,
                         const FileInfo& attachment);
 
+    // Reads several attachments of the same content type, submitting
+    // their reads as one batch to the storage area. The attachments
+    // that are read are not added to the cache, as they are typically
+    // only read once (e.g. by the archives).
+    void ReadAttachments(std::vector<std::string>& contents,
+                         const std::vector<FileInfo>& attachments);
+
+    // Reads one raw frame of an instance from the storage area,
+    // without parsing its DICOM file, using the "FrameOffsets"
+    // metadata that is computed at the reception of the instance.
+    // Returns "false" if this metadata is not available, or if the
+    // DICOM file cannot be partially read (e.g. if it is compressed).
+    bool ReadRawFrame(std::string& target,
+                      MimeType& mime,
+                      const std::string& instancePublicId,
+                      unsigned int frame);
+
+    // Loads the "FrameOffsets" metadata of an instance, together with
+    // its DICOM attachment, so that several raw frames can be read
+    // without looking up the index again. Returns "false" in the same
+    // situations as "ReadRawFrame()".
+    bool LookupFrameOffsets(DicomFrameOffsetTable& offsets,
+                            FileInfo& attachment,
+                            const std::string& instancePublicId);
+
+    void ReadRawFrame(std::string& target,
+                      const DicomFrameOffsetTable& offsets,
+                      const FileInfo& attachment,
+                      unsigned int frame);
+
+    // Reads the DICOM file of the instance, up to the header of its
+    // pixel data element if it is present, to be parsed by
+    // "ParsedDicomFile::CreateUntilPixelData()". Only the first bytes
+    // of the file are read if the storage area supports partial reads.
+    void ReadDicomUntilPixelData(std::string& dicom,
+                                 const std::string& instancePublicId);
+
+    // Recomputes the "FrameOffsets" metadata of an instance that
+    // was received before this metadata was introduced
+    void ReconstructFrameOffsets(const std::string& instancePublicId,
+                                 const DicomMap& summary);
+
+    // Loads the attachments of the given instances into the cache of
+    // attachments, without reading more than "budget" bytes from the
+    // storage area. The attachments that are already cached, or that
+    // cannot be cached, are skipped. Returns the number of bytes read,
+    // and sets "count" to the number of attachments read.
+    uint64_t PrefetchAttachments(unsigned int& count,
+                                 const std::vector<std::string>& instances,
+                                 FileContentType content,
+                                 uint64_t budget);
+
+    // Signals that the given instance was accessed, in order to
+    // prefetch the neighboring instances of its series
+    void PrefetchNeighbors(const std::string& instancePublicId)
+    {
+      prefetcher_.SignalAccess(instancePublicId);
+    }
+
     void SetStoreMD5ForAttachments(bool storeMD5);
 
+    // Adds the state of the cache of attachments to the statistics
+    // of the server
+    void ComputeStorageCacheStatistics(Json::Value& target);
+
+    RenderedImageCache& GetRenderingsCache()
+    {
+      return renderingsCache_;
+    }
+
+    TaskPool& GetImageProcessingPool()
+    {
+      return imageProcessingPool_;
+    }
+
+    void SetBinaryDicomAsJson(bool binary)
+    {
+      binaryDicomAsJson_ = binary;
+    }
+
+    bool IsBinaryDicomAsJson() const
+    {
+      return binaryDicomAsJson_;
+    }
+
+    void SetDicomAsJsonGeneration(DicomAsJsonGeneration generation);
+
+    DicomAsJsonGeneration GetDicomAsJsonGeneration() const
+    {
+      return dicomAsJsonGeneration_;
+    }
+
+    // Adds the state of the background generation of the
+    // "DICOM-as-JSON" summaries to the statistics of the server
+    void ComputeDicomAsJsonStatistics(Json::Value& target);
+
     bool IsStoreMD5ForAttachments() const
     {
       return storeMD5_;
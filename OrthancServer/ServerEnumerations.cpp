@@ -70,6 +70,7 @@ namespace Orthanc
     dictMetadataType_.Add(MetadataType_Instance_RemoteIp, "RemoteIP");
     dictMetadataType_.Add(MetadataType_Instance_CalledAet, "CalledAET");
     dictMetadataType_.Add(MetadataType_Instance_HttpUsername, "HttpUsername");
+    dictMetadataType_.Add(MetadataType_Instance_FrameOffsets, "FrameOffsets");
 
     dictContentType_.Add(FileContentType_Dicom, "dicom");
     dictContentType_.Add(FileContentType_DicomAsJson, "dicom-as-json");
@@ -315,11 +316,55 @@ namespace Orthanc
       case ChangeType_UpdatedMetadata:
         return "UpdatedMetadata";
 
+      case ChangeType_CorruptedAttachment:
+        return "CorruptedAttachment";
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+
+  const char* EnumerationToString(DicomAsJsonGeneration generation)
+  {
+    switch (generation)
+    {
+      case DicomAsJsonGeneration_Immediate:
+        return "Immediate";
+
+      case DicomAsJsonGeneration_Deferred:
+        return "Deferred";
+
+      case DicomAsJsonGeneration_OnDemand:
+        return "OnDemand";
+
       default:
         throw OrthancException(ErrorCode_ParameterOutOfRange);
     }
   }
 
+
+  DicomAsJsonGeneration StringToDicomAsJsonGeneration(const std::string& str)
+  {
+    if (str == "Immediate")
+    {
+      return DicomAsJsonGeneration_Immediate;
+    }
+    else if (str == "Deferred")
+    {
+      return DicomAsJsonGeneration_Deferred;
+    }
+    else if (str == "OnDemand")
+    {
+      return DicomAsJsonGeneration_OnDemand;
+    }
+    else
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
   
   bool IsUserMetadata(MetadataType metadata)
   {
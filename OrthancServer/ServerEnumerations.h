@@ -125,6 +125,7 @@ namespace Orthanc
     MetadataType_Instance_RemoteIp = 11,       // New in Orthanc 1.4.0
     MetadataType_Instance_CalledAet = 12,      // New in Orthanc 1.4.0
     MetadataType_Instance_HttpUsername = 13,   // New in Orthanc 1.4.0
+    MetadataType_Instance_FrameOffsets = 14,   // New in Orthanc 1.5.0
 
     // Make sure that the value "65535" can be stored into this enumeration
     MetadataType_StartUser = 1024,
@@ -149,6 +150,7 @@ namespace Orthanc
     ChangeType_StableSeries = 14,
     ChangeType_UpdatedAttachment = 15,
     ChangeType_UpdatedMetadata = 16,
+    ChangeType_CorruptedAttachment = 17,  // Detected by the integrity checks
 
     ChangeType_INTERNAL_LastLogged = 4095,
 
@@ -157,6 +159,15 @@ namespace Orthanc
     ChangeType_NewChildInstance = 4097
   };
 
+  // When the "DICOM-as-JSON" summary of an incoming instance is
+  // written to the storage area
+  enum DicomAsJsonGeneration
+  {
+    DicomAsJsonGeneration_Immediate,  // While storing the instance
+    DicomAsJsonGeneration_Deferred,   // By a background worker
+    DicomAsJsonGeneration_OnDemand    // On the first access to the summary
+  };
+
 
 
   void InitializeServerEnumerations();
@@ -187,5 +198,9 @@ namespace Orthanc
 
   const char* EnumerationToString(ChangeType type);
 
+  const char* EnumerationToString(DicomAsJsonGeneration generation);
+
+  DicomAsJsonGeneration StringToDicomAsJsonGeneration(const std::string& str);
+
   bool IsUserMetadata(MetadataType type);
 }
@@ -128,16 +128,31 @@ namespace Orthanc
       return sizeOfFilesToRemove_;
     }
 
-    void CommitFilesToRemove()
+    void CommitFilesToRemove(ServerIndex& index)
     {
       for (std::list<FileToRemove>::const_iterator 
              it = pendingFilesToRemove_.begin();
            it != pendingFilesToRemove_.end(); ++it)
       {
-        context_.RemoveFile(it->GetUuid(), it->GetContentType());
+        if (index.IsAttachmentUuidInUse(it->GetUuid()))
+        {
+          // Content-addressed storage: The same content is still
+          // referenced by another attachment
+          VLOG(1) << "Keeping deduplicated attachment " << it->GetUuid();
+        }
+        else
+        {
+          RemoveFile(it->GetUuid(), it->GetContentType());
+        }
       }
     }
 
+    void RemoveFile(const std::string& uuid,
+                    FileContentType type)
+    {
+      context_.RemoveFile(uuid, type);
+    }
+
     void CommitChanges()
     {
       for (std::list<ServerIndexChange>::const_iterator 
@@ -250,7 +265,7 @@ namespace Orthanc
         // We can remove the files once the SQLite transaction has
         // been successfully committed. Some files might have to be
         // deleted because of recycling.
-        index_.listener_->CommitFilesToRemove();
+        index_.listener_->CommitFilesToRemove(index_);
 
         index_.currentStorageSize_ += sizeOfAddedFiles;
 
@@ -545,7 +560,8 @@ namespace Orthanc
     db_(db),
     maximumStorageSize_(0),
     maximumPatients_(0),
-    overwrite_(false)
+    overwrite_(false),
+    deduplication_(false)
   {
     listener_.reset(new Listener(context));
     db_.SetListener(*listener_);
@@ -1478,6 +1494,166 @@ namespace Orthanc
   }
 
 
+  void ServerIndex::SetStorageDeduplication(bool deduplication)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    deduplication_ = deduplication;
+  }
+
+
+  bool ServerIndex::IsAttachmentUuidInUse(const std::string& uuid)
+  {
+    // WARNING: No mutex here, do not include this as a public method
+
+    // The index is checked even if deduplication is currently
+    // disabled, as the storage area might have been filled while it
+    // was enabled: Files can still be shared by several attachments
+    FileInfo tmp;
+    return (pendingUuids_.find(uuid) != pendingUuids_.end() ||
+            db_.LookupAttachmentByUuid(tmp, uuid));
+  }
+
+
+  void ServerIndex::AddPendingUuidInternal(const std::string& uuid)
+  {
+    // WARNING: No mutex here, do not include this as a public method
+    std::map<std::string, unsigned int>::iterator pending = pendingUuids_.find(uuid);
+
+    if (pending == pendingUuids_.end())
+    {
+      pendingUuids_[uuid] = 1;
+    }
+    else
+    {
+      pending->second += 1;
+    }
+  }
+
+
+  void ServerIndex::RemovePendingUuidInternal(const std::string& uuid)
+  {
+    // WARNING: No mutex here, do not include this as a public method
+    std::map<std::string, unsigned int>::iterator pending = pendingUuids_.find(uuid);
+
+    if (pending != pendingUuids_.end())
+    {
+      assert(pending->second > 0);
+      pending->second -= 1;
+
+      if (pending->second == 0)
+      {
+        pendingUuids_.erase(pending);
+      }
+    }
+  }
+
+
+  bool ServerIndex::ReserveAttachmentUuid(bool& isStored,
+                                          FileInfo& existing,
+                                          const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!deduplication_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    isStored = db_.LookupAttachmentByUuid(existing, uuid);
+
+    if (!isStored &&
+        pendingUuids_.find(uuid) != pendingUuids_.end())
+    {
+      // Another thread is writing the same content at this very
+      // moment, but has not indexed it yet
+      return false;
+    }
+
+    AddPendingUuidInternal(uuid);
+    return true;
+  }
+
+
+  void ServerIndex::ReleaseAttachmentUuid(const std::string& uuid,
+                                          FileContentType type)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    RemovePendingUuidInternal(uuid);
+
+    // The mutex is still locked, which prevents a concurrent
+    // "ReserveAttachmentUuid()" to reuse the content before it is
+    // removed from the storage area
+    if (!IsAttachmentUuidInUse(uuid))
+    {
+      listener_->RemoveFile(uuid, type);
+    }
+  }
+
+
+  void ServerIndex::AddPendingAttachment(const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    AddPendingUuidInternal(uuid);
+  }
+
+
+  void ServerIndex::RemovePendingAttachment(const std::string& uuid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    RemovePendingUuidInternal(uuid);
+  }
+
+
+  void ServerIndex::ListAttachmentUuids(std::list<std::string>& target,
+                                        const std::string& after,
+                                        const std::string& before,
+                                        uint32_t limit)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    db_.ListAttachmentUuids(target, after, before, limit);
+  }
+
+
+  void ServerIndex::ListAttachments(std::list< std::pair<std::string, FileInfo> >& target,
+                                    const std::string& after,
+                                    uint32_t limit)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::list<IDatabaseWrapper::AttachmentOwner> attachments;
+    db_.ListAttachments(attachments, after, limit);
+
+    target.clear();
+
+    for (std::list<IDatabaseWrapper::AttachmentOwner>::const_iterator
+           it = attachments.begin(); it != attachments.end(); ++it)
+    {
+      target.push_back(std::make_pair(db_.GetPublicId(it->first), it->second));
+    }
+  }
+
+
+  bool ServerIndex::RemoveOrphanAttachment(const std::string& uuid)
+  {
+    // The index is checked again under the mutex, which prevents a
+    // concurrent writer from indexing the file while it is removed
+    boost::mutex::scoped_lock lock(mutex_);
+
+    FileInfo tmp;
+    if (pendingUuids_.find(uuid) != pendingUuids_.end() ||
+        db_.LookupAttachmentByUuid(tmp, uuid))
+    {
+      return false;
+    }
+    else
+    {
+      listener_->RemoveFile(uuid, FileContentType_Unknown);
+      return true;
+    }
+  }
+
+
   void ServerIndex::StandaloneRecycling()
   {
     // WARNING: No mutex here, do not include this as a public method
@@ -74,12 +74,22 @@ namespace Orthanc
     unsigned int maximumPatients_;
     bool         overwrite_;
 
+    // Number of attachments that are being written for each UUID,
+    // but not indexed yet. This protects them against the removal of
+    // the orphan files, and is shared with content-addressed storage.
+    bool                                  deduplication_;
+    std::map<std::string, unsigned int>   pendingUuids_;
+
     static void FlushThread(ServerIndex* that,
                             unsigned int threadSleep);
 
     static void UnstableResourcesMonitorThread(ServerIndex* that,
                                                unsigned int threadSleep);
 
+    void AddPendingUuidInternal(const std::string& uuid);
+
+    void RemovePendingUuidInternal(const std::string& uuid);
+
     void MainDicomTagsToJson(Json::Value& result,
                              int64_t resourceId,
                              ResourceType resourceType);
@@ -124,6 +134,8 @@ namespace Orthanc
                              MetadataType metadata,
                              const std::string& value);
 
+    bool IsAttachmentUuidInUse(const std::string& uuid);
+
   public:
     ServerIndex(ServerContext& context,
                 IDatabaseWrapper& database,
@@ -151,6 +163,58 @@ namespace Orthanc
 
     void SetOverwriteInstances(bool overwrite);
 
+    void SetStorageDeduplication(bool deduplication);
+
+    bool IsStorageDeduplication() const
+    {
+      return deduplication_;
+    }
+
+    /**
+     * Content-addressed storage. This method returns "false" if
+     * another thread is currently writing the same content (in which
+     * case the caller must fallback to a random UUID). Otherwise, a
+     * pending reference to "uuid" is registered, and "isStored" is
+     * set to "true" iff the content is already referenced by the
+     * index (in which case "existing" is filled). Each successful
+     * call must be followed by "ReleaseAttachmentUuid()".
+     **/
+    bool ReserveAttachmentUuid(bool& isStored,
+                               FileInfo& existing,
+                               const std::string& uuid);
+
+    // Removes the content from the storage area if it is not
+    // referenced anymore
+    void ReleaseAttachmentUuid(const std::string& uuid,
+                               FileContentType type);
+
+    // Registers an attachment with a random UUID that is about to be
+    // written to the storage area, but that is not indexed yet. Each
+    // call must be followed by "RemovePendingAttachment()".
+    void AddPendingAttachment(const std::string& uuid);
+
+    void RemovePendingAttachment(const std::string& uuid);
+
+    void ListAttachmentUuids(std::list<std::string>& target,
+                             const std::string& after,
+                             const std::string& before,
+                             uint32_t limit);
+
+    // Lists the attachments in increasing order of uuid (keyset
+    // pagination), together with the public identifier of their owner
+    void ListAttachments(std::list< std::pair<std::string, FileInfo> >& target,
+                         const std::string& after,
+                         uint32_t limit);
+
+    /**
+     * Removes a file from the storage area if it is not referenced
+     * by the index, nor being written by another thread (cf.
+     * "AddPendingAttachment()" and "ReserveAttachmentUuid()"). Returns
+     * "false" if the file is still in use, in which case nothing is
+     * removed.
+     **/
+    bool RemoveOrphanAttachment(const std::string& uuid);
+
     StoreStatus Store(std::map<MetadataType, std::string>& instanceMetadata,
                       DicomInstanceToStore& instance,
                       const Attachments& attachments);
@@ -49,6 +49,11 @@ static const uint64_t MEGA_BYTES = 1024 * 1024;
 static const uint64_t GIGA_BYTES = 1024 * 1024 * 1024;
 static const char* MEDIA_IMAGES_FOLDER = "IMAGES"; 
 
+// The DICOM files of the next instances of an archive are read as one
+// batch from the storage area, within these limits
+static const size_t   READ_AHEAD_INSTANCES = 16;
+static const uint64_t READ_AHEAD_SIZE = 64 * MEGA_BYTES;
+
 namespace Orthanc
 {
   static bool IsZip64Required(uint64_t uncompressedSize,
@@ -360,10 +365,15 @@ namespace Orthanc
       std::string   filename_;
       std::string   instanceId_;
       FileInfo      info_;
+      bool          readAhead_;
+      bool          hasContent_;
+      std::string   content_;   // Content read ahead of time
 
     public:
       explicit Command(Type type) :
-        type_(type)
+        type_(type),
+        readAhead_(false),
+        hasContent_(false)
       {
         assert(type_ == Type_CloseDirectory);
       }
@@ -371,7 +381,9 @@ namespace Orthanc
       Command(Type type,
               const std::string& filename) :
         type_(type),
-        filename_(filename)
+        filename_(filename),
+        readAhead_(false),
+        hasContent_(false)
       {
         assert(type_ == Type_OpenDirectory);
       }
@@ -383,15 +395,42 @@ namespace Orthanc
         type_(type),
         filename_(filename),
         instanceId_(instanceId),
-        info_(info)
+        info_(info),
+        readAhead_(false),
+        hasContent_(false)
       {
         assert(type_ == Type_WriteInstance);
       }
+
+      bool IsReadAheadNeeded() const
+      {
+        return (type_ == Type_WriteInstance &&
+                !readAhead_);
+      }
+
+      const FileInfo& GetInfo() const
+      {
+        return info_;
+      }
+
+      void SetContent(std::string& content)
+      {
+        content_.swap(content);
+        readAhead_ = true;
+        hasContent_ = true;
+      }
+
+      // The instance could not be read ahead of time (it was
+      // possibly removed), it will be read by "Apply()"
+      void SkipReadAhead()
+      {
+        readAhead_ = true;
+      }
         
       void Apply(HierarchicalZipWriter& writer,
                  ServerContext& context,
                  DicomDirWriter* dicomDir,
-                 const std::string& dicomDirFolder) const
+                 const std::string& dicomDirFolder)
       {
         switch (type_)
         {
@@ -407,14 +446,22 @@ namespace Orthanc
           {
             std::string content;
 
-            try
+            if (hasContent_)
             {
-              context.ReadAttachment(content, info_);
+              content.swap(content_);
+              hasContent_ = false;
             }
-            catch (OrthancException& e)
+            else
             {
-              LOG(WARNING) << "An instance was removed after the job was issued: " << instanceId_;
-              return;
+              try
+              {
+                context.ReadAttachment(content, info_);
+              }
+              catch (OrthancException& e)
+              {
+                LOG(WARNING) << "An instance was removed after the job was issued: " << instanceId_;
+                return;
+              }
             }
 
             //boost::this_thread::sleep(boost::posix_time::milliseconds(300));
@@ -442,6 +489,67 @@ namespace Orthanc
     unsigned int          instancesCount_;
 
       
+    // Reads the DICOM files of the instances of the next commands
+    // as one batch, so that the storage area can overlap their reads
+    void ReadAhead(ServerContext& context,
+                   size_t index) const
+    {
+      std::vector<size_t> indexes;
+      std::vector<FileInfo> attachments;
+      uint64_t size = 0;
+
+      for (size_t i = index; (i < commands_.size() &&
+                              attachments.size() < READ_AHEAD_INSTANCES &&
+                              size < READ_AHEAD_SIZE); i++)
+      {
+        if (commands_[i]->IsReadAheadNeeded())
+        {
+          indexes.push_back(i);
+          attachments.push_back(commands_[i]->GetInfo());
+          size += commands_[i]->GetInfo().GetCompressedSize();
+        }
+      }
+
+      if (attachments.size() < 2)
+      {
+        return;  // Nothing to gain over a single read
+      }
+
+      std::vector<std::string> contents;
+
+      try
+      {
+        context.ReadAttachments(contents, attachments);
+      }
+      catch (OrthancException&)
+      {
+        // Some instance was removed after the job was issued: Read
+        // the instances one by one, the missing ones being skipped
+        // by their command
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+          std::string content;
+
+          try
+          {
+            context.ReadAttachment(content, attachments[i]);
+            commands_[indexes[i]]->SetContent(content);
+          }
+          catch (OrthancException&)
+          {
+            commands_[indexes[i]]->SkipReadAhead();
+          }
+        }
+
+        return;
+      }
+
+      for (size_t i = 0; i < indexes.size(); i++)
+      {
+        commands_[indexes[i]]->SetContent(contents[i]);
+      }
+    }
+
     void ApplyInternal(HierarchicalZipWriter& writer,
                        ServerContext& context,
                        size_t index,
@@ -453,6 +561,11 @@ namespace Orthanc
         throw OrthancException(ErrorCode_ParameterOutOfRange);
       }
 
+      if (commands_[index]->IsReadAheadNeeded())
+      {
+        ReadAhead(context, index);
+      }
+
       commands_[index]->Apply(writer, context, dicomDir, dicomDirFolder);
     }
       
@@ -0,0 +1,183 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeadersServer.h"
+#include "DicomAsJsonConversionJob.h"
+
+#include "../../Core/BinaryJson.h"
+#include "../../Core/Logging.h"
+#include "../../Core/OrthancException.h"
+
+namespace Orthanc
+{
+  void DicomAsJsonConversionJob::ConvertInstance(const std::string& instance)
+  {
+    FileInfo attachment;
+    if (!context_.GetIndex().LookupAttachment(attachment, instance, FileContentType_DicomAsJson))
+    {
+      skippedCount_++;
+      return;
+    }
+
+    std::string content;
+    context_.ReadAttachment(content, attachment);
+
+    bool isBinary = BinaryJson::IsBinaryJson(content);
+    if (isBinary == binary_)
+    {
+      skippedCount_++;
+      return;
+    }
+
+    Json::Value summary;
+    if (isBinary)
+    {
+      BinaryJson::Decode(summary, content);
+    }
+    else
+    {
+      Json::Reader reader;
+      if (!reader.parse(content, summary))
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+    }
+
+    if (binary_)
+    {
+      BinaryJson::Encode(content, summary);
+    }
+    else
+    {
+      content = summary.toStyledString();
+    }
+
+    if (context_.AddAttachment(instance, FileContentType_DicomAsJson,
+                               content.empty() ? NULL : content.c_str(), content.size()))
+    {
+      convertedCount_++;
+    }
+    else
+    {
+      // The instance has been deleted in the meantime
+      skippedCount_++;
+    }
+  }
+
+
+  DicomAsJsonConversionJob::DicomAsJsonConversionJob(ServerContext& context,
+                                                     bool binary) :
+    context_(context),
+    binary_(binary)
+  {
+    Reset();
+  }
+
+
+  JobStepResult DicomAsJsonConversionJob::Step()
+  {
+    if (!listed_)
+    {
+      std::list<std::string> studies;
+      context_.GetIndex().GetAllUuids(studies, ResourceType_Study);
+
+      studies_.assign(studies.begin(), studies.end());
+      listed_ = true;
+      return JobStepResult::Continue();
+    }
+
+    if (position_ >= studies_.size())
+    {
+      return JobStepResult::Success();
+    }
+
+    std::list<std::string> instances;
+    context_.GetIndex().GetChildInstances(instances, studies_[position_]);
+
+    for (std::list<std::string>::const_iterator
+           it = instances.begin(); it != instances.end(); ++it)
+    {
+      try
+      {
+        ConvertInstance(*it);
+      }
+      catch (OrthancException& e)
+      {
+        LOG(WARNING) << "Cannot convert the DICOM-as-JSON summary of instance "
+                     << *it << ": " << e.What();
+        failedCount_++;
+      }
+    }
+
+    position_++;
+    return JobStepResult::Continue();
+  }
+
+
+  void DicomAsJsonConversionJob::Reset()
+  {
+    listed_ = false;
+    studies_.clear();
+    position_ = 0;
+    convertedCount_ = 0;
+    skippedCount_ = 0;
+    failedCount_ = 0;
+  }
+
+
+  float DicomAsJsonConversionJob::GetProgress()
+  {
+    if (!listed_)
+    {
+      return 0;
+    }
+    else if (studies_.empty())
+    {
+      return 1;
+    }
+    else
+    {
+      return (static_cast<float>(position_) /
+              static_cast<float>(studies_.size()));
+    }
+  }
+
+
+  void DicomAsJsonConversionJob::GetPublicContent(Json::Value& value)
+  {
+    value["Format"] = (binary_ ? "Binary" : "Json");
+    value["ConvertedCount"] = static_cast<unsigned int>(convertedCount_);
+    value["SkippedCount"] = static_cast<unsigned int>(skippedCount_);
+    value["FailedCount"] = static_cast<unsigned int>(failedCount_);
+  }
+}
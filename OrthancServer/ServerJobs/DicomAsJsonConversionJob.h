@@ -0,0 +1,92 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../../Core/JobsEngine/IJob.h"
+#include "../ServerContext.h"
+
+namespace Orthanc
+{
+  /**
+   * Rewrites the "DICOM-as-JSON" summaries of all the instances in
+   * the target format (either the textual JSON format, or the compact
+   * binary format). The instances are processed one study at a time.
+   * The summaries that are already in the target format, or that are
+   * missing (they will be reconstructed on demand), are skipped.
+   **/
+  class DicomAsJsonConversionJob : public IJob
+  {
+  private:
+    ServerContext&            context_;
+    bool                      binary_;
+    bool                      listed_;
+    std::vector<std::string>  studies_;
+    size_t                    position_;
+    uint64_t                  convertedCount_;
+    uint64_t                  skippedCount_;
+    uint64_t                  failedCount_;
+
+    void ConvertInstance(const std::string& instance);
+
+  public:
+    DicomAsJsonConversionJob(ServerContext& context,
+                             bool binary);
+
+    virtual void Start()
+    {
+    }
+
+    virtual JobStepResult Step();
+
+    virtual void Reset();
+
+    virtual void Stop(JobStopReason reason)
+    {
+    }
+
+    virtual float GetProgress();
+
+    virtual void GetJobType(std::string& target)
+    {
+      target = "DicomAsJsonConversion";
+    }
+
+    virtual void GetPublicContent(Json::Value& value);
+
+    virtual bool Serialize(Json::Value& value)
+    {
+      return false;  // Cannot serialize this kind of job
+    }
+  };
+}
@@ -51,6 +51,7 @@
 #include "ResourceModificationJob.h"
 #include "MergeStudyJob.h"
 #include "SplitStudyJob.h"
+#include "StorageIntegrityJob.h"
 
 namespace Orthanc
 {
@@ -93,6 +94,10 @@ namespace Orthanc
     {
       return new DicomMoveScuJob(context_, source);
     }
+    else if (type == "StorageIntegrity")
+    {
+      return new StorageIntegrityJob(context_, source);
+    }
     else
     {
       return GenericJobUnserializer::UnserializeJob(source);
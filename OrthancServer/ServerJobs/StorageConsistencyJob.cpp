@@ -0,0 +1,275 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeadersServer.h"
+#include "StorageConsistencyJob.h"
+
+#include "../../Core/Logging.h"
+#include "../../Core/OrthancException.h"
+
+namespace Orthanc
+{
+  // Number of uuids that are read at once from the index
+  static const uint32_t INDEX_BATCH_SIZE = 1000;
+
+  // Maximum number of orphan/missing uuids listed in the public content
+  static const unsigned int MAX_REPORTED = 100;
+
+  // An orphan file is only removed if it is still orphan some time
+  // after its detection, as files are written to the storage area
+  // before they are referenced by the index
+  static const unsigned int DEFAULT_ORPHANS_GRACE_PERIOD = 60;  // In seconds
+
+
+  bool StorageConsistencyJob::IsRecentFile(const std::string& uuid)
+  {
+    time_t modification;
+    return (context_.GetStorageArea().LookupModificationTime(modification, uuid, FileContentType_Unknown) &&
+            modification >= start_);
+  }
+
+
+  void StorageConsistencyJob::CheckPrefix(const std::string& prefix,
+                                          std::set<std::string>& files)
+  {
+    scannedFiles_ += files.size();
+
+    // Keyset pagination over the uuids of the index that start with
+    // "prefix" ("~" is sorted after all the characters of a uuid)
+    std::string after = prefix;
+    const std::string before = prefix + "~";
+
+    for (;;)
+    {
+      std::list<std::string> uuids;
+      context_.GetIndex().ListAttachmentUuids(uuids, after, before, INDEX_BATCH_SIZE);
+
+      for (std::list<std::string>::const_iterator 
+             it = uuids.begin(); it != uuids.end(); ++it)
+      {
+        if (files.erase(*it) == 0)
+        {
+          LOG(WARNING) << "Missing file in the storage area: " << *it;
+          missingCount_++;
+
+          if (reportedMissing_.size() < MAX_REPORTED)
+          {
+            reportedMissing_.append(*it);
+          }
+        }
+      }
+
+      if (uuids.size() < INDEX_BATCH_SIZE)
+      {
+        break;
+      }
+
+      after = uuids.back();
+    }
+
+    // The remaining files are not referenced by the index
+    const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+
+    for (std::set<std::string>::const_iterator
+           it = files.begin(); it != files.end(); ++it)
+    {
+      if (IsRecentFile(*it))
+      {
+        // This file was written after the start of the job, and is
+        // most probably being stored at this very moment
+        VLOG(1) << "Ignoring a recent file in the storage area: " << *it;
+        recentCount_++;
+        continue;
+      }
+
+      LOG(WARNING) << "Orphan file in the storage area: " << *it;
+      orphansCount_++;
+
+      if (reportedOrphans_.size() < MAX_REPORTED)
+      {
+        reportedOrphans_.append(*it);
+      }
+
+      if (removeOrphans_)
+      {
+        Orphan orphan;
+        orphan.uuid_ = *it;
+        orphan.detection_ = now;
+        pendingOrphans_.push_back(orphan);
+      }
+    }
+  }
+
+
+  unsigned int StorageConsistencyJob::RemovePendingOrphans()
+  {
+    const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+
+    while (!pendingOrphans_.empty())
+    {
+      const Orphan& orphan = pendingOrphans_.front();
+
+      boost::posix_time::time_duration elapsed = now - orphan.detection_;
+      if (elapsed.total_seconds() < static_cast<int>(orphansGracePeriod_))
+      {
+        // Number of seconds to wait before the next orphan can be removed
+        return orphansGracePeriod_ - static_cast<unsigned int>(elapsed.total_seconds());
+      }
+
+      // The file might have been overwritten since its detection. The
+      // index and the pending writes are checked again under the
+      // mutex of the index by "RemoveOrphanAttachment()".
+      if (IsRecentFile(orphan.uuid_))
+      {
+        recentCount_++;
+      }
+      else if (context_.GetIndex().RemoveOrphanAttachment(orphan.uuid_))
+      {
+        LOG(WARNING) << "Orphan file removed from the storage area: " << orphan.uuid_;
+        removedOrphans_++;
+      }
+
+      pendingOrphans_.pop_front();
+    }
+
+    return 0;
+  }
+
+
+  StorageConsistencyJob::StorageConsistencyJob(ServerContext& context,
+                                               unsigned int threadsCount,
+                                               bool removeOrphans) :
+    context_(context),
+    threadsCount_(threadsCount),
+    removeOrphans_(removeOrphans),
+    orphansGracePeriod_(DEFAULT_ORPHANS_GRACE_PERIOD)
+  {
+    if (threadsCount == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (!context.GetStorageArea().HasListAttachments())
+    {
+      LOG(ERROR) << "The storage area cannot be scanned for consistency checks";
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    Reset();
+  }
+
+
+  JobStepResult StorageConsistencyJob::Step()
+  {
+    if (!scanDone_)
+    {
+      if (scanner_.get() == NULL)
+      {
+        // Start or resume the scan
+        scanner_.reset(new StorageScanner(context_.GetStorageArea(), threadsCount_,
+                                          2 * threadsCount_, scannedPrefixes_));
+      }
+
+      std::string prefix;
+      std::set<std::string> files;
+      if (scanner_->GetNext(prefix, files))
+      {
+        CheckPrefix(prefix, files);
+        scannedPrefixes_++;
+        RemovePendingOrphans();
+        return JobStepResult::Continue();
+      }
+
+      scanner_.reset(NULL);
+      scanDone_ = true;
+    }
+
+    unsigned int wait = RemovePendingOrphans();
+    if (wait == 0)
+    {
+      LOG(WARNING) << "Storage consistency check done: " << scannedFiles_ << " files, "
+                   << orphansCount_ << " orphans (" << removedOrphans_ << " removed), "
+                   << missingCount_ << " missing";
+      return JobStepResult::Success();
+    }
+    else
+    {
+      return JobStepResult::Retry(wait * 1000);
+    }
+  }
+
+
+  void StorageConsistencyJob::Reset()
+  {
+    scanner_.reset(NULL);
+    start_ = time(NULL);
+    scanDone_ = false;
+    scannedPrefixes_ = 0;
+    scannedFiles_ = 0;
+    orphansCount_ = 0;
+    missingCount_ = 0;
+    recentCount_ = 0;
+    removedOrphans_ = 0;
+    pendingOrphans_.clear();
+    reportedOrphans_ = Json::arrayValue;
+    reportedMissing_ = Json::arrayValue;
+  }
+
+
+  void StorageConsistencyJob::Stop(JobStopReason reason)
+  {
+    // Release the scanning threads, the scan will be resumed at the
+    // current top-level directory
+    scanner_.reset(NULL);
+  }
+
+
+  float StorageConsistencyJob::GetProgress()
+  {
+    return (static_cast<float>(scannedPrefixes_) /
+            static_cast<float>(StorageScanner::PREFIXES_COUNT));
+  }
+
+
+  void StorageConsistencyJob::GetPublicContent(Json::Value& value)
+  {
+    value["RemoveOrphans"] = removeOrphans_;
+    value["ScannedFiles"] = static_cast<unsigned int>(scannedFiles_);
+    value["OrphansCount"] = static_cast<unsigned int>(orphansCount_);
+    value["RemovedOrphansCount"] = static_cast<unsigned int>(removedOrphans_);
+    value["MissingCount"] = static_cast<unsigned int>(missingCount_);
+    value["RecentCount"] = static_cast<unsigned int>(recentCount_);
+    value["Orphans"] = reportedOrphans_;
+    value["Missing"] = reportedMissing_;
+  }
+}
@@ -0,0 +1,126 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../../Core/FileStorage/StorageScanner.h"
+#include "../../Core/JobsEngine/IJob.h"
+#include "../ServerContext.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <time.h>
+
+namespace Orthanc
+{
+  /**
+   * Compares the content of the storage area with the attachments
+   * that are referenced by the index. The storage area is listed in
+   * parallel, one top-level directory at a time, and each directory
+   * is compared with the index in sorted batches of uuids. The job
+   * reports the orphan files (that are not referenced by the index),
+   * and the missing files (that are referenced by the index, but
+   * that are absent from the storage area). Optionally, the orphan
+   * files are removed from the storage area. The files that were
+   * modified after the start of the job are ignored, as they are
+   * most probably being stored by another thread.
+   **/
+  class StorageConsistencyJob : public IJob
+  {
+  private:
+    struct Orphan
+    {
+      std::string               uuid_;
+      boost::posix_time::ptime  detection_;
+    };
+
+    ServerContext&                 context_;
+    unsigned int                   threadsCount_;
+    bool                           removeOrphans_;
+    unsigned int                   orphansGracePeriod_;
+    time_t                         start_;
+    std::auto_ptr<StorageScanner>  scanner_;
+    bool                           scanDone_;
+    unsigned int                   scannedPrefixes_;
+    uint64_t                       scannedFiles_;
+    uint64_t                       orphansCount_;
+    uint64_t                       missingCount_;
+    uint64_t                       recentCount_;
+    uint64_t                       removedOrphans_;
+    std::list<Orphan>              pendingOrphans_;
+    Json::Value                    reportedOrphans_;
+    Json::Value                    reportedMissing_;
+
+    void CheckPrefix(const std::string& prefix,
+                     std::set<std::string>& files);
+
+    bool IsRecentFile(const std::string& uuid);
+
+    unsigned int RemovePendingOrphans();
+
+  public:
+    StorageConsistencyJob(ServerContext& context,
+                          unsigned int threadsCount,
+                          bool removeOrphans);
+
+    // Number of seconds between the detection of an orphan file and
+    // its removal (60 seconds by default)
+    void SetOrphansGracePeriod(unsigned int seconds)
+    {
+      orphansGracePeriod_ = seconds;
+    }
+
+    virtual void Start()
+    {
+    }
+
+    virtual JobStepResult Step();
+
+    virtual void Reset();
+
+    virtual void Stop(JobStopReason reason);
+
+    virtual float GetProgress();
+
+    virtual void GetJobType(std::string& target)
+    {
+      target = "StorageConsistency";
+    }
+
+    virtual void GetPublicContent(Json::Value& value);
+
+    virtual bool Serialize(Json::Value& value)
+    {
+      return false;  // Cannot serialize this kind of job
+    }
+  };
+}
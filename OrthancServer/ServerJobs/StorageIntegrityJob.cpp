@@ -0,0 +1,339 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeadersServer.h"
+#include "StorageIntegrityJob.h"
+
+#include "../../Core/FileStorage/StorageAccessor.h"
+#include "../../Core/Logging.h"
+#include "../../Core/OrthancException.h"
+#include "../../Core/SerializationToolbox.h"
+
+#include <algorithm>
+#include <cassert>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <stdlib.h>
+
+namespace Orthanc
+{
+  // Number of attachments that are read at once from the index
+  static const uint32_t INDEX_BATCH_SIZE = 100;
+
+  // Maximum number of bytes that are verified by one step, if the
+  // job is not throttled
+  static const uint64_t MAX_STEP_SIZE = 64 * 1024 * 1024;
+
+  // Maximum number of corrupted attachments listed in the public content
+  static const unsigned int MAX_REPORTED = 100;
+
+  static const char* BANDWIDTH = "Bandwidth";
+  static const char* POSITION = "Position";
+  static const char* DONE = "Done";
+  static const char* CHECKED_COUNT = "CheckedCount";
+  static const char* CHECKED_SIZE = "CheckedSize";
+  static const char* SKIPPED_COUNT = "SkippedCount";
+  static const char* CORRUPTED_COUNT = "CorruptedCount";
+  static const char* CORRUPTED = "Corrupted";
+
+
+  uint64_t StorageIntegrityJob::CheckAttachment(uint64_t maxSize)
+  {
+    assert(!pending_.empty());
+    const FileInfo& attachment = pending_.front().second;
+
+    if (verifier_.get() == NULL)
+    {
+      if (attachment.GetCompressedMD5().empty())
+      {
+        // The attachment was stored while "StoreMD5ForAttachments"
+        // was disabled
+        skippedCount_++;
+        position_ = attachment.GetUuid();
+        pending_.pop_front();
+        return 0;
+      }
+    }
+
+    size_t size = 0;
+
+    try
+    {
+      if (verifier_.get() == NULL)
+      {
+        StorageAccessor accessor(context_.GetStorageArea());
+        verifier_.reset(new StorageAccessor::MD5Verifier(accessor, attachment));
+      }
+
+      size = verifier_->Read(static_cast<size_t>(std::min(maxSize, MAX_STEP_SIZE)));
+    }
+    catch (OrthancException&)
+    {
+      // Missing or unreadable file
+      FinishAttachment(false);
+      return size;
+    }
+
+    if (verifier_->IsDone())
+    {
+      FinishAttachment(verifier_->IsValid());
+    }
+
+    return size;
+  }
+
+
+  void StorageIntegrityJob::FinishAttachment(bool ok)
+  {
+    assert(!pending_.empty());
+
+    const std::string resource = pending_.front().first;
+    const FileInfo attachment = pending_.front().second;
+
+    verifier_.reset(NULL);
+    position_ = attachment.GetUuid();
+    pending_.pop_front();
+
+    checkedCount_++;
+    checkedSize_ += attachment.GetCompressedSize();
+
+    if (ok)
+    {
+      return;
+    }
+
+    FileInfo current;
+    if (!context_.GetIndex().LookupAttachment(current, resource, attachment.GetContentType()) ||
+        current.GetUuid() != attachment.GetUuid())
+    {
+      // The attachment was removed while being checked
+      return;
+    }
+
+    LOG(ERROR) << "Corrupted attachment in the storage area: " << attachment.GetUuid()
+               << " (" << EnumerationToString(attachment.GetContentType())
+               << " of resource " << resource << ")";
+
+    corruptedCount_++;
+
+    if (reportedCorrupted_.size() < MAX_REPORTED)
+    {
+      Json::Value item = Json::objectValue;
+      item["Uuid"] = attachment.GetUuid();
+      item["ID"] = resource;
+      item["ContentType"] = EnumerationToString(attachment.GetContentType());
+      reportedCorrupted_.append(item);
+    }
+
+    try
+    {
+      context_.GetIndex().LogChange(ChangeType_CorruptedAttachment, resource);
+    }
+    catch (OrthancException&)
+    {
+      // The resource was deleted in the meantime
+    }
+  }
+
+
+  StorageIntegrityJob::StorageIntegrityJob(ServerContext& context,
+                                           uint64_t bandwidth) :
+    context_(context),
+    bandwidth_(bandwidth)
+  {
+    Reset();
+  }
+
+
+  StorageIntegrityJob::StorageIntegrityJob(ServerContext& context,
+                                           const Json::Value& serialized) :
+    context_(context)
+  {
+    Reset();
+
+    if (!serialized.isMember(CHECKED_SIZE) ||
+        serialized[CHECKED_SIZE].type() != Json::stringValue ||
+        !serialized.isMember(CORRUPTED) ||
+        serialized[CORRUPTED].type() != Json::arrayValue)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    try
+    {
+      bandwidth_ = boost::lexical_cast<uint64_t>(SerializationToolbox::ReadString(serialized, BANDWIDTH));
+      checkedSize_ = boost::lexical_cast<uint64_t>(serialized[CHECKED_SIZE].asString());
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    position_ = SerializationToolbox::ReadString(serialized, POSITION);
+    done_ = SerializationToolbox::ReadBoolean(serialized, DONE);
+    checkedCount_ = SerializationToolbox::ReadUnsignedInteger(serialized, CHECKED_COUNT);
+    skippedCount_ = SerializationToolbox::ReadUnsignedInteger(serialized, SKIPPED_COUNT);
+    corruptedCount_ = SerializationToolbox::ReadUnsignedInteger(serialized, CORRUPTED_COUNT);
+    reportedCorrupted_ = serialized[CORRUPTED];
+  }
+
+
+  JobStepResult StorageIntegrityJob::Step()
+  {
+    if (done_)
+    {
+      return JobStepResult::Success();
+    }
+
+    if (pending_.empty())
+    {
+      // Keyset pagination over the uuids of the attachments
+      context_.GetIndex().ListAttachments(pending_, position_, INDEX_BATCH_SIZE);
+
+      if (pending_.empty())
+      {
+        LOG(WARNING) << "Storage integrity check done: " << checkedCount_ << " attachments ("
+                     << checkedSize_ << " bytes) verified, " << corruptedCount_ << " corrupted, "
+                     << skippedCount_ << " without MD5";
+        done_ = true;
+        return JobStepResult::Success();
+      }
+    }
+
+    // If the job is throttled, one step reads at most 100ms worth of
+    // data, then waits for the remaining of the time slot. A large
+    // attachment is thus read over several steps.
+    const uint64_t maxSize = (bandwidth_ == 0 ? MAX_STEP_SIZE : std::max(bandwidth_ / 10, static_cast<uint64_t>(1)));
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    uint64_t size = 0;
+    while (!pending_.empty() &&
+           size < maxSize)
+    {
+      size += CheckAttachment(maxSize - size);
+    }
+
+    if (bandwidth_ != 0)
+    {
+      const uint64_t expected = size * 1000 / bandwidth_;  // In milliseconds
+      const boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+
+      if (expected > static_cast<uint64_t>(elapsed.total_milliseconds()))
+      {
+        return JobStepResult::Retry(static_cast<unsigned int>(expected - elapsed.total_milliseconds()));
+      }
+    }
+
+    return JobStepResult::Continue();
+  }
+
+
+  void StorageIntegrityJob::Reset()
+  {
+    position_.clear();
+    done_ = false;
+    pending_.clear();
+    verifier_.reset(NULL);
+    checkedCount_ = 0;
+    checkedSize_ = 0;
+    skippedCount_ = 0;
+    corruptedCount_ = 0;
+    reportedCorrupted_ = Json::arrayValue;
+  }
+
+
+  void StorageIntegrityJob::Stop(JobStopReason reason)
+  {
+    if (reason != JobStopReason_Retry)
+    {
+      // The attachments of the current batch are read again from the
+      // index when the job is resumed, and the verification of the
+      // current attachment starts over
+      pending_.clear();
+      verifier_.reset(NULL);
+    }
+  }
+
+
+  float StorageIntegrityJob::GetProgress()
+  {
+    if (done_)
+    {
+      return 1;
+    }
+    else if (position_.size() < 8)
+    {
+      return 0;
+    }
+    else
+    {
+      // The uuids are uniformly distributed: The progress is estimated
+      // from the first 8 hexadecimal digits of the last checked uuid
+      unsigned long prefix = strtoul(position_.substr(0, 8).c_str(), NULL, 16);
+      return static_cast<float>(static_cast<double>(prefix) / 4294967296.0);
+    }
+  }
+
+
+  void StorageIntegrityJob::GetPublicContent(Json::Value& value)
+  {
+    value[BANDWIDTH] = static_cast<unsigned int>(bandwidth_ / (1024 * 1024));
+    value[CHECKED_COUNT] = static_cast<unsigned int>(checkedCount_);
+    value[CHECKED_SIZE] = boost::lexical_cast<std::string>(checkedSize_);
+    value[SKIPPED_COUNT] = static_cast<unsigned int>(skippedCount_);
+    value[CORRUPTED_COUNT] = static_cast<unsigned int>(corruptedCount_);
+    value[CORRUPTED] = reportedCorrupted_;
+  }
+
+
+  bool StorageIntegrityJob::Serialize(Json::Value& value)
+  {
+    value = Json::objectValue;
+
+    std::string type;
+    GetJobType(type);
+    value["Type"] = type;
+
+    value[BANDWIDTH] = boost::lexical_cast<std::string>(bandwidth_);
+    value[POSITION] = position_;
+    value[DONE] = done_;
+    value[CHECKED_COUNT] = static_cast<unsigned int>(checkedCount_);
+    value[CHECKED_SIZE] = boost::lexical_cast<std::string>(checkedSize_);
+    value[SKIPPED_COUNT] = static_cast<unsigned int>(skippedCount_);
+    value[CORRUPTED_COUNT] = static_cast<unsigned int>(corruptedCount_);
+    value[CORRUPTED] = reportedCorrupted_;
+
+    return true;
+  }
+}
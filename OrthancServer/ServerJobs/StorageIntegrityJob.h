@@ -0,0 +1,108 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../../Core/FileStorage/StorageAccessor.h"
+#include "../../Core/JobsEngine/IJob.h"
+#include "../ServerContext.h"
+
+namespace Orthanc
+{
+  /**
+   * Verifies the size and the MD5 hash of all the attachments of the
+   * storage area, in increasing order of uuid. The reads from the
+   * storage area are throttled to a maximum bandwidth. The corrupted
+   * (or missing) attachments are listed in the content of the job,
+   * and are logged as "CorruptedAttachment" changes of the resources
+   * they belong to. As the job is serialized together with the last
+   * checked uuid, the verification resumes after a restart. The
+   * large attachments are verified over several steps, so that the
+   * throttling applies to each chunk that is read.
+   **/
+  class StorageIntegrityJob : public IJob
+  {
+  private:
+    typedef std::list< std::pair<std::string, FileInfo> >  Attachments;
+
+    ServerContext&  context_;
+    uint64_t        bandwidth_;
+    std::string     position_;
+    bool            done_;
+    Attachments     pending_;
+    uint64_t        checkedCount_;
+    uint64_t        checkedSize_;
+    uint64_t        skippedCount_;
+    uint64_t        corruptedCount_;
+    Json::Value     reportedCorrupted_;
+
+    // Verification of the attachment at the front of "pending_", if
+    // it has not been completed by the previous step
+    std::auto_ptr<StorageAccessor::MD5Verifier>  verifier_;
+
+    // Reads at most "maxSize" bytes of the attachment at the front of
+    // "pending_", and returns the number of bytes that were read
+    uint64_t CheckAttachment(uint64_t maxSize);
+
+    void FinishAttachment(bool ok);
+
+  public:
+    // "bandwidth" is in bytes per second, "0" means no throttling
+    StorageIntegrityJob(ServerContext& context,
+                        uint64_t bandwidth);
+
+    StorageIntegrityJob(ServerContext& context,
+                        const Json::Value& serialized);
+
+    virtual void Start()
+    {
+    }
+
+    virtual JobStepResult Step();
+
+    virtual void Reset();
+
+    virtual void Stop(JobStopReason reason);
+
+    virtual float GetProgress();
+
+    virtual void GetJobType(std::string& target)
+    {
+      target = "StorageIntegrity";
+    }
+
+    virtual void GetPublicContent(Json::Value& value);
+
+    virtual bool Serialize(Json::Value& value);
+  };
+}
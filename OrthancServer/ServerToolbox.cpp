@@ -433,10 +433,15 @@ namespace Orthanc
         Json::Value dicomAsJson;
         locker.GetDicom().DatasetToJson(dicomAsJson);
 
-        std::string s = dicomAsJson.toStyledString();
+        std::string s;
+        context.SerializeDicomAsJson(s, dicomAsJson);
         context.AddAttachment(*it, FileContentType_DicomAsJson, s.c_str(), s.size());
 
         context.GetIndex().ReconstructInstance(locker.GetDicom());
+
+        DicomMap summary;
+        locker.GetDicom().ExtractDicomSummary(summary);
+        context.ReconstructFrameOffsets(*it, summary);
       }
     }
   }
@@ -35,6 +35,7 @@
 #include "OrthancRestApi/OrthancRestApi.h"
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "../Core/Logging.h"
 #include "../Core/HttpServer/EmbeddedResourceHttpHandler.h"
@@ -582,6 +583,7 @@ static void PrintErrors(const char* path)
     PrintErrorCode(ErrorCode_NullPointer, "Cannot handle a NULL pointer");
     PrintErrorCode(ErrorCode_DatabaseUnavailable, "The database is currently not available (probably a transient situation)");
     PrintErrorCode(ErrorCode_CanceledJob, "This job was canceled");
+    PrintErrorCode(ErrorCode_DuplicateResource, "Duplicated resource");
     PrintErrorCode(ErrorCode_SQLiteNotOpened, "SQLite: The database is not opened");
     PrintErrorCode(ErrorCode_SQLiteAlreadyOpened, "SQLite: Connection is already open");
     PrintErrorCode(ErrorCode_SQLiteCannotOpen, "SQLite: Unable to open the database");
@@ -817,6 +819,17 @@ static bool StartDicomServer(ServerContext& context,
   dicomServer.SetMoveRequestHandlerFactory(serverFactory);
   dicomServer.SetFindRequestHandlerFactory(serverFactory);
   dicomServer.SetAssociationTimeout(Configuration::GetGlobalUnsignedIntegerParameter("DicomScpTimeout", 30));
+  dicomServer.SetBitPreservingStore(Configuration::GetGlobalBoolParameter("DicomBitPreservingStore", false));
+
+  {
+    std::string directory = Configuration::GetGlobalStringParameter("DicomBitPreservingDirectory", "");
+    if (!directory.empty())
+    {
+      directory = Configuration::InterpretStringParameterAsPath(directory);
+      SystemToolbox::MakeDirectory(directory);
+      dicomServer.SetBitPreservingDirectory(directory);
+    }
+  }
 
 
 #if ORTHANC_ENABLE_PLUGINS == 1
@@ -969,6 +982,45 @@ static void UpgradeDatabase(IDatabaseWrapper& database,
 }
 
 
+static void ConfigureCompressionPolicy(ServerContext& context,
+                                       FileContentType type,
+                                       const std::string& option)
+{
+  // The value of the option is either empty (follow the global
+  // "StorageCompression" option), or of the form "Codec[:Level]"
+  std::string value = Configuration::GetGlobalStringParameter(option, "");
+  if (value.empty())
+  {
+    return;
+  }
+
+  std::vector<std::string> tokens;
+  Toolbox::TokenizeString(tokens, value, ':');
+
+  if (tokens.size() > 2)
+  {
+    LOG(ERROR) << "Bad value for option \"" << option << "\": " << value;
+    throw OrthancException(ErrorCode_BadFileFormat);
+  }
+
+  int level = 0;
+  if (tokens.size() == 2)
+  {
+    try
+    {
+      level = boost::lexical_cast<int>(tokens[1]);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      LOG(ERROR) << "Bad compression level for option \"" << option << "\": " << value;
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+  }
+
+  context.SetCompressionPolicy(type, StringToCompressionType(tokens[0]), level);
+}
+
+
 static bool ConfigureServerContext(IDatabaseWrapper& database,
                                    IStorageArea& storageArea,
                                    OrthancPlugins *plugins,
@@ -988,11 +1040,44 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
 
   ServerContext context(database, storageArea, false /* not running unit tests */);
   context.SetCompressionEnabled(Configuration::GetGlobalBoolParameter("StorageCompression", false));
+  ConfigureCompressionPolicy(context, FileContentType_Dicom, "StorageCompressionDicom");
+  ConfigureCompressionPolicy(context, FileContentType_DicomAsJson, "StorageCompressionDicomAsJson");
+  context.SetBinaryDicomAsJson(Configuration::GetGlobalBoolParameter("BinaryDicomAsJson", false));
+
+  {
+    std::string generation = Configuration::GetGlobalStringParameter("DicomAsJsonGeneration", "Immediate");
+
+    try
+    {
+      context.SetDicomAsJsonGeneration(StringToDicomAsJsonGeneration(generation));
+    }
+    catch (OrthancException&)
+    {
+      LOG(ERROR) << "Bad value for option \"DicomAsJsonGeneration\": " << generation;
+      throw;
+    }
+  }
+
   context.SetStoreMD5ForAttachments(Configuration::GetGlobalBoolParameter("StoreMD5ForAttachments", true));
 
   // New option in Orthanc 1.4.2
   context.GetIndex().SetOverwriteInstances(Configuration::GetGlobalBoolParameter("OverwriteInstances", false));
 
+  if (Configuration::GetGlobalBoolParameter("StorageDeduplication", false))
+  {
+#if ORTHANC_ENABLE_PLUGINS == 1
+    if (plugins != NULL &&
+        plugins->HasDatabaseBackend())
+    {
+      LOG(ERROR) << "The \"StorageDeduplication\" option is not compatible with database plugins";
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+#endif
+
+    LOG(WARNING) << "Deduplication of the attachments in the storage area is enabled";
+    context.GetIndex().SetStorageDeduplication(true);
+  }
+
   try
   {
     context.GetIndex().SetMaximumPatientCount(Configuration::GetGlobalUnsignedIntegerParameter("MaximumPatientCount", 0));
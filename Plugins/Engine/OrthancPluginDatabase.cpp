@@ -598,6 +598,34 @@ namespace Orthanc
   }
 
 
+  bool OrthancPluginDatabase::LookupAttachmentByUuid(FileInfo& attachment,
+                                                     const std::string& uuid)
+  {
+    LOG(ERROR) << "The database plugins do not support content-addressed storage "
+               << "(the \"StorageDeduplication\" option must be disabled)";
+    throw OrthancException(ErrorCode_DatabasePlugin);
+  }
+
+
+  void OrthancPluginDatabase::ListAttachmentUuids(std::list<std::string>& target,
+                                                  const std::string& after,
+                                                  const std::string& before,
+                                                  uint32_t limit)
+  {
+    LOG(ERROR) << "The database plugins do not support the storage consistency checks";
+    throw OrthancException(ErrorCode_DatabasePlugin);
+  }
+
+
+  void OrthancPluginDatabase::ListAttachments(std::list<AttachmentOwner>& target,
+                                              const std::string& after,
+                                              uint32_t limit)
+  {
+    LOG(ERROR) << "The database plugins do not support the storage integrity checks";
+    throw OrthancException(ErrorCode_DatabasePlugin);
+  }
+
+
   bool OrthancPluginDatabase::LookupGlobalProperty(std::string& target,
                                                    GlobalProperty property)
   {
@@ -1682,7 +1682,7 @@ namespace Orthanc
         else
         {
           Json::Value simplified;
-          ServerToolbox::SimplifyTags(simplified, instance.GetJson(), DicomToJsonFormat_Human);
+          instance.GetSimplifiedJson(simplified);
           s = writer.write(simplified);
         }
 
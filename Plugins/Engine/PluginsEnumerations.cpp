@@ -129,6 +129,9 @@ namespace Orthanc
         case ChangeType_UpdatedMetadata:
           return OrthancPluginChangeType_UpdatedMetadata;
 
+        case ChangeType_CorruptedAttachment:
+          return OrthancPluginChangeType_CorruptedAttachment;
+
         default:
           throw OrthancException(ErrorCode_ParameterOutOfRange);
       }
@@ -0,0 +1,19 @@
+# LZ4 is only supported as a system library, as it is an optional
+# accelerator for the storage area (the default codec being zlib)
+
+if (STATIC_BUILD)
+  message(FATAL_ERROR "LZ4 compression cannot be enabled in static builds")
+endif()
+
+CHECK_INCLUDE_FILE(lz4.h HAVE_LZ4_H)
+CHECK_INCLUDE_FILE(lz4hc.h HAVE_LZ4HC_H)
+if (NOT HAVE_LZ4_H OR NOT HAVE_LZ4HC_H)
+  message(FATAL_ERROR "Please install the liblz4-dev package")
+endif()
+
+check_library_exists(lz4 LZ4_compress_HC "" HAVE_LZ4_LIB)
+if (NOT HAVE_LZ4_LIB)
+  message(FATAL_ERROR "Unable to find the lz4 library")
+endif()
+
+link_libraries(lz4)
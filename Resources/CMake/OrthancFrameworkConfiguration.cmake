@@ -77,6 +77,14 @@ if (NOT ENABLE_ZLIB)
   add_definitions(-DORTHANC_ENABLE_ZLIB=0)
 endif()
 
+if (NOT ENABLE_LZ4)
+  add_definitions(-DORTHANC_ENABLE_LZ4=0)
+endif()
+
+if (NOT ENABLE_ZSTD)
+  add_definitions(-DORTHANC_ENABLE_ZSTD=0)
+endif()
+
 if (NOT ENABLE_PNG)
   unset(USE_SYSTEM_LIBPNG CACHE)
   add_definitions(-DORTHANC_ENABLE_PNG=0)
@@ -122,6 +130,7 @@ endif()
 #####################################################################
 
 set(ORTHANC_CORE_SOURCES_INTERNAL
+  ${ORTHANC_ROOT}/Core/BinaryJson.cpp
   ${ORTHANC_ROOT}/Core/Cache/MemoryCache.cpp
   ${ORTHANC_ROOT}/Core/ChunkedBuffer.cpp
   ${ORTHANC_ROOT}/Core/DicomFormat/DicomTag.cpp
@@ -142,6 +151,7 @@ if (ENABLE_MODULE_IMAGES)
     ${ORTHANC_ROOT}/Core/Images/ImageAccessor.cpp
     ${ORTHANC_ROOT}/Core/Images/ImageBuffer.cpp
     ${ORTHANC_ROOT}/Core/Images/ImageProcessing.cpp
+    ${ORTHANC_ROOT}/Core/Images/ImageProcessingSimd.cpp
     ${ORTHANC_ROOT}/Core/Images/PamReader.cpp
     ${ORTHANC_ROOT}/Core/Images/PamWriter.cpp
     )
@@ -150,6 +160,7 @@ endif()
 if (ENABLE_MODULE_DICOM)
   list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
     ${ORTHANC_ROOT}/Core/DicomFormat/DicomArray.cpp
+    ${ORTHANC_ROOT}/Core/DicomFormat/DicomFrameOffsetTable.cpp
     ${ORTHANC_ROOT}/Core/DicomFormat/DicomImageInformation.cpp
     ${ORTHANC_ROOT}/Core/DicomFormat/DicomInstanceHasher.cpp
     ${ORTHANC_ROOT}/Core/DicomFormat/DicomIntegerPixelAccessor.cpp
@@ -320,6 +331,7 @@ if (ENABLE_ZLIB)
 
   if (NOT ORTHANC_SANDBOXED)
     list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+      ${ORTHANC_ROOT}/Core/Compression/BufferCompressorFactory.cpp
       ${ORTHANC_ROOT}/Core/Compression/HierarchicalZipWriter.cpp
       ${ORTHANC_ROOT}/Core/Compression/ZipWriter.cpp
       ${ORTHANC_ROOT}/Core/FileStorage/StorageAccessor.cpp
@@ -328,6 +340,35 @@ if (ENABLE_ZLIB)
 endif()
 
 
+##
+## Optional storage compression: LZ4 and Zstandard
+##
+
+if (ENABLE_LZ4 OR ENABLE_ZSTD)
+  if (NOT ENABLE_ZLIB OR ORTHANC_SANDBOXED)
+    message(FATAL_ERROR "Support for zlib must be enabled if enabling LZ4 or Zstandard support")
+  endif()
+endif()
+
+if (ENABLE_LZ4)
+  include(${CMAKE_CURRENT_LIST_DIR}/Lz4Configuration.cmake)
+  add_definitions(-DORTHANC_ENABLE_LZ4=1)
+
+  list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+    ${ORTHANC_ROOT}/Core/Compression/Lz4Compressor.cpp
+    )
+endif()
+
+if (ENABLE_ZSTD)
+  include(${CMAKE_CURRENT_LIST_DIR}/ZstdConfiguration.cmake)
+  add_definitions(-DORTHANC_ENABLE_ZSTD=1)
+
+  list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+    ${ORTHANC_ROOT}/Core/Compression/ZstdCompressor.cpp
+    )
+endif()
+
+
 ##
 ## PNG support: libpng (in conjunction with zlib)
 ##
@@ -529,16 +570,28 @@ else()
     )
 
   list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+    ${ORTHANC_ROOT}/Core/Cache/MemoryStringCache.cpp
     ${ORTHANC_ROOT}/Core/Cache/SharedArchive.cpp
+    ${ORTHANC_ROOT}/Core/Cache/SharedObjectCache.cpp
     ${ORTHANC_ROOT}/Core/FileStorage/FilesystemStorage.cpp
+    ${ORTHANC_ROOT}/Core/FileStorage/StorageScanner.cpp
+    ${ORTHANC_ROOT}/Core/FileStorage/TieredStorageArea.cpp
+    ${ORTHANC_ROOT}/Core/Images/ImageBufferPool.cpp
     ${ORTHANC_ROOT}/Core/MultiThreading/RunnableWorkersPool.cpp
     ${ORTHANC_ROOT}/Core/MultiThreading/Semaphore.cpp
     ${ORTHANC_ROOT}/Core/MultiThreading/SharedMessageQueue.cpp
+    ${ORTHANC_ROOT}/Core/MultiThreading/TaskPool.cpp
     ${ORTHANC_ROOT}/Core/SharedLibrary.cpp
     ${ORTHANC_ROOT}/Core/SystemToolbox.cpp
     ${ORTHANC_ROOT}/Core/TemporaryFile.cpp
     )
 
+  if (ENABLE_SQLITE)
+    list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+      ${ORTHANC_ROOT}/Core/FileStorage/PackedStorageArea.cpp
+      )
+  endif()
+
   if (ENABLE_MODULE_JOBS)
     list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
       ${ORTHANC_ROOT}/Core/JobsEngine/JobsEngine.cpp
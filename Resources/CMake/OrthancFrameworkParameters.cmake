@@ -90,10 +90,12 @@ set(ENABLE_JPEG OFF CACHE INTERNAL "Enable support of JPEG")
 set(ENABLE_GOOGLE_TEST OFF CACHE INTERNAL "Enable support of Google Test")
 set(ENABLE_LOCALE OFF CACHE INTERNAL "Enable support for locales (notably in Boost)")
 set(ENABLE_LUA OFF CACHE INTERNAL "Enable support of Lua scripting")
+set(ENABLE_LZ4 OFF CACHE INTERNAL "Enable support of LZ4 compression")
 set(ENABLE_PNG OFF CACHE INTERNAL "Enable support of PNG")
 set(ENABLE_PUGIXML OFF CACHE INTERNAL "Enable support of XML through Pugixml")
 set(ENABLE_SQLITE OFF CACHE INTERNAL "Enable support of SQLite databases")
 set(ENABLE_ZLIB OFF CACHE INTERNAL "Enable support of zlib")
+set(ENABLE_ZSTD OFF CACHE INTERNAL "Enable support of Zstandard compression")
 set(ENABLE_WEB_CLIENT OFF CACHE INTERNAL "Enable Web client")
 set(ENABLE_WEB_SERVER OFF CACHE INTERNAL "Enable embedded Web server")
 set(ENABLE_DCMTK OFF CACHE INTERNAL "Enable DCMTK")
@@ -0,0 +1,19 @@
+# Zstandard is only supported as a system library, as it is an
+# optional accelerator for the storage area (the default codec being
+# zlib)
+
+if (STATIC_BUILD)
+  message(FATAL_ERROR "Zstandard compression cannot be enabled in static builds")
+endif()
+
+CHECK_INCLUDE_FILE(zstd.h HAVE_ZSTD_H)
+if (NOT HAVE_ZSTD_H)
+  message(FATAL_ERROR "Please install the libzstd-dev package")
+endif()
+
+check_library_exists(zstd ZSTD_compress "" HAVE_ZSTD_LIB)
+if (NOT HAVE_ZSTD_LIB)
+  message(FATAL_ERROR "Unable to find the zstd library")
+endif()
+
+link_libraries(zstd)
@@ -35,10 +35,12 @@
 #include "gtest/gtest.h"
 
 #include "../Core/OrthancException.h"
+#include "../Core/DicomFormat/DicomFrameOffsetTable.h"
 #include "../Core/DicomFormat/DicomMap.h"
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
 
 #include <memory>
+#include <boost/lexical_cast.hpp>
 
 using namespace Orthanc;
 
@@ -409,3 +411,254 @@ TEST(DicomMap, Serialize)
     ASSERT_THROW(v->GetContent(), OrthancException);
   }
 }
+
+
+static void AddUInt16(std::string& target,
+                      uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+
+static void AddUInt32(std::string& target,
+                      uint32_t value)
+{
+  AddUInt16(target, static_cast<uint16_t>(value & 0xffff));
+  AddUInt16(target, static_cast<uint16_t>(value >> 16));
+}
+
+
+// Explicit VR little endian, "length" overrides the size of "value"
+static void AddElement(std::string& target,
+                       uint16_t group,
+                       uint16_t element,
+                       const std::string& vr,
+                       const std::string& value,
+                       uint32_t length = 0)
+{
+  AddUInt16(target, group);
+  AddUInt16(target, element);
+  target += vr;
+
+  if (vr == "OB" || vr == "OW" || vr == "SQ" || vr == "UN")
+  {
+    AddUInt16(target, 0);
+    AddUInt32(target, length == 0 ? static_cast<uint32_t>(value.size()) : length);
+  }
+  else
+  {
+    AddUInt16(target, static_cast<uint16_t>(value.size()));
+  }
+
+  target += value;
+}
+
+
+static void AddItem(std::string& target,
+                    uint16_t element,
+                    const std::string& value,
+                    uint32_t length = 0)
+{
+  AddUInt16(target, 0xfffe);
+  AddUInt16(target, element);
+  AddUInt32(target, length == 0 ? static_cast<uint32_t>(value.size()) : length);
+  target += value;
+}
+
+
+static std::string CreateDicomFile(const std::string& transferSyntax)
+{
+  std::string dicom(128, '\0');
+  dicom += "DICM";
+
+  std::string uid = transferSyntax;
+  if (uid.size() % 2 == 1)
+  {
+    uid.push_back('\0');
+  }
+
+  AddElement(dicom, 0x0002, 0x0010, "UI", uid);
+  AddElement(dicom, 0x0008, 0x0060, "CS", "OT");
+
+  // Sequence of undefined length, whose item has an undefined length
+  std::string item;
+  AddElement(item, 0x0008, 0x0100, "SH", "AB");
+  AddItem(item, 0xe00d, "");
+
+  std::string sequence;
+  AddItem(sequence, 0xe000, item, 0xffffffffu);
+  AddItem(sequence, 0xe0dd, "");
+  AddElement(dicom, 0x0008, 0x1140, "SQ", sequence, 0xffffffffu);
+
+  return dicom;
+}
+
+
+static void CreateSummary(DicomMap& summary,
+                          unsigned int framesCount)
+{
+  summary.SetValue(DICOM_TAG_PHOTOMETRIC_INTERPRETATION, "MONOCHROME2", false);
+  summary.SetValue(DICOM_TAG_ROWS, "1", false);
+  summary.SetValue(DICOM_TAG_COLUMNS, "2", false);
+  summary.SetValue(DICOM_TAG_BITS_ALLOCATED, "16", false);
+  summary.SetValue(DICOM_TAG_NUMBER_OF_FRAMES, boost::lexical_cast<std::string>(framesCount), false);
+}
+
+
+TEST(DicomFrameOffsetTable, Native)
+{
+  std::string dicom = CreateDicomFile("1.2.840.10008.1.2.1");
+  AddElement(dicom, 0x7fe0, 0x0010, "OW", "abcdefghijkl");
+
+  DicomMap summary;
+  CreateSummary(summary, 3);
+
+  DicomFrameOffsetTable table;
+  ASSERT_TRUE(table.Compute(dicom.c_str(), dicom.size(), summary));
+  ASSERT_EQ(3u, table.GetFramesCount());
+  ASSERT_EQ(MimeType_Binary, table.GetMimeType());
+  ASSERT_TRUE(table.IsNative());
+
+  uint64_t start, end;
+  table.GetFrameRange(start, end, 1);
+  ASSERT_EQ(dicom.size() - 4u, end);
+  ASSERT_EQ(4u, end - start);
+
+  std::string frame;
+  table.ExtractFrame(frame, dicom.substr(start, end - start), 1);
+  ASSERT_EQ("efgh", frame);
+  ASSERT_THROW(table.GetFrameRange(start, end, 3), OrthancException);
+
+  std::string s;
+  table.Serialize(s);
+  ASSERT_EQ(0u, s.find("application/octet-stream;native;"));
+
+  DicomFrameOffsetTable table2;
+  ASSERT_TRUE(table2.Unserialize(s));
+  ASSERT_EQ(3u, table2.GetFramesCount());
+  table2.GetFrameRange(start, end, 2);
+  table2.ExtractFrame(frame, dicom.substr(start, end - start), 2);
+  ASSERT_EQ("ijkl", frame);
+
+  // Not enough pixel data for the 4 frames
+  CreateSummary(summary, 4);
+  ASSERT_FALSE(table.Compute(dicom.c_str(), dicom.size(), summary));
+  ASSERT_EQ(0u, table.GetFramesCount());
+
+  ASSERT_FALSE(table.Unserialize("nope"));
+  ASSERT_FALSE(table.Unserialize("application/octet-stream;native;12"));
+}
+
+
+TEST(DicomFrameOffsetTable, Encapsulated)
+{
+  std::string dicom = CreateDicomFile("1.2.840.10008.1.2.4.50");
+
+  // 3 fragments for 2 frames: The basic offset table is needed
+  std::string offsets;
+  AddUInt32(offsets, 0);
+  AddUInt32(offsets, 8 + 4);
+
+  std::string pixelData;
+  AddItem(pixelData, 0xe000, offsets);
+  AddItem(pixelData, 0xe000, "ABCD");
+  AddItem(pixelData, 0xe000, "EF");
+  AddItem(pixelData, 0xe000, "GHIJ");
+  AddItem(pixelData, 0xe0dd, "");
+  AddElement(dicom, 0x7fe0, 0x0010, "OB", pixelData, 0xffffffffu);
+
+  DicomMap summary;
+  CreateSummary(summary, 2);
+
+  DicomFrameOffsetTable table;
+  ASSERT_TRUE(table.Compute(dicom.c_str(), dicom.size(), summary));
+  ASSERT_EQ(2u, table.GetFramesCount());
+  ASSERT_EQ(MimeType_Jpeg, table.GetMimeType());
+  ASSERT_FALSE(table.IsNative());
+
+  std::string s;
+  table.Serialize(s);
+  ASSERT_EQ(0u, s.find("image/jpeg;fragments;"));
+
+  DicomFrameOffsetTable table2;
+  ASSERT_TRUE(table2.Unserialize(s));
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    const DicomFrameOffsetTable& t = (i == 0 ? table : table2);
+
+    uint64_t start, end;
+    std::string frame;
+
+    t.GetFrameRange(start, end, 0);
+    t.ExtractFrame(frame, dicom.substr(start, end - start), 0);
+    ASSERT_EQ("ABCD", frame);
+
+    // The second frame spans 2 fragments
+    t.GetFrameRange(start, end, 1);
+    ASSERT_EQ(2u + 8u + 4u, end - start);
+    t.ExtractFrame(frame, dicom.substr(start, end - start), 1);
+    ASSERT_EQ("EFGHIJ", frame);
+  }
+
+  // Big endian and deflated transfer syntaxes are not supported
+  dicom = CreateDicomFile("1.2.840.10008.1.2.2");
+  AddElement(dicom, 0x7fe0, 0x0010, "OW", "abcd");
+  CreateSummary(summary, 1);
+  ASSERT_FALSE(table.Compute(dicom.c_str(), dicom.size(), summary));
+
+  // No pixel data
+  dicom = CreateDicomFile("1.2.840.10008.1.2.1");
+  ASSERT_FALSE(table.Compute(dicom.c_str(), dicom.size(), summary));
+}
+
+
+TEST(DicomFrameOffsetTable, LookupPixelData)
+{
+  std::string dicom = CreateDicomFile("1.2.840.10008.1.2.1");
+  const size_t header = dicom.size();
+  AddElement(dicom, 0x7fe0, 0x0010, "OW", "abcdefghijkl");
+
+  uint64_t headerStart, valueStart;
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Found, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), dicom.size()));
+  ASSERT_EQ(header, headerStart);
+  ASSERT_EQ(header + 12u, valueStart);
+
+  // The value of the pixel data is not needed
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Found, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), header + 12));
+  ASSERT_EQ(header + 12u, valueStart);
+
+  // Truncated inside the header of the pixel data, the sequence and
+  // the preamble
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Incomplete, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), header + 6));
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Incomplete, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), header - 10));
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Incomplete, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), 100));
+
+  // Elements after the pixel data are not needed either
+  AddElement(dicom, 0xfffc, 0xfffc, "OB", "pad!");
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Found, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), dicom.size()));
+  ASSERT_EQ(header, headerStart);
+
+  // No pixel data
+  dicom = CreateDicomFile("1.2.840.10008.1.2.1");
+  AddElement(dicom, 0xfffc, 0xfffc, "OB", "pad!");
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_NotFound, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), dicom.size()));
+
+  // Unsupported transfer syntax, and not a DICOM file
+  dicom = CreateDicomFile("1.2.840.10008.1.2.2");
+  AddElement(dicom, 0x7fe0, 0x0010, "OW", "abcd");
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_NotFound, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), dicom.size()));
+
+  dicom.assign(200, 'x');
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_NotFound, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), dicom.size()));
+}
@@ -35,9 +35,16 @@
 #include "gtest/gtest.h"
 
 #include <ctype.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
+#include "../Core/Compression/ZlibCompressor.h"
 #include "../Core/FileStorage/FilesystemStorage.h"
+#include "../Core/FileStorage/MemoryStorageArea.h"
+#include "../Core/FileStorage/PackedStorageArea.h"
 #include "../Core/FileStorage/StorageAccessor.h"
+#include "../Core/FileStorage/StorageScanner.h"
+#include "../Core/FileStorage/TieredStorageArea.h"
 #include "../Core/HttpServer/BufferHttpSender.h"
 #include "../Core/HttpServer/FilesystemHttpSender.h"
 #include "../Core/Logging.h"
@@ -122,6 +129,544 @@ TEST(FilesystemStorage, EndToEnd)
 }
 
 
+TEST(FilesystemStorage, ReadBatch)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  s.Clear();
+
+  std::vector<std::string> uuids, values;
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    uuids.push_back(Toolbox::GenerateUuid());
+    values.push_back(Toolbox::GenerateUuid());
+    s.Create(uuids.back(), values.back().c_str(), values.back().size(), FileContentType_Unknown);
+  }
+
+  for (unsigned int threads = 0; threads < 3; threads++)
+  {
+    s.SetIoThreadsCount(threads);
+    ASSERT_EQ(threads, s.GetIoThreadsCount());
+
+    std::vector<std::string> contents;
+    s.ReadBatch(contents, uuids, FileContentType_Unknown);
+    ASSERT_EQ(values, contents);
+  }
+
+  Json::Value statistics = Json::objectValue;
+  s.ComputeStatistics(statistics);
+  ASSERT_EQ(0, statistics["StorageIoQueued"].asInt());
+  ASSERT_EQ(0, statistics["StorageIoRunning"].asInt());
+  ASSERT_EQ("60", statistics["StorageReadCount"].asString());
+  ASSERT_EQ("20", statistics["StorageWriteCount"].asString());
+  ASSERT_LE(statistics["StorageReadLatencyP50"].asUInt(), statistics["StorageReadLatencyP99"].asUInt());
+
+  uuids.push_back(Toolbox::GenerateUuid());  // Inexistent attachment
+  std::vector<std::string> contents;
+  ASSERT_THROW(s.ReadBatch(contents, uuids, FileContentType_Unknown), OrthancException);
+
+  s.Clear();
+}
+
+
+static void DurableWriter(FilesystemStorage* storage,
+                          std::vector<std::string>* uuids)
+{
+  for (size_t i = 0; i < uuids->size(); i++)
+  {
+    const std::string& uuid = (*uuids) [i];
+    storage->Create(uuid, uuid.c_str(), uuid.size(), FileContentType_Unknown);
+  }
+}
+
+
+TEST(FilesystemStorage, DurableWrites)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  s.Clear();
+  s.SetDurableWrites(true);
+  ASSERT_TRUE(s.IsDurableWrites());
+
+  std::vector< std::vector<std::string> > uuids(4);
+  boost::thread_group threads;
+
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    for (unsigned int j = 0; j < 10; j++)
+    {
+      uuids[i].push_back(Toolbox::GenerateUuid());
+    }
+
+    threads.create_thread(boost::bind(DurableWriter, &s, &uuids[i]));
+  }
+
+  threads.join_all();
+
+  std::set<std::string> files;
+  s.ListAllFiles(files);
+  ASSERT_EQ(40u, files.size());
+
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    for (size_t j = 0; j < uuids[i].size(); j++)
+    {
+      std::string content;
+      s.Read(content, uuids[i][j], FileContentType_Unknown);
+      ASSERT_EQ(uuids[i][j], content);
+    }
+  }
+
+  {
+    // Streaming write that is not committed
+    std::string uuid = Toolbox::GenerateUuid();
+    std::auto_ptr<IStorageArea::IWriter> writer(s.OpenWriter(uuid, FileContentType_Unknown));
+    writer->Write("Hello", 5);
+    ASSERT_FALSE(s.Exists(uuid));
+  }
+
+  Json::Value statistics = Json::objectValue;
+  s.ComputeStatistics(statistics);
+  ASSERT_EQ("40", statistics["StorageDurableWrites"].asString());
+  ASSERT_GE(40, boost::lexical_cast<int>(statistics["StorageSyncCount"].asString()));
+
+  s.Clear();
+  s.ListAllFiles(files);
+  ASSERT_EQ(0u, files.size());
+}
+
+
+TEST(StorageScanner, Basic)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  s.Clear();
+
+  std::set<std::string> u;
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    std::string uid = Toolbox::GenerateUuid();
+    s.Create(uid.c_str(), "Hello", 5, FileContentType_Unknown);
+    u.insert(uid);
+  }
+
+  ASSERT_EQ("00", StorageScanner::FormatPrefix(0));
+  ASSERT_EQ("a7", StorageScanner::FormatPrefix(0xa7));
+  ASSERT_EQ("ff", StorageScanner::FormatPrefix(255));
+  ASSERT_THROW(StorageScanner::FormatPrefix(256), OrthancException);
+
+  {
+    StorageScanner scanner(s, 3, 2, 0);
+
+    std::set<std::string> found;
+    std::string prefix;
+    std::set<std::string> uuids;
+    unsigned int count = 0;
+    while (scanner.GetNext(prefix, uuids))
+    {
+      ASSERT_EQ(StorageScanner::FormatPrefix(count), prefix);
+      for (std::set<std::string>::const_iterator it = uuids.begin(); it != uuids.end(); ++it)
+      {
+        ASSERT_EQ(prefix, it->substr(0, 2));
+        found.insert(*it);
+      }
+
+      count++;
+    }
+
+    ASSERT_EQ(256u, count);
+    ASSERT_EQ(256u, scanner.GetScannedCount());
+    ASSERT_TRUE(found == u);
+  }
+
+  {
+    // Resume the scan at the last top-level directory
+    StorageScanner scanner(s, 2, 1, 255);
+
+    std::string prefix;
+    std::set<std::string> uuids;
+    ASSERT_TRUE(scanner.GetNext(prefix, uuids));
+    ASSERT_EQ("ff", prefix);
+    ASSERT_FALSE(scanner.GetNext(prefix, uuids));
+  }
+
+  s.Clear();
+}
+
+TEST(TieredStorageArea, Migration)
+{
+  FilesystemStorage hot("UnitTestsStorage");
+  FilesystemStorage cold("UnitTestsStorageCold");
+  hot.Clear();
+  cold.Clear();
+
+  TieredStorageArea s("UnitTestsStorage", "UnitTestsStorageCold");
+  s.SetMigrationDelay(0);
+  s.SetIoThreadsCount(2);
+
+  std::string a = Toolbox::GenerateUuid();
+  std::string b = Toolbox::GenerateUuid();
+  s.Create(a, "Hello", 5, FileContentType_Unknown);
+  s.Create(b, "World", 5, FileContentType_Unknown);
+  ASSERT_EQ(2u, s.GetHotCount());
+
+  // Both attachments are demoted to the cold tier
+  uint64_t size;
+  ASSERT_TRUE(s.MigrateNext(size));  ASSERT_EQ(5u, size);
+  ASSERT_TRUE(s.MigrateNext(size));  ASSERT_EQ(5u, size);
+  ASSERT_FALSE(s.MigrateNext(size));
+  ASSERT_EQ(0u, s.GetHotCount());
+
+  std::set<std::string> ss;
+  hot.ListAllFiles(ss);
+  ASSERT_EQ(0u, ss.size());
+  cold.ListAllFiles(ss);
+  ASSERT_EQ(2u, ss.size());
+
+  // Reading from the cold tier schedules a promotion
+  s.SetMigrationDelay(3600);
+  std::string d;
+  s.Read(d, a, FileContentType_Unknown);
+  ASSERT_EQ("Hello", d);
+  ASSERT_EQ(1u, s.GetPendingPromotionsCount());
+
+  ASSERT_TRUE(s.MigrateNext(size));  ASSERT_EQ(5u, size);
+  ASSERT_FALSE(s.MigrateNext(size));
+  ASSERT_EQ(1u, s.GetHotCount());
+  ASSERT_EQ(0u, s.GetPendingPromotionsCount());
+
+  hot.ListAllFiles(ss);
+  ASSERT_EQ(1u, ss.size());
+  ASSERT_TRUE(ss.find(a) != ss.end());
+  cold.ListAllFiles(ss);
+  ASSERT_EQ(1u, ss.size());
+  ASSERT_TRUE(ss.find(b) != ss.end());
+
+  s.Read(d, a, FileContentType_Unknown);  ASSERT_EQ("Hello", d);
+  s.Read(d, b, FileContentType_Unknown);  ASSERT_EQ("World", d);
+
+  {
+    // Batch mixing a hot and a cold attachment
+    std::vector<std::string> uuids, contents;
+    uuids.push_back(b);
+    uuids.push_back(a);
+    uuids.push_back(a);
+    s.ReadBatch(contents, uuids, FileContentType_Unknown);
+    ASSERT_EQ(3u, contents.size());
+    ASSERT_EQ("World", contents[0]);
+    ASSERT_EQ("Hello", contents[1]);
+    ASSERT_EQ("Hello", contents[2]);
+  }
+
+  s.Remove(a, FileContentType_Unknown);
+  s.Remove(b, FileContentType_Unknown);
+  ASSERT_EQ(0u, s.GetHotCount());
+  ASSERT_EQ(0u, s.GetPendingPromotionsCount());
+
+  hot.ListAllFiles(ss);
+  ASSERT_EQ(0u, ss.size());
+  cold.ListAllFiles(ss);
+  ASSERT_EQ(0u, ss.size());
+}
+
+
+static void TieredReader(TieredStorageArea* storage,
+                         const std::string* uuid,
+                         const bool* done,
+                         unsigned int* errors)
+{
+  while (!*done)
+  {
+    try
+    {
+      std::string content;
+      storage->Read(content, *uuid, FileContentType_Unknown);
+      if (content != "Hello")
+      {
+        (*errors)++;
+      }
+
+      storage->ReadRange(content, *uuid, FileContentType_Unknown, 1, 3);
+      if (content != "el")
+      {
+        (*errors)++;
+      }
+    }
+    catch (OrthancException&)
+    {
+      (*errors)++;
+    }
+  }
+}
+
+
+TEST(TieredStorageArea, ConcurrentMigrations)
+{
+  FilesystemStorage hot("UnitTestsStorage");
+  FilesystemStorage cold("UnitTestsStorageCold");
+  hot.Clear();
+  cold.Clear();
+
+  TieredStorageArea s("UnitTestsStorage", "UnitTestsStorageCold");
+  s.SetMigrationDelay(0);
+
+  std::string uuid = Toolbox::GenerateUuid();
+  s.Create(uuid, "Hello", 5, FileContentType_Unknown);
+
+  // The attachment is read while it is continuously moved between
+  // the two tiers: No read may fail
+  bool done = false;
+  std::vector<unsigned int> errors(4, 0);
+  boost::thread_group threads;
+
+  for (size_t i = 0; i < errors.size(); i++)
+  {
+    threads.create_thread(boost::bind(TieredReader, &s, &uuid, &done, &errors[i]));
+  }
+
+  unsigned int migrations = 0;
+  while (migrations < 200)
+  {
+    uint64_t size;
+    if (s.MigrateNext(size))
+    {
+      migrations++;
+    }
+  }
+
+  done = true;
+  threads.join_all();
+
+  for (size_t i = 0; i < errors.size(); i++)
+  {
+    ASSERT_EQ(0u, errors[i]);
+  }
+
+  s.Remove(uuid, FileContentType_Unknown);
+}
+
+
+TEST(PackedStorageArea, Basic)
+{
+  boost::filesystem::remove_all("UnitTestsStoragePacked");
+
+  std::string a = Toolbox::GenerateUuid();
+  std::string b = Toolbox::GenerateUuid();
+  std::string c = Toolbox::GenerateUuid();
+  std::string large = Toolbox::GenerateUuid();
+
+  {
+    // Attachments up to 8 bytes are packed, in segments of 10 bytes
+    PackedStorageArea s("UnitTestsStoragePacked", 8, 10);
+    s.Create(a, "Hello", 5, FileContentType_Unknown);
+    s.Create(b, "World", 5, FileContentType_Unknown);
+    s.Create(c, "", 0, FileContentType_Unknown);
+    s.Create(large, "HelloWorld", 10, FileContentType_Unknown);
+    ASSERT_THROW(s.Create(a, "Hello", 5, FileContentType_Unknown), OrthancException);
+    ASSERT_EQ(1u, s.GetSegmentsCount());
+
+    std::set<std::string> ss;
+    s.ListAllFiles(ss);
+    ASSERT_EQ(4u, ss.size());
+
+    // Only the large attachment is stored as an individual file
+    FilesystemStorage f("UnitTestsStoragePacked");
+    f.ListAllFiles(ss);
+    ASSERT_EQ(1u, ss.size());
+    ASSERT_TRUE(ss.find(large) != ss.end());
+  }
+
+  {
+    // Reopen the storage area, and fill a second segment
+    PackedStorageArea s("UnitTestsStoragePacked", 8, 10);
+    std::string d = Toolbox::GenerateUuid();
+    s.Create(d, "Orthanc", 7, FileContentType_Unknown);
+    ASSERT_EQ(2u, s.GetSegmentsCount());
+
+    std::string r;
+    s.Read(r, a, FileContentType_Unknown);  ASSERT_EQ("Hello", r);
+    s.Read(r, b, FileContentType_Unknown);  ASSERT_EQ("World", r);
+    s.Read(r, c, FileContentType_Unknown);  ASSERT_TRUE(r.empty());
+    s.Read(r, d, FileContentType_Unknown);  ASSERT_EQ("Orthanc", r);
+    s.Read(r, large, FileContentType_Unknown);  ASSERT_EQ("HelloWorld", r);
+
+    // Half of the first segment is deleted: It gets compacted
+    ASSERT_FALSE(s.CompactNext());
+    s.Remove(a, FileContentType_Unknown);
+    s.Remove(large, FileContentType_Unknown);
+    ASSERT_TRUE(s.CompactNext());
+    ASSERT_FALSE(s.CompactNext());
+    ASSERT_EQ(2u, s.GetSegmentsCount());
+
+    ASSERT_THROW(s.Read(r, a, FileContentType_Unknown), OrthancException);
+    ASSERT_THROW(s.Read(r, large, FileContentType_Unknown), OrthancException);
+    s.Read(r, b, FileContentType_Unknown);  ASSERT_EQ("World", r);
+    s.Read(r, c, FileContentType_Unknown);  ASSERT_TRUE(r.empty());
+    s.Read(r, d, FileContentType_Unknown);  ASSERT_EQ("Orthanc", r);
+
+    std::set<std::string> ss;
+    s.ListAllFiles(ss);
+    ASSERT_EQ(3u, ss.size());
+  }
+
+  boost::filesystem::remove_all("UnitTestsStoragePacked");
+}
+
+
+TEST(PackedStorageArea, DurableWrites)
+{
+  boost::filesystem::remove_all("UnitTestsStoragePacked");
+
+  std::vector<std::string> uuids;
+
+  {
+    PackedStorageArea s("UnitTestsStoragePacked", 8, 10);
+    s.SetDurableWrites(true);
+
+    // Each segment holds one attachment, which creates new segments
+    // that must be flushed together with their directory
+    for (unsigned int i = 0; i < 6; i++)
+    {
+      uuids.push_back(Toolbox::GenerateUuid());
+      std::string content = "Hello" + boost::lexical_cast<std::string>(i);
+      s.Create(uuids.back(), content.c_str(), content.size(), FileContentType_Unknown);
+    }
+
+    // Large attachment, that is stored as an individual file
+    uuids.push_back(Toolbox::GenerateUuid());
+    s.Create(uuids.back(), "HelloWorld", 10, FileContentType_Unknown);
+
+    ASSERT_EQ(6u, s.GetSegmentsCount());
+  }
+
+  {
+    PackedStorageArea s("UnitTestsStoragePacked", 8, 10);
+
+    for (unsigned int i = 0; i < 6; i++)
+    {
+      std::string content;
+      s.Read(content, uuids[i], FileContentType_Unknown);
+      ASSERT_EQ("Hello" + boost::lexical_cast<std::string>(i), content);
+    }
+
+    std::string content;
+    s.Read(content, uuids[6], FileContentType_Unknown);
+    ASSERT_EQ("HelloWorld", content);
+  }
+
+  boost::filesystem::remove_all("UnitTestsStoragePacked");
+}
+
+
+static ErrorCode CreateTwice(IStorageArea& area)
+{
+  const std::string uuid = Toolbox::GenerateUuid();
+  area.Create(uuid, "Hello", 5, FileContentType_Unknown);
+
+  ErrorCode code = ErrorCode_Success;
+
+  try
+  {
+    area.Create(uuid, "World", 5, FileContentType_Unknown);
+  }
+  catch (OrthancException& e)
+  {
+    code = e.GetErrorCode();
+  }
+
+  std::string content;
+  area.Read(content, uuid, FileContentType_Unknown);
+  EXPECT_EQ("Hello", content);
+
+  area.Remove(uuid, FileContentType_Unknown);
+  return code;
+}
+
+
+TEST(StorageAccessor, DuplicateResource)
+{
+  // The creation of an existing attachment is reported by a specific
+  // error code, that is distinguished from the I/O errors
+  MemoryStorageArea memory;
+  ASSERT_EQ(ErrorCode_DuplicateResource, CreateTwice(memory));
+
+  FilesystemStorage filesystem("UnitTestsStorage");
+  filesystem.Clear();
+  ASSERT_EQ(ErrorCode_DuplicateResource, CreateTwice(filesystem));
+
+  boost::filesystem::remove_all("UnitTestsStoragePacked");
+  PackedStorageArea packed("UnitTestsStoragePacked", 8, 100);
+  ASSERT_EQ(ErrorCode_DuplicateResource, CreateTwice(packed));
+
+  // An attachment that only exists in the cold tier
+  const std::string coldUuid = Toolbox::GenerateUuid();
+  FilesystemStorage cold("UnitTestsStorageCold");
+  cold.Clear();
+  cold.Create(coldUuid, "Hello", 5, FileContentType_Unknown);
+
+  {
+    TieredStorageArea tiered("UnitTestsStorage", "UnitTestsStorageCold");
+    ASSERT_EQ(ErrorCode_DuplicateResource, CreateTwice(tiered));
+
+    try
+    {
+      tiered.Create(coldUuid, "World", 5, FileContentType_Unknown);
+      FAIL();
+    }
+    catch (OrthancException& e)
+    {
+      ASSERT_EQ(ErrorCode_DuplicateResource, e.GetErrorCode());
+    }
+  }
+
+  cold.Clear();
+}
+
+
+TEST(StorageAccessor, ReadRange)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  MemoryStorageArea m;
+  ASSERT_TRUE(s.HasReadRange());
+  ASSERT_FALSE(m.HasReadRange());
+
+  std::string data = "Hello world";
+
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    IStorageArea& area = (i == 1 ? static_cast<IStorageArea&>(m) : static_cast<IStorageArea&>(s));
+    StorageAccessor accessor(area);
+
+    // The compressed attachments are uncompressed as a whole
+    FileInfo info = accessor.Write(data, FileContentType_Dicom,
+                                   (i == 2 ? CompressionType_ZlibWithSize : CompressionType_None), false);
+
+    std::string r;
+    accessor.ReadRange(r, info, 6, 11);  ASSERT_EQ("world", r);
+    accessor.ReadRange(r, info, 0, 5);   ASSERT_EQ("Hello", r);
+    accessor.ReadRange(r, info, 4, 4);   ASSERT_TRUE(r.empty());
+    ASSERT_THROW(accessor.ReadRange(r, info, 6, 12), OrthancException);
+    ASSERT_THROW(accessor.ReadRange(r, info, 6, 5), OrthancException);
+
+    accessor.Remove(info);
+  }
+
+  {
+    boost::filesystem::remove_all("UnitTestsStoragePacked");
+
+    std::string a = Toolbox::GenerateUuid();
+    std::string large = Toolbox::GenerateUuid();
+
+    PackedStorageArea p("UnitTestsStoragePacked", 8, 10);
+    p.Create(a, "Orthanc", 7, FileContentType_Unknown);
+    p.Create(large, "HelloWorld", 10, FileContentType_Unknown);
+
+    std::string r;
+    p.ReadRange(r, a, FileContentType_Unknown, 2, 5);  ASSERT_EQ("tha", r);
+    p.ReadRange(r, large, FileContentType_Unknown, 5, 10);  ASSERT_EQ("World", r);
+    ASSERT_THROW(p.ReadRange(r, a, FileContentType_Unknown, 2, 8), OrthancException);
+  }
+
+  boost::filesystem::remove_all("UnitTestsStoragePacked");
+}
+
 TEST(StorageAccessor, NoCompression)
 {
   FilesystemStorage s("UnitTestsStorage");
@@ -163,6 +708,147 @@ TEST(StorageAccessor, Compression)
 }
 
 
+TEST(StorageAccessor, ReadBatch)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  s.SetIoThreadsCount(2);
+  StorageAccessor accessor(s);
+
+  std::vector<std::string> values;
+  values.push_back("Hello world");
+  values.push_back("");
+  values.push_back(std::string(10000, 'a'));
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    CompressionType compression = (i == 0 ? CompressionType_None : CompressionType_ZlibWithSize);
+
+    std::vector<FileInfo> infos;
+    for (size_t j = 0; j < values.size(); j++)
+    {
+      infos.push_back(accessor.Write(values[j], FileContentType_DicomAsJson, compression, true));
+    }
+
+    std::vector<std::string> contents;
+    accessor.ReadBatch(contents, infos);
+    ASSERT_EQ(values, contents);
+
+    for (size_t j = 0; j < infos.size(); j++)
+    {
+      accessor.Remove(infos[j]);
+    }
+  }
+}
+
+
+TEST(StorageAccessor, MD5Verifier)
+{
+  MemoryStorageArea area;
+  StorageAccessor accessor(area);
+
+  std::string data(1000, 'a');
+  FileInfo info = accessor.Write(data, FileContentType_Dicom, CompressionType_None, true);
+
+  {
+    StorageAccessor::MD5Verifier verifier(accessor, info);
+
+    for (unsigned int i = 0; i < 10; i++)
+    {
+      ASSERT_FALSE(verifier.IsDone());
+      ASSERT_EQ(100u, verifier.Read(100));
+    }
+
+    ASSERT_EQ(0u, verifier.Read(100));
+    ASSERT_TRUE(verifier.IsDone());
+    ASSERT_TRUE(verifier.IsValid());
+    ASSERT_EQ(0u, verifier.Read(100));
+  }
+
+  data[500] = 'b';
+  accessor.Remove(info);
+  area.Create(info.GetUuid(), data.c_str(), data.size(), FileContentType_Dicom);
+  ASSERT_FALSE(accessor.VerifyMD5(info));
+
+  // The batched reads check the MD5 as well
+  std::vector<FileInfo> infos;
+  infos.push_back(info);
+  std::vector<std::string> contents;
+  ASSERT_THROW(accessor.ReadBatch(contents, infos), OrthancException);
+
+  infos[0] = FileInfo(info.GetUuid(), info.GetContentType(), info.GetUncompressedSize(), "");
+  accessor.ReadBatch(contents, infos);
+  ASSERT_EQ(data, contents[0]);
+
+  accessor.Remove(info);
+  ASSERT_THROW(accessor.VerifyMD5(info), OrthancException);
+}
+
+
+TEST(StorageAccessor, Streaming)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  MemoryStorageArea m;
+  ASSERT_TRUE(s.HasStreaming());
+  ASSERT_FALSE(m.HasStreaming());
+
+  // Several chunks of input and output, with some redundancy
+  std::string data;
+  data.resize(3 * 1024 * 1024 + 17);
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    data[i] = static_cast<char>((i * i) % 251);
+  }
+
+  std::string md5;
+  Toolbox::ComputeMD5(md5, data);
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    IStorageArea& area = (i == 0 ? static_cast<IStorageArea&>(s) : m);
+    StorageAccessor accessor(area);
+
+    FileInfo info = accessor.Write(data, FileContentType_Dicom, CompressionType_ZlibWithSize, true);
+    ASSERT_EQ(md5, info.GetUncompressedMD5());
+    ASSERT_EQ(data.size(), info.GetUncompressedSize());
+
+    // The stored attachment is compatible with "ZlibCompressor"
+    std::string compressed, uncompressed;
+    area.Read(compressed, info.GetUuid(), FileContentType_Dicom);
+    ASSERT_EQ(compressed.size(), info.GetCompressedSize());
+    Toolbox::ComputeMD5(uncompressed, compressed);
+    ASSERT_EQ(uncompressed, info.GetCompressedMD5());
+
+    ZlibCompressor compressor;
+    IBufferCompressor::Uncompress(uncompressed, compressor, compressed);
+    ASSERT_TRUE(uncompressed == data);
+
+    std::string r;
+    accessor.Read(r, info);
+    ASSERT_TRUE(r == data);
+
+    // Truncated attachment
+    accessor.Remove(info);
+    area.Create(info.GetUuid(), compressed.c_str(), compressed.size() / 2, FileContentType_Dicom);
+    ASSERT_THROW(accessor.Read(r, info), OrthancException);
+    accessor.Remove(info);
+
+    // Attachment written by "ZlibCompressor"
+    IBufferCompressor::Compress(compressed, compressor, data);
+    area.Create(info.GetUuid(), compressed.c_str(), compressed.size(), FileContentType_Dicom);
+    accessor.Read(r, info);
+    ASSERT_TRUE(r == data);
+    accessor.Remove(info);
+
+    // Empty attachment
+    info = accessor.Write("", FileContentType_Dicom, CompressionType_ZlibWithSize, true);
+    ASSERT_EQ(0u, info.GetCompressedSize());
+    accessor.Read(r, info);
+    ASSERT_TRUE(r.empty());
+    accessor.Remove(info);
+  }
+}
+
+
 TEST(StorageAccessor, Mix)
 {
   FilesystemStorage s("UnitTestsStorage");
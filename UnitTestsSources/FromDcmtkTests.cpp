@@ -34,6 +34,7 @@
 #include "PrecompiledHeadersUnitTests.h"
 #include "gtest/gtest.h"
 
+#include "../Core/DicomFormat/DicomFrameOffsetTable.h"
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
 #include "../Core/DicomParsing/ToDcmtkBridge.h"
 #include "../Core/DicomParsing/DicomModification.h"
@@ -721,6 +722,213 @@ TEST(ParsedDicomFile, ToJsonFlags2)
 }
 
 
+TEST(ParsedDicomFile, CreateUntilPixelData)
+{
+  std::string dicom;
+
+  {
+    ParsedDicomFile f(true);
+    f.ReplacePlainString(DICOM_TAG_PATIENT_NAME, "Orthanc");
+    f.Insert(DICOM_TAG_PIXEL_DATA, "Pixels", false);
+    f.SaveToMemoryBuffer(dicom);
+  }
+
+  uint64_t headerStart, valueStart;
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Found, DicomFrameOffsetTable::LookupPixelData
+            (headerStart, valueStart, dicom.c_str(), dicom.size()));
+  ASSERT_EQ(dicom.size(), valueStart + 6u);
+
+  Json::Value reference;
+
+  {
+    ParsedDicomFile original(dicom);
+    original.DatasetToJson(reference);
+  }
+
+  // Parse the whole file, then only its first bytes up to the header
+  // of the pixel data: The summaries are the same
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    size_t size = (i == 0 ? dicom.size() : static_cast<size_t>(valueStart));
+    std::auto_ptr<ParsedDicomFile> f(ParsedDicomFile::CreateUntilPixelData(dicom.c_str(), size));
+
+    ASSERT_TRUE(f->HasTag(DICOM_TAG_PIXEL_DATA));
+
+    std::string s;
+    ASSERT_TRUE(f->GetTagValue(s, DICOM_TAG_PATIENT_NAME));
+    ASSERT_EQ("Orthanc", s);
+
+    Json::Value v;
+    f->DatasetToJson(v);
+    ASSERT_EQ(reference.toStyledString(), v.toStyledString());
+  }
+
+  // Without pixel data, the whole file is parsed
+  {
+    ParsedDicomFile f(true);
+    f.SaveToMemoryBuffer(dicom);
+  }
+
+  std::auto_ptr<ParsedDicomFile> f(ParsedDicomFile::CreateUntilPixelData(dicom.c_str(), dicom.size()));
+  ASSERT_FALSE(f->HasTag(DICOM_TAG_PIXEL_DATA));
+}
+
+
+static void AppendExplicitElement(std::string& target,
+                                  uint16_t group,
+                                  uint16_t element,
+                                  const char* vr,
+                                  const std::string& value,
+                                  uint32_t length)
+{
+  const uint8_t tag[4] = {
+    static_cast<uint8_t>(group & 0xff), static_cast<uint8_t>(group >> 8),
+    static_cast<uint8_t>(element & 0xff), static_cast<uint8_t>(element >> 8)
+  };
+
+  target.append(reinterpret_cast<const char*>(tag), 4);
+
+  if (vr != NULL)
+  {
+    target.append(vr, 2);
+  }
+
+  if (vr == NULL ||
+      std::string(vr) == "OB" ||
+      std::string(vr) == "OW")
+  {
+    if (vr != NULL)
+    {
+      target.append(2, '\0');  // Reserved
+    }
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+      target.push_back(static_cast<char>((length >> (8 * i)) & 0xff));
+    }
+  }
+  else
+  {
+    target.push_back(static_cast<char>(length & 0xff));
+    target.push_back(static_cast<char>((length >> 8) & 0xff));
+  }
+
+  target.append(value);
+}
+
+
+TEST(ParsedDicomFile, CreateUntilEncapsulatedPixelData)
+{
+  // JPEG baseline file, whose pixel data has an undefined length
+  std::string dicom(128, '\0');
+  dicom += "DICM";
+  AppendExplicitElement(dicom, 0x0002, 0x0010, "UI", "1.2.840.10008.1.2.4.50", 22);
+  AppendExplicitElement(dicom, 0x0010, 0x0010, "PN", "Orthanc^Test", 12);
+
+  const size_t headerStart = dicom.size();
+
+  std::string fragments;
+  AppendExplicitElement(fragments, 0xfffe, 0xe000, NULL, "", 0);  // Empty offset table
+  AppendExplicitElement(fragments, 0xfffe, 0xe000, NULL, "ABCD", 4);
+  AppendExplicitElement(fragments, 0xfffe, 0xe0dd, NULL, "", 0);
+  AppendExplicitElement(dicom, 0x7fe0, 0x0010, "OB", fragments, 0xffffffffu);
+
+  uint64_t start, valueStart;
+  ASSERT_EQ(DicomFrameOffsetTable::PixelDataLookup_Found, DicomFrameOffsetTable::LookupPixelData
+            (start, valueStart, dicom.c_str(), dicom.size()));
+  ASSERT_EQ(headerStart, start);
+  ASSERT_EQ(headerStart + 12u, valueStart);
+
+  // Parse the whole file, then only its first bytes up to the header
+  // of the pixel data (whose undefined length is replaced by zero)
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    size_t size = (i == 0 ? dicom.size() : static_cast<size_t>(valueStart));
+    std::auto_ptr<ParsedDicomFile> f(ParsedDicomFile::CreateUntilPixelData(dicom.c_str(), size));
+
+    ASSERT_TRUE(f->HasTag(DICOM_TAG_PIXEL_DATA));
+
+    std::string s;
+    ASSERT_TRUE(f->GetTagValue(s, DICOM_TAG_PATIENT_NAME));
+    ASSERT_EQ("Orthanc^Test", s);
+
+    DicomMap summary;
+    f->ExtractDicomSummary(summary);
+    ASSERT_EQ("Orthanc^Test", summary.GetValue(DICOM_TAG_PATIENT_NAME).GetContent());
+  }
+}
+
+
+static void AppendUnsignedShort(std::string& target,
+                                uint16_t element,
+                                uint16_t value)
+{
+  std::string s;
+  s.push_back(static_cast<char>(value & 0xff));
+  s.push_back(static_cast<char>(value >> 8));
+  AppendExplicitElement(target, 0x0028, element, "US", s, 2);
+}
+
+
+static std::string CreateImageHeader(const std::string& transferSyntax)
+{
+  // 3 frames of 2x1 pixels, 16bpp
+  std::string dicom(128, '\0');
+  dicom += "DICM";
+  AppendExplicitElement(dicom, 0x0002, 0x0010, "UI", transferSyntax, transferSyntax.size());
+  AppendUnsignedShort(dicom, 0x0002, 1);  // Samples per pixel
+  AppendExplicitElement(dicom, 0x0028, 0x0004, "CS", "MONOCHROME2 ", 12);
+  AppendExplicitElement(dicom, 0x0028, 0x0008, "IS", "3 ", 2);
+  AppendUnsignedShort(dicom, 0x0010, 1);  // Rows
+  AppendUnsignedShort(dicom, 0x0011, 2);  // Columns
+  AppendUnsignedShort(dicom, 0x0100, 16);  // Bits allocated
+  AppendUnsignedShort(dicom, 0x0101, 16);  // Bits stored
+  AppendUnsignedShort(dicom, 0x0102, 15);  // High bit
+  AppendUnsignedShort(dicom, 0x0103, 0);  // Pixel representation
+  return dicom;
+}
+
+
+TEST(ParsedDicomFile, CreateSingleFrame)
+{
+  std::string dicom = CreateImageHeader(std::string("1.2.840.10008.1.2.1") + '\0');
+  const size_t header = dicom.size();
+  AppendExplicitElement(dicom, 0x7fe0, 0x0010, "OW", std::string("\1\0\2\0\3\0\4\0\5\0\6\0", 12), 12);
+
+  ParsedDicomFile full(dicom);
+  ASSERT_EQ(3u, full.GetFramesCount());
+
+  std::string raw;
+  MimeType mime;
+  full.GetRawFrame(raw, mime, 1);
+  ASSERT_EQ(4u, raw.size());
+
+  // Only the header of the pixel data is needed, not its value
+  ASSERT_THROW(ParsedDicomFile::CreateSingleFrame(dicom.c_str(), header, raw), OrthancException);
+  std::auto_ptr<ParsedDicomFile> single(ParsedDicomFile::CreateSingleFrame(dicom.c_str(), header + 12, raw));
+  ASSERT_EQ(1u, single->GetFramesCount());
+
+  std::auto_ptr<ImageAccessor> decoded(DicomImageDecoder::Decode(*single, 0));
+  ASSERT_EQ(PixelFormat_Grayscale16, decoded->GetFormat());
+  ASSERT_EQ(2u, decoded->GetWidth());
+  ASSERT_EQ(1u, decoded->GetHeight());
+
+  const uint16_t* p = reinterpret_cast<const uint16_t*>(decoded->GetConstRow(0));
+  ASSERT_EQ(3, p[0]);
+  ASSERT_EQ(4, p[1]);
+
+  // Encapsulated pixel data: The frame becomes the only fragment
+  dicom = CreateImageHeader(std::string("1.2.840.10008.1.2.5") + '\0');  // RLE lossless
+  AppendExplicitElement(dicom, 0x7fe0, 0x0010, "OB", "", 0xffffffffu);
+
+  single.reset(ParsedDicomFile::CreateSingleFrame(dicom.c_str(), dicom.size(), "ABC"));
+  ASSERT_EQ(1u, single->GetFramesCount());
+  single->GetRawFrame(raw, mime, 0);
+  ASSERT_LE(3u, raw.size());
+  ASSERT_EQ("ABC", raw.substr(0, 3));
+}
+
+
 TEST(DicomFindAnswers, Basic)
 {
   DicomFindAnswers a(false);
@@ -1314,3 +1522,273 @@ TEST(ParsedDicomFile, InvalidCharacterSets)
     ASSERT_EQ(Encoding_Latin3, d.GetEncoding());
   }
 }
+
+
+
+#if ORTHANC_ENABLE_DCMTK_NETWORKING == 1
+
+#include "../Core/DicomNetworking/DicomServer.h"
+#include "../Core/DicomNetworking/DicomUserConnection.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <dcmtk/dcmdata/dcuid.h>
+
+namespace
+{
+  class AnyRemoteModalities : public DicomServer::IRemoteModalities
+  {
+  public:
+    virtual bool IsSameAETitle(const std::string& aet1,
+                               const std::string& aet2)
+    {
+      return aet1 == aet2;
+    }
+
+    virtual bool LookupAETitle(RemoteModalityParameters& modality,
+                               const std::string& aet)
+    {
+      return false;
+    }
+  };
+
+
+  // Records the instances that are received by the C-STORE SCP
+  class ReceivedInstances : public IStoreRequestHandlerFactory
+  {
+  private:
+    class Handler : public IStoreRequestHandler
+    {
+    private:
+      ReceivedInstances&  that_;
+
+    public:
+      explicit Handler(ReceivedInstances& that) :
+        that_(that)
+      {
+      }
+
+      virtual void Handle(const std::string& dicomFile,
+                          const DicomMap& dicomSummary,
+                          const Json::Value& dicomJson,
+                          const std::string& remoteIp,
+                          const std::string& remoteAet,
+                          const std::string& calledAet)
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+        that_.count_++;
+        that_.dicom_ = dicomFile;
+        that_.summary_.Assign(dicomSummary);
+        that_.json_ = dicomJson;
+      }
+    };
+
+    boost::mutex  mutex_;
+    unsigned int  count_;
+    std::string   dicom_;
+    DicomMap      summary_;
+    Json::Value   json_;
+
+  public:
+    ReceivedInstances() :
+      count_(0)
+    {
+    }
+
+    virtual IStoreRequestHandler* ConstructStoreRequestHandler()
+    {
+      return new Handler(*this);
+    }
+
+    unsigned int GetCount() const
+    {
+      return count_;
+    }
+
+    const std::string& GetDicom() const
+    {
+      return dicom_;
+    }
+
+    const DicomMap& GetSummary() const
+    {
+      return summary_;
+    }
+
+    const Json::Value& GetJson() const
+    {
+      return json_;
+    }
+  };
+}
+
+
+static const uint16_t STORE_SCP_TEST_PORT = 10400;
+
+
+// Multi-frame instance of "frames" frames of "size" x "size" pixels
+// coded on 16 bits, whose pixel data is returned in "pixelData"
+static void CreateMultiFrameInstance(std::string& dicom,
+                                     std::string& pixelData,
+                                     unsigned int frames,
+                                     unsigned int size)
+{
+  pixelData.resize(static_cast<size_t>(frames) * size * size * 2);
+  for (size_t i = 0; i < pixelData.size(); i++)
+  {
+    pixelData[i] = static_cast<char>(i % 251);
+  }
+
+  ParsedDicomFile f(true);
+  f.ReplacePlainString(DICOM_TAG_SOP_CLASS_UID, UID_SecondaryCaptureImageStorage);
+  f.ReplacePlainString(DICOM_TAG_ROWS, boost::lexical_cast<std::string>(size));
+  f.ReplacePlainString(DICOM_TAG_COLUMNS, boost::lexical_cast<std::string>(size));
+  f.ReplacePlainString(DICOM_TAG_BITS_ALLOCATED, "16");
+  f.ReplacePlainString(DICOM_TAG_NUMBER_OF_FRAMES, boost::lexical_cast<std::string>(frames));
+  f.ReplacePlainString(DICOM_TAG_PHOTOMETRIC_INTERPRETATION, "MONOCHROME2");
+  ASSERT_TRUE(f.GetDcmtkObject().getDataset()->putAndInsertUint8Array
+              (DCM_PixelData, reinterpret_cast<const Uint8*>(pixelData.c_str()), pixelData.size()).good());
+  f.SaveToMemoryBuffer(dicom);
+}
+
+
+// Sends one instance from a C-STORE SCU to the C-STORE SCP of
+// Orthanc, through a DICOM association over the loopback interface
+static void SendToStoreScp(ReceivedInstances& received,
+                           const std::string& dicom,
+                           bool bitPreserving)
+{
+  AnyRemoteModalities modalities;
+
+  DicomServer server;
+  server.SetPortNumber(STORE_SCP_TEST_PORT);
+  server.SetApplicationEntityTitle("ORTHANC");
+  server.SetCalledApplicationEntityTitleCheck(true);
+  server.SetBitPreservingStore(bitPreserving);
+  server.SetRemoteModalities(modalities);
+  server.SetStoreRequestHandlerFactory(received);
+  server.Start();
+
+  try
+  {
+    DicomUserConnection scu;
+    scu.SetLocalApplicationEntityTitle("STORESCU");
+    scu.SetRemoteApplicationEntityTitle("ORTHANC");
+    scu.SetRemoteHost("127.0.0.1");
+    scu.SetRemotePort(STORE_SCP_TEST_PORT);
+    scu.Open();
+    scu.Store(dicom);
+    scu.Close();
+  }
+  catch (OrthancException&)
+  {
+    server.Stop();
+    throw;
+  }
+
+  server.Stop();
+}
+
+
+TEST(StoreScp, BitPreserving)
+{
+  std::string dicom, pixelData;
+  CreateMultiFrameInstance(dicom, pixelData, 4, 64);
+
+  std::string sopInstanceUid;
+
+  {
+    ParsedDicomFile f(dicom);
+    ASSERT_TRUE(f.GetTagValue(sopInstanceUid, DICOM_TAG_SOP_INSTANCE_UID));
+  }
+
+  for (unsigned int mode = 0; mode < 2; mode++)
+  {
+    const bool bitPreserving = (mode == 1);
+
+    ReceivedInstances received;
+    SendToStoreScp(received, dicom, bitPreserving);
+
+    ASSERT_EQ(1u, received.GetCount());
+    ASSERT_EQ(sopInstanceUid, received.GetSummary().GetValue(DICOM_TAG_SOP_INSTANCE_UID).GetContent());
+    ASSERT_EQ("4", received.GetSummary().GetValue(DICOM_TAG_NUMBER_OF_FRAMES).GetContent());
+    ASSERT_TRUE(received.GetJson().isMember("0008,0018"));
+
+    // The pixel data, that is the last element of the data set, is
+    // received untouched
+    const std::string& d = received.GetDicom();
+    ASSERT_GT(d.size(), pixelData.size());
+    ASSERT_TRUE(d.compare(d.size() - pixelData.size(), pixelData.size(), pixelData) == 0);
+
+    // The received buffer can be parsed by DCMTK
+    ParsedDicomFile f(d);
+    std::string s;
+    ASSERT_TRUE(f.GetTagValue(s, DICOM_TAG_SOP_INSTANCE_UID));
+    ASSERT_EQ(sopInstanceUid, s);
+  }
+}
+
+
+#if defined(__linux__)
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+TEST(StoreScp, DISABLED_Benchmark)
+{
+  // Multi-frame instance with 128MB of pixel data
+  std::string dicom, pixelData;
+  CreateMultiFrameInstance(dicom, pixelData, 64, 1024);
+  pixelData.clear();
+
+  // Each reception is run in a child process, so as to measure its
+  // peak memory. As the resident memory of the parent process is
+  // inherited by the child, the run that sends nothing is the
+  // reference. The figures include the C-STORE SCU, whose cost is
+  // the same in both modes.
+  static const char* NAMES[] = { "None", "Dataset", "BitPreserving" };
+
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0)
+    {
+      bool success = true;
+
+      if (i != 0)
+      {
+        try
+        {
+          ReceivedInstances received;
+          SendToStoreScp(received, dicom, (i == 2));
+          success = (received.GetCount() == 1 &&
+                     received.GetDicom().size() > dicom.size() / 2);
+        }
+        catch (OrthancException&)
+        {
+          success = false;
+        }
+      }
+
+      _exit(success ? 0 : 1);
+    }
+
+    int status;
+    struct rusage usage;
+    ASSERT_EQ(pid, wait4(pid, &status, 0, &usage));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    double cpu = (static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+                  static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0);
+
+    printf("%-14s CPU: %.3f s, peak memory: %ld MB\n", NAMES[i], cpu, usage.ru_maxrss / 1024);
+  }
+}
+
+#endif
+
+#endif
@@ -36,8 +36,12 @@
 
 #include "../Core/DicomFormat/DicomImageInformation.h"
 #include "../Core/Images/Image.h"
+#include "../Core/Images/ImageBufferPool.h"
 #include "../Core/Images/ImageProcessing.h"
+#include "../Core/Images/ImageProcessingSimd.h"
+#include "../Core/MultiThreading/TaskPool.h"
 #include "../Core/Images/ImageTraits.h"
+#include "../Core/OrthancException.h"
 
 #include <memory>
 
@@ -198,3 +202,422 @@ TYPED_TEST(TestIntegerImageTraits, SetZeroFloat)
     }
   }
 }
+
+
+TEST(ImageProcessing, ResizeBox)
+{
+  Image source(PixelFormat_Grayscale8, 4, 4, false);
+  for (unsigned int y = 0; y < 4; y++)
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(source.GetRow(y));
+    for (unsigned int x = 0; x < 4; x++)
+    {
+      p[x] = static_cast<uint8_t>(10 * (4 * y + x));
+    }
+  }
+
+  Image target(PixelFormat_Grayscale8, 2, 2, false);
+  ImageProcessing::Resize(target, source, ImageInterpolation_Box);
+  ASSERT_EQ(25, reinterpret_cast<const uint8_t*>(target.GetConstRow(0)) [0]);   // (0+10+40+50)/4
+  ASSERT_EQ(45, reinterpret_cast<const uint8_t*>(target.GetConstRow(0)) [1]);
+  ASSERT_EQ(105, reinterpret_cast<const uint8_t*>(target.GetConstRow(1)) [0]);
+  ASSERT_EQ(125, reinterpret_cast<const uint8_t*>(target.GetConstRow(1)) [1]);
+
+  // Upscaling with a box filter replicates the pixels
+  Image large(PixelFormat_Grayscale8, 8, 8, false);
+  ImageProcessing::Resize(large, source, ImageInterpolation_Box);
+  ASSERT_EQ(0, reinterpret_cast<const uint8_t*>(large.GetConstRow(1)) [1]);
+  ASSERT_EQ(150, reinterpret_cast<const uint8_t*>(large.GetConstRow(7)) [7]);
+
+  Image bad(PixelFormat_Grayscale16, 2, 2, false);
+  ASSERT_THROW(ImageProcessing::Resize(bad, source, ImageInterpolation_Box), OrthancException);
+
+  // Rounding of negative values, and color images
+  Image s16(PixelFormat_SignedGrayscale16, 2, 1, false);
+  reinterpret_cast<int16_t*>(s16.GetRow(0)) [0] = -10;
+  reinterpret_cast<int16_t*>(s16.GetRow(0)) [1] = -5;
+  Image t16(PixelFormat_SignedGrayscale16, 1, 1, false);
+  ImageProcessing::Resize(t16, s16, ImageInterpolation_Box);
+  ASSERT_EQ(-8, reinterpret_cast<const int16_t*>(t16.GetConstRow(0)) [0]);
+
+  Image rgb(PixelFormat_RGB24, 2, 1, false);
+  uint8_t* p = reinterpret_cast<uint8_t*>(rgb.GetRow(0));
+  p[0] = 0;   p[1] = 100;  p[2] = 255;
+  p[3] = 10;  p[4] = 200;  p[5] = 255;
+  Image rgbTarget(PixelFormat_RGB24, 1, 1, false);
+  ImageProcessing::Resize(rgbTarget, rgb, ImageInterpolation_Box);
+  const uint8_t* q = reinterpret_cast<const uint8_t*>(rgbTarget.GetConstRow(0));
+  ASSERT_EQ(5, q[0]);
+  ASSERT_EQ(150, q[1]);
+  ASSERT_EQ(255, q[2]);
+}
+
+
+TEST(ImageProcessing, ResizeBilinear)
+{
+  Image source(PixelFormat_Grayscale8, 2, 1, false);
+  reinterpret_cast<uint8_t*>(source.GetRow(0)) [0] = 0;
+  reinterpret_cast<uint8_t*>(source.GetRow(0)) [1] = 255;
+
+  Image target(PixelFormat_Grayscale8, 4, 1, false);
+  ImageProcessing::Resize(target, source, ImageInterpolation_Bilinear);
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(target.GetConstRow(0));
+  ASSERT_EQ(0, p[0]);
+  ASSERT_EQ(64, p[1]);
+  ASSERT_EQ(191, p[2]);
+  ASSERT_EQ(255, p[3]);
+
+  Image f(PixelFormat_Float32, 2, 1, false);
+  reinterpret_cast<float*>(f.GetRow(0)) [0] = 0.0f;
+  reinterpret_cast<float*>(f.GetRow(0)) [1] = 1.0f;
+
+  Image g(PixelFormat_Float32, 4, 1, false);
+  ImageProcessing::Resize(g, f, ImageInterpolation_Bilinear);
+  ASSERT_FLOAT_EQ(0.25f, reinterpret_cast<const float*>(g.GetConstRow(0)) [1]);
+  ASSERT_FLOAT_EQ(0.75f, reinterpret_cast<const float*>(g.GetConstRow(0)) [2]);
+}
+
+
+TEST(ImageProcessing, ApplyWindowing)
+{
+  Image source(PixelFormat_SignedGrayscale16, 4, 1, false);
+  int16_t* p = reinterpret_cast<int16_t*>(source.GetRow(0));
+  p[0] = -1000;
+  p[1] = 39;
+  p[2] = 40;
+  p[3] = 1000;
+
+  Image target(PixelFormat_Grayscale8, 4, 1, false);
+  const uint8_t* q = reinterpret_cast<const uint8_t*>(target.GetConstRow(0));
+
+  ImageProcessing::ApplyWindowing(target, source, 40.0f, 400.0f, 1.0f, 0.0f, false);
+  ASSERT_EQ(0, q[0]);
+  ASSERT_EQ(127, q[1]);
+  ASSERT_EQ(128, q[2]);
+  ASSERT_EQ(255, q[3]);
+
+  ImageProcessing::ApplyWindowing(target, source, 40.0f, 400.0f, 1.0f, 0.0f, true);
+  ASSERT_EQ(255, q[0]);
+  ASSERT_EQ(127, q[2]);
+  ASSERT_EQ(0, q[3]);
+
+  // Binary threshold
+  ImageProcessing::ApplyWindowing(target, source, 40.0f, 1.0f, 1.0f, 0.0f, false);
+  ASSERT_EQ(0, q[1]);
+  ASSERT_EQ(255, q[2]);
+
+  // Rescale of the stored values (e.g. to Hounsfield units)
+  Image unsignedSource(PixelFormat_Grayscale16, 1, 1, false);
+  reinterpret_cast<uint16_t*>(unsignedSource.GetRow(0)) [0] = 1064;
+  Image t(PixelFormat_Grayscale8, 1, 1, false);
+  ImageProcessing::ApplyWindowing(t, unsignedSource, 40.0f, 400.0f, 1.0f, -1024.0f, false);
+  ASSERT_EQ(128, reinterpret_cast<const uint8_t*>(t.GetConstRow(0)) [0]);
+
+  ASSERT_THROW(ImageProcessing::ApplyWindowing(target, source, 40.0f, 0.5f, 1.0f, 0.0f, false), OrthancException);
+  ASSERT_THROW(ImageProcessing::ApplyWindowing(t, source, 40.0f, 400.0f, 1.0f, 0.0f, false), OrthancException);
+}
+
+
+namespace
+{
+  class SimdTester : public boost::noncopyable
+  {
+  private:
+    uint32_t  seed_;
+
+    static bool IsSameImage(const ImageAccessor& a,
+                            const ImageAccessor& b)
+    {
+      if (a.GetFormat() != b.GetFormat() ||
+          a.GetWidth() != b.GetWidth() ||
+          a.GetHeight() != b.GetHeight())
+      {
+        return false;
+      }
+
+      const size_t size = a.GetWidth() * a.GetBytesPerPixel();
+
+      for (unsigned int y = 0; y < a.GetHeight(); y++)
+      {
+        if (memcmp(a.GetConstRow(y), b.GetConstRow(y), size) != 0)
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+  public:
+    SimdTester() : seed_(42)
+    {
+    }
+
+    ~SimdTester()
+    {
+      ImageProcessingSimd::SetInstructionSet(ImageProcessingSimd::GetSupportedInstructionSet());
+    }
+
+    // The odd width exercises the scalar tails of the kernels
+    Image* CreateRandomImage(PixelFormat format)
+    {
+      std::auto_ptr<Image> image(new Image(format, 77, 5, false));
+
+      const size_t size = image->GetWidth() * image->GetBytesPerPixel();
+
+      for (unsigned int y = 0; y < image->GetHeight(); y++)
+      {
+        uint8_t* p = reinterpret_cast<uint8_t*>(image->GetRow(y));
+        for (size_t x = 0; x < size; x++)
+        {
+          seed_ = seed_ * 1664525u + 1013904223u;
+          p[x] = static_cast<uint8_t>(seed_ >> 24);
+        }
+      }
+
+      return image.release();
+    }
+
+    void CheckConvert(PixelFormat targetFormat,
+                      PixelFormat sourceFormat)
+    {
+      std::auto_ptr<Image> source(CreateRandomImage(sourceFormat));
+
+      ImageProcessingSimd::SetInstructionSet(ImageProcessingSimd::InstructionSet_Scalar);
+      Image reference(targetFormat, source->GetWidth(), source->GetHeight(), false);
+      ImageProcessing::Convert(reference, *source);
+
+      for (int i = ImageProcessingSimd::InstructionSet_SSE2; i <= ImageProcessingSimd::InstructionSet_AVX2; i++)
+      {
+        ImageProcessingSimd::SetInstructionSet(static_cast<ImageProcessingSimd::InstructionSet>(i));
+        Image target(targetFormat, source->GetWidth(), source->GetHeight(), false);
+        ImageProcessing::Convert(target, *source);
+        ASSERT_TRUE(IsSameImage(reference, target));
+      }
+    }
+
+    void CheckMinMax(PixelFormat format,
+                     float scaling)
+    {
+      std::auto_ptr<Image> source(CreateRandomImage(format));
+
+      ImageProcessingSimd::SetInstructionSet(ImageProcessingSimd::InstructionSet_Scalar);
+      ImageProcessing::MultiplyConstant(*source, scaling, false);
+
+      int64_t a, b;
+      ImageProcessing::GetMinMaxIntegerValue(a, b, *source);
+
+      for (int i = ImageProcessingSimd::InstructionSet_SSE2; i <= ImageProcessingSimd::InstructionSet_AVX2; i++)
+      {
+        ImageProcessingSimd::SetInstructionSet(static_cast<ImageProcessingSimd::InstructionSet>(i));
+
+        int64_t c, d;
+        ImageProcessing::GetMinMaxIntegerValue(c, d, *source);
+        ASSERT_EQ(a, c);
+        ASSERT_EQ(b, d);
+      }
+    }
+
+    void CheckShiftScale(PixelFormat format,
+                         float offset,
+                         float scaling,
+                         bool useRound)
+    {
+      std::auto_ptr<Image> reference(CreateRandomImage(format));
+      std::auto_ptr<Image> source(Image::Clone(*reference));
+
+      ImageProcessingSimd::SetInstructionSet(ImageProcessingSimd::InstructionSet_Scalar);
+      ImageProcessing::ShiftScale(*reference, offset, scaling, useRound);
+
+      for (int i = ImageProcessingSimd::InstructionSet_SSE2; i <= ImageProcessingSimd::InstructionSet_AVX2; i++)
+      {
+        ImageProcessingSimd::SetInstructionSet(static_cast<ImageProcessingSimd::InstructionSet>(i));
+        std::auto_ptr<Image> target(Image::Clone(*source));
+        ImageProcessing::ShiftScale(*target, offset, scaling, useRound);
+        ASSERT_TRUE(IsSameImage(*reference, *target));
+
+        target.reset(Image::Clone(*source));
+        ImageProcessing::MultiplyConstant(*target, scaling, useRound);
+
+        ImageProcessingSimd::SetInstructionSet(ImageProcessingSimd::InstructionSet_Scalar);
+        std::auto_ptr<Image> multiplied(Image::Clone(*source));
+        ImageProcessing::MultiplyConstant(*multiplied, scaling, useRound);
+        ASSERT_TRUE(IsSameImage(*multiplied, *target));
+      }
+    }
+  };
+}
+
+
+TEST(ImageProcessing, SimdKernels)
+{
+  SimdTester tester;
+
+  tester.CheckConvert(PixelFormat_Grayscale16, PixelFormat_Grayscale8);
+  tester.CheckConvert(PixelFormat_SignedGrayscale16, PixelFormat_Grayscale8);
+  tester.CheckConvert(PixelFormat_Grayscale8, PixelFormat_Grayscale16);
+  tester.CheckConvert(PixelFormat_SignedGrayscale16, PixelFormat_Grayscale16);
+  tester.CheckConvert(PixelFormat_Grayscale8, PixelFormat_SignedGrayscale16);
+  tester.CheckConvert(PixelFormat_Grayscale16, PixelFormat_SignedGrayscale16);
+  tester.CheckConvert(PixelFormat_Float32, PixelFormat_Grayscale8);
+  tester.CheckConvert(PixelFormat_Float32, PixelFormat_Grayscale16);
+  tester.CheckConvert(PixelFormat_Float32, PixelFormat_SignedGrayscale16);
+  tester.CheckConvert(PixelFormat_Grayscale8, PixelFormat_RGB24);
+
+  tester.CheckMinMax(PixelFormat_Grayscale8, 1.0f);
+  tester.CheckMinMax(PixelFormat_Grayscale8, 0.3f);
+  tester.CheckMinMax(PixelFormat_Grayscale16, 1.0f);
+  tester.CheckMinMax(PixelFormat_Grayscale16, 0.3f);
+  tester.CheckMinMax(PixelFormat_SignedGrayscale16, 1.0f);
+  tester.CheckMinMax(PixelFormat_SignedGrayscale16, 0.3f);
+
+  const PixelFormat formats[] = {
+    PixelFormat_Grayscale8,
+    PixelFormat_Grayscale16,
+    PixelFormat_SignedGrayscale16
+  };
+
+  for (size_t i = 0; i < sizeof(formats) / sizeof(PixelFormat); i++)
+  {
+    for (int round = 0; round < 2; round++)
+    {
+      tester.CheckShiftScale(formats[i], 0.0f, 0.5f, round == 1);   // Halves
+      tester.CheckShiftScale(formats[i], -100.5f, 1.7f, round == 1);
+      tester.CheckShiftScale(formats[i], 13.0f, -0.37f, round == 1);
+      tester.CheckShiftScale(formats[i], 0.25f, 3.0f, round == 1);
+    }
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    std::auto_ptr<Image> reference(tester.CreateRandomImage(i == 0 ? PixelFormat_Grayscale8 : PixelFormat_RGB24));
+    std::auto_ptr<Image> image(Image::Clone(*reference));
+
+    ImageProcessingSimd::SetInstructionSet(ImageProcessingSimd::GetSupportedInstructionSet());
+    ImageProcessing::Invert(*image);
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(reference->GetConstRow(3));
+    const uint8_t* q = reinterpret_cast<const uint8_t*>(image->GetConstRow(3));
+    for (unsigned int x = 0; x < reference->GetWidth() * reference->GetBytesPerPixel(); x++)
+    {
+      ASSERT_EQ(255 - p[x], q[x]);
+    }
+  }
+}
+
+
+TEST(ImageProcessing, WorkersPool)
+{
+  SimdTester tester;
+
+  std::auto_ptr<Image> source(tester.CreateRandomImage(PixelFormat_SignedGrayscale16));
+  std::auto_ptr<Image> sequential(Image::Clone(*source));
+  std::auto_ptr<Image> parallel(Image::Clone(*source));
+
+  Image target1(PixelFormat_Grayscale8, source->GetWidth(), source->GetHeight(), false);
+  Image target2(PixelFormat_Grayscale8, source->GetWidth(), source->GetHeight(), false);
+
+  TaskPool pool(3);
+
+  for (int i = 0; i < 2; i++)
+  {
+    // Bands are used for all the images, as the threshold is zero
+    ImageProcessing::SetWorkersPool(i == 0 ? NULL : &pool, 0);
+
+    ImageAccessor& image = (i == 0 ? *sequential : *parallel);
+    ImageAccessor& target = (i == 0 ? target1 : target2);
+
+    ImageProcessing::ShiftScale(image, 100.0f, 0.7f, true);
+    ImageProcessing::Convert(target, image);
+    ImageProcessing::Invert(target);
+  }
+
+  ImageProcessing::SetWorkersPool(NULL, 0);
+
+  for (unsigned int y = 0; y < source->GetHeight(); y++)
+  {
+    ASSERT_EQ(0, memcmp(sequential->GetConstRow(y), parallel->GetConstRow(y), 2 * source->GetWidth()));
+    ASSERT_EQ(0, memcmp(target1.GetConstRow(y), target2.GetConstRow(y), source->GetWidth()));
+  }
+
+  int64_t a, b, c, d;
+  ImageProcessing::GetMinMaxIntegerValue(a, b, *source);
+  ImageProcessing::SetWorkersPool(&pool, 0);
+  ImageProcessing::GetMinMaxIntegerValue(c, d, *source);
+  ASSERT_EQ(a, c);
+  ASSERT_EQ(b, d);
+
+  ImageProcessing::Set(*parallel, 42);
+  ImageProcessing::GetMinMaxIntegerValue(c, d, *parallel);
+  ASSERT_EQ(42, c);
+  ASSERT_EQ(42, d);
+
+  // The errors of the bands are reported to the caller
+  Image color(PixelFormat_RGB24, 10, 10, false);
+  ASSERT_THROW(ImageProcessing::ShiftScale(color, 0, 1, false), OrthancException);
+
+  ImageProcessing::SetWorkersPool(NULL, 0);
+}
+
+
+TEST(ImageBufferPool, Basic)
+{
+  const size_t k = ImageBufferPool::MINIMUM_POOLED_SIZE;
+
+  ASSERT_EQ(10u, ImageBufferPool::GetCapacity(10));
+  ASSERT_EQ(k, ImageBufferPool::GetCapacity(k));
+  ASSERT_EQ(k + k / 4, ImageBufferPool::GetCapacity(k + 1));
+  ASSERT_EQ(2 * k, ImageBufferPool::GetCapacity(2 * k - 1));
+  ASSERT_EQ(2 * k, ImageBufferPool::GetCapacity(2 * k));
+  ASSERT_EQ(2 * k + k / 2, ImageBufferPool::GetCapacity(2 * k + 1));
+
+  ImageBufferPool pool(2 * k);
+
+  void* a = pool.Allocate(10);
+  void* b = pool.Allocate(k + 100);
+  void* c = pool.Allocate(k + 200);
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(a) % ImageBufferPool::ALIGNMENT);
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(b) % ImageBufferPool::ALIGNMENT);
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(c) % ImageBufferPool::ALIGNMENT);
+  ASSERT_EQ(0u, pool.GetHits());
+  ASSERT_EQ(2u, pool.GetMisses());  // The small buffers are not counted
+
+  memset(b, 0, k + 100);
+
+  pool.Release(a);
+  pool.Release(b);
+  pool.Release(c);  // Beyond the maximum retained size
+  ASSERT_EQ(1u, pool.GetRetainedCount());
+  ASSERT_EQ(k + k / 4, pool.GetRetainedSize());
+
+  // Same size class
+  void* d = pool.Allocate(k + 1);
+  ASSERT_EQ(b, d);
+  ASSERT_EQ(1u, pool.GetHits());
+  ASSERT_EQ(0u, pool.GetRetainedCount());
+  ASSERT_EQ(0u, pool.GetRetainedSize());
+
+  pool.SetMaximumRetainedSize(4 * k);
+  void* e = pool.Allocate(2 * k + 1);
+  ASSERT_EQ(3u, pool.GetMisses());
+  pool.Release(d);
+  pool.Release(e);
+  ASSERT_EQ(2u, pool.GetRetainedCount());
+  ASSERT_EQ(3 * k + 3 * k / 4, pool.GetRetainedSize());
+
+  // The largest buffers are dropped first
+  pool.SetMaximumRetainedSize(2 * k + k / 2);
+  ASSERT_EQ(1u, pool.GetRetainedCount());
+  ASSERT_EQ(k + k / 4, pool.GetRetainedSize());
+
+  pool.SetMaximumRetainedSize(0);
+  ASSERT_EQ(0u, pool.GetRetainedCount());
+  ASSERT_EQ(0u, pool.GetRetainedSize());
+
+  pool.Release(NULL);
+
+  // The images are allocated through the global pool
+  Image image(PixelFormat_RGB24, 1000, 1000, false);
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(image.GetBuffer()) % ImageBufferPool::ALIGNMENT);
+}
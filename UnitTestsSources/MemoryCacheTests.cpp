@@ -39,9 +39,14 @@
 #include <boost/lexical_cast.hpp>
 
 #include "../Core/Cache/MemoryCache.h"
+#include "../Core/Cache/MemoryStringCache.h"
 #include "../Core/Cache/SharedArchive.h"
+#include "../Core/Cache/SharedObjectCache.h"
 #include "../Core/IDynamicObject.h"
 #include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+#include "../Core/SystemToolbox.h"
+#include "../OrthancServer/RenderedImageCache.h"
 
 
 TEST(LRU, Basic)
@@ -282,3 +287,256 @@ TEST(LRU, SharedArchive)
 
   ASSERT_EQ(2u, count);
 }
+
+
+TEST(MemoryStringCache, Basic)
+{
+  Orthanc::MemoryStringCache c(10);
+  std::string s;
+
+  ASSERT_FALSE(c.Fetch(s, "a"));
+  c.Add("a", "hello");
+  c.Add("b", "world");
+  ASSERT_EQ(10u, c.GetCurrentSize());
+  ASSERT_EQ(2u, c.GetCount());
+
+  ASSERT_TRUE(c.Fetch(s, "a"));   // "a" becomes the most recent
+  ASSERT_EQ("hello", s);
+
+  c.Add("c", "!");                // Recycles "b"
+  ASSERT_EQ(6u, c.GetCurrentSize());
+  ASSERT_FALSE(c.Fetch(s, "b"));
+  ASSERT_TRUE(c.Fetch(s, "c"));
+  ASSERT_EQ("!", s);
+
+  c.Add("d", "too large value");  // Larger than the capacity
+  ASSERT_FALSE(c.Fetch(s, "d"));
+  ASSERT_EQ(6u, c.GetCurrentSize());
+
+  c.Add("a", "hi");               // Replacement
+  ASSERT_EQ(3u, c.GetCurrentSize());
+  ASSERT_TRUE(c.Fetch(s, "a"));
+  ASSERT_EQ("hi", s);
+
+  c.Invalidate("a");
+  c.Invalidate("nope");
+  ASSERT_FALSE(c.Fetch(s, "a"));
+  ASSERT_EQ(1u, c.GetCurrentSize());
+
+  ASSERT_TRUE(c.IsCached("c"));
+  ASSERT_FALSE(c.IsCached("a"));
+  ASSERT_EQ(3u, c.GetHits());
+  ASSERT_EQ(4u, c.GetMisses());
+
+  c.SetMaximumSize(0);
+  ASSERT_EQ(0u, c.GetCount());
+  ASSERT_EQ(0u, c.GetCurrentSize());
+  c.Add("e", "x");
+  ASSERT_FALSE(c.Fetch(s, "e"));
+}
+
+
+namespace
+{
+  class SharedInteger : public Orthanc::IDynamicObject
+  {
+  private:
+    int value_;
+
+  public:
+    SharedInteger(int value) : value_(value)
+    {
+    }
+
+    int GetValue() const
+    {
+      return value_;
+    }
+  };
+
+  typedef Orthanc::SharedObjectCache::Item  SharedItem;
+
+  static int GetSharedValue(const SharedItem& item)
+  {
+    return dynamic_cast<const SharedInteger&>(*item).GetValue();
+  }
+}
+
+
+TEST(SharedObjectCache, Basic)
+{
+  Orthanc::SharedObjectCache c(10, 1);
+  SharedItem item;
+
+  ASSERT_FALSE(c.Fetch(item, "a"));
+  c.Add("a", SharedItem(new SharedInteger(1)), 5);
+  c.Add("b", SharedItem(new SharedInteger(2)), 5);
+  ASSERT_EQ(10u, c.GetCurrentSize());
+  ASSERT_EQ(2u, c.GetCount());
+
+  ASSERT_TRUE(c.Fetch(item, "a"));   // "a" becomes the most recent
+  ASSERT_EQ(1, GetSharedValue(item));
+
+  c.Add("c", SharedItem(new SharedInteger(3)), 1);  // Recycles "b"
+  ASSERT_EQ(6u, c.GetCurrentSize());
+  ASSERT_FALSE(c.Fetch(item, "b"));
+
+  // A concurrent insertion of the same key returns the cached object
+  SharedItem other = c.Add("a", SharedItem(new SharedInteger(4)), 5);
+  ASSERT_EQ(1, GetSharedValue(other));
+  ASSERT_EQ(6u, c.GetCurrentSize());
+
+  // Objects larger than the capacity are not cached
+  SharedItem large = c.Add("d", SharedItem(new SharedInteger(5)), 11);
+  ASSERT_EQ(5, GetSharedValue(large));
+  ASSERT_FALSE(c.Fetch(item, "d"));
+
+  // Invalidated objects remain valid for their current owners
+  ASSERT_TRUE(c.Fetch(item, "a"));
+  c.Invalidate("a");
+  c.Invalidate("nope");
+  ASSERT_FALSE(c.Fetch(other, "a"));
+  ASSERT_EQ(1, GetSharedValue(item));
+  ASSERT_EQ(1u, c.GetCurrentSize());
+
+  ASSERT_EQ(2u, c.GetHits());
+  ASSERT_EQ(4u, c.GetMisses());
+
+  c.SetMaximumSize(0);
+  ASSERT_EQ(0u, c.GetCount());
+  ASSERT_EQ(0u, c.GetCurrentSize());
+}
+
+
+TEST(SharedObjectCache, Shards)
+{
+  Orthanc::SharedObjectCache c(100, 4);
+
+  for (int i = 0; i < 50; i++)
+  {
+    c.Add(boost::lexical_cast<std::string>(i), SharedItem(new SharedInteger(i)), 10);
+    ASSERT_LE(c.GetCurrentSize(), 100u);
+  }
+
+  ASSERT_EQ(100u, c.GetCurrentSize());
+  ASSERT_EQ(10u, c.GetCount());
+
+  c.Clear();
+  ASSERT_EQ(0u, c.GetCount());
+  ASSERT_EQ(0u, c.GetCurrentSize());
+}
+
+
+TEST(RenderedImageCache, Tiers)
+{
+  using namespace Orthanc;
+
+  const std::string dicom1 = "01234567-89ab-cdef-0123-456789abcdef";
+  const std::string dicom2 = "fedcba98-7654-3210-fedc-ba9876543210";
+  ASSERT_THROW(RenderedImageCache::ComputeKey("nope", "0"), OrthancException);
+
+  const std::string key1 = RenderedImageCache::ComputeKey(dicom1, "0|png");
+  const std::string key2 = RenderedImageCache::ComputeKey(dicom1, "1|png");
+  const std::string key3 = RenderedImageCache::ComputeKey(dicom2, "0|png");
+  ASSERT_EQ(key1, RenderedImageCache::ComputeKey(dicom1, "0|png"));
+  ASSERT_NE(RenderedImageCache::ComputeETag(key1), RenderedImageCache::ComputeETag(key3));
+  ASSERT_EQ('"', RenderedImageCache::ComputeETag(key1)[0]);
+
+  const std::string directory = "UnitTestsResults/RenderingsCache";
+  boost::filesystem::remove_all(directory);
+
+  std::string content;
+  MimeType mime;
+
+  {
+    RenderedImageCache cache(10);
+    cache.SetDiskTier(directory, 1024);
+
+    const uint64_t generation = cache.GetGeneration();
+    ASSERT_FALSE(cache.Fetch(content, mime, key1));
+    cache.Add(key1, "hello", MimeType_Png, generation);
+    cache.Add(key2, "world", MimeType_Jpeg, generation);
+    cache.Add(key3, "!!", MimeType_Pam, generation);  // Recycles "key1" from memory
+
+    ASSERT_TRUE(cache.Fetch(content, mime, key1));  // Read from the disk
+    ASSERT_EQ("hello", content);
+    ASSERT_EQ(MimeType_Png, mime);
+
+    // Removing the DICOM file discards all its renderings
+    cache.Invalidate(dicom1);
+    ASSERT_FALSE(cache.Fetch(content, mime, key1));
+    ASSERT_FALSE(cache.Fetch(content, mime, key2));
+    ASSERT_TRUE(cache.Fetch(content, mime, key3));
+  }
+
+  {
+    // The on-disk tier survives restarts
+    RenderedImageCache cache(0);
+    cache.SetDiskTier(directory, 1024);
+
+    ASSERT_FALSE(cache.Fetch(content, mime, key1));
+    ASSERT_TRUE(cache.Fetch(content, mime, key3));
+    ASSERT_EQ("!!", content);
+    ASSERT_EQ(MimeType_Pam, mime);
+
+    Json::Value statistics;
+    cache.ComputeStatistics(statistics);
+    ASSERT_EQ(0u, statistics["RenderingsCacheCount"].asUInt());
+    ASSERT_EQ(1u, statistics["RenderingsCacheDiskCount"].asUInt());
+    ASSERT_EQ("1", statistics["RenderingsCacheHits"].asString());
+  }
+
+  {
+    // The renderings of another version are discarded from the disk
+    SystemToolbox::WriteFile(std::string("0.0.0"), directory + "/version");
+
+    RenderedImageCache cache(0);
+    cache.SetDiskTier(directory, 1024);
+    ASSERT_FALSE(cache.Fetch(content, mime, key3));
+
+    Json::Value statistics;
+    cache.ComputeStatistics(statistics);
+    ASSERT_EQ(0u, statistics["RenderingsCacheDiskCount"].asUInt());
+  }
+}
+
+
+TEST(RenderedImageCache, Invalidation)
+{
+  using namespace Orthanc;
+
+  const std::string dicom1 = "01234567-89ab-cdef-0123-456789abcdef";
+  const std::string dicom2 = "fedcba98-7654-3210-fedc-ba9876543210";
+  const std::string key1 = RenderedImageCache::ComputeKey(dicom1, "0|png");
+  const std::string key2 = RenderedImageCache::ComputeKey(dicom2, "0|png");
+
+  std::string content;
+  MimeType mime;
+
+  RenderedImageCache cache(10);
+
+  // The DICOM file is removed while its rendering is computed
+  uint64_t generation = cache.GetGeneration();
+  cache.Invalidate(dicom1);
+  cache.Add(key1, "hello", MimeType_Png, generation);
+  cache.Add(key2, "world", MimeType_Png, generation);
+  ASSERT_FALSE(cache.Fetch(content, mime, key1));
+  ASSERT_TRUE(cache.Fetch(content, mime, key2));
+
+  // Renderings started after the invalidation are cached
+  generation = cache.GetGeneration();
+  cache.Add(key1, "hello", MimeType_Png, generation);
+  ASSERT_TRUE(cache.Fetch(content, mime, key1));
+
+  // Once the history of the invalidations is exceeded, the
+  // renderings that were started before are conservatively dropped
+  generation = cache.GetGeneration();
+  for (unsigned int i = 0; i < 2000; i++)
+  {
+    cache.Invalidate(dicom1);
+  }
+
+  const std::string key3 = RenderedImageCache::ComputeKey("00000000-0000-0000-0000-000000000000", "0|png");
+  cache.Add(key3, "!!", MimeType_Png, generation);
+  ASSERT_FALSE(cache.Fetch(content, mime, key3));
+}
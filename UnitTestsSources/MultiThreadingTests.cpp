@@ -38,6 +38,7 @@
 #include "../Core/JobsEngine/JobsEngine.h"
 #include "../Core/Logging.h"
 #include "../Core/MultiThreading/SharedMessageQueue.h"
+#include "../Core/MultiThreading/TaskPool.h"
 #include "../Core/OrthancException.h"
 #include "../Core/SerializationToolbox.h"
 #include "../Core/SystemToolbox.h"
@@ -294,6 +295,125 @@ TEST(MultiThreading, SharedMessageQueueClean)
 
 
 
+namespace
+{
+  class IncrementTask : public TaskPool::ITask
+  {
+  private:
+    boost::mutex&  mutex_;
+    unsigned int&  counter_;
+    bool           fail_;
+
+  public:
+    IncrementTask(boost::mutex& mutex,
+                  unsigned int& counter,
+                  bool fail) :
+      mutex_(mutex),
+      counter_(counter),
+      fail_(fail)
+    {
+    }
+
+    virtual void Execute()
+    {
+      if (fail_)
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+      counter_++;
+    }
+  };
+
+
+  class NestedBatchTask : public TaskPool::ITask
+  {
+  private:
+    TaskPool&      pool_;
+    boost::mutex&  mutex_;
+    unsigned int&  counter_;
+
+  public:
+    NestedBatchTask(TaskPool& pool,
+                    boost::mutex& mutex,
+                    unsigned int& counter) :
+      pool_(pool),
+      mutex_(mutex),
+      counter_(counter)
+    {
+    }
+
+    virtual void Execute()
+    {
+      TaskPool::Batch batch(pool_);
+      for (unsigned int i = 0; i < 10; i++)
+      {
+        batch.Submit(new IncrementTask(mutex_, counter_, false));
+      }
+
+      batch.Join();
+    }
+  };
+}
+
+
+TEST(MultiThreading, TaskPool)
+{
+  for (size_t threads = 0; threads < 4; threads++)
+  {
+    TaskPool pool(threads);
+    ASSERT_EQ(threads, pool.GetThreadsCount());
+
+    boost::mutex mutex;
+    unsigned int counter = 0;
+
+    {
+      TaskPool::Batch batch(pool);
+      for (unsigned int i = 0; i < 100; i++)
+      {
+        batch.Submit(new IncrementTask(mutex, counter, false));
+      }
+
+      batch.Join();
+      ASSERT_EQ(100u, counter);
+    }
+
+    {
+      TaskPool::Batch batch(pool);
+      batch.Submit(new IncrementTask(mutex, counter, false));
+      batch.Submit(new IncrementTask(mutex, counter, true));
+      batch.Submit(new IncrementTask(mutex, counter, false));
+
+      try
+      {
+        batch.Join();
+        ASSERT_TRUE(false);
+      }
+      catch (OrthancException& e)
+      {
+        ASSERT_EQ(ErrorCode_CorruptedFile, e.GetErrorCode());
+      }
+
+      ASSERT_EQ(102u, counter);
+    }
+
+    {
+      // Batches submitted from the tasks of the pool must not deadlock
+      TaskPool::Batch batch(pool);
+      for (unsigned int i = 0; i < 10; i++)
+      {
+        batch.Submit(new NestedBatchTask(pool, mutex, counter));
+      }
+
+      batch.Join();
+      ASSERT_EQ(202u, counter);
+    }
+  }
+}
+
+
+
 
 static bool CheckState(JobsRegistry& registry,
                        const std::string& id,
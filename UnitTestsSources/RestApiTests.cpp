@@ -47,6 +47,8 @@
 #include "../Core/Compression/ZlibCompressor.h"
 #include "../Core/RestApi/RestApiHierarchy.h"
 #include "../Core/HttpServer/HttpContentNegociation.h"
+#include "../Core/HttpServer/StringHttpOutput.h"
+#include "../OrthancServer/FramesRangeExtractor.h"
 
 using namespace Orthanc;
 
@@ -643,3 +645,167 @@ TEST(WebServiceParameters, UserProperties)
     ASSERT_FALSE(p.LookupUserProperty(s, "hello"));
   }
 }
+
+
+TEST(FramesRangeExtractor, ParseRange)
+{
+  unsigned int first, count;
+
+  FramesRangeExtractor::ParseRange(first, count, "0", "0");
+  ASSERT_EQ(0u, first);
+  ASSERT_EQ(0u, count);
+
+  FramesRangeExtractor::ParseRange(first, count, "3", "2");
+  ASSERT_EQ(3u, first);
+  ASSERT_EQ(2u, count);
+
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "", "0"), OrthancException);
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "0", ""), OrthancException);
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "-1", "0"), OrthancException);
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "0", "-2"), OrthancException);
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "abc", "0"), OrthancException);
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "1.5", "0"), OrthancException);
+  ASSERT_THROW(FramesRangeExtractor::ParseRange(first, count, "0", "99999999999"), OrthancException);
+}
+
+
+TEST(FramesRangeExtractor, ClampRange)
+{
+  unsigned int count = 0;
+  ASSERT_TRUE(FramesRangeExtractor::ClampRange(count, 0, 10));
+  ASSERT_EQ(10u, count);
+
+  count = 3;
+  ASSERT_TRUE(FramesRangeExtractor::ClampRange(count, 2, 10));
+  ASSERT_EQ(3u, count);
+
+  count = 20;
+  ASSERT_TRUE(FramesRangeExtractor::ClampRange(count, 8, 10));
+  ASSERT_EQ(2u, count);
+
+  count = 0xffffffffu;
+  ASSERT_TRUE(FramesRangeExtractor::ClampRange(count, 9, 10));
+  ASSERT_EQ(1u, count);
+
+  count = 1;
+  ASSERT_FALSE(FramesRangeExtractor::ClampRange(count, 10, 10));
+  ASSERT_FALSE(FramesRangeExtractor::ClampRange(count, 0xffffffffu, 10));
+  ASSERT_FALSE(FramesRangeExtractor::ClampRange(count, 0, 0));
+}
+
+
+namespace
+{
+  class FakeFrameSource : public FramesRangeExtractor::IFrameSource
+  {
+  private:
+    boost::mutex            mutex_;
+    std::set<unsigned int>  busySlots_;
+    bool                    sharedSlot_;
+
+  public:
+    FakeFrameSource() : sharedSlot_(false)
+    {
+    }
+
+    bool HasSharedSlot()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return sharedSlot_;
+    }
+
+    virtual void ExtractFrame(std::string& target,
+                              MimeType& mime,
+                              unsigned int slot,
+                              unsigned int frame)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (!busySlots_.insert(slot).second)
+        {
+          sharedSlot_ = true;
+        }
+      }
+
+      // The frames of each chunk complete in reverse order
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2 * (10 - frame % 10)));
+
+      target = "frame" + boost::lexical_cast<std::string>(frame);
+      mime = MimeType_Jpeg;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        busySlots_.erase(slot);
+      }
+    }
+  };
+}
+
+
+static void AnswerFakeFrames(std::string& target,
+                             FramesRangeExtractor& extractor,
+                             FramesRangeExtractor::IFrameSource& source,
+                             unsigned int first,
+                             unsigned int count,
+                             bool multipart)
+{
+  StringHttpOutput stream;
+
+  {
+    HttpOutput http(stream, false /* no keep-alive */);
+    RestApiOutput output(http, HttpMethod_Get);
+    extractor.Answer(output, source, first, count, multipart);
+  }
+
+  stream.GetOutput(target);
+}
+
+
+TEST(FramesRangeExtractor, Answer)
+{
+  for (unsigned int threads = 0; threads <= 3; threads += 3)
+  {
+    TaskPool pool(threads);
+    FramesRangeExtractor extractor(pool);
+    ASSERT_EQ(threads + 1, extractor.GetChunkSize());
+
+    FakeFrameSource source;
+
+    std::string s;
+    AnswerFakeFrames(s, extractor, source, 2, 7, false);
+    ASSERT_EQ("frame2frame3frame4frame5frame6frame7frame8", s);
+
+    AnswerFakeFrames(s, extractor, source, 2, 7, true);
+
+    // One part per frame, each with the MIME type of the frames
+    size_t parts = 0;
+    for (size_t pos = s.find("Content-Type: image/jpeg"); pos != std::string::npos;
+         pos = s.find("Content-Type: image/jpeg", pos + 1))
+    {
+      parts++;
+    }
+
+    ASSERT_EQ(7u, parts);
+    ASSERT_EQ(std::string::npos, s.find("frame1"));
+    ASSERT_EQ(std::string::npos, s.find("frame9"));
+
+    size_t previous = 0;
+    for (unsigned int frame = 2; frame <= 8; frame++)
+    {
+      // The parts are sent in increasing order of frames
+      size_t pos = s.find("frame" + boost::lexical_cast<std::string>(frame));
+      ASSERT_NE(std::string::npos, pos);
+      ASSERT_LT(previous, pos);
+      previous = pos;
+    }
+
+    ASSERT_FALSE(source.HasSharedSlot());
+
+    ASSERT_THROW(AnswerFakeFrames(s, extractor, source, 0, 0, true), OrthancException);
+
+    // "frame9" and "frame10" have different sizes: They cannot be
+    // split by the client if they are concatenated
+    ASSERT_THROW(AnswerFakeFrames(s, extractor, source, 8, 3, false), OrthancException);
+    AnswerFakeFrames(s, extractor, source, 8, 3, true);
+  }
+}
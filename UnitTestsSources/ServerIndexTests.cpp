@@ -41,6 +41,9 @@
 #include "../OrthancServer/ServerContext.h"
 #include "../OrthancServer/ServerIndex.h"
 #include "../OrthancServer/Search/LookupIdentifierQuery.h"
+#include "../OrthancServer/SeriesPrefetcher.h"
+#include "../OrthancServer/ServerJobs/StorageConsistencyJob.h"
+#include "../OrthancServer/ServerJobs/StorageIntegrityJob.h"
 
 #include <ctype.h>
 #include <algorithm>
@@ -369,6 +372,23 @@ TEST_P(DatabaseWrapperTest, Simple)
                                        CompressionType_ZlibWithSize, 21, "compressedMD5"));
   index_->AddAttachment(a[4], FileInfo("my dicom file", FileContentType_Dicom, 42, "md5"));
   index_->AddAttachment(a[6], FileInfo("world", FileContentType_Dicom, 44, "md5"));
+
+  {
+    std::list<IDatabaseWrapper::AttachmentOwner> attachments;
+    index_->ListAttachments(attachments, "", 2);
+    ASSERT_EQ(2u, attachments.size());
+    ASSERT_EQ(a[4], attachments.front().first);
+    ASSERT_EQ("my dicom file", attachments.front().second.GetUuid());
+    ASSERT_EQ("my json file", attachments.back().second.GetUuid());
+    ASSERT_EQ(CompressionType_ZlibWithSize, attachments.back().second.GetCompressionType());
+    ASSERT_EQ("compressedMD5", attachments.back().second.GetCompressedMD5());
+
+    index_->ListAttachments(attachments, "my json file", 2);
+    ASSERT_EQ(1u, attachments.size());
+    ASSERT_EQ(a[6], attachments.front().first);
+    ASSERT_EQ("world", attachments.front().second.GetUuid());
+  }
+
   index_->SetMetadata(a[4], MetadataType_Instance_RemoteAet, "PINNACLE");
   
   index_->ListAvailableMetadata(md, a[4]);
@@ -984,3 +1004,525 @@ TEST(ServerIndex, Overwrite)
 }
 
 
+
+
+TEST(ServerIndex, Deduplication)
+{
+  MemoryStorageArea storage;
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */);
+  context.SetupJobsEngine(true, false);
+  context.GetIndex().SetStorageDeduplication(true);
+  context.GetIndex().SetOverwriteInstances(true);
+
+  DicomMap instance;
+  instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+  instance.SetValue(DICOM_TAG_PATIENT_NAME, "name", false);
+  instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+  instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+  instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "sop", false);
+  instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+
+  DicomInstanceHasher hasher(instance);
+  std::string id = hasher.HashInstance();
+
+  FileInfo dicom[2];
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    toStore.SetOrigin(DicomInstanceOrigin::FromPlugins());
+
+    std::string id2;
+    ASSERT_EQ(StoreStatus_Success, context.Store(id2, toStore));
+    ASSERT_EQ(id, id2);
+    ASSERT_TRUE(context.GetIndex().LookupAttachment(dicom[i], id, FileContentType_Dicom));
+  }
+
+  // Overwriting with the same content reuses the stored file
+  ASSERT_EQ(dicom[0].GetUuid(), dicom[1].GetUuid());
+  ASSERT_EQ(dicom[0].GetCompressedMD5(), dicom[1].GetCompressedMD5());
+
+  std::string content;
+  storage.Read(content, dicom[1].GetUuid(), FileContentType_Dicom);
+
+  // Removing the last reference removes the file
+  Json::Value tmp;
+  ASSERT_TRUE(context.DeleteResource(tmp, id, ResourceType_Instance));
+  ASSERT_THROW(storage.Read(content, dicom[1].GetUuid(), FileContentType_Dicom), OrthancException);
+
+  // Two instances sharing the content of an attachment
+  std::string ids[2];
+  FileInfo shared[2];
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "sop" + boost::lexical_cast<std::string>(i), false);
+
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    toStore.SetOrigin(DicomInstanceOrigin::FromPlugins());
+    ASSERT_EQ(StoreStatus_Success, context.Store(ids[i], toStore));
+
+    ASSERT_TRUE(context.AddAttachment(ids[i], FileContentType_StartUser, "hello", 5));
+    ASSERT_TRUE(context.GetIndex().LookupAttachment(shared[i], ids[i], FileContentType_StartUser));
+  }
+
+  ASSERT_EQ(shared[0].GetUuid(), shared[1].GetUuid());
+
+  // Disabling the deduplication (e.g. after a restart) must not
+  // remove the content that is still referenced by the other instance
+  context.GetIndex().SetStorageDeduplication(false);
+
+  ASSERT_TRUE(context.DeleteResource(tmp, ids[0], ResourceType_Instance));
+  storage.Read(content, shared[1].GetUuid(), FileContentType_StartUser);
+  ASSERT_EQ("hello", content);
+
+  ASSERT_TRUE(context.DeleteResource(tmp, ids[1], ResourceType_Instance));
+  ASSERT_THROW(storage.Read(content, shared[1].GetUuid(), FileContentType_StartUser), OrthancException);
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, DicomAsJsonGeneration)
+{
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    bool deferred = (i == 0);
+
+    MemoryStorageArea storage;
+    DatabaseWrapper db;   // The SQLite DB is in memory
+    db.Open();
+    ServerContext context(db, storage, true /* running unit tests */);
+    context.SetupJobsEngine(true, false);
+    context.SetDicomAsJsonGeneration(deferred ? DicomAsJsonGeneration_Deferred :
+                                     DicomAsJsonGeneration_OnDemand);
+
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_PATIENT_NAME, "name", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "sop", false);
+    instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+
+    std::string id;
+
+    {
+      DicomInstanceToStore toStore;
+      toStore.SetSummary(instance);
+      toStore.SetOrigin(DicomInstanceOrigin::FromPlugins());
+      ASSERT_EQ(StoreStatus_Success, context.Store(id, toStore));
+    }
+
+    FileInfo json;
+    Json::Value tmp;
+
+    if (deferred)
+    {
+      // Wait for the background worker to generate the summary
+      for (unsigned int j = 0; j < 100; j++)
+      {
+        context.ComputeDicomAsJsonStatistics(tmp);
+        if (tmp["DicomAsJsonBacklog"].asInt() == 0)
+        {
+          break;
+        }
+
+        boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+      }
+
+      ASSERT_EQ(0, tmp["DicomAsJsonBacklog"].asInt());
+      ASSERT_EQ(1, tmp["DicomAsJsonGenerated"].asInt());
+      ASSERT_EQ(0, tmp["DicomAsJsonFailures"].asInt());
+      ASSERT_TRUE(context.GetIndex().LookupAttachment(json, id, FileContentType_DicomAsJson));
+    }
+    else
+    {
+      ASSERT_FALSE(context.GetIndex().LookupAttachment(json, id, FileContentType_DicomAsJson));
+
+      context.ReadDicomAsJson(tmp, id);
+      ASSERT_EQ("name", tmp["0010,0010"]["Value"].asString());
+      ASSERT_TRUE(context.GetIndex().LookupAttachment(json, id, FileContentType_DicomAsJson));
+    }
+
+    context.Stop();
+    db.Close();
+  }
+}
+
+
+TEST(ServerIndex, StorageIntegrity)
+{
+  MemoryStorageArea storage;
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */);
+  context.SetupJobsEngine(true, false);
+
+  DicomMap instance;
+  instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+  instance.SetValue(DICOM_TAG_PATIENT_NAME, "name", false);
+  instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+  instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+  instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "sop", false);
+  instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+
+  std::string id;
+
+  {
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    toStore.SetOrigin(DicomInstanceOrigin::FromPlugins());
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, toStore));
+  }
+
+  FileInfo dicom;
+  ASSERT_TRUE(context.GetIndex().LookupAttachment(dicom, id, FileContentType_Dicom));
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    if (i == 1)
+    {
+      // Corrupt the DICOM file
+      std::string content;
+      storage.Read(content, dicom.GetUuid(), FileContentType_Dicom);
+      ASSERT_FALSE(content.empty());
+      content[content.size() / 2] ^= 0xff;
+      storage.Remove(dicom.GetUuid(), FileContentType_Dicom);
+      storage.Create(dicom.GetUuid(), content.c_str(), content.size(), FileContentType_Dicom);
+    }
+
+    StorageIntegrityJob job(context, 0 /* no throttling */);
+
+    unsigned int count = 0;
+    while (job.Step().GetCode() == JobStepCode_Continue)
+    {
+      ASSERT_LT(count++, 10u);
+    }
+
+    ASSERT_FLOAT_EQ(1.0f, job.GetProgress());
+
+    Json::Value content = Json::objectValue;
+    job.GetPublicContent(content);
+    ASSERT_EQ(2u, content["CheckedCount"].asUInt());  // DICOM file and JSON summary
+    ASSERT_EQ(i, content["CorruptedCount"].asUInt());
+
+    // The job can be resumed after a restart
+    Json::Value serialized;
+    ASSERT_TRUE(job.Serialize(serialized));
+    StorageIntegrityJob resumed(context, serialized);
+    ASSERT_EQ(JobStepCode_Success, resumed.Step().GetCode());
+  }
+
+  Json::Value changes;
+  context.GetIndex().GetLastChange(changes);
+  ASSERT_EQ(1u, changes["Changes"].size());
+  ASSERT_EQ("CorruptedAttachment", changes["Changes"][0]["ChangeType"].asString());
+  ASSERT_EQ(id, changes["Changes"][0]["ID"].asString());
+
+  {
+    // Throttled job: Each step reads at most 10 bytes, so that the
+    // attachments are verified over several steps. Pausing the job
+    // restarts the verification of the current attachment.
+    StorageIntegrityJob job(context, 100 /* bytes per second */);
+
+    unsigned int steps = 0;
+    for (;;)
+    {
+      JobStepCode code = job.Step().GetCode();
+      steps++;
+
+      if (code == JobStepCode_Success)
+      {
+        break;
+      }
+
+      ASSERT_TRUE(code == JobStepCode_Retry ||
+                  code == JobStepCode_Continue);
+      job.Stop(steps == 5 ? JobStopReason_Paused : JobStopReason_Retry);
+    }
+
+    ASSERT_GT(steps, dicom.GetCompressedSize() / 10);
+
+    Json::Value content = Json::objectValue;
+    job.GetPublicContent(content);
+    ASSERT_EQ(2u, content["CheckedCount"].asUInt());
+    ASSERT_EQ(1u, content["CorruptedCount"].asUInt());
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, StorageConsistencyPendingWrites)
+{
+  const std::string path = "UnitTestsStorage";
+
+  SystemToolbox::RemoveFile(path + "/index");
+  FilesystemStorage storage(path);
+  storage.Clear();
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */);
+  context.SetupJobsEngine(true, false);
+
+  ServerIndex& index = context.GetIndex();
+
+  const std::string content = "Hello";
+  const time_t past = time(NULL) - 3600;
+
+  // Orphan file, that is left over by a previous execution
+  const std::string orphan = Toolbox::GenerateUuid();
+  storage.Create(orphan, content.c_str(), content.size(), FileContentType_Dicom);
+  storage.SetLastWriteTime(orphan, past);
+
+  // File that has been written before the start of the job, but
+  // that is not indexed yet
+  const std::string pending = Toolbox::GenerateUuid();
+  index.AddPendingAttachment(pending);
+  storage.Create(pending, content.c_str(), content.size(), FileContentType_Dicom);
+  storage.SetLastWriteTime(pending, past);
+
+  StorageConsistencyJob job(context, 1, true /* remove orphans */);
+  job.SetOrphansGracePeriod(0);
+
+  // File that is written while the job is running, and that is not
+  // registered as pending
+  const std::string recent = Toolbox::GenerateUuid();
+  storage.Create(recent, content.c_str(), content.size(), FileContentType_Dicom);
+
+  unsigned int count = 0;
+  while (job.Step().GetCode() == JobStepCode_Continue)
+  {
+    ASSERT_LT(count++, 2u * StorageScanner::PREFIXES_COUNT);
+  }
+
+  Json::Value status = Json::objectValue;
+  job.GetPublicContent(status);
+  ASSERT_EQ(3u, status["ScannedFiles"].asUInt());
+  ASSERT_EQ(2u, status["OrphansCount"].asUInt());
+  ASSERT_EQ(1u, status["RemovedOrphansCount"].asUInt());
+  ASSERT_EQ(1u, status["RecentCount"].asUInt());
+  ASSERT_EQ(0u, status["MissingCount"].asUInt());
+
+  ASSERT_FALSE(storage.Exists(orphan));
+  ASSERT_TRUE(storage.Exists(pending));
+  ASSERT_TRUE(storage.Exists(recent));
+
+  // Once the write is over, the file is not protected anymore
+  index.RemovePendingAttachment(pending);
+  ASSERT_TRUE(index.RemoveOrphanAttachment(pending));
+  ASSERT_FALSE(storage.Exists(pending));
+
+  storage.Clear();
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, SeriesPrefetcher)
+{
+  MemoryStorageArea storage;
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */);
+  context.SetupJobsEngine(true, false);
+
+  // Series of 7 instances, that are received in another order than
+  // the one given by their "InstanceNumber"
+  static const unsigned int COUNT = 7;
+  static const unsigned int received[COUNT] = { 3, 0, 6, 1, 5, 2, 4 };
+
+  std::string ids[COUNT];
+  FileInfo dicom[COUNT];
+
+  for (unsigned int i = 0; i < COUNT; i++)
+  {
+    const unsigned int k = received[i];
+
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_PATIENT_NAME, "name", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "sop" + boost::lexical_cast<std::string>(k), false);
+    instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+    instance.SetValue(DICOM_TAG_INSTANCE_NUMBER, boost::lexical_cast<std::string>(k + 1), false);
+
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    toStore.SetOrigin(DicomInstanceOrigin::FromPlugins());
+    ASSERT_EQ(StoreStatus_Success, context.Store(ids[k], toStore));
+    ASSERT_TRUE(context.GetIndex().LookupAttachment(dicom[k], ids[k], FileContentType_Dicom));
+  }
+
+  // Accessing the 4th instance prefetches, nearest first, the 5th,
+  // 3rd, 6th and 2nd instances. The budget is one byte too small to
+  // include the 2nd instance.
+  const uint64_t expectedSize = (dicom[4].GetCompressedSize() +
+                                 dicom[2].GetCompressedSize() +
+                                 dicom[5].GetCompressedSize());
+
+  {
+    SeriesPrefetcher prefetcher(context);
+    prefetcher.SetWindow(2);
+    prefetcher.SetBudget(expectedSize + dicom[1].GetCompressedSize() - 1);
+    prefetcher.Start();
+    prefetcher.SignalAccess(ids[3]);
+
+    // Wait for the background thread to read the neighbors
+    Json::Value tmp;
+    for (unsigned int j = 0; j < 100; j++)
+    {
+      prefetcher.ComputeStatistics(tmp);
+      if (tmp["SeriesPrefetchedCount"].asString() != "0")
+      {
+        break;
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    }
+
+    prefetcher.Stop();
+
+    ASSERT_EQ("3", tmp["SeriesPrefetchedCount"].asString());
+    ASSERT_EQ(boost::lexical_cast<std::string>(expectedSize), tmp["SeriesPrefetchedSize"].asString());
+  }
+
+  // The attachments that are already cached are not read again
+  std::vector<std::string> neighbors;
+  neighbors.push_back(ids[4]);
+  neighbors.push_back(ids[2]);
+
+  unsigned int count;
+  ASSERT_EQ(0u, context.PrefetchAttachments(count, neighbors, FileContentType_Dicom, expectedSize));
+  ASSERT_EQ(0u, count);
+
+  // Once the files are removed from the storage area, only the
+  // prefetched attachments can still be read, from the cache
+  for (unsigned int k = 0; k < COUNT; k++)
+  {
+    std::string content;
+    storage.Read(content, dicom[k].GetUuid(), FileContentType_Dicom);
+    storage.Remove(dicom[k].GetUuid(), FileContentType_Dicom);
+  }
+
+  for (unsigned int k = 0; k < COUNT; k++)
+  {
+    std::string content;
+    if (k == 2 || k == 4 || k == 5)
+    {
+      context.ReadAttachment(content, dicom[k]);
+      ASSERT_EQ(dicom[k].GetUncompressedSize(), content.size());
+    }
+    else
+    {
+      ASSERT_THROW(context.ReadAttachment(content, dicom[k]), OrthancException);
+    }
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+namespace
+{
+  // Storage area whose writes of one content type always fail, and
+  // that records the UUIDs of all the attempted writes
+  class FailingStorageArea : public MemoryStorageArea
+  {
+  private:
+    FileContentType        failing_;
+    boost::mutex           mutex_;
+    std::set<std::string>  created_;
+
+  public:
+    explicit FailingStorageArea(FileContentType failing) :
+      failing_(failing)
+    {
+    }
+
+    virtual void Create(const std::string& uuid,
+                        const void* content,
+                        size_t size,
+                        FileContentType type)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        created_.insert(uuid);
+      }
+
+      if (type == failing_)
+      {
+        throw OrthancException(ErrorCode_FileStorageCannotWrite);
+      }
+
+      MemoryStorageArea::Create(uuid, content, size, type);
+    }
+
+    const std::set<std::string>& GetCreated() const
+    {
+      return created_;
+    }
+  };
+}
+
+
+TEST(ServerIndex, StoreRollback)
+{
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    const bool deduplication = (i >= 2);
+    const FileContentType failing = (i % 2 == 0 ? FileContentType_DicomAsJson : FileContentType_Dicom);
+
+    FailingStorageArea storage(failing);
+    DatabaseWrapper db;   // The SQLite DB is in memory
+    db.Open();
+    ServerContext context(db, storage, true /* running unit tests */);
+    context.SetupJobsEngine(true, false);
+    context.GetIndex().SetStorageDeduplication(deduplication);
+
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_PATIENT_NAME, "name", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "sop", false);
+    instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    toStore.SetOrigin(DicomInstanceOrigin::FromPlugins());
+
+    std::string id;
+    ASSERT_THROW(context.Store(id, toStore), OrthancException);
+
+    std::list<std::string> instances;
+    context.GetIndex().GetAllUuids(instances, ResourceType_Instance);
+    ASSERT_TRUE(instances.empty());
+
+    // The DICOM file and its JSON summary are written in parallel:
+    // The one that has been written before the other one failed must
+    // have been removed, and none of their UUIDs is still pending
+    ASSERT_EQ(2u, storage.GetCreated().size());
+
+    for (std::set<std::string>::const_iterator
+           it = storage.GetCreated().begin(); it != storage.GetCreated().end(); ++it)
+    {
+      std::string content;
+      ASSERT_THROW(storage.Read(content, *it, FileContentType_Unknown), OrthancException);
+      ASSERT_TRUE(context.GetIndex().RemoveOrphanAttachment(*it));
+    }
+
+    context.Stop();
+    db.Close();
+  }
+}
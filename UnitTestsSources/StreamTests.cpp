@@ -42,6 +42,15 @@
 #include "../Core/HttpServer/HttpStreamTranscoder.h"
 #include "../Core/Compression/ZlibCompressor.h"
 #include "../Core/Compression/GzipCompressor.h"
+#include "../Core/Compression/BufferCompressorFactory.h"
+
+#if ORTHANC_ENABLE_LZ4 == 1
+#  include "../Core/Compression/Lz4Compressor.h"
+#endif
+
+#if ORTHANC_ENABLE_ZSTD == 1
+#  include "../Core/Compression/ZstdCompressor.h"
+#endif
 
 
 using namespace Orthanc;
@@ -178,6 +187,85 @@ TEST(Zlib, Empty)
 }
 
 
+TEST(BufferCompressorFactory, Basic)
+{
+  std::string s = Toolbox::GenerateUuid();
+  s = s + s + s + s;
+
+  for (int i = CompressionType_ZlibWithSize; i <= CompressionType_ZstdWithSize; i++)
+  {
+    CompressionType type = static_cast<CompressionType>(i);
+    if (!BufferCompressorFactory::IsSupported(type))
+    {
+      ASSERT_THROW(BufferCompressorFactory::Create(type, 0), OrthancException);
+      continue;
+    }
+
+    std::auto_ptr<IBufferCompressor> c(BufferCompressorFactory::Create(type, 0));
+
+    std::string compressed, uncompressed;
+    IBufferCompressor::Compress(compressed, *c, s);
+    ASSERT_LT(compressed.size(), s.size());
+
+    IBufferCompressor::Uncompress(uncompressed, *c, compressed);
+    ASSERT_EQ(s, uncompressed);
+
+    IBufferCompressor::Compress(compressed, *c, "");
+    ASSERT_TRUE(compressed.empty());
+    IBufferCompressor::Uncompress(uncompressed, *c, compressed);
+    ASSERT_TRUE(uncompressed.empty());
+  }
+
+  ASSERT_TRUE(BufferCompressorFactory::IsSupported(CompressionType_None));
+  ASSERT_THROW(BufferCompressorFactory::Create(CompressionType_None, 0), OrthancException);
+  ASSERT_THROW(BufferCompressorFactory::Create(CompressionType_ZlibWithSize, 10), OrthancException);
+}
+
+
+#if ORTHANC_ENABLE_LZ4 == 1
+TEST(Lz4, Level)
+{
+  std::string s = Toolbox::GenerateUuid();
+  s = s + s + s + s;
+
+  Lz4Compressor c;
+  ASSERT_THROW(c.SetCompressionLevel(13), OrthancException);
+  c.SetCompressionLevel(9);
+
+  std::string compressed, uncompressed;
+  IBufferCompressor::Compress(compressed, c, s);
+  IBufferCompressor::Uncompress(uncompressed, c, compressed);
+  ASSERT_EQ(s, uncompressed);
+
+  ASSERT_FALSE(compressed.empty());
+  compressed.resize(compressed.size() - 1);
+  ASSERT_THROW(IBufferCompressor::Uncompress(uncompressed, c, compressed), OrthancException);
+}
+#endif
+
+
+#if ORTHANC_ENABLE_ZSTD == 1
+TEST(Zstd, Level)
+{
+  std::string s = Toolbox::GenerateUuid();
+  s = s + s + s + s;
+
+  ZstdCompressor c;
+  ASSERT_THROW(c.SetCompressionLevel(100), OrthancException);
+  c.SetCompressionLevel(19);
+
+  std::string compressed, uncompressed;
+  IBufferCompressor::Compress(compressed, c, s);
+  IBufferCompressor::Uncompress(uncompressed, c, compressed);
+  ASSERT_EQ(s, uncompressed);
+
+  ASSERT_FALSE(compressed.empty());
+  compressed.resize(compressed.size() - 1);
+  ASSERT_THROW(IBufferCompressor::Uncompress(uncompressed, c, compressed), OrthancException);
+}
+#endif
+
+
 static bool ReadAllStream(std::string& result,
                           IHttpStreamAnswer& stream,
                           bool allowGzip = false,
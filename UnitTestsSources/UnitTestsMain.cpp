@@ -37,7 +37,9 @@
 #include "gtest/gtest.h"
 
 #include <ctype.h>
+#include <boost/filesystem.hpp>
 
+#include "../Core/BinaryJson.h"
 #include "../Core/DicomFormat/DicomTag.h"
 #include "../Core/HttpServer/HttpToolbox.h"
 #include "../Core/Logging.h"
@@ -337,6 +339,15 @@ TEST(Toolbox, ComputeMD5)
   ASSERT_EQ("8b1a9953c4611296a827abf8c47804d7", s);
   Toolbox::ComputeMD5(s, "");
   ASSERT_EQ("d41d8cd98f00b204e9800998ecf8427e", s);
+
+  {
+    Toolbox::MD5Context context;
+    context.Append("He", 2);
+    context.Append("", 0);
+    context.Append("llo", 3);
+    context.Finish(s);
+    ASSERT_EQ("8b1a9953c4611296a827abf8c47804d7", s);
+  }
 }
 
 TEST(Toolbox, ComputeSHA1)
@@ -545,6 +556,10 @@ TEST(EnumerationDictionary, ServerEnumerations)
 
   ASSERT_STREQ("CompletedSeries", EnumerationToString(ChangeType_CompletedSeries));
 
+  ASSERT_STREQ("Deferred", EnumerationToString(DicomAsJsonGeneration_Deferred));
+  ASSERT_EQ(DicomAsJsonGeneration_OnDemand, StringToDicomAsJsonGeneration("OnDemand"));
+  ASSERT_THROW(StringToDicomAsJsonGeneration("Never"), OrthancException);
+
   ASSERT_EQ("IndexInSeries", EnumerationToString(MetadataType_Instance_IndexInSeries));
   ASSERT_EQ("LastUpdate", EnumerationToString(MetadataType_LastUpdate));
 
@@ -619,6 +634,27 @@ TEST(Toolbox, WriteFile)
 }
 
 
+TEST(Toolbox, TemporaryFileDirectory)
+{
+  SystemToolbox::MakeDirectory("UnitTestsTemporary");
+
+  std::string path;
+
+  {
+    TemporaryFile tmp("UnitTestsTemporary", ".dcm");
+    path = tmp.GetPath();
+    ASSERT_EQ(boost::filesystem::path("UnitTestsTemporary"), boost::filesystem::path(path).parent_path());
+    ASSERT_EQ(".dcm", boost::filesystem::path(path).extension().string());
+
+    tmp.Write("Hello");
+    ASSERT_TRUE(SystemToolbox::IsRegularFile(path));
+  }
+
+  ASSERT_FALSE(boost::filesystem::exists(path));
+  boost::filesystem::remove_all("UnitTestsTemporary");
+}
+
+
 TEST(Toolbox, Wildcard)
 {
   ASSERT_EQ("abcd", Toolbox::WildcardToRegularExpression("abcd"));
@@ -729,6 +765,12 @@ TEST(Toolbox, Enumerations)
   ASSERT_EQ(MimeType_WebAssembly, StringToMimeType(EnumerationToString(MimeType_WebAssembly)));
   ASSERT_EQ(MimeType_Css, StringToMimeType(EnumerationToString(MimeType_Css)));
   ASSERT_THROW(StringToMimeType("nope"), OrthancException);
+
+  ASSERT_EQ(CompressionType_None, StringToCompressionType(EnumerationToString(CompressionType_None)));
+  ASSERT_EQ(CompressionType_ZlibWithSize, StringToCompressionType(EnumerationToString(CompressionType_ZlibWithSize)));
+  ASSERT_EQ(CompressionType_Lz4WithSize, StringToCompressionType(EnumerationToString(CompressionType_Lz4WithSize)));
+  ASSERT_EQ(CompressionType_ZstdWithSize, StringToCompressionType(EnumerationToString(CompressionType_ZstdWithSize)));
+  ASSERT_THROW(StringToCompressionType("nope"), OrthancException);
 }
 
 
@@ -1095,6 +1137,63 @@ TEST(Toolbox, AccessJson)
 }
 
 
+TEST(BinaryJson, Basic)
+{
+  Json::Value v = Json::objectValue;
+  v["0010,0010"]["Name"] = "PatientName";
+  v["0010,0010"]["Type"] = "String";
+  v["0010,0010"]["Value"] = "Hello^World";
+  v["0008,0005"]["Name"] = "SpecificCharacterSet";
+  v["0008,0005"]["Type"] = "Null";
+  v["0008,0005"]["Value"] = Json::nullValue;
+  v["0008,1111"]["Name"] = "ReferencedPerformedProcedureStepSequence";
+  v["0008,1111"]["Type"] = "Sequence";
+  v["0008,1111"]["Value"] = Json::arrayValue;
+  v["0008,1111"]["Value"].append(Json::objectValue);
+  v["0008,1111"]["Value"][0]["0008,1150"]["Name"] = "ReferencedSOPClassUID";
+  v["0008,1111"]["Value"][0]["0008,1150"]["Type"] = "String";
+  v["0008,1111"]["Value"][0]["0008,1150"]["Value"] = "1.2.3";
+  v["misc"]["int"] = -42;
+  v["misc"]["uint"] = 42u;
+  v["misc"]["real"] = 3.5;
+  v["misc"]["bool"] = true;
+  v["misc"]["empty"] = "";
+  v["misc"]["array"] = Json::arrayValue;
+  v["misc"]["object"] = Json::objectValue;
+
+  std::string encoded;
+  BinaryJson::Encode(encoded, v);
+  ASSERT_TRUE(BinaryJson::IsBinaryJson(encoded));
+  ASSERT_FALSE(BinaryJson::IsBinaryJson(v.toStyledString()));
+  ASSERT_FALSE(BinaryJson::IsBinaryJson(""));
+  ASSERT_LT(encoded.size(), v.toStyledString().size());
+
+  Json::Value decoded;
+  BinaryJson::Decode(decoded, encoded);
+  ASSERT_EQ(v.toStyledString(), decoded.toStyledString());
+
+  Json::Value tag;
+  ASSERT_TRUE(BinaryJson::LookupMember(tag, encoded, "0010,0010"));
+  ASSERT_EQ("Hello^World", tag["Value"].asString());
+  ASSERT_TRUE(BinaryJson::LookupMember(tag, encoded, "0008,1111"));
+  ASSERT_EQ("1.2.3", tag["Value"][0]["0008,1150"]["Value"].asString());
+  ASSERT_TRUE(BinaryJson::LookupMember(tag, encoded, "misc"));
+  ASSERT_EQ(-42, tag["int"].asInt());
+  ASSERT_FALSE(BinaryJson::LookupMember(tag, encoded, "0010,0020"));
+  ASSERT_FALSE(BinaryJson::LookupMember(tag, encoded, "zzz"));
+
+  BinaryJson::Encode(encoded, Json::arrayValue);
+  ASSERT_FALSE(BinaryJson::LookupMember(tag, encoded, "0010,0010"));
+
+  // Truncated documents must be detected
+  BinaryJson::Encode(encoded, v);
+  for (size_t i = 5; i < encoded.size(); i += 7)
+  {
+    ASSERT_THROW(BinaryJson::Decode(decoded, encoded.substr(0, i)), OrthancException);
+  }
+}
+
+
 TEST(Toolbox, LinesIterator)
 {
   std::string s;